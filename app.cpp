@@ -13,12 +13,19 @@
 #include "app.h"
 #include "etrobo_env.h"
 
-#include "odometry/TurnAngleCalculator.h"
-#include "control/LineTracer.h"
+#include "control/RobotT.h"
+#include "control/LineCalibrator.h"
+#include "logging/DataLogger.h"
+#include "logging/CycleProfiler.h"
+#include "logging/StartupTimer.h"
+#include "logging/Telemetry.h"
+#include "comm/CommandChannel.h"
 
 // デストラクタ問題の回避
 // https://github.com/ETrobocon/etroboEV3/wiki/problem_and_coping
+#if !defined(MAKE_HOST) // ホストビルドではcrtbeginが定義する
 void *__dso_handle = 0;
+#endif
 
 // Bluetooth設定
 #if defined(MAKE_BT_DISABLE)
@@ -27,214 +34,258 @@ static const int _bt_enabled = 0;
 static const int _bt_enabled = 1;
 #endif
 
-static int bt_cmd = 0;  // Bluetoothコマンド 1:リモートスタート
+static int bt_cmd = 0;  // Bluetoothコマンド 1:リモートスタート(CommandChannel)
 static FILE *bt = NULL; // Bluetoothファイルハンドル
+static volatile bool logger_stop = false; // logger_task の終了要求(main_task -> logger_task)
+static volatile bool logger_done = false; // logger_task が残りを書き出した(logger_task -> main_task)
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   システムの構成
+ *
+ * @struct  system_t
+ * @note    クラスオブジェクトとバッファは静的に確保し,ヒープを使わない(new/delete しない)。
+ *          コンストラクタは ev3api を呼ばないので静的初期化で作れる。ポートの設定やリセットは user_system_create で行う
+ */
+typedef struct
+{
+    RobotT<Ev3RobotIo> robot;  // 1台分の制御の本体(TracerCore)と入出力(ev3api, MotorRunner)
+    DataLogger logger;         // DataLoggerクラス, ログのリングバッファ
+    DeadlineMonitor deadline;  // DeadlineMonitorクラス, tracer_taskの締め切り超過の検出
+    LineCalibrator calibrator; // LineCalibratorクラス, 走行前のラインのしきい値の自動調整
+    StartupTimer startup;      // StartupTimerクラス, 起動の段階ごとの時間計測
+    CommandChannel channel;    // CommandChannelクラス, Bluetoothのコマンド受信
+    DoubleBuffer<tracerparams_t> params; // 走行中の調整値(bt_task -> tracer_task)
+    Telemetry telemetry;       // Telemetryクラス, チャンネルごとに間引くテレメトリ
+#if defined(MAKE_PROFILE)
+    CycleProfiler profiler;    // CycleProfilerクラス, tracer_taskの区間時間計測
+    char prof_text[PROF_TEXT_MAX]; // 区間時間の統計のテキスト
+#endif
+    uint8_t cmap_buf[CMAP_FILE_MAX]; // コースマップの読み書き
+    char startup_text[STARTUP_TEXT_MAX]; // 起動時間のテキスト
+} system_t;
+
+static system_t gSys; // システムの構成
+
+#define LOGGER_CYCLE 20 // ログ書き出し周期[ms]
+
+// logger_task のスタック: drain の作業領域は STACK_SIZE の半分まで(残りは呼び出しの入れ子と syslog)
+static_assert(LOG_DRAIN_STACK_BYTES <= STACK_SIZE / 2, "DataLogger::drain does not fit in the logger_task stack");
+static_assert(TLM_DRAIN_STACK_BYTES <= STACK_SIZE / 2, "Telemetry::drain does not fit in the logger_task stack");
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   前回の走行のコースマップの読み込み
+ * @fn      void load_course_map()
+ * @note    COURSEMAP_FILE が空かファイルがなければ速度計画なし(設定の前進速度で走る)
+ */
+static void load_course_map()
+{
+    const char *path = COURSEMAP_FILE;
+    if (path[0] == '\0')
+        return;
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return;
+    int size = (int)fread(gSys.cmap_buf, 1, CMAP_FILE_MAX, fp);
+    fclose(fp);
+    bool ok = gSys.robot.core.loadCourseMap(gSys.cmap_buf, size);
+    _debug(syslog(LOG_NOTICE, "coursemap: load %s %d bytes %s", path, size, ok ? "ok" : "invalid"));
+}
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   今回の走行のコースマップの書き出し
+ * @fn      void save_course_map()
+ */
+static void save_course_map()
+{
+    const char *path = COURSEMAP_FILE;
+    if (path[0] == '\0')
+        return;
+    int size = gSys.robot.core.saveCourseMap(gSys.cmap_buf, CMAP_FILE_MAX);
+    FILE *fp = fopen(path, "wb");
+    if (fp != NULL)
+    {
+        fwrite(gSys.cmap_buf, 1, size, fp);
+        fclose(fp);
+    }
+    _debug(syslog(LOG_NOTICE, "coursemap: save %s %d bytes", path, size));
+}
 
-// クラスオブジェクトの定義
-static ColorSensorCalculator *gColorSensorCalculator; // ColorSensorCalculatorクラス
-static TurnAngleCalculator *gTurnAngleCalculator;     // TurnAngleCalculatorクラス
-static PIDController *gPIDreflect;                    // PIDControllerクラス, HSV明度のPID制御
-static PIDController *gPIDhsv;                        // PIDControllerクラス, HSV彩度のPID制御
-static MotorRunner *gMainMotor;                       // MotorRunnerクラス, メインモーター制御
-static LineTracer *gLineTracer;                       // LineTracerクラス
-
-// 構造体の定義
-static turnangle_t st_angle = {0}; // 車両回転角情報の構造体
-
-#define MAIN_CYCLE 4                // メインサイクル周期[ms]
-static unsigned int COUNT_time = 0; // 開始からの経過時間[ms]
-static int DrivingStage = 0;        // 区間判定モード兼走行モード
-static int distance;                // 障害物との距離[cm]
-static int arm_deg;                 // アーム角
-#define ARM_SPEED 20                // アームのモーター速度
-#define ARM_ZERO -53                // アームのゼロ点角度
-#define ARM_SWINGUP 40              // アームの振り上げ最大角
-#define ARM_SWINGBACK -70           // アームの後方振り最大角
-static int gyro_deg;                // ジャイロ角
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   走行前のラインのしきい値の自動調整
+ * @fn      void calibrate_line()
+ * @note    LINE_AUTOCALIB が 0 なら何もしない(LineTracer.h のマクロの値で走る)。
+ *          ラインの上でその場旋回を右,左,右と振り(CALIB_TIME_MS 以内),元の向きで止まる。
+ *          分かれ方が悪ければマクロの値のまま走る。旋回で進んだエンコーダーはリセットする
+ */
+static void calibrate_line()
+{
+    if (!LINE_AUTOCALIB)
+        return;
+    LineCalibrator *calibrator = &gSys.calibrator;
+    cycleinput_t in = cycleinput_t();
+    int turn = 0;
+    bool more = true;
+    while (more)
+    {
+        gSys.robot.io.read(RATE_BIT(RATE_IN_COLOR) | RATE_BIT(RATE_IN_WHEEL), &in); // 入力は走行中と同じ Io から
+        more = calibrator->step(&in.rgb, in.left_count, in.right_count, &turn);
+        if (more)
+        {
+            gSys.robot.io.motor.run(CALIB_POWER, turn);
+            tslp_tsk(CALIB_CYCLE_MS * 1000U);
+        }
+    }
+    gSys.robot.io.motor.stop();
+    gSys.robot.io.motor.reset();
+
+    linecalib_t calib;
+    calibrator->finish(&calib);
+    gSys.robot.core.setCalibration(&calib);
+    _debug(syslog(LOG_NOTICE, "calib: %s quality=%d%% black=%d white=%d blue=%d target=%d/%d (%d samples, %d ms)",
+                  calib.status == LINE_CALIB_OK ? "ok" : "poor", calib.quality, calib.black_val, calib.white_val,
+                  calib.blue_sat, calib.target_reflect, calib.target_hsv, calib.samples, calib.time_ms));
+}
 
 /** ******** ******** ******** ******** ******** ******** ******** ********
  * @brief   オブジェクトの初期化
  * @fn      void user_system_create()
+ * @note    オブジェクトは gSys に静的に確保済み。段階ごとの時間を gSys.startup に積む
  */
 static void user_system_create()
 {
+    gSys.startup.begin(fch_hrt());
     /* センサー入力ポートの設定 */
     ev3_sensor_config(sonar_sensor, ULTRASONIC_SENSOR);
     ev3_sensor_config(color_sensor, COLOR_SENSOR);
     ev3_sensor_config(touch_sensor, TOUCH_SENSOR);
     ev3_sensor_config(gyro_sensor, GYRO_SENSOR);
+    gSys.startup.lap(STARTUP_SENSOR, fch_hrt());
     /* モーター出力ポートの設定 */
     ev3_motor_config(left_motor, LARGE_MOTOR);
     ev3_motor_config(right_motor, LARGE_MOTOR);
     ev3_motor_config(arm_motor, LARGE_MOTOR);
     ev3_motor_config(tail_motor, MEDIUM_MOTOR);
-
-    // クラスオブジェクトの作成
-    gColorSensorCalculator = new ColorSensorCalculator();
-    gTurnAngleCalculator = new TurnAngleCalculator();
-    gPIDreflect = new PIDController();
-    gPIDhsv = new PIDController();
-    gMainMotor = new MotorRunner();
-    gLineTracer = new LineTracer();
-
-    gPIDreflect->setPIDparam(Kp_reflect, Ki_reflect, Kd_reflect);
-    gPIDhsv->setPIDparam(Kp_hsv, Ki_hsv, Kd_hsv);
+    gSys.startup.lap(STARTUP_MOTOR, fch_hrt());
+
+    // クラスオブジェクトの結び付け
+    load_course_map();
+    gSys.robot.io.motor.reset(); // 走行モーターエンコーダーリセット
+    gSys.robot.core.setDeadline(&gSys.deadline);
+    gSys.robot.core.setParamBuffer(&gSys.params);
+    gSys.robot.core.setTelemetry(&gSys.telemetry);
+    gSys.channel.setTelemetry(&gSys.telemetry);
+    tlmconfig_t tlm;
+    if (!Telemetry::parse(TELEMETRY_CONFIG, &tlm)) // 読めたところまで使う
+        _debug(syslog(LOG_NOTICE, "telemetry: invalid config %s", TELEMETRY_CONFIG));
+    gSys.telemetry.configure(tlm);
+#if defined(MAKE_PROFILE)
+    gSys.robot.core.setProfiler(&gSys.profiler);
+#endif
+    gSys.startup.lap(STARTUP_OBJECTS, fch_hrt());
 
     // swingarm
     ev3_motor_reset_counts(arm_motor);
-    arm_deg = ev3_motor_get_counts(arm_motor);
     ev3_gyro_sensor_reset(gyro_sensor);
-    gyro_deg = ev3_gyro_sensor_get_angle(gyro_sensor);
+    gSys.startup.lap(STARTUP_GYRO, fch_hrt());
 }
 /** ******** ******** ******** ******** ******** ******** ******** ********
- * @brief   オブジェクトの廃棄
- * @fn      void user_system_destroy()
+ * @brief   コマンドの応答の書き出し
+ * @fn      void write_replies()
+ * @note    logger_task(DataLogger::drain と同じタスク)から呼ぶ。応答はログの 'C' レコードになる
  */
-static void user_system_destroy()
+static void write_replies()
 {
-    gMainMotor->reset();
-    gMainMotor->stop();
-
-    delete gLineTracer;
-    delete gMainMotor;
-    delete gPIDreflect;
-    delete gPIDhsv;
-    delete gTurnAngleCalculator;
-    delete gColorSensorCalculator;
-
-    if (_bt_enabled)
-    {
-        ter_tsk(BT_TASK);
-        fclose(bt);
-    }
+    cmdframe_t reply;
+    while (gSys.channel.popReply(&reply))
+        gSys.logger.writeRecord(bt, LOG_TAG_COMMAND, reply.buf, reply.len);
 }
 
 /** ******** ******** ******** ******** ******** ******** ******** ********
- * @brief   データロガー
- * @fn      void datalogging()
+ * @brief   ログの残りと走行の最後のレコードの書き出し
+ * @fn      void flush_log()
+ * @note    logger_task の最後に呼ぶ(DataLogger::drain と同じタスク)。'U' は走行の最後のレコード
  */
-void datalogging()
+static void flush_log()
 {
-    int turn;
-    int drivin;
-    int hsv_val;
-
-    drivin = st_angle.MODE_straight * 100;         // 直進コーナー判定:ログ見づらいので適当にN*100倍する
-    turn = gLineTracer->getTurnRatio();            // 舵角取得
-    hsv_val = gColorSensorCalculator->getHSVval(); // 現在センサ値取得
-
-    // 各種変数のログ出力
-    fwrite(&COUNT_time, sizeof(COUNT_time), 1, bt);         // unsigned int,'I', 4byte
-    fwrite(&drivin, sizeof(drivin), 1, bt);                 // int 'i', 4byte
-    fwrite(&turn, sizeof(turn), 1, bt);                     // int 'i', 4byte
-    fwrite(&st_angle.omega, sizeof(st_angle.omega), 1, bt); // int 'i', 4byte
-    fwrite(&hsv_val, sizeof(hsv_val), 1, bt);               // int 'i', 4byte
-    fwrite(&distance, sizeof(distance), 1, bt);             // int 'i', 4byte
-    fwrite(&gyro_deg, sizeof(gyro_deg), 1, bt);             // int 'i', 4byte
-
-    // ログ計算用ループカウンタ
-    COUNT_time += MAIN_CYCLE;
+    gSys.logger.drain(bt); // 残りを書き出す
+    gSys.telemetry.drain(bt, &gSys.logger);
+    write_replies();
+#if defined(MAKE_PROFILE)
+    int plen = gSys.profiler.format(gSys.prof_text, PROF_TEXT_MAX);
+    gSys.logger.writeRecord(bt, LOG_TAG_PROFILE, gSys.prof_text, plen); // 区間時間の統計をログに出す
+#endif
+    int len = gSys.startup.format(gSys.startup_text, STARTUP_TEXT_MAX);
+    gSys.logger.writeRecord(bt, LOG_TAG_STARTUP, gSys.startup_text, len); // 起動時間をログに出す
+    fflush(bt);
 }
 
 /** ******** ******** ******** ******** ******** ******** ******** ********
- * @brief 障害物検知
- * @fn      int ObstacleCalc()
- * @return true : 障害物を検知, false : 未検知
+ * @brief   オブジェクトの廃棄
+ * @fn      void user_system_destroy()
  */
-static int ObstacleCalc()
+static void user_system_destroy()
 {
-    // 障害物検知
-    if (COUNT_time % 40 == 0) // 約40msec周期毎に障害物検知
+    gSys.robot.io.motor.reset();
+    gSys.robot.io.motor.stop();
+
+    if (_bt_enabled)
     {
-        distance = ev3_ultrasonic_sensor_get_distance(sonar_sensor);
-        if ((distance <= SONAR_ALERT_DISTANCE) && (distance >= 0))
-            return true;
-        else
-            return false;
+        ter_tsk(BT_TASK);
+        // logger_task は止めずに,残りを書き出して自分で終わるのを待つ
+        // (drain や fwrite の途中で止めるとレコードが途中で切れ,リングから取り出したフレームを失う)
+        logger_stop = true;
+        wup_tsk(LOGGER_TASK);
+        while (!logger_done)
+            slp_tsk();
+        fclose(bt);
     }
-    return false;
-}
-
-/** ******** ******** ******** ******** ******** ******** ******** ********
- * @brief   アームを動かす
- * @fn      int SwingArm(int power, int degree)
- * @param   power   (int)アームのモーター速度[deg]
- * @param   degree  (int)アームの角度[deg]
- * @return  true: 引数degreeに到達, false: 引数degreeに未到達 
- */
-static int SwingArm(int power, int degree)
-{
-    arm_deg = ev3_motor_get_counts(arm_motor);
-
-    ev3_motor_set_power(arm_motor, power);
-
-    if (arm_deg == degree)
-        return true;
-    else
-        return false;
+    _debug(syslog(LOG_NOTICE, "log: dropped=%u highwater=%u/%u",
+                  gSys.logger.getDropped(), gSys.logger.getHighWater(), LOG_RING_SIZE));
+    _debug(syslog(LOG_NOTICE, "deadline: miss=%u worst_late=%u us shed=%u cycles",
+                  (unsigned)gSys.deadline.getMisses(), (unsigned)gSys.deadline.getWorstLateUs(),
+                  (unsigned)gSys.deadline.getShedCycles()));
+    _debug(syslog(LOG_NOTICE, "telemetry: dropped=%u/%u", gSys.telemetry.getDropped(), TLM_RING_SIZE));
+    _debug(syslog(LOG_NOTICE, "command: frames=%u errors=%u commits=%u", (unsigned)gSys.channel.getFrames(),
+                  (unsigned)gSys.channel.getErrors(), (unsigned)gSys.channel.getCommits()));
+    _debug(syslog(LOG_NOTICE, "startup: wait=%u us launch=%u us", (unsigned)gSys.startup.getPhaseUs(STARTUP_WAIT),
+                  (unsigned)gSys.startup.getPhaseUs(STARTUP_LAUNCH)));
+
+    save_course_map();
 }
 
 /** ******** ******** ******** ******** ******** ******** ******** ********
  * @brief   周期タスク
  * @fn      void tracer_task(intptr_t exinf)
- * @note    app.cfgで設定した周期で呼び出される
+ * @note    app.cfgで設定した周期で呼び出される。
+ *          締め切り(次の起動)を超えたら,回復するまで TRACER_SHED_MASK の処理を止めてモーター出力を間に合わせる
  */
 void tracer_task(intptr_t exinf)
 {
-    if (ev3_button_is_pressed(BACK_BUTTON)) // バックボタン押下
-        wup_tsk(MAIN_TASK);
+    cycleoutput_t out;
+    logframe_t frame;
+    gSys.deadline.begin(fch_hrt());
 
-    //カラーセンサー取得＆計算
-    gColorSensorCalculator->calc();
-    //車両姿勢取得
-    gTurnAngleCalculator->calc(&st_angle, gLineTracer->getTurnRatio());
-    gyro_deg = ev3_gyro_sensor_get_angle(gyro_sensor);
+    PROF_BEGIN(&gSys.profiler, gSys.robot.core.getStage());
 
-    //状態遷移
-    switch (DrivingStage)
-    {
-    case 0:
-        // 走行
-        gLineTracer->run(gPIDreflect, gPIDhsv, gColorSensorCalculator, gMainMotor);
+    // センサ,エンコーダー取得(取得しない値は前回のまま)
+    uint32_t due = gSys.robot.read(); // 今回の周期で実行するレートグループ(縮退中は間引く)
+    PROF_LAP(&gSys.profiler, PROF_INPUT);
 
-        //障害物検知
-        if (ObstacleCalc())
-        {
-            gMainMotor->stop();
-            DrivingStage = 101;
-        }
-        break;
-
-    case 101: // 段差を上る為にアームを上げる
-        gMainMotor->stop();
-        if (SwingArm(ARM_SPEED, ARM_SWINGUP))
-            DrivingStage = 102;
-        break;
-
-    case 102: // 段差を上がる
-        gMainMotor->run(30, 0);
-        if (st_angle.leftWheel_deg >= 480)
-            DrivingStage = 103;
-        break;
-
-    case 103: // 止まってアームを下げる
-        gMainMotor->stop();
-        if (SwingArm(-1 * ARM_SPEED, ARM_ZERO))
-        {
-            ev3_motor_stop(arm_motor, false);
-            DrivingStage = 999;
-        }
-        break;
+    // 制御(区間時間は TracerCore が計測する)
+    gSys.robot.step(&out, &frame);
 
-    case 999:
+    // モーター出力
+    gSys.robot.write(&out);
+    if (out.wakeup_main)
         wup_tsk(MAIN_TASK);
-        break;
-    default:
-        break;
-    }
+    PROF_LAP(&gSys.profiler, PROF_OUTPUT);
 
     // ロギング
-    datalogging();
+    if (due & RATE_BIT(RATE_LOG))
+        gSys.logger.put(frame); // 満杯なら捨てる(制御周期を止めない)
+    PROF_LAP(&gSys.profiler, PROF_LOGGING);
+    PROF_END(&gSys.profiler);
+    gSys.deadline.end(fch_hrt());
 
     ext_tsk();
 }
@@ -256,21 +307,41 @@ void main_task(intptr_t unused)
 
         /* Bluetooth通信タスクの起動 */
         act_tsk(BT_TASK);
+        /* ログ書き出しタスクの起動 */
+        act_tsk(LOGGER_TASK);
     }
-
-    /* スタート待機 */
+    gSys.startup.lap(STARTUP_BT, fch_hrt());
+
+    /* ラインのしきい値の自動調整(スタート待機の前,ラインの上に置いた状態で) */
+    calibrate_line();
+    gSys.startup.lap(STARTUP_CALIB, fch_hrt());
+    _debug(syslog(LOG_NOTICE, "startup: ready=%u us (sensor=%u motor=%u objects=%u gyro=%u bt=%u calib=%u)",
+                  (unsigned)gSys.startup.getReadyUs(), (unsigned)gSys.startup.getPhaseUs(STARTUP_SENSOR),
+                  (unsigned)gSys.startup.getPhaseUs(STARTUP_MOTOR), (unsigned)gSys.startup.getPhaseUs(STARTUP_OBJECTS),
+                  (unsigned)gSys.startup.getPhaseUs(STARTUP_GYRO), (unsigned)gSys.startup.getPhaseUs(STARTUP_BT),
+                  (unsigned)gSys.startup.getPhaseUs(STARTUP_CALIB)));
+
+    /* スタート待機(止まっている間にジャイロのバイアスを推定する) */
+    GyroBiasEstimator gyroBias;
+    int wait_ms = 0;
     while (1)
     {
+        gyroBias.add(wait_ms, ev3_gyro_sensor_get_angle(gyro_sensor));
         if (bt_cmd == 1)
             break; /* リモートスタート */
         if (ev3_touch_sensor_is_pressed(touch_sensor) == 1)
             break; /* タッチセンサが押された */
 
         tslp_tsk(10 * 1000U); /* 10secウェイト */
+        wait_ms += 10;
     }
+    gSys.startup.lap(STARTUP_WAIT, fch_hrt());
+    gSys.robot.core.calibrateGyro(gyroBias.getBiasMdps(), gyroBias.getZeroMdeg());
+    _debug(syslog(LOG_NOTICE, "gyro: bias=%d mdps (%d ms)", gyroBias.getBiasMdps(), gyroBias.getSpanMs()));
 
     // 周期ハンドラ開始
     sta_cyc(TRACER_CYC);
+    gSys.startup.lap(STARTUP_LAUNCH, fch_hrt());
 
     slp_tsk(); // バックボタンが押されるまで待つ
     // while(!ev3_button_is_pressed(BACK_BUTTON))
@@ -290,8 +361,10 @@ void main_task(intptr_t unused)
 // 関数名 : bt_task
 // 引数 : unused
 // 返り値 : なし
-// 概要 : Bluetooth通信によるリモートスタート。 Tera Termなどのターミナルソフトから、
-//       ASCIIコードで1を送信すると、リモートスタートする。
+// 概要 : Bluetooth通信によるリモートスタートと調整値の変更(CommandChannel)。
+//       Tera Termなどのターミナルソフトから、ASCIIコードで1を送信すると、リモートスタートする。
+//       フレームのコマンドで PIDゲイン, PID目標, 前進速度, DrivingStage を読み書きする。
+//       応答はログと同じストリームに 'C' レコードで返す(エコーバックはログを壊すのでしない)。
 //*****************************************************************************
 void bt_task(intptr_t unused)
 {
@@ -300,15 +373,35 @@ void bt_task(intptr_t unused)
         if (_bt_enabled)
         {
             uint8_t c = fgetc(bt); /* 受信 */
-            switch (c)
+            if (gSys.channel.feed(c))
             {
-            case '1':
-                bt_cmd = 1;
-                break;
-            default:
-                break;
+                tracerparams_t live; // 制御ループが今使っている値
+                gSys.robot.core.getParams(&live);
+                gSys.channel.handle(&live, &gSys.params); // 設定は CMD_COMMIT で次の周期の始めに反映する
             }
-            fputc(c, bt); /* エコーバック */
+            if (gSys.channel.isStartRequested())
+                bt_cmd = 1;
         }
     }
 }
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   ログ書き出しタスク
+ * @fn      void logger_task(intptr_t unused)
+ * @note    tracer_taskより低い優先度で動き,リングバッファに溜まったフレームとテレメトリをまとめてBluetoothに書き出す。
+ *          終了要求(logger_stop)で残りを書き出してから main_task を起こして終わる
+ */
+void logger_task(intptr_t unused)
+{
+    while (!logger_stop)
+    {
+        gSys.logger.drain(bt);
+        gSys.telemetry.drain(bt, &gSys.logger);
+        write_replies();
+        tslp_tsk(LOGGER_CYCLE * 1000U);
+    }
+    flush_log();
+    logger_done = true;
+    wup_tsk(MAIN_TASK);
+    ext_tsk();
+}
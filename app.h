@@ -84,6 +84,7 @@ extern "C" {
 extern void main_task(intptr_t exinf);
 extern void bt_task(intptr_t exinf);
 extern void tracer_task(intptr_t exinf);
+extern void logger_task(intptr_t exinf);
 
 #endif /* TOPPERS_MACRO_ONLY */
 
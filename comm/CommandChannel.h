@@ -0,0 +1,463 @@
+/**
+ * @file CommandChannel.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief
+ * @version 0.1
+ * @date 2021-10-03
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef EV3_APP_COMMANDCHANNEL_H
+#define EV3_APP_COMMANDCHANNEL_H
+
+#include <stdint.h>
+#include <string.h>
+#include "control/TracerParams.h"
+#include "control/DoubleBuffer.h"
+#include "logging/Telemetry.h"
+#include "logging/SpscRingBuffer.h"
+
+/**
+ * @brief   コマンドフレーム
+ * @note    SOF(0xA5), 長さ(本体のバイト数), コマンド, 通し番号, 本体, CRC-8(長さから本体の終わりまで, 多項式 0x07)。
+ *          応答はコマンドに CMD_REPLY を足し,同じ通し番号で返す。本体の先頭は CMD_OK などの結果。
+ *          値は int32_t のリトルエンディアン, ゲインは PARAM_GAIN_SCALE 倍の整数。
+ *          - CMD_REMOTE_START 本体なし         応答 [結果]
+ *          - CMD_GET          [番号]           応答 [結果][番号][値 4byte]  制御ループが今使っている値
+ *          - CMD_SET          [番号][値 4byte] 応答 [結果][番号]            CMD_COMMIT まで反映しない
+ *          - CMD_COMMIT       本体なし         応答 [結果][組の番号 4byte]  設定した値をまとめて周期の境目で反映する
+ *          - CMD_TELEMETRY    [番号][間引き]   応答 [結果][番号]            テレメトリのチャンネル(TLM_*)の間引き, 0 で無効
+ */
+#define CMD_SOF 0xA5
+#define CMD_PAYLOAD_MAX 8                      // 本体の最大バイト数
+#define CMD_FRAME_MAX (CMD_PAYLOAD_MAX + 5)    // フレームの最大バイト数
+#define CMD_REPLY 0x80                         // 応答のコマンドに足す
+#define CMD_REPLY_RING 16                      // 書き出し待ちの応答の数(2のべき乗)
+#define CMD_LEGACY_START '1'                   // フレームの外の '1' はリモートスタート(etrobo_env.h の CMD_START, ターミナルソフトから)
+
+enum
+{
+    CMD_REMOTE_START = 0x01, /* リモートスタート */
+    CMD_GET = 0x02,          /* 調整値の読み出し */
+    CMD_SET = 0x03,          /* 調整値の設定 */
+    CMD_COMMIT = 0x04,       /* 設定した調整値の反映 */
+    CMD_TELEMETRY = 0x05     /* テレメトリの間引きの設定 */
+};
+
+enum
+{
+    CMD_OK = 0,      /* 成功 */
+    CMD_ERR_CMD,     /* 知らないコマンド */
+    CMD_ERR_LEN,     /* 本体の長さが違う */
+    CMD_ERR_ID,      /* 知らない調整値の番号 */
+    CMD_ERR_RANGE,   /* 値が範囲外(paramValid) */
+    CMD_ERR_BUSY     /* 反映中の組と重なった, やり直すこと */
+};
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   コマンド1つ(フレームの中身)
+ *
+ * @struct  cmdmsg_t
+ */
+typedef struct
+{
+    uint8_t cmd;                      /* CMD_* (応答は | CMD_REPLY) */
+    uint8_t seq;                      /* 通し番号, 応答は同じ番号 */
+    uint8_t len;                      /* 本体のバイト数 */
+    uint8_t payload[CMD_PAYLOAD_MAX]; /* 本体 */
+} cmdmsg_t;
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   符号化したフレーム
+ *
+ * @struct  cmdframe_t
+ */
+typedef struct
+{
+    uint8_t len;                /* バイト数 */
+    uint8_t buf[CMD_FRAME_MAX]; /* フレーム */
+} cmdframe_t;
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   Bluetooth のコマンド受信 クラス
+ *
+ * @class   CommandChannel
+ * @note    bt_task が1バイトずつ feed し,フレームがそろったら handle で実行する。ev3api は呼ばない。
+ *          CMD_SET は手元の組に積むだけで,CMD_COMMIT でまとめて DoubleBuffer に公開し,
+ *          tracer_task が次の周期の始めに反映する(TracerCore::setParamBuffer, 制御ループはロックを取らない)。
+ *          応答は同じシリアルにログと一緒に書くので直接は書かず,logger_task が popReply で取り出して
+ *          ログの 'C' レコードにする(ログのストリームを壊さない)。
+ *          CRC が合わないフレームは捨てて数えるだけで応答しない(送る側が応答を待って送り直す)。
+ */
+class CommandChannel
+{
+private:
+    uint8_t rx[CMD_FRAME_MAX]; // 受信中のフレーム(SOF を除く)
+    int rx_len;                // 受信したバイト数, -1 なら SOF 待ち
+    cmdmsg_t msg;              // そろったコマンド
+    tracerparams_t staged;     // 設定した調整値(CMD_COMMIT で公開する)
+    bool start;                // リモートスタートを受けた
+    uint32_t frames;           // 受けたフレームの数
+    uint32_t errors;           // 捨てたフレームの数(CRC, 長さ)
+    uint32_t commits;          // 公開した組の数
+    Telemetry *telemetry;      // CMD_TELEMETRY の設定先, NULL なら受け付けない
+    SpscRingBuffer<cmdframe_t, CMD_REPLY_RING> replies; // 書き出し待ちの応答
+
+    void reply(uint8_t status, const uint8_t *body, int len); // 応答を積む
+
+public:
+    CommandChannel(); // Constructor
+
+    bool feed(uint8_t c);                                        // 1バイト受信
+    void handle(const tracerparams_t *live, DoubleBuffer<tracerparams_t> *out); // そろったコマンドの実行
+    void setTelemetry(Telemetry *t);                             // CMD_TELEMETRY の設定先
+    bool popReply(cmdframe_t *frame);                            // 書き出し待ちの応答の取り出し(logger_task)
+    bool isStartRequested();                                     // リモートスタートを受けたか
+    uint32_t getFrames();                                        // 受けたフレームの数
+    uint32_t getErrors();                                        // 捨てたフレームの数
+    uint32_t getCommits();                                       // 公開した組の数
+    uint32_t getDroppedReplies();                                // 満杯で捨てた応答の数
+
+    static uint8_t crc8(const uint8_t *p, int n);                // CRC-8(多項式 0x07)
+    static int encode(const cmdmsg_t *m, uint8_t *out);          // フレームに符号化
+    static bool decode(const uint8_t *buf, int n, cmdmsg_t *m);  // フレームを復号
+    static void putValue(uint8_t *p, int32_t v);                 // 値の書き込み(リトルエンディアン)
+    static int32_t getValue(const uint8_t *p);                   // 値の読み出し(リトルエンディアン)
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+// Constructor
+CommandChannel::CommandChannel()
+    : rx_len(-1),
+      msg(),
+      staged(),
+      start(false),
+      frames(0),
+      errors(0),
+      commits(0),
+      telemetry(NULL)
+{
+}
+
+/**
+ * @brief   CRC-8(多項式 0x07, 初期値 0)
+ *
+ * @fn      uint8_t CommandChannel::crc8(const uint8_t *p, int n)
+ * @param   p   (const uint8_t*)データ
+ * @param   n   (int)バイト数
+ * @return  uint8_t CRC
+ */
+uint8_t CommandChannel::crc8(const uint8_t *p, int n)
+{
+    uint8_t crc = 0;
+    for (int i = 0; i < n; i++)
+    {
+        crc ^= p[i];
+        for (int k = 0; k < 8; k++)
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+    return crc;
+}
+
+/**
+ * @brief   値の書き込み
+ *
+ * @fn      void CommandChannel::putValue(uint8_t *p, int32_t v)
+ * @param   p   (uint8_t*)書き込み先 4byte
+ * @param   v   (int32_t)値
+ * @return  無し
+ */
+inline void CommandChannel::putValue(uint8_t *p, int32_t v)
+{
+    const uint32_t u = (uint32_t)v;
+    p[0] = (uint8_t)u;
+    p[1] = (uint8_t)(u >> 8);
+    p[2] = (uint8_t)(u >> 16);
+    p[3] = (uint8_t)(u >> 24);
+}
+
+/**
+ * @brief   値の読み出し
+ *
+ * @fn      int32_t CommandChannel::getValue(const uint8_t *p)
+ * @param   p   (const uint8_t*)読み出し元 4byte
+ * @return  int32_t 値
+ */
+inline int32_t CommandChannel::getValue(const uint8_t *p)
+{
+    return (int32_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+/**
+ * @brief   フレームに符号化
+ *
+ * @fn      int CommandChannel::encode(const cmdmsg_t *m, uint8_t *out)
+ * @param   m   (const cmdmsg_t*)コマンド, len は CMD_PAYLOAD_MAX 以下
+ * @param   out (uint8_t*)書き出し先, CMD_FRAME_MAX あれば足りる
+ * @return  int 書いたバイト数
+ */
+int CommandChannel::encode(const cmdmsg_t *m, uint8_t *out)
+{
+    out[0] = CMD_SOF;
+    out[1] = m->len;
+    out[2] = m->cmd;
+    out[3] = m->seq;
+    memcpy(&out[4], m->payload, m->len);
+    out[4 + m->len] = crc8(&out[1], 3 + m->len);
+    return 5 + m->len;
+}
+
+/**
+ * @brief   フレームを復号
+ *
+ * @fn      bool CommandChannel::decode(const uint8_t *buf, int n, cmdmsg_t *m)
+ * @param   buf (const uint8_t*)フレーム1つ(SOF から CRC まで)
+ * @param   n   (int)バイト数
+ * @param   m   (cmdmsg_t*)復号先
+ * @return  true: 復号した, false: 形式か CRC が違う
+ * @note    ログの 'C' レコード(応答)を読むのに使う
+ */
+bool CommandChannel::decode(const uint8_t *buf, int n, cmdmsg_t *m)
+{
+    if (n < 5 || buf[0] != CMD_SOF || buf[1] > CMD_PAYLOAD_MAX || n != 5 + buf[1] ||
+        crc8(&buf[1], 3 + buf[1]) != buf[4 + buf[1]])
+        return false;
+    m->len = buf[1];
+    m->cmd = buf[2];
+    m->seq = buf[3];
+    memcpy(m->payload, &buf[4], m->len);
+    return true;
+}
+
+/**
+ * @brief   1バイト受信
+ *
+ * @fn      bool CommandChannel::feed(uint8_t c)
+ * @param   c   (uint8_t)受信したバイト
+ * @return  true: CRC の合ったフレームがそろった(handle を呼ぶ), false: 途中か捨てた
+ * @note    フレームの外の CMD_LEGACY_START はリモートスタート,それ以外は読み飛ばす
+ */
+bool CommandChannel::feed(uint8_t c)
+{
+    if (rx_len < 0)
+    {
+        if (c == CMD_SOF)
+            rx_len = 0;
+        else if (c == CMD_LEGACY_START)
+            start = true;
+        return false;
+    }
+    rx[rx_len++] = c;
+    if (rx_len == 1 && rx[0] > CMD_PAYLOAD_MAX)
+    {
+        errors++; // 長さが壊れている
+        rx_len = -1;
+        return false;
+    }
+    if (rx_len < 4 + rx[0]) // 長さ,コマンド,通し番号,本体,CRC
+        return false;
+    rx_len = -1;
+    if (crc8(rx, 3 + rx[0]) != rx[3 + rx[0]])
+    {
+        errors++;
+        return false;
+    }
+    msg.len = rx[0];
+    msg.cmd = rx[1];
+    msg.seq = rx[2];
+    memcpy(msg.payload, &rx[3], msg.len);
+    frames++;
+    return true;
+}
+
+/**
+ * @brief   応答を積む
+ *
+ * @fn      void CommandChannel::reply(uint8_t status, const uint8_t *body, int len)
+ * @param   status  (uint8_t)CMD_OK など
+ * @param   body    (const uint8_t*)結果の後ろに付ける本体
+ * @param   len     (int)本体のバイト数(CMD_PAYLOAD_MAX - 1 以下)
+ * @return  無し
+ */
+void CommandChannel::reply(uint8_t status, const uint8_t *body, int len)
+{
+    cmdmsg_t r;
+    r.cmd = msg.cmd | CMD_REPLY;
+    r.seq = msg.seq;
+    r.len = (uint8_t)(1 + len);
+    r.payload[0] = status;
+    memcpy(&r.payload[1], body, len);
+    cmdframe_t f;
+    f.len = (uint8_t)encode(&r, f.buf);
+    replies.push(f); // 満杯なら捨てる(送る側が送り直す)
+}
+
+/**
+ * @brief   そろったコマンドの実行
+ *
+ * @fn      void CommandChannel::handle(const tracerparams_t *live, DoubleBuffer<tracerparams_t> *out)
+ * @param   live    (const tracerparams_t*)制御ループが今使っている値(TracerCore::getParams), CMD_GET で返す
+ * @param   out     (DoubleBuffer<tracerparams_t>*)CMD_COMMIT の公開先
+ * @return  無し
+ * @note    feed が true を返したら呼ぶ。応答を1つ積む
+ */
+void CommandChannel::handle(const tracerparams_t *live, DoubleBuffer<tracerparams_t> *out)
+{
+    uint8_t body[CMD_PAYLOAD_MAX - 1];
+    const int id = msg.payload[0];
+    body[0] = (uint8_t)id;
+
+    switch (msg.cmd)
+    {
+    case CMD_REMOTE_START:
+        start = true;
+        reply(CMD_OK, body, 0);
+        break;
+
+    case CMD_GET:
+        if (msg.len != 1)
+            reply(CMD_ERR_LEN, body, 0);
+        else if (id >= PARAM_COUNT)
+            reply(CMD_ERR_ID, body, 1);
+        else
+        {
+            putValue(&body[1], live->value[id]);
+            reply(CMD_OK, body, 5);
+        }
+        break;
+
+    case CMD_SET:
+        if (msg.len != 5)
+            reply(CMD_ERR_LEN, body, 0);
+        else if (id >= PARAM_COUNT)
+            reply(CMD_ERR_ID, body, 1);
+        else if (!paramValid(id, getValue(&msg.payload[1])))
+            reply(CMD_ERR_RANGE, body, 1);
+        else
+        {
+            staged.value[id] = getValue(&msg.payload[1]);
+            staged.set |= PARAM_BIT(id);
+            if (id == PARAM_STAGE)
+                staged.stage_req++; // 反映したら1回だけ区間を移る
+            reply(CMD_OK, body, 1);
+        }
+        break;
+
+    case CMD_COMMIT:
+        if (msg.len != 0)
+            reply(CMD_ERR_LEN, body, 0);
+        else if (!out->publish(staged))
+            reply(CMD_ERR_BUSY, body, 0);
+        else
+        {
+            commits++;
+            putValue(body, (int32_t)out->getSeq());
+            reply(CMD_OK, body, 4);
+        }
+        break;
+
+    case CMD_TELEMETRY:
+        if (telemetry == NULL)
+            reply(CMD_ERR_CMD, body, 0);
+        else if (msg.len != 2)
+            reply(CMD_ERR_LEN, body, 0);
+        else if (id >= TLM_CHANNELS)
+            reply(CMD_ERR_ID, body, 1);
+        else
+        {
+            tlmconfig_t c = telemetry->getRequested();
+            c.decim[id] = msg.payload[1];
+            reply(telemetry->configure(c) ? CMD_OK : CMD_ERR_BUSY, body, 1); // 次の周期の始めに反映する
+        }
+        break;
+
+    default:
+        reply(CMD_ERR_CMD, body, 0);
+        break;
+    }
+}
+
+/**
+ * @brief   CMD_TELEMETRY の設定先
+ *
+ * @fn      void CommandChannel::setTelemetry(Telemetry *t)
+ * @param   t   (Telemetry*)設定先, NULL なら CMD_TELEMETRY は CMD_ERR_CMD
+ * @return  無し
+ * @note    走行前に呼ぶこと。間引きは Telemetry::getRequested を変えて configure する(bt_task が書き込み側)
+ */
+inline void CommandChannel::setTelemetry(Telemetry *t)
+{
+    telemetry = t;
+}
+
+/**
+ * @brief   書き出し待ちの応答の取り出し
+ *
+ * @fn      bool CommandChannel::popReply(cmdframe_t *frame)
+ * @param   frame   (cmdframe_t*)取り出し先
+ * @return  true: 取り出した, false: なし
+ * @note    logger_task から呼び,ログの 'C' レコードにする
+ */
+inline bool CommandChannel::popReply(cmdframe_t *frame)
+{
+    return replies.pop(frame, 1) == 1;
+}
+
+/**
+ * @brief   リモートスタートを受けたか
+ *
+ * @fn      bool CommandChannel::isStartRequested()
+ * @return  true: CMD_REMOTE_START かフレームの外の '1' を受けた
+ */
+inline bool CommandChannel::isStartRequested()
+{
+    return start;
+}
+
+/**
+ * @brief   受けたフレームの数
+ *
+ * @fn      uint32_t CommandChannel::getFrames()
+ * @return  uint32_t CRC の合ったフレームの数
+ */
+inline uint32_t CommandChannel::getFrames()
+{
+    return frames;
+}
+
+/**
+ * @brief   捨てたフレームの数
+ *
+ * @fn      uint32_t CommandChannel::getErrors()
+ * @return  uint32_t CRC か長さが合わなかったフレームの数
+ */
+inline uint32_t CommandChannel::getErrors()
+{
+    return errors;
+}
+
+/**
+ * @brief   公開した組の数
+ *
+ * @fn      uint32_t CommandChannel::getCommits()
+ * @return  uint32_t CMD_COMMIT が成功した数
+ */
+inline uint32_t CommandChannel::getCommits()
+{
+    return commits;
+}
+
+/**
+ * @brief   満杯で捨てた応答の数
+ *
+ * @fn      uint32_t CommandChannel::getDroppedReplies()
+ * @return  uint32_t logger_task が取り出す前に積めなかった応答の数
+ */
+inline uint32_t CommandChannel::getDroppedReplies()
+{
+    return replies.getDropped();
+}
+
+#endif // EV3_APP_COMMANDCHANNEL_H
@@ -0,0 +1,193 @@
+/**
+ * @file DeadlineMonitor.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief
+ * @version 0.1
+ * @date 2021-09-19
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef EV3_APP_DEADLINEMONITOR_H
+#define EV3_APP_DEADLINEMONITOR_H
+
+#include <stdint.h>
+
+#define DEADLINE_PERIOD_US 4000     // 周期(=締め切り)[us], TRACER_CYC と同じ
+#define DEADLINE_RECOVER_US 3000    // 回復とみなす応答時間の上限[us] (周期の75%)
+#define DEADLINE_RECOVER_CYCLES 25  // 縮退を抜けるのに続けて要る回復した周期の数(100ms)
+#define DEADLINE_RECOVER_MAX_CYCLES 250 // 縮退を抜けてすぐ超過したときに倍にする上限(1s)
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   周期の締め切り超過の検出 クラス
+ *
+ * @class   DeadlineMonitor
+ * @note    起動(リリース)時刻を DEADLINE_PERIOD_US ずつ進め,周期の終わりまでの応答時間が周期を超えたら超過と数える。
+ *          TRACER_CYC の起動要求は1つまでしか溜まらないので,開始が1周期以上遅れたら失われた起動も超過と数える。
+ *          超過したら縮退(isDegraded)に入り,応答時間が DEADLINE_RECOVER_US 以下の周期が
+ *          DEADLINE_RECOVER_CYCLES 続いたら抜ける。抜けてからその周期数のうちにまた超過したら(遅い状態が続いている),
+ *          次に抜けるのに要る周期数を DEADLINE_RECOVER_MAX_CYCLES まで倍にし,止めた処理を試す間隔を延ばす。
+ *          時刻は呼び出し側が渡す(fch_hrt)。ev3api は呼ばない。
+ */
+class DeadlineMonitor
+{
+private:
+    uint32_t release;    // 今回の周期の起動時刻[us]
+    bool started;        // 最初の begin を済ませた
+    bool degraded;       // 縮退中
+    int calm;            // 縮退中に続けて回復した周期の数
+    int hold;            // 縮退を抜けるのに要る周期の数
+    int normal;          // 縮退を抜けてからの周期の数(hold まで数える)
+    uint32_t misses;     // 締め切り超過の累計(失われた起動を含む)
+    uint32_t worst_late; // 最大の超過時間[us]
+    uint32_t shed;       // 縮退した周期の累計
+
+    void miss(); // 超過したとき
+
+public:
+    DeadlineMonitor(); // Constructor
+
+    void begin(uint32_t now_us); // 周期開始
+    void end(uint32_t now_us);   // 周期終了
+    bool isDegraded();           // 縮退中か
+    uint32_t getMisses();        // 締め切り超過の累計
+    uint32_t getWorstLateUs();   // 最大の超過時間[us]
+    uint32_t getShedCycles();    // 縮退した周期の累計
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+// Constructor
+DeadlineMonitor::DeadlineMonitor()
+    : release(0),
+      started(false),
+      degraded(false),
+      calm(0),
+      hold(DEADLINE_RECOVER_CYCLES),
+      normal(DEADLINE_RECOVER_CYCLES),
+      misses(0),
+      worst_late(0),
+      shed(0)
+{
+}
+
+/**
+ * @brief   超過したとき
+ *
+ * @fn      void DeadlineMonitor::miss()
+ * @return  無し
+ * @note    縮退に入る。抜けてすぐの超過なら次に抜けるのに要る周期数を倍にする
+ */
+inline void DeadlineMonitor::miss()
+{
+    misses++;
+    if (!degraded && normal < hold)
+        hold = (hold * 2 > DEADLINE_RECOVER_MAX_CYCLES) ? DEADLINE_RECOVER_MAX_CYCLES : hold * 2;
+    degraded = true;
+    calm = 0;
+}
+
+/**
+ * @brief   周期開始
+ *
+ * @fn      void DeadlineMonitor::begin(uint32_t now_us)
+ * @param   now_us  (uint32_t)現在時刻[us], 最初の呼び出しの時刻を起動時刻の基準にする
+ * @return  無し
+ * @note    周期の最初に呼ぶ。前の周期が長引いて起動が失われていたら起動時刻を今の周期まで進める
+ */
+inline void DeadlineMonitor::begin(uint32_t now_us)
+{
+    if (!started)
+    {
+        release = now_us;
+        started = true;
+    }
+    else
+        release += DEADLINE_PERIOD_US;
+    while (now_us - release >= DEADLINE_PERIOD_US) // 失われた起動(除算を使わない)
+    {
+        release += DEADLINE_PERIOD_US;
+        miss();
+    }
+    if (degraded)
+        shed++;
+}
+
+/**
+ * @brief   周期終了
+ *
+ * @fn      void DeadlineMonitor::end(uint32_t now_us)
+ * @param   now_us  (uint32_t)現在時刻[us]
+ * @return  無し
+ * @note    周期の最後(モーター出力とロギングの後)に呼ぶ
+ */
+inline void DeadlineMonitor::end(uint32_t now_us)
+{
+    const uint32_t response = now_us - release;
+    if (response > DEADLINE_PERIOD_US)
+    {
+        if (response - DEADLINE_PERIOD_US > worst_late)
+            worst_late = response - DEADLINE_PERIOD_US;
+        miss();
+    }
+    else if (degraded)
+    {
+        calm = (response <= DEADLINE_RECOVER_US) ? calm + 1 : 0;
+        if (calm >= hold)
+        {
+            degraded = false;
+            normal = 0;
+        }
+    }
+    else if (normal < hold)
+    {
+        if (++normal == hold) // 抜けてから超過せずに続いた
+            hold = DEADLINE_RECOVER_CYCLES;
+    }
+}
+
+/**
+ * @brief   縮退中か
+ *
+ * @fn      bool DeadlineMonitor::isDegraded()
+ * @return  true: 縮退中(省ける処理を止める), false: 通常
+ */
+inline bool DeadlineMonitor::isDegraded()
+{
+    return degraded;
+}
+
+/**
+ * @brief   締め切り超過の累計
+ *
+ * @fn      uint32_t DeadlineMonitor::getMisses()
+ * @return  uint32_t 応答時間が周期を超えた周期と失われた起動の数
+ */
+inline uint32_t DeadlineMonitor::getMisses()
+{
+    return misses;
+}
+
+/**
+ * @brief   最大の超過時間
+ *
+ * @fn      uint32_t DeadlineMonitor::getWorstLateUs()
+ * @return  uint32_t 応答時間 - 周期 の最大[us]
+ */
+inline uint32_t DeadlineMonitor::getWorstLateUs()
+{
+    return worst_late;
+}
+
+/**
+ * @brief   縮退した周期の累計
+ *
+ * @fn      uint32_t DeadlineMonitor::getShedCycles()
+ * @return  uint32_t 縮退中に始まった周期の数
+ */
+inline uint32_t DeadlineMonitor::getShedCycles()
+{
+    return shed;
+}
+
+#endif // EV3_APP_DEADLINEMONITOR_H
@@ -0,0 +1,154 @@
+/**
+ * @file DoubleBuffer.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief
+ * @version 0.1
+ * @date 2021-10-03
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef EV3_APP_DOUBLEBUFFER_H
+#define EV3_APP_DOUBLEBUFFER_H
+
+#include <atomic>
+#include <stdint.h>
+#include "logging/SpscRingBuffer.h"
+
+/**
+ * @brief 読み出し中の印と公開の回数の順序保証(Store-Load)
+ * @note  EV3 は単一コアなので,bt_task(書き込み側, TMIN+2)が tracer_task(読み出し側, TMIN+3)の
+ *        読み出しの途中に割り込んでもメモリの見え方は順番どおりで,コンパイラの並べ替えだけ止めれば十分。
+ *        ホストビルドは別スレッドから読むのでフェンスを入れる。
+ *        確認用に,インクルードの前に定義すれば差し替えられる(bench_command が読み出しの途中に公開を挟む)。
+ */
+#if !defined(DBUF_FENCE)
+#if defined(MAKE_HOST)
+#define DBUF_FENCE() std::atomic_thread_fence(std::memory_order_seq_cst)
+#else
+#define DBUF_FENCE() std::atomic_signal_fence(std::memory_order_seq_cst)
+#endif
+#endif
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   ロックフリー 単一書き込み/単一読み出し ダブルバッファ
+ *
+ * @class   DoubleBuffer
+ * @tparam  T 値の型(コピーできること)
+ * @note    publish は書き込み側タスク(bt_task)だけ,fetch は読み出し側タスク(tracer_task)だけが呼ぶこと。
+ *          書き込み側は最新でない方の面に書いてから公開の回数(seq)を進め,読み出し側は最新の面を丸ごとコピーする。
+ *          読み出し側は待たない(ロックを取らない)。まだ読まれていない値は次の publish で置き換わる(最新だけ残る)。
+ *          書き込み側は,読み出し中の面に書こうとしたときだけ失敗する。EV3 でも bt_task が tracer_task より
+ *          優先度が高いので,1回の読み出しの間に2回公開すると起きる(CommandChannel は CMD_ERR_BUSY を返す)。
+ */
+template <typename T>
+class DoubleBuffer
+{
+private:
+    T slot[2];
+    std::atomic<uint32_t> seq;     // 公開した回数, slot[seq & 1] が最新(書き込み側だけが更新)
+    std::atomic<uint32_t> reading; // 読み出しを始めた seq(読み出し側だけが更新)
+    std::atomic<uint32_t> done;    // 読み終えた seq(読み出し側だけが更新)
+    uint32_t fetched;              // 最後に読んだ seq(読み出し側だけが使う)
+
+public:
+    DoubleBuffer(); // Constructor
+
+    bool publish(const T &item); // 値を公開する(書き込み側)
+    bool fetch(T *out);          // 新しい値があれば読む(読み出し側)
+    uint32_t getSeq() const;     // 公開した回数
+    uint32_t getFetched() const; // 読み出し側が最後に読んだ seq, 0 なら読んでいない
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+// Constructor
+template <typename T>
+DoubleBuffer<T>::DoubleBuffer()
+    : slot(), seq(0), reading(0), done(0), fetched(0)
+{
+}
+
+/**
+ * @brief   値を公開する
+ *
+ * @fn      bool DoubleBuffer::publish(const T &item)
+ * @param   item    (const T&)値
+ * @return  true: 公開した, false: 書く面を読み出し中(あとでやり直す)
+ */
+template <typename T>
+bool DoubleBuffer<T>::publish(const T &item)
+{
+    const uint32_t s = seq.load(std::memory_order_relaxed);
+    DBUF_FENCE(); // 前回の seq の公開の後で reading を読む
+    const uint32_t r = reading.load(std::memory_order_relaxed);
+    const uint32_t d = done.load(std::memory_order_relaxed);
+    SPSC_ACQUIRE(); // reading, done を読んでから面を上書きする
+    if (r != d && ((r ^ (s + 1)) & 1) == 0)
+        return false;
+    slot[(s + 1) & 1] = item;
+    SPSC_RELEASE(); // 面を書いてから seq を進める
+    seq.store(s + 1, std::memory_order_relaxed);
+    return true;
+}
+
+/**
+ * @brief   新しい値があれば読む
+ *
+ * @fn      bool DoubleBuffer::fetch(T *out)
+ * @param   out (T*)読み出し先, 新しい値がなければ書かない
+ * @return  true: 新しい値を読んだ, false: 前回から公開されていない
+ * @note    新しい値がなければ seq を1回読むだけ
+ */
+template <typename T>
+bool DoubleBuffer<T>::fetch(T *out)
+{
+    uint32_t s = seq.load(std::memory_order_relaxed);
+    if (s == fetched)
+        return false;
+    // 読む面に印を付けてから,その間に次が公開されていないか確かめる。やり直すのは印と確認の間に
+    // 公開されたときだけで,回数はその間の公開の回数まで(EV3 では bt_task がコマンドのフレームを
+    // 1つ受け取るごとに1回しか公開しないので,ふつうは1回,割り込まれても2回で抜ける)
+    while (true)
+    {
+        reading.store(s, std::memory_order_relaxed);
+        DBUF_FENCE();
+        const uint32_t now = seq.load(std::memory_order_relaxed);
+        if (now == s)
+            break;
+        s = now;
+    }
+    SPSC_ACQUIRE(); // seq を読んでから面を読む
+    *out = slot[s & 1];
+    SPSC_RELEASE(); // 面を読み終えてから done を進める
+    done.store(s, std::memory_order_relaxed);
+    fetched = s;
+    return true;
+}
+
+/**
+ * @brief   公開した回数
+ *
+ * @fn      uint32_t DoubleBuffer::getSeq()
+ * @return  publish が成功した回数
+ */
+template <typename T>
+inline uint32_t DoubleBuffer<T>::getSeq() const
+{
+    return seq.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief   読み出し側が最後に読んだ seq
+ *
+ * @fn      uint32_t DoubleBuffer::getFetched()
+ * @return  最後に fetch で読んだ値の seq, 0 なら読んでいない
+ * @note    読み出し側から呼ぶこと
+ */
+template <typename T>
+inline uint32_t DoubleBuffer<T>::getFetched() const
+{
+    return fetched;
+}
+
+#endif // EV3_APP_DOUBLEBUFFER_H
@@ -0,0 +1,87 @@
+/**
+ * @file FixedPoint.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief 
+ * @version 0.1
+ * @date 2021-07-11
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+#ifndef EV3_APP_FIXEDPOINT_H
+#define EV3_APP_FIXEDPOINT_H
+
+#include <stdint.h>
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   固定小数点(Q形式)の飽和演算
+ * @note    EV3(ARM926)はFPUを持たないので,毎周期の計算は整数で行う。
+ *          Qは小数部のビット数。積は64bitで計算してから32bitに飽和させる。
+ */
+
+/**
+ * @brief   64bit -> 32bit 飽和
+ */
+static inline int32_t fx_sat(int64_t v)
+{
+    if (v > INT32_MAX)
+        return INT32_MAX;
+    if (v < INT32_MIN)
+        return INT32_MIN;
+    return (int32_t)v;
+}
+
+/**
+ * @brief   飽和加算
+ */
+static inline int32_t fx_add(int32_t a, int32_t b)
+{
+    return fx_sat((int64_t)a + b);
+}
+
+/**
+ * @brief   飽和乗算 (Q値 x 整数 -> Q値)
+ */
+static inline int32_t fx_mul_int(int32_t a_q, int32_t b)
+{
+    return fx_sat((int64_t)a_q * b);
+}
+
+/**
+ * @brief   飽和乗算 (Q値 x Q値 -> Q値)
+ */
+template <int Q>
+static inline int32_t fx_mul(int32_t a_q, int32_t b_q)
+{
+    return fx_sat(((int64_t)a_q * b_q) >> Q);
+}
+
+/**
+ * @brief   実数 -> Q値 (四捨五入, 初期化時のみ使う)
+ */
+template <int Q>
+static inline int32_t fx_from_float(float v)
+{
+    double scaled = (double)v * (double)(1LL << Q);
+    return fx_sat((int64_t)(scaled < 0 ? scaled - 0.5 : scaled + 0.5));
+}
+
+/**
+ * @brief   整数 -> Q値
+ */
+template <int Q>
+static inline int32_t fx_from_int(int32_t v)
+{
+    return fx_sat((int64_t)v << Q);
+}
+
+/**
+ * @brief   Q値 -> 整数 (0方向への切り捨て, floatからintへの変換と同じ)
+ */
+template <int Q>
+static inline int32_t fx_to_int(int32_t v_q)
+{
+    return (v_q >= 0) ? (v_q >> Q) : -((-(int64_t)v_q) >> Q);
+}
+
+#endif // EV3_APP_FIXEDPOINT_H
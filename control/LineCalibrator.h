@@ -0,0 +1,225 @@
+/**
+ * @file LineCalibrator.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief
+ * @version 0.1
+ * @date 2021-08-29
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef EV3_APP_LINECALIBRATOR_H
+#define EV3_APP_LINECALIBRATOR_H
+
+#include <stdint.h>
+
+#include "odometry/ColorSensorCalculator.h"
+#include "control/LineTracer.h"
+
+#define CALIB_CYCLE_MS 4         // step を呼ぶ周期[ms]
+#define CALIB_TIME_MS 1000       // かける時間の上限[ms]
+#define CALIB_SAMPLES (CALIB_TIME_MS / CALIB_CYCLE_MS)
+#define CALIB_POWER 20           // その場旋回のパワー
+#define CALIB_SWEEP_DEG 25       // 片側に振るホイール回転角[deg] (車体 約15deg, センサ 約±25mm)
+#define CALIB_ITERATIONS 8       // 2群に分ける繰り返し回数
+#define CALIB_MIN_SHARE_PCT 10   // 黒,白それぞれのサンプルの割合の下限[%]
+#define CALIB_MIN_QUALITY 70     // 明度の分かれ方(群間分散/全分散)の下限[%]
+#define CALIB_MIN_CONTRAST 8     // 黒と白の明度の差の下限
+#define CALIB_BLUE_MIN_GAP 30    // 白と青の彩度の差の下限
+#define CALIB_BLUE_MIN_SHARE_PCT 5 // 青のサンプルの割合の下限[%]
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   走行前のラインのしきい値の自動調整 クラス
+ *
+ * @class   LineCalibrator
+ * @note    ラインの上でその場旋回を 右 -> 左 -> 右(元の向き) と振り,カラーセンサでラインを横切る。
+ *          ホイール回転角で振り幅を決めるので元の向きに戻る。CALIB_TIME_MS で打ち切る。
+ *          サンプルの HSV明度を黒/白の2群に分け(1次元の2-means),中間を明度のPID目標にする。
+ *          明るいサンプルの彩度が白/青の2群に分かれれば,その中間を彩度のPID目標にする(青を見なければ既定値)。
+ *          青のラインの上では明度が分かれないので,彩度の目標だけを決める。
+ *          どちらも分かれない(ラインを横切っていない,照明が暗すぎる)ときは既定値のまま LINE_CALIB_POOR を返す。
+ *          ev3api は呼ばない(呼び出し側が入力値を渡し,舵角でモーターを回す)。
+ */
+class LineCalibrator
+{
+private:
+    ColorSensorCalculator colorSensor; // RGB=>HSVへの変換
+    int16_t val[CALIB_SAMPLES];        // HSV明度のサンプル
+    int16_t sat[CALIB_SAMPLES];        // HSV彩度のサンプル
+    int samples;                       // サンプル数
+    int phase;                         // 旋回の段階 0:右 1:左 2:右(戻し) 3:終了
+    int left0, right0;                 // 開始時のホイール回転角
+    int time_ms;                       // 経過時間
+
+    static void split(const int16_t *v, int n, int *lo, int *hi, int *n_lo, int *n_hi); // 2群に分ける
+
+public:
+    LineCalibrator(); // Constructor
+
+    bool step(const rgb_raw_t *rgb, int left_count, int right_count, int *turn); // 1周期分
+    void finish(linecalib_t *calib);                                              // しきい値を求める(1回だけ)
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+// Constructor
+LineCalibrator::LineCalibrator()
+    : samples(0),
+      phase(0),
+      left0(0),
+      right0(0),
+      time_ms(0)
+{
+}
+
+/**
+ * @brief   1周期分
+ *
+ * @fn      bool LineCalibrator::step(const rgb_raw_t *rgb, int left_count, int right_count, int *turn)
+ * @param   rgb         (const rgb_raw_t*)カラーセンサ RGB Raw値
+ * @param   left_count  (int)左ホイール回転角
+ * @param   right_count (int)右ホイール回転角
+ * @param   turn        (int*)舵角, CALIB_POWER と一緒に出力する(100: 右旋回, -100: 左旋回)
+ * @return  true: 続ける(CALIB_CYCLE_MS 後にまた呼ぶ), false: 終了(モーターを止めて finish を呼ぶ)
+ */
+bool LineCalibrator::step(const rgb_raw_t *rgb, int left_count, int right_count, int *turn)
+{
+    if (samples == 0 && phase == 0)
+    {
+        left0 = left_count;
+        right0 = right_count;
+    }
+    if (phase < 3 && samples < CALIB_SAMPLES)
+    {
+        colorSensor.calc(rgb);
+        val[samples] = (int16_t)colorSensor.getHSVval();
+        sat[samples] = (int16_t)colorSensor.getHSVsat();
+        samples++;
+    }
+
+    // -------- 旋回: 左右のホイール回転角の差で振り幅を測る --------
+    const int d = (left_count - left0) - (right_count - right0); // 右旋回で増える
+    if (phase == 0 && d >= 2 * CALIB_SWEEP_DEG)
+        phase = 1;
+    else if (phase == 1 && d <= -2 * CALIB_SWEEP_DEG)
+        phase = 2;
+    else if (phase == 2 && d >= 0)
+        phase = 3;
+    time_ms += CALIB_CYCLE_MS;
+    if (time_ms >= CALIB_TIME_MS)
+        phase = 3;
+
+    *turn = (phase == 1) ? -100 : 100;
+    return phase < 3;
+}
+
+/**
+ * @brief   2群に分ける
+ *
+ * @fn      void LineCalibrator::split(const int16_t *v, int n, int *lo, int *hi, int *n_lo, int *n_hi)
+ * @param   v       (const int16_t*)サンプル
+ * @param   n       (int)サンプル数
+ * @param   lo,hi   (int*)小さい群,大きい群の平均
+ * @param   n_lo,n_hi (int*)小さい群,大きい群のサンプル数
+ * @return  無し
+ * @note    最小値と最大値から始めて,境界(2群の平均の中間)と平均を CALIB_ITERATIONS 回更新する
+ */
+void LineCalibrator::split(const int16_t *v, int n, int *lo, int *hi, int *n_lo, int *n_hi)
+{
+    int a = v[0], b = v[0];
+    for (int i = 1; i < n; i++)
+    {
+        if (v[i] < a)
+            a = v[i];
+        if (v[i] > b)
+            b = v[i];
+    }
+    int c0 = 0, c1 = 0;
+    for (int k = 0; k < CALIB_ITERATIONS; k++)
+    {
+        int thr2 = a + b; // 境界 x2
+        int32_t s0 = 0, s1 = 0;
+        c0 = c1 = 0;
+        for (int i = 0; i < n; i++)
+        {
+            if (2 * v[i] < thr2)
+            {
+                s0 += v[i];
+                c0++;
+            }
+            else
+            {
+                s1 += v[i];
+                c1++;
+            }
+        }
+        if (c0 == 0 || c1 == 0)
+            break;
+        a = (s0 + c0 / 2) / c0;
+        b = (s1 + c1 / 2) / c1;
+    }
+    *lo = a;
+    *hi = b;
+    *n_lo = c0;
+    *n_hi = c1;
+}
+
+/**
+ * @brief   しきい値を求める
+ *
+ * @fn      void LineCalibrator::finish(linecalib_t *calib)
+ * @param   calib   (linecalib_t*)結果, LINE_CALIB_POOR のときもしきい値は既定値で埋める
+ * @return  無し
+ */
+void LineCalibrator::finish(linecalib_t *calib)
+{
+    *calib = LINE_DEFAULT_CALIB;
+    calib->samples = samples;
+    calib->time_ms = time_ms;
+    calib->status = LINE_CALIB_POOR;
+    if (samples < 2)
+        return;
+
+    // -------- 明度: 黒/白 --------
+    int black, white, n_black, n_white;
+    split(val, samples, &black, &white, &n_black, &n_white);
+    int64_t mean2 = 0, total = 0; // 全分散 x n
+    for (int i = 0; i < samples; i++)
+        mean2 += val[i];
+    for (int i = 0; i < samples; i++)
+    {
+        int64_t e = (int64_t)val[i] * samples - mean2;
+        total += e * e;
+    }
+    total /= samples; // Σ(v-mean)^2 x n
+    int64_t between = (int64_t)n_black * n_white * (white - black) * (white - black); // 群間分散 x n^2
+    calib->quality = (total > 0) ? (int)(100 * between / total) : 0;
+    calib->black_val = black;
+    calib->white_val = white;
+    if (n_black * 100 >= CALIB_MIN_SHARE_PCT * samples && n_white * 100 >= CALIB_MIN_SHARE_PCT * samples &&
+        calib->quality >= CALIB_MIN_QUALITY && white - black >= CALIB_MIN_CONTRAST)
+    {
+        calib->target_reflect = (black + white) / 2;
+        calib->status = LINE_CALIB_OK;
+    }
+
+    // -------- 彩度: 黒(彩度がばらつく)を除いたサンプルを白/青 --------
+    // 青は白と明度がほぼ同じなので,青のラインの上では明度が分かれず彩度だけで決まる
+    int n = 0; // sat の前に詰める(スタックに別の配列を置かない)
+    for (int i = 0; i < samples; i++)
+        if (calib->status != LINE_CALIB_OK || val[i] >= calib->target_reflect)
+            sat[n++] = sat[i];
+    if (n < 2)
+        return;
+    int white_sat, blue_sat, n_ws, n_bs;
+    split(sat, n, &white_sat, &blue_sat, &n_ws, &n_bs);
+    if (blue_sat - white_sat >= CALIB_BLUE_MIN_GAP && n_bs * 100 >= CALIB_BLUE_MIN_SHARE_PCT * samples &&
+        n_ws * 100 >= CALIB_BLUE_MIN_SHARE_PCT * samples)
+    {
+        calib->target_hsv = (white_sat + blue_sat) / 2;
+        calib->blue_sat = blue_sat;
+        calib->status = LINE_CALIB_OK;
+    }
+}
+
+#endif // EV3_APP_LINECALIBRATOR_H
@@ -21,6 +21,35 @@
 #define TARGET_HSV 59                                    // PID目標,HSV値, 青vs白のsaturation中間値
 #define MOTOR_POWER 70                                   //前進速度
 
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   ラインのしきい値(走行前の自動調整の結果)
+ *
+ * @struct  linecalib_t
+ * @note    LineCalibrator が作り,LineTracer::setCalibration で設定する。既定値は上のマクロ(LINE_DEFAULT_CALIB)
+ */
+typedef struct
+{
+    int target_reflect; /* PID目標,HSV明度 */
+    int target_hsv;     /* PID目標,HSV彩度 */
+    int black_val;      /* 黒の明度 */
+    int white_val;      /* 白の明度 */
+    int blue_sat;       /* 青の彩度, 0 なら青を見ていない(target_hsv は既定値) */
+    int quality;        /* 明度の黒/白の分かれ方[%] (群間分散/全分散) */
+    int samples;        /* サンプル数 */
+    int time_ms;        /* かかった時間[ms] */
+    int status;         /* LINE_CALIB_* */
+} linecalib_t;
+
+enum
+{
+    LINE_CALIB_DEFAULT = 0, /* 調整していない(マクロの値) */
+    LINE_CALIB_OK,          /* 調整した(黒/白か白/青の少なくとも一方) */
+    LINE_CALIB_POOR         /* 黒/白にも白/青にも分かれなかった(マクロの値のまま) */
+};
+
+static const linecalib_t LINE_DEFAULT_CALIB = {
+    TARGET_REFLECT, TARGET_HSV, LIGHT_BLACK, LIGHT_WHITE, 0, 0, 0, 0, LINE_CALIB_DEFAULT};
+
 /** ******** ******** ******** ******** ******** ******** ******** ********
  * @brief   ライントレーサー クラス
  * 
@@ -29,56 +58,71 @@
 class LineTracer
 {
 private:
-    int turn; // turn ratio
+    int turn;           // turn ratio
+    int error;          // 舵角に使ったPIDの目標とセンサ値の差
+    int target_reflect; // PID目標,HSV明度
+    int target_hsv;     // PID目標,HSV彩度(青の判定を兼ねる)
 public:
     LineTracer(); // Constructor
 
-    // PID制御の実行
-    void run(PIDController *PIDreflect,
-             PIDController *PIDhsv,
-             ColorSensorCalculator *ColorSensor,
-             MotorRunner *Motor);
+    // 舵角の計算のみ(モーター出力しない)
+    int calc(PIDControllerType *PIDreflect,
+             PIDControllerType *PIDhsv,
+             ColorSensorCalculator *ColorSensor);
 
     int getTurnRatio(); // turn ratio(舵角)の取得
+    int getError();     // ラインからの偏差の取得
+    void setCalibration(const linecalib_t *calib); // ラインのしきい値の設定
+    void setTargets(int reflect, int hsv); // PID目標の設定
+    int getTargetReflect(); // PID目標,HSV明度の取得
+    int getTargetHsv(); // PID目標,HSV彩度の取得
 };
 
 // ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
 
 // Constructor
 LineTracer::LineTracer()
-    : turn(0)
+    : turn(0),
+      error(0),
+      target_reflect(TARGET_REFLECT),
+      target_hsv(TARGET_HSV)
 {
 }
 
 /**
- * @brief PID制御の実行
+ * @brief 舵角の計算
  * 
- * @fn    void LineTracer::run(PIDController*,PIDController*,ColorSensorCalculator*,MotorRunner*)
- * @param PIDreflect    (PIDController*)HSV明度によるPID制御
- * @param PIDhsv        (PIDController*)HSV彩度によるPID制御
+ * @fn    int LineTracer::calc(PIDControllerType*,PIDControllerType*,ColorSensorCalculator*)
+ * @param PIDreflect    (PIDControllerType*)HSV明度によるPID制御
+ * @param PIDhsv        (PIDControllerType*)HSV彩度によるPID制御
  * @param ColorSensor   (ColorSensorCalculator*)RGB=>HSVへの変換
- * @param Motor         (MotorRunner*)モーター制御
- * @return 無し
+ * @return int turn: 舵角
+ * @note  ev3apiを呼ばない。モーター出力は呼び出し側で MOTOR_POWER と舵角で行う。
+ *        PID目標は setCalibration の値(既定はマクロ TARGET_REFLECT, TARGET_HSV)
  */
-void LineTracer::run(PIDController *PIDreflect,
-                     PIDController *PIDhsv,
-                     ColorSensorCalculator *ColorSensor,
-                     MotorRunner *Motor)
+int LineTracer::calc(PIDControllerType *PIDreflect,
+                     PIDControllerType *PIDhsv,
+                     ColorSensorCalculator *ColorSensor)
 {
     // -------- HSV値PID --------
     PIDhsv->setPIDactual(ColorSensor->getHSVsat()); // 現在satuation値取得
-    PIDhsv->calc(TARGET_HSV, _EDGE);
+    PIDhsv->calc(target_hsv, _EDGE);
     // -------- 光反射値PID --------
     PIDreflect->setPIDactual(ColorSensor->getHSVval()); // 現在value値取得
-    PIDreflect->calc(TARGET_REFLECT, -1 * _EDGE);
+    PIDreflect->calc(target_reflect, -1 * _EDGE);
     // -------- 青色判断 --------
-    if (ColorSensor->getHSVsat() >= TARGET_HSV)
+    if (ColorSensor->getHSVsat() >= target_hsv)
+    {
         turn = PIDhsv->getPIDvalue(); //青色検知したらHSVに切り替えてSaturationで制御する
-    else                              //if (ColorSensor->hsv->sat <= 40) // 戻りが遅くなるので黒のしきい値やめる
+        error = ColorSensor->getHSVsat() - target_hsv;
+    }
+    else //if (ColorSensor->hsv->sat <= 40) // 戻りが遅くなるので黒のしきい値やめる
+    {
         turn = PIDreflect->getPIDvalue();
+        error = ColorSensor->getHSVval() - target_reflect;
+    }
 
-    // -------- モーター出力 --------
-    Motor->run(MOTOR_POWER, turn);
+    return turn;
 }
 
 /**
@@ -92,4 +136,65 @@ inline int LineTracer::getTurnRatio()
     return turn;
 }
 
+/**
+ * @brief   ラインからの偏差の取得
+ *
+ * @fn      int LineTracer::getError()
+ * @return  int error: 舵角に使ったPIDの センサ値 - 目標 (明度か彩度)
+ */
+inline int LineTracer::getError()
+{
+    return error;
+}
+
+/**
+ * @brief   ラインのしきい値の設定
+ *
+ * @fn      void LineTracer::setCalibration(const linecalib_t *calib)
+ * @param   calib   (const linecalib_t*)走行前の自動調整の結果, LINE_DEFAULT_CALIB でマクロの値
+ * @return  無し
+ */
+inline void LineTracer::setCalibration(const linecalib_t *calib)
+{
+    target_reflect = calib->target_reflect;
+    target_hsv = calib->target_hsv;
+}
+
+/**
+ * @brief   PID目標の設定
+ *
+ * @fn      void LineTracer::setTargets(int reflect, int hsv)
+ * @param   reflect (int)PID目標,HSV明度
+ * @param   hsv     (int)PID目標,HSV彩度
+ * @return  無し
+ * @note    走行中に変えてよい(PIDの内部状態は変えない)
+ */
+inline void LineTracer::setTargets(int reflect, int hsv)
+{
+    target_reflect = reflect;
+    target_hsv = hsv;
+}
+
+/**
+ * @brief   PID目標,HSV明度の取得
+ *
+ * @fn      int LineTracer::getTargetReflect()
+ * @return  int 明度がこれより小さければ黒寄り
+ */
+inline int LineTracer::getTargetReflect()
+{
+    return target_reflect;
+}
+
+/**
+ * @brief   PID目標,HSV彩度の取得
+ *
+ * @fn      int LineTracer::getTargetHsv()
+ * @return  int 彩度がこれ以上なら青のライン
+ */
+inline int LineTracer::getTargetHsv()
+{
+    return target_hsv;
+}
+
 #endif // EV3_APP_LINETRACER_H
\ No newline at end of file
@@ -0,0 +1,233 @@
+/**
+ * @file LineTracerT.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief
+ * @version 0.1
+ * @date 2021-07-18
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef EV3_APP_LINETRACERT_H
+#define EV3_APP_LINETRACERT_H
+
+#include <stddef.h>
+#include "control/LineTracer.h"
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   ライントレースの既定の設定(コンパイル時定数)
+ *
+ * @struct  LineTraceConfig
+ * @note    別の設定は同じメンバを持つ構造体を作ってテンプレート引数に渡す。
+ *          target_reflect, target_hsv は初期値で,走行中は setTargets/setCalibration で変えられる
+ */
+struct LineTraceConfig
+{
+    static constexpr int edge = _EDGE;                    // ライン検知左右エッジ
+    static constexpr int target_reflect = TARGET_REFLECT; // PID目標,明度(初期値)
+    static constexpr int target_hsv = TARGET_HSV;         // PID目標,彩度(初期値)
+    static constexpr int power = MOTOR_POWER;             // 前進速度
+};
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   明度PIDと彩度PIDを青ラインで切り替える舵角計算(既定のコントローラポリシー)
+ *
+ * @class   DualPIDSteering
+ * @tparam  PID     PIDコントローラの型 (setPIDparam/setPIDactual/calc/getPIDvalue)
+ * @tparam  Config  設定 (edge, target_reflect, target_hsv)
+ * @note    LineTracer::calc と同じ計算。センサポリシーは getHSVsat/getHSVval を持つこと。
+ *          PID目標は LineTracer と同じく実行時の値(既定は Config の値)
+ */
+template <class PID, class Config = LineTraceConfig>
+class DualPIDSteering
+{
+private:
+    PID reflect;        // HSV明度のPID制御
+    PID hsv;            // HSV彩度のPID制御
+    int error;          // 舵角に使ったPIDの目標とセンサ値の差
+    int target_reflect; // PID目標,HSV明度
+    int target_hsv;     // PID目標,HSV彩度(青の判定を兼ねる)
+
+public:
+    DualPIDSteering(); // Constructor
+
+    template <class Sensor>
+    int steer(Sensor &sensor);             // 舵角の計算
+    int getError() const;                  // ラインからの偏差の取得
+    void setTargets(int reflect, int hsv); // PID目標の設定
+    int getTargetReflect() const;          // PID目標,HSV明度の取得
+    int getTargetHsv() const;              // PID目標,HSV彩度の取得
+    PID &getReflectPID() { return reflect; }
+    PID &getHsvPID() { return hsv; }
+};
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   ライントレーサー ポリシー合成版 クラス
+ *
+ * @class   LineTracerT
+ * @tparam  Sensor      センサ特徴量ポリシー (例: ColorSensorCalculator)
+ * @tparam  Controller  舵角計算ポリシー, int steer(Sensor&) を持つ (例: DualPIDSteering)
+ * @tparam  Actuator    モーター出力ポリシー, run(power, turn) を持つ (例: MotorRunner)
+ * @tparam  Config      設定, power を持つ (例: LineTraceConfig)
+ * @note    LineTracer と同じ「計測->計算->出力」を,ポインタや仮想関数を通さずに合成する。
+ *          全てコンパイル時に決まるので calc()/run() の中身は呼び出し元にインライン展開できる。
+ *          TracerCore は出力を cycleoutput_t で返すので Actuator を渡さず calc() だけ使う。
+ *          PID目標などは Controller に任せる(使ったときだけ Controller に同じ名前の関数が要る)
+ */
+template <class Sensor, class Controller, class Actuator = MotorRunner, class Config = LineTraceConfig>
+class LineTracerT
+{
+private:
+    Sensor &sensor;
+    Controller &controller;
+    Actuator *actuator; // NULL なら run() を呼ばないこと
+    int turn;           // turn ratio
+
+    LineTracerT(const LineTracerT &);            // 参照を持つのでコピーしない
+    LineTracerT &operator=(const LineTracerT &); // 同上
+
+public:
+    LineTracerT(Sensor &sensor, Controller &controller, Actuator *actuator = NULL); // Constructor
+
+    int calc(); // 舵角の計算のみ(モーター出力しない)
+    void run(); // PID制御の実行
+
+    int getTurnRatio() const { return turn; }                              // turn ratio(舵角)の取得
+    int getError() const { return controller.getError(); }                 // ラインからの偏差の取得
+    void setCalibration(const linecalib_t *calib);                         // ラインのしきい値の設定
+    void setTargets(int reflect, int hsv) { controller.setTargets(reflect, hsv); } // PID目標の設定
+    int getTargetReflect() const { return controller.getTargetReflect(); } // PID目標,HSV明度の取得
+    int getTargetHsv() const { return controller.getTargetHsv(); }         // PID目標,HSV彩度の取得
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+// Constructor
+template <class PID, class Config>
+DualPIDSteering<PID, Config>::DualPIDSteering()
+    : error(0),
+      target_reflect(Config::target_reflect),
+      target_hsv(Config::target_hsv)
+{
+    reflect.setPIDparam(Kp_reflect, Ki_reflect, Kd_reflect);
+    hsv.setPIDparam(Kp_hsv, Ki_hsv, Kd_hsv);
+}
+
+/**
+ * @brief   舵角の計算
+ *
+ * @fn      int DualPIDSteering::steer(Sensor &sensor)
+ * @param   sensor  (Sensor&)センサ特徴量, 呼び出し側で更新しておくこと
+ * @return  int 舵角
+ */
+template <class PID, class Config>
+template <class Sensor>
+inline int DualPIDSteering<PID, Config>::steer(Sensor &sensor)
+{
+    // -------- HSV値PID --------
+    hsv.setPIDactual(sensor.getHSVsat());
+    hsv.calc(target_hsv, Config::edge);
+    // -------- 光反射値PID --------
+    reflect.setPIDactual(sensor.getHSVval());
+    reflect.calc(target_reflect, -1 * Config::edge);
+    // -------- 青色判断 --------
+    if (sensor.getHSVsat() >= target_hsv)
+    {
+        error = sensor.getHSVsat() - target_hsv;
+        return hsv.getPIDvalue();
+    }
+    error = sensor.getHSVval() - target_reflect;
+    return reflect.getPIDvalue();
+}
+
+/**
+ * @brief   ラインからの偏差の取得
+ *
+ * @fn      int DualPIDSteering::getError()
+ * @return  int 舵角に使ったPIDの センサ値 - 目標 (明度か彩度)
+ */
+template <class PID, class Config>
+inline int DualPIDSteering<PID, Config>::getError() const
+{
+    return error;
+}
+
+/**
+ * @brief   PID目標の設定
+ *
+ * @fn      void DualPIDSteering::setTargets(int reflect, int hsv)
+ * @param   reflect (int)PID目標,HSV明度
+ * @param   hsv     (int)PID目標,HSV彩度
+ * @return  無し
+ * @note    走行中に変えてよい(PIDの内部状態は変えない)
+ */
+template <class PID, class Config>
+inline void DualPIDSteering<PID, Config>::setTargets(int reflect, int hsv)
+{
+    target_reflect = reflect;
+    target_hsv = hsv;
+}
+
+// PID目標,HSV明度の取得
+template <class PID, class Config>
+inline int DualPIDSteering<PID, Config>::getTargetReflect() const
+{
+    return target_reflect;
+}
+
+// PID目標,HSV彩度の取得
+template <class PID, class Config>
+inline int DualPIDSteering<PID, Config>::getTargetHsv() const
+{
+    return target_hsv;
+}
+
+// Constructor
+template <class Sensor, class Controller, class Actuator, class Config>
+LineTracerT<Sensor, Controller, Actuator, Config>::LineTracerT(Sensor &sensor, Controller &controller, Actuator *actuator)
+    : sensor(sensor), controller(controller), actuator(actuator), turn(0)
+{
+}
+
+/**
+ * @brief   舵角の計算
+ *
+ * @fn      int LineTracerT::calc()
+ * @return  int turn: 舵角
+ * @note    センサ値は呼び出し側で更新しておくこと(ColorSensorCalculator::calc)
+ */
+template <class Sensor, class Controller, class Actuator, class Config>
+inline int LineTracerT<Sensor, Controller, Actuator, Config>::calc()
+{
+    turn = controller.steer(sensor);
+    return turn;
+}
+
+/**
+ * @brief   PID制御の実行
+ *
+ * @fn      void LineTracerT::run()
+ * @return  無し
+ * @note    舵角を計算して Config::power で出力する。Actuator を渡して作ったときだけ呼ぶこと
+ */
+template <class Sensor, class Controller, class Actuator, class Config>
+inline void LineTracerT<Sensor, Controller, Actuator, Config>::run()
+{
+    calc();
+    actuator->run(Config::power, turn);
+}
+
+/**
+ * @brief   ラインのしきい値の設定
+ *
+ * @fn      void LineTracerT::setCalibration(const linecalib_t *calib)
+ * @param   calib   (const linecalib_t*)走行前の自動調整の結果, LINE_DEFAULT_CALIB でマクロの値
+ * @return  無し
+ */
+template <class Sensor, class Controller, class Actuator, class Config>
+inline void LineTracerT<Sensor, Controller, Actuator, Config>::setCalibration(const linecalib_t *calib)
+{
+    controller.setTargets(calib->target_reflect, calib->target_hsv);
+}
+
+#endif // EV3_APP_LINETRACERT_H
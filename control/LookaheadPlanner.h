@@ -0,0 +1,153 @@
+/**
+ * @file LookaheadPlanner.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief
+ * @version 0.1
+ * @date 2021-08-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef EV3_APP_LOOKAHEADPLANNER_H
+#define EV3_APP_LOOKAHEADPLANNER_H
+
+#include <stdint.h>
+
+#include "odometry/CourseMap.h"
+
+#define PLAN_POWER_MAX 100      // 直線での前進速度
+#define PLAN_STRAIGHT_MM 2000   // 回転半径がこれより大きければ直線(最大まで加速)
+#define PLAN_CURVE_MM 800       // 回転半径がこれより小さければカーブ(加速しない)
+#define PLAN_WINDOW_BINS 5      // 回転半径を求める区間の数(ライントレースの蛇行をならす)
+#define PLAN_BRAKE_BINS 6       // 最大からカーブの速度まで落とす区間の数(カーブの手前から減速する)
+#define PLAN_LOOKAHEAD_MM 128   // 今の位置より先の区間の速度を使う(モーターの応答遅れ)
+#define PLAN_BOOST_MAX 256      // 加速の割合の最大 (1.0)
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   コースマップによる先読みの速度計画 クラス
+ *
+ * @class   LookaheadPlanner
+ * @note    前回の走行で記録した CourseMap から区間ごとの加速の割合(0 to PLAN_BOOST_MAX)を作る。
+ *          長い直線は最大まで加速し,カーブと,ラインの色が変わる所(PIDを切り替える所)は加速しない。
+ *          カーブの手前 PLAN_BRAKE_BINS 区間から減速しておく(後ろから前へ加速の割合の下がり方を制限する)。
+ *          走行中は走行距離の区間の値を引くだけ。計画を作るのは走行前の1回(build)で,除算はそこだけ。
+ */
+class LookaheadPlanner
+{
+private:
+    uint16_t boost[CMAP_BINS]; // 区間ごとの加速の割合 0 to PLAN_BOOST_MAX
+    int length;                // 計画した区間の数, 0 なら計画なし
+
+public:
+    LookaheadPlanner(); // Constructor
+
+    void build(CourseMap *map);                // 記録したマップから計画を作る
+    int getLength();                           // 計画した区間の数
+    int getBoost(int index);                   // 区間の加速の割合
+    int getPower(int32_t s, int base_power);   // 走行距離での前進速度
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+// Constructor
+LookaheadPlanner::LookaheadPlanner()
+    : length(0)
+{
+    for (int i = 0; i < CMAP_BINS; i++)
+        boost[i] = 0;
+}
+
+/**
+ * @brief   記録したマップから計画を作る
+ *
+ * @fn      void LookaheadPlanner::build(CourseMap *map)
+ * @param   map (CourseMap*)前回の走行で記録したマップ
+ * @return  無し
+ * @note    走行前に呼ぶ。区間の数が PLAN_WINDOW_BINS に満たなければ計画しない(常に base_power)
+ */
+void LookaheadPlanner::build(CourseMap *map)
+{
+    length = map->getLength();
+    if (length < PLAN_WINDOW_BINS)
+        length = 0;
+
+    // -------- 区間ごと: 前後 PLAN_WINDOW_BINS 区間の方位の変化から回転半径 --------
+    // R = 距離 / 方位の変化[rad] = (W * BIN_MM) / (|Σcurv| * 2π / 2^16)
+    const int64_t num = (int64_t)PLAN_WINDOW_BINS * CMAP_BIN_MM * 65536 * 1000 / 6283; // 2π = 6283/1000
+    for (int i = 0; i < length; i++)
+    {
+        int from = i - PLAN_WINDOW_BINS / 2;
+        if (from < 0)
+            from = 0;
+        if (from + PLAN_WINDOW_BINS > length)
+            from = length - PLAN_WINDOW_BINS;
+        int32_t sum = 0;
+        for (int k = from; k < from + PLAN_WINDOW_BINS; k++)
+            sum += map->getCurv(k);
+        if (sum < 0)
+            sum = -sum;
+        int64_t radius = (sum == 0) ? INT32_MAX : num / sum;
+
+        int b;
+        if (radius >= PLAN_STRAIGHT_MM)
+            b = PLAN_BOOST_MAX;
+        else if (radius <= PLAN_CURVE_MM)
+            b = 0;
+        else
+            b = (int)((radius - PLAN_CURVE_MM) * PLAN_BOOST_MAX / (PLAN_STRAIGHT_MM - PLAN_CURVE_MM));
+        if ((i > 0 && map->getColor(i) != map->getColor(i - 1)) ||
+            (i + 1 < length && map->getColor(i) != map->getColor(i + 1))) // ラインの色が変わる所
+            b = 0;
+        boost[i] = (uint16_t)b;
+    }
+
+    // -------- 減速: 次の区間より PLAN_BOOST_MAX / PLAN_BRAKE_BINS を超えて大きくしない --------
+    const int step = PLAN_BOOST_MAX / PLAN_BRAKE_BINS;
+    for (int i = length - 2; i >= 0; i--)
+        if (boost[i] > boost[i + 1] + step)
+            boost[i] = (uint16_t)(boost[i + 1] + step);
+}
+
+/**
+ * @brief   計画した区間の数
+ *
+ * @fn      int LookaheadPlanner::getLength()
+ * @return  int 区間の数, 0 なら計画なし
+ */
+inline int LookaheadPlanner::getLength()
+{
+    return length;
+}
+
+/**
+ * @brief   区間の加速の割合
+ *
+ * @fn      int LookaheadPlanner::getBoost(int index)
+ * @param   index   (int)区間の番号
+ * @return  int 0 to PLAN_BOOST_MAX
+ */
+inline int LookaheadPlanner::getBoost(int index)
+{
+    return boost[index];
+}
+
+/**
+ * @brief   走行距離での前進速度
+ *
+ * @fn      int LookaheadPlanner::getPower(int32_t s, int base_power)
+ * @param   s           (int32_t)開始からの走行距離 [mm] Q(ODO_POS_Q)
+ * @param   base_power  (int)計画がない所(カーブ,マップの外)の前進速度
+ * @return  int 前進速度 base_power to PLAN_POWER_MAX
+ */
+inline int LookaheadPlanner::getPower(int32_t s, int base_power)
+{
+    int index = (s >> ODO_POS_Q) + PLAN_LOOKAHEAD_MM;
+    if (index < 0 || base_power >= PLAN_POWER_MAX)
+        return base_power;
+    index >>= CMAP_BIN_SHIFT;
+    if (index >= length)
+        return base_power;
+    return base_power + (((PLAN_POWER_MAX - base_power) * boost[index]) >> 8);
+}
+
+#endif // EV3_APP_LOOKAHEADPLANNER_H
@@ -11,85 +11,368 @@
 #ifndef EV3_APP_MOTORRUNNER_H
 #define EV3_APP_MOTORRUNNER_H
 
+#include <stdint.h>
+
 #include "ev3api.h"
 #include "etrobo_env.h"
 
+#define MOTOR_CYCLE_MS 4        // run を呼ぶ周期[ms] (tracer_task)
+#define MOTOR_SPEED_Q 10        // 回転速度 [deg/周期] の小数部ビット数
+#define MOTOR_DPS_PER_POWER 10  // パワー1あたりの無負荷の回転速度[deg/s] (パワー100で1000deg/s)
+#define MOTOR_TARGET_PER_POWER ((MOTOR_DPS_PER_POWER * MOTOR_CYCLE_MS * (1 << MOTOR_SPEED_Q) + 500) / 1000)
+#define MOTOR_SPEED_WINDOW 8    // 回転速度を求めるエンコーダーの差の区間[周期] (2のべき乗)
+#define MOTOR_SPEED_WINDOW_SHIFT 3
+#define MOTOR_KP 16             // 回転速度の偏差 1deg/周期 あたりのパワー (比例)
+#define MOTOR_KI_SHIFT 2        // 回転角の偏差 2^2 deg あたりパワー1 (積分)
+#define MOTOR_POS_ERR_MAX 120   // 回転角の偏差の上限[deg] (積分の飽和)
+#define MOTOR_POWER_MAX 100
+
+/**
+ * @brief   走行モーターの既定の制御方式
+ * @note    MAKE_MOTOR_SPEED_LOOP で車輪ごとの回転速度のフィードバック,なければパワー指令のまま(ev3_motor_steer)
+ */
+#if defined(MAKE_MOTOR_SPEED_LOOP)
+#define MOTOR_SPEED_LOOP_DEFAULT true
+#else
+#define MOTOR_SPEED_LOOP_DEFAULT false
+#endif
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   車輪1つの回転速度のフィードバック クラス
+ *
+ * @class   WheelSpeedLoop
+ * @note    目標の回転速度はパワー x MOTOR_DPS_PER_POWER(無負荷でパワー指令のままと同じ速さ)。
+ *          出力 = 目標のパワー(フィードフォワード) + 比例 x 回転速度の偏差 + 積分 x 回転角の偏差。
+ *          回転速度は MOTOR_SPEED_WINDOW 周期のエンコーダーの差,回転速度の偏差の積分は
+ *          目標の回転角と実際の回転角の差(エンコーダーの量子化が積もらない)。
+ *          負荷で遅れた分を回転角の偏差で取り戻す。ev3api は呼ばない。除算は使わない。
+ */
+class WheelSpeedLoop
+{
+private:
+    int32_t count_hist[MOTOR_SPEED_WINDOW]; // 過去のエンコーダー値
+    int hist_pos;                           // 一番古いエンコーダー値の位置
+    int32_t prev_count;                     // 前回のエンコーダー値
+    int32_t pos_err;                        // 目標の回転角 - 実際の回転角 [deg] Q(MOTOR_SPEED_Q)
+    int32_t speed;                          // 回転速度 [deg/周期] Q(MOTOR_SPEED_Q)
+    bool started;                           // 最初の update を済ませた
+
+public:
+    WheelSpeedLoop(); // Constructor
+
+    void reset();                        // 状態を捨てる(停止,エンコーダーリセット)
+    int update(int power, int32_t count); // 1周期分の出力
+    int getSpeed();                      // 回転速度 [deg/周期] Q(MOTOR_SPEED_Q)
+};
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   ev3api のモーター出力(実機,HostKernel のホストビルド)
+ *
+ * @struct  Ev3MotorDriver
+ * @note    MotorRunnerT のドライバポリシー。状態は持たない
+ */
+struct Ev3MotorDriver
+{
+    void config(motor_port_t port) { ev3_motor_config(port, LARGE_MOTOR); }
+    void setPower(motor_port_t port, int power) { ev3_motor_set_power(port, power); }
+    void stop(motor_port_t port, bool brake) { ev3_motor_stop(port, brake); }
+    void steer(motor_port_t left, motor_port_t right, int power, int turn) { ev3_motor_steer(left, right, power, turn); }
+    void resetCounts(motor_port_t port) { ev3_motor_reset_counts(port); }
+};
+
 /** ******** ******** ******** ******** ******** ******** ******** ********
  * @brief モーター出力クラス
  * 
- * @class MotorRunner
+ * @class MotorRunnerT
+ * @tparam Drv ドライバポリシー, config/setPower/stop/steer/resetCounts を持つ
+ *             (例: Ev3MotorDriver, ホストでは SimWorld に直接出す SimMotorDriver)
  * @attention ev3組み込みのMotorクラスはリンクエラーが出るのでやむなく作った
+ * @note  前回と同じ出力ならドライバを呼ばない(stop と reset の後は必ず呼ぶ)。止まっているときの stop も呼ばない。
+ *        回転速度のフィードバック(setSpeedLoop)では車輪ごとに ev3_motor_set_power で出力する
  */
-class MotorRunner
+template <class Drv = Ev3MotorDriver>
+class MotorRunnerT
 {
 private:
     //int power;                 // 前進速度 (-100 to 100)
     //int turn;                  // 舵角 (-100 to 100)
     const motor_port_t left_motor;
     const motor_port_t right_motor;
+    Drv drv;                     // ドライバ
+    bool speed_loop;             // 回転速度のフィードバック
+    WheelSpeedLoop left_loop;    // 左車輪
+    WheelSpeedLoop right_loop;   // 右車輪
+    int last_power, last_turn;   // 前回の ev3_motor_steer の指令
+    int last_left, last_right;   // 前回の ev3_motor_set_power の指令
+    bool sent;                   // 前回の指令が有効(stop, reset で無効)
+    bool steered;                // 前回の指令は ev3_motor_steer
+    bool stopped;                // 前回の指令は stop(run までもう一度止めない)
+
+    void setWheels(int left, int right); // 車輪ごとのパワー出力
 
 public:
-    MotorRunner();
+    MotorRunnerT(motor_port_t left = EV3_PORT_C, motor_port_t right = EV3_PORT_B, const Drv &drv = Drv());
     void config();
     void run(int power, int turn);
+    void run(int power, int turn, int32_t left_count, int32_t right_count);
     void stop();
     void reset();
+    void setSpeedLoop(bool on);
+    static void steerPower(int power, int turn, int *left, int *right);
 };
 
+typedef MotorRunnerT<> MotorRunner; // ev3api に出すモーター出力
+
 // ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
 
 // Constructor
-MotorRunner::MotorRunner()
-    : left_motor(EV3_PORT_C),
-      right_motor(EV3_PORT_B)
+WheelSpeedLoop::WheelSpeedLoop()
+{
+    reset();
+}
+
+/**
+ * @brief   状態を捨てる
+ *
+ * @fn      void WheelSpeedLoop::reset()
+ * @return  無し
+ * @note    次の update のエンコーダー値から測り直す
+ */
+inline void WheelSpeedLoop::reset()
+{
+    hist_pos = 0;
+    prev_count = 0;
+    pos_err = 0;
+    speed = 0;
+    started = false;
+}
+
+/**
+ * @brief   1周期分の出力
+ *
+ * @fn      int WheelSpeedLoop::update(int power, int32_t count)
+ * @param   power   (int)目標のパワー (-100 to 100), 回転速度の目標は power x MOTOR_DPS_PER_POWER
+ * @param   count   (int32_t)エンコーダー値[deg]
+ * @return  int 出力するパワー (-100 to 100)
+ */
+int WheelSpeedLoop::update(int power, int32_t count)
+{
+    if (!started)
+    {
+        for (int i = 0; i < MOTOR_SPEED_WINDOW; i++)
+            count_hist[i] = count;
+        prev_count = count;
+        started = true;
+    }
+
+    // -------- 回転速度と回転角の偏差 --------
+    const int32_t target = power * MOTOR_TARGET_PER_POWER;
+    speed = ((count - count_hist[hist_pos]) << MOTOR_SPEED_Q) >> MOTOR_SPEED_WINDOW_SHIFT;
+    count_hist[hist_pos] = count;
+    hist_pos = (hist_pos + 1) & (MOTOR_SPEED_WINDOW - 1);
+    pos_err += target - ((count - prev_count) << MOTOR_SPEED_Q);
+    prev_count = count;
+    const int32_t err_max = (int32_t)MOTOR_POS_ERR_MAX << MOTOR_SPEED_Q;
+    if (pos_err > err_max)
+        pos_err = err_max;
+    else if (pos_err < -err_max)
+        pos_err = -err_max;
+
+    // -------- フィードフォワード + 比例 + 積分 --------
+    int32_t u = ((int32_t)power << MOTOR_SPEED_Q) + MOTOR_KP * (target - speed) + (pos_err >> MOTOR_KI_SHIFT);
+    int out = (int)((u + (1 << (MOTOR_SPEED_Q - 1))) >> MOTOR_SPEED_Q);
+    if (out > MOTOR_POWER_MAX)
+        out = MOTOR_POWER_MAX;
+    else if (out < -MOTOR_POWER_MAX)
+        out = -MOTOR_POWER_MAX;
+    return out;
+}
+
+/**
+ * @brief   回転速度
+ *
+ * @fn      int WheelSpeedLoop::getSpeed()
+ * @return  int 前回の update までの MOTOR_SPEED_WINDOW 周期の回転速度 [deg/周期] Q(MOTOR_SPEED_Q)
+ */
+inline int WheelSpeedLoop::getSpeed()
+{
+    return speed;
+}
+
+// Constructor
+template <class Drv>
+MotorRunnerT<Drv>::MotorRunnerT(motor_port_t left, motor_port_t right, const Drv &drv)
+    : left_motor(left),
+      right_motor(right),
+      drv(drv),
+      speed_loop(MOTOR_SPEED_LOOP_DEFAULT),
+      last_power(0),
+      last_turn(0),
+      last_left(0),
+      last_right(0),
+      sent(false),
+      steered(false),
+      stopped(false)
 {
     // this->config();
-    this->reset();
+    // ev3api は呼ばない(静的に確保するので)。使う前に reset() でエンコーダーをリセットする
 }
 
 /**
  * @brief モーター出力ポートの設定
  * 
- * @fn void MotorRunner::config()
+ * @fn void MotorRunnerT::config()
  */
-inline void MotorRunner::config()
+template <class Drv>
+inline void MotorRunnerT<Drv>::config()
 {
-    ev3_motor_config(left_motor, LARGE_MOTOR);
-    ev3_motor_config(right_motor, LARGE_MOTOR);
+    drv.config(left_motor);
+    drv.config(right_motor);
+}
+
+/**
+ * @brief ev3_motor_steer と同じ左右のパワーの配分
+ *
+ * @fn void MotorRunnerT::steerPower(int power, int turn, int *left, int *right)
+ * @param power (int)前進速度 (-100 to 100)
+ * @param turn  (int)舵角 (-100 to 100), 曲がる側の車輪を turn/50 だけ減速する
+ * @param left  (int*)左車輪のパワー
+ * @param right (int*)右車輪のパワー
+ * @return 無し
+ */
+template <class Drv>
+inline void MotorRunnerT<Drv>::steerPower(int power, int turn, int *left, int *right)
+{
+    *left = power;
+    *right = power;
+    if (turn > 0)
+        *right = power - power * turn / 50;
+    else if (turn < 0)
+        *left = power + power * turn / 50;
 }
 
 /**
  * @brief モーター出力
  * 
- * @fn void MotorRunner::run(int power, int turn)
+ * @fn void MotorRunnerT::run(int power, int turn)
  * @param power (int)前進速度 (-100 to 100)
  * @param turn  (int)舵角 (-100 to 100)
  * @return 無し
+ * @note  パワー指令のまま(回転速度のフィードバックなし)。前回と同じ指令ならドライバを呼ばない
  */
-inline void MotorRunner::run(int power, int turn)
+template <class Drv>
+inline void MotorRunnerT<Drv>::run(int power, int turn)
 {
-    ev3_motor_steer(left_motor, right_motor, power, turn);
+    if (sent && steered && power == last_power && turn == last_turn)
+        return;
+    if (!steered) // 回転速度のフィードバックから切り替え
+    {
+        left_loop.reset();
+        right_loop.reset();
+    }
+    drv.steer(left_motor, right_motor, power, turn);
+    last_power = power;
+    last_turn = turn;
+    sent = true;
+    steered = true;
+    stopped = false;
+}
+
+/**
+ * @brief モーター出力(エンコーダー値つき)
+ *
+ * @fn void MotorRunnerT::run(int power, int turn, int32_t left_count, int32_t right_count)
+ * @param power         (int)前進速度 (-100 to 100)
+ * @param turn          (int)舵角 (-100 to 100)
+ * @param left_count    (int32_t)左ホイール回転角(今回の入力値)
+ * @param right_count   (int32_t)右ホイール回転角(今回の入力値)
+ * @return 無し
+ * @note  setSpeedLoop(true) なら ev3_motor_steer と同じ配分の回転速度を車輪ごとのフィードバックで出す。
+ *        毎周期呼ぶこと。false なら run(power, turn) と同じ
+ */
+template <class Drv>
+void MotorRunnerT<Drv>::run(int power, int turn, int32_t left_count, int32_t right_count)
+{
+    if (!speed_loop)
+    {
+        run(power, turn);
+        return;
+    }
+    int left, right;
+    steerPower(power, turn, &left, &right);
+    setWheels(left_loop.update(left, left_count), right_loop.update(right, right_count));
+}
+
+/**
+ * @brief 車輪ごとのパワー出力
+ *
+ * @fn void MotorRunnerT::setWheels(int left, int right)
+ * @param left  (int)左車輪のパワー
+ * @param right (int)右車輪のパワー
+ * @return 無し
+ * @note  前回と同じ車輪はドライバを呼ばない
+ */
+template <class Drv>
+inline void MotorRunnerT<Drv>::setWheels(int left, int right)
+{
+    const bool all = !sent || steered;
+    if (all || left != last_left)
+        drv.setPower(left_motor, left);
+    if (all || right != last_right)
+        drv.setPower(right_motor, right);
+    last_left = left;
+    last_right = right;
+    sent = true;
+    steered = false;
+    stopped = false;
 }
 
 /**
  * @brief モーター停止
- * @fn void MotorRunner::stop()
+ * @fn void MotorRunnerT::stop()
+ * @note  走行を終えた後は毎周期呼ばれるので,止めた後は次の run までドライバを呼ばない
  */
-inline void MotorRunner::stop()
+template <class Drv>
+inline void MotorRunnerT<Drv>::stop()
 {
-    ev3_motor_stop(left_motor, true);
-    ev3_motor_stop(right_motor, true);
+    if (stopped)
+        return;
+    drv.stop(left_motor, true);
+    drv.stop(right_motor, true);
+    stopped = true;
+    sent = false;
+    left_loop.reset();
+    right_loop.reset();
 }
 
 /**
  * @brief 走行モーターエンコーダーリセット
- * @fn void MotorRunner::reset()
+ * @fn void MotorRunnerT::reset()
  */
-inline void MotorRunner::reset()
+template <class Drv>
+inline void MotorRunnerT<Drv>::reset()
 {
     /* 走行モーターエンコーダーリセット */
-    ev3_motor_reset_counts(left_motor);
-    ev3_motor_reset_counts(right_motor);
+    drv.resetCounts(left_motor);
+    drv.resetCounts(right_motor);
+    sent = false;
+    left_loop.reset();
+    right_loop.reset();
+}
+
+/**
+ * @brief 回転速度のフィードバックの設定
+ * @fn void MotorRunnerT::setSpeedLoop(bool on)
+ * @param on    (bool)true: 車輪ごとの回転速度のフィードバック(run にエンコーダー値を渡す), false: パワー指令のまま
+ * @return 無し
+ */
+template <class Drv>
+inline void MotorRunnerT<Drv>::setSpeedLoop(bool on)
+{
+    speed_loop = on;
+    sent = false;
+    left_loop.reset();
+    right_loop.reset();
 }
 
 #endif // EV3_APP_MOTORRUNNER_H
\ No newline at end of file
@@ -62,6 +62,7 @@ public:
 
     void calc(int target, int edge);                // PIDの計算
     float getPIDvalue();                            // PID計算結果の取得
+    const pidStatus_t &getStatus();                 // PID計算情報の取得(テレメトリの登録用)
     void setPIDactual(int actual);                  // 現在センサ値の設定
     void setPIDparam(float Kp, float Ki, float Kd); // PIDパラメータの設定
 };
@@ -125,6 +126,17 @@ inline float PIDController::getPIDvalue()
     return this->pid_value;
 }
 
+/**
+ * @brief PID計算情報の取得
+ * 
+ * @fn const pidStatus_t &PIDController::getStatus()
+ * @return const pidStatus_t&: PID計算情報, 各項(p_value, i_value, d_value)はオブジェクトと同じ間有効
+ */
+inline const pidStatus_t &PIDController::getStatus()
+{
+    return this->pid;
+}
+
 /**
  * @brief 現在センサ値の設定
  * 
@@ -153,4 +165,15 @@ inline void PIDController::setPIDparam(float Kp, float Ki, float Kd)
     this->pid.Kd = Kd;
 }
 
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   ライントレースで使うPIDコントローラの型
+ * @note    MAKE_PID_FIXED を定義すると固定小数点版(Q=PID_FIXED_Q)になる
+ */
+#if defined(MAKE_PID_FIXED)
+#include "control/PIDControllerFixed.h"
+typedef PIDControllerFixed<PID_FIXED_Q> PIDControllerType;
+#else
+typedef PIDController PIDControllerType;
+#endif
+
 #endif // EV3_APP_PIDCONTROLLER_H
\ No newline at end of file
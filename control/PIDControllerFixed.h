@@ -0,0 +1,193 @@
+/**
+ * @file PIDControllerFixed.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief 
+ * @version 0.1
+ * @date 2021-07-11
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+#ifndef EV3_APP_PIDCONTROLLERFIXED_H
+#define EV3_APP_PIDCONTROLLERFIXED_H
+
+#include "control/FixedPoint.h"
+
+#ifndef I_ARRAY_MAX
+#define I_ARRAY_MAX 20 // 積分計算用,センサ値過去履歴回数
+#endif
+#define PID_FIXED_Q 16 // 固定小数点版の既定のQ(小数部ビット数)
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief PID制御 固定小数点版 クラス
+ * 
+ * @class PIDControllerFixed
+ * @tparam Q 小数部のビット数
+ * @note  PIDController(float版)と同じ計算をQ形式の整数で行う。
+ *        係数は setPIDparam でQ形式に丸める。各項は飽和演算で,結果は±100に制限する。
+ *        積分の移動平均は履歴の合計を差分更新し,1/I_ARRAY_MAX は逆数の乗算で求める(整数除算と同じ結果)。
+ */
+template <int Q>
+class PIDControllerFixed
+{
+    static_assert(Q > 0 && Q <= 24, "Q must be 1..24");
+
+private:
+    int actual;               // センサ現在値
+    int prev_diff;            // いっこまえのセンサ値の差分
+    int32_t Kp, Ki, Kd;       // PID係数(Q形式)
+    int32_t p_value, i_value, d_value; // PIDの各項(Q形式)
+    int i_array[I_ARRAY_MAX]; // 積分計算用,センサ値過去履歴
+    int i_index;              // 積分計算用,過去履歴インデックス
+    int i_sum;                // 積分計算用,過去履歴の合計
+    int32_t pid_value;        // PID計算結果(Q形式)
+
+public:
+    PIDControllerFixed(); // Constructor
+
+    void calc(int target, int edge);                // PIDの計算
+    int getPIDvalue();                              // PID計算結果の取得(整数に切り捨て)
+    int32_t getPIDvalueQ();                         // PID計算結果の取得(Q形式)
+    const int32_t &getTermQ(int k);                 // PIDの各項の取得(Q形式, テレメトリの登録用)
+    void setPIDactual(int actual);                  // 現在センサ値の設定
+    void setPIDparam(float Kp, float Ki, float Kd); // PIDパラメータの設定
+
+    static int divHistory(int sum); // sum / I_ARRAY_MAX (0方向へ切り捨て)
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+// Constructor
+template <int Q>
+PIDControllerFixed<Q>::PIDControllerFixed()
+    : actual(0), prev_diff(0),
+      Kp(0), Ki(0), Kd(0),
+      p_value(0), i_value(0), d_value(0),
+      i_array(), i_index(0), i_sum(0),
+      pid_value(0)
+{
+}
+
+/**
+ * @brief sum / I_ARRAY_MAX を除算なしで求める
+ * 
+ * @fn    int PIDControllerFixed::divHistory(int sum)
+ * @param sum (int)履歴の合計, |sum| < 2^16
+ * @return 整数除算と同じ結果
+ * @note  I_ARRAY_MAX=20 なら 52429/2^20 を掛ける。|sum|<2^16 で整数除算と一致する
+ */
+template <int Q>
+inline int PIDControllerFixed<Q>::divHistory(int sum)
+{
+    const uint32_t recip = ((1u << 20) + I_ARRAY_MAX - 1) / I_ARRAY_MAX; // コンパイル時定数
+    if (sum >= 0)
+        return (int)(((uint32_t)sum * recip) >> 20);
+    return -(int)(((uint32_t)(-sum) * recip) >> 20);
+}
+
+/**
+ * @brief PIDの計算
+ * 
+ * @fn  void PIDControllerFixed::calc(int target, int edge)
+ * @param target    (int)目標値
+ * @param edge      (int)ライン検知左右エッジ, ±1 (0 なら出力 0)
+ * @return 無し
+ * @attention HSVの場合はエッジ値を逆にすること
+ * @note    float版は edge を掛けるので,ここでは edge の符号を掛ける(±1, 0 で同じ値になる)
+ */
+template <int Q>
+void PIDControllerFixed<Q>::calc(int target, int edge)
+{
+    const int32_t limit = 100 << Q;
+    int diff = actual - target; // 目標との差分
+    int32_t sum;
+
+    // -------- Kp --------
+    p_value = fx_mul_int(Kp, diff);
+    // -------- Ki --------
+    i_sum += diff - i_array[i_index]; // 一番古い履歴と入れ替え
+    i_array[i_index] = diff;
+    i_index = (i_index + 1 == I_ARRAY_MAX) ? 0 : i_index + 1;
+    i_value = fx_mul_int(Ki, divHistory(i_sum)); // 過去20回分移動平均
+    // -------- Kd --------
+    d_value = fx_mul_int(Kd, diff - prev_diff);
+    // -------- 差分値の保存 --------
+    prev_diff = diff;
+    // -------- PID --------
+    sum = fx_add(fx_add(p_value, i_value), d_value);
+    pid_value = (edge < 0) ? fx_sat(-(int64_t)sum) : (edge > 0) ? sum : 0; // 乗算せず符号だけ掛ける
+    if (pid_value > limit)
+        pid_value = limit;
+    else if (pid_value < -limit)
+        pid_value = -limit;
+}
+
+/**
+ * @brief PID計算結果の取得
+ * 
+ * @fn int PIDControllerFixed::getPIDvalue()
+ * @return int: PID計算結果, 0方向へ切り捨て
+ */
+template <int Q>
+inline int PIDControllerFixed<Q>::getPIDvalue()
+{
+    return fx_to_int<Q>(pid_value);
+}
+
+/**
+ * @brief PID計算結果の取得(Q形式)
+ * 
+ * @fn int32_t PIDControllerFixed::getPIDvalueQ()
+ * @return int32_t: PID計算結果, 2^Q 倍の値
+ */
+template <int Q>
+inline int32_t PIDControllerFixed<Q>::getPIDvalueQ()
+{
+    return pid_value;
+}
+
+/**
+ * @brief PIDの各項の取得(Q形式)
+ * 
+ * @fn const int32_t &PIDControllerFixed::getTermQ(int k)
+ * @param k (int)0: 比例項, 1: 積分項, 2: 微分項
+ * @return const int32_t&: 項, 2^Q 倍の値
+ */
+template <int Q>
+inline const int32_t &PIDControllerFixed<Q>::getTermQ(int k)
+{
+    return (k == 0) ? p_value : (k == 1) ? i_value : d_value;
+}
+
+/**
+ * @brief 現在センサ値の設定
+ * 
+ * @fn      void PIDControllerFixed::setPIDactual(int actual)
+ * @param   actual (int)現在センサ値
+ * @return  無し
+ */
+template <int Q>
+inline void PIDControllerFixed<Q>::setPIDactual(int actual)
+{
+    this->actual = actual;
+}
+
+/**
+ * @brief PIDパラメータの設定
+ * 
+ * @fn      void PIDControllerFixed::setPIDparam(float Kp, float Ki, float Kd)
+ * @param   Kp  (float)PID 比例パラメータ 
+ * @param   Ki  (float)PID 積分パラメータ
+ * @param   Kd  (float)PID 微分パラメータ
+ * @return 無し
+ * @note    初期化時だけ浮動小数点を使う
+ */
+template <int Q>
+inline void PIDControllerFixed<Q>::setPIDparam(float Kp, float Ki, float Kd)
+{
+    this->Kp = fx_from_float<Q>(Kp);
+    this->Ki = fx_from_float<Q>(Ki);
+    this->Kd = fx_from_float<Q>(Kd);
+}
+
+#endif // EV3_APP_PIDCONTROLLERFIXED_H
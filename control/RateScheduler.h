@@ -0,0 +1,343 @@
+/**
+ * @file RateScheduler.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief
+ * @version 0.1
+ * @date 2021-07-25
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef EV3_APP_RATESCHEDULER_H
+#define EV3_APP_RATESCHEDULER_H
+
+#include <stdint.h>
+
+#define RATE_MAX_TASKS 32     // 登録できる処理の最大数(マスクのビット数)
+#define RATE_HYPER_MAX 256    // 位相の自動配置で調べる最大のハイパーピリオド[フレーム]
+#define RATE_PHASE_AUTO 0xFF  // 位相を自動で配置する
+#define RATE_NONE -1          // 追従先なし
+#define RATE_BIT(id) (1UL << (id))
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   レートグループの1処理(センサ取得,計算,ロギング)
+ *
+ * @struct  ratetask_t
+ * @note    フレームは tracer_task の1周期(4ms)。period フレームごと,
+ *          frame % period == phase のフレームで実行する。
+ *          with に先に並んだ処理の番号を書くと,その処理と同じフレームで(後に)実行する(period も揃えること)。
+ */
+typedef struct
+{
+    const char *name; /* 名前(表示用) */
+    uint8_t period;   /* 周期[フレーム] 1以上 */
+    uint8_t phase;    /* 位相[フレーム] 0 to period-1, RATE_PHASE_AUTO で自動配置 */
+    uint16_t cost;    /* 見積もり処理時間[us],位相の自動配置に使う */
+    int8_t with;      /* 同じフレームで実行する先行処理の番号, RATE_NONE で独立 */
+} ratetask_t;
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   表駆動のレートグループ スケジューラ クラス
+ *
+ * @class   RateScheduler
+ * @note    処理は表の並び順に実行する(マスクのビット番号 = 表の番号)。
+ *          位相 RATE_PHASE_AUTO の処理は,見積もり処理時間の大きい順に,
+ *          ハイパーピリオド内のフレーム負荷の最大が最も小さくなる位相に置く(重い取得を別フレームに散らす)。
+ *          毎周期の advance は初期化時に作ったハイパーピリオド分のマスク表を引くだけにする。
+ *          ハイパーピリオドが RATE_HYPER_MAX を超えるときは処理ごとのカウントダウンで求める
+ *          (どちらも除算を使わない。EV3 は整数除算命令を持たない)。
+ */
+class RateScheduler
+{
+private:
+    const ratetask_t *table;           // 処理の表
+    int ntasks;                        // 処理の数
+    uint8_t phase[RATE_MAX_TASKS];     // 決定した位相
+    uint8_t countdown[RATE_MAX_TASKS]; // 次の実行までのフレーム数(マスク表を使わないとき)
+    uint32_t masks[RATE_HYPER_MAX];    // ハイパーピリオド分のマスク表
+    uint16_t hyper;                    // マスク表の長さ, 0 ならカウントダウンで求める
+    uint16_t index;                    // マスク表の現在位置
+    uint32_t frame;                    // 現在のフレーム番号
+    uint32_t due;                      // 現在のフレームで実行する処理のマスク
+
+    void balance(); // 位相の自動配置
+
+public:
+    RateScheduler(const ratetask_t *table, int ntasks); // Constructor
+
+    void reset();                          // フレーム0に戻す
+    uint32_t getDue();                     // 現在のフレームで実行する処理のマスク
+    uint32_t getFrame();                   // 現在のフレーム番号
+    void advance();                        // 次のフレームへ進める
+    int getPhase(int id);                  // 決定した位相の取得
+    uint32_t dueAt(uint32_t frame);        // 任意のフレームのマスク(解析用,除算を使う)
+    uint32_t hyperPeriod();                // 全周期の最小公倍数(RATE_HYPER_MAX で打ち切り)
+    int frameCost(uint32_t mask);          // マスクの見積もり処理時間の合計[us]
+    int worstFrameCost();                  // ハイパーピリオド内の最大フレーム負荷[us]
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+// Constructor
+RateScheduler::RateScheduler(const ratetask_t *table, int ntasks)
+    : table(table),
+      ntasks(ntasks > RATE_MAX_TASKS ? RATE_MAX_TASKS : ntasks),
+      hyper(0),
+      index(0),
+      frame(0),
+      due(0)
+{
+    balance();
+    if (hyperPeriod() < RATE_HYPER_MAX)
+    {
+        hyper = (uint16_t)hyperPeriod();
+        for (uint32_t k = 0; k < hyper; k++)
+            masks[k] = dueAt(k);
+    }
+    reset();
+}
+
+/**
+ * @brief   位相の自動配置
+ *
+ * @fn      void RateScheduler::balance()
+ * @return  無し
+ * @note    固定位相の処理を先に積み,自動の処理を見積もり処理時間(追従する処理を含む)の大きい順に置く。
+ *          同じ最大負荷なら合計負荷の小さい位相,さらに同じなら小さい位相を選ぶ。初期化時に1回だけ呼ぶ。
+ */
+void RateScheduler::balance()
+{
+    uint16_t load[RATE_HYPER_MAX];
+    int group[RATE_MAX_TASKS]; // 追従する処理を含めた処理時間
+    bool placed[RATE_MAX_TASKS];
+    int hyper = (int)hyperPeriod();
+
+    for (int k = 0; k < hyper; k++)
+        load[k] = 0;
+    for (int i = 0; i < ntasks; i++)
+    {
+        group[i] = table[i].cost;
+        placed[i] = false;
+    }
+    for (int i = 0; i < ntasks; i++)
+        if (table[i].with >= 0 && table[i].with < i)
+            group[table[i].with] += table[i].cost;
+
+    // 固定位相
+    for (int i = 0; i < ntasks; i++)
+    {
+        if (table[i].with >= 0 && table[i].with < i)
+            continue;
+        if (table[i].phase != RATE_PHASE_AUTO)
+        {
+            phase[i] = table[i].phase % table[i].period;
+            placed[i] = true;
+            for (int k = phase[i]; k < hyper; k += table[i].period)
+                load[k] += group[i];
+        }
+    }
+
+    // 自動配置: 処理時間の大きい順
+    while (true)
+    {
+        int best = -1;
+        for (int i = 0; i < ntasks; i++)
+        {
+            if (placed[i] || (table[i].with >= 0 && table[i].with < i))
+                continue;
+            if (best < 0 || group[i] > group[best])
+                best = i;
+        }
+        if (best < 0)
+            break;
+
+        int period = table[best].period;
+        int best_phase = 0, best_max = -1, best_sum = 0;
+        for (int p = 0; p < period; p++)
+        {
+            int m = 0, s = 0;
+            for (int k = p; k < hyper; k += period)
+            {
+                if (load[k] > m)
+                    m = load[k];
+                s += load[k];
+            }
+            if (best_max < 0 || m < best_max || (m == best_max && s < best_sum))
+            {
+                best_phase = p;
+                best_max = m;
+                best_sum = s;
+            }
+        }
+        phase[best] = (uint8_t)best_phase;
+        placed[best] = true;
+        for (int k = best_phase; k < hyper; k += period)
+            load[k] += group[best];
+    }
+
+    // 追従する処理は先行処理と同じ位相
+    for (int i = 0; i < ntasks; i++)
+        if (table[i].with >= 0 && table[i].with < i)
+            phase[i] = phase[table[i].with];
+}
+
+/**
+ * @brief   フレーム0に戻す
+ *
+ * @fn      void RateScheduler::reset()
+ * @return  無し
+ */
+void RateScheduler::reset()
+{
+    frame = 0;
+    index = 0;
+    due = 0;
+    for (int i = 0; i < ntasks; i++)
+    {
+        countdown[i] = phase[i];
+        if (countdown[i] == 0)
+            due |= RATE_BIT(i);
+    }
+}
+
+/**
+ * @brief   現在のフレームで実行する処理のマスク
+ *
+ * @fn      uint32_t RateScheduler::getDue()
+ * @return  uint32_t due: ビット i が表の i 番目の処理
+ */
+inline uint32_t RateScheduler::getDue()
+{
+    return due;
+}
+
+/**
+ * @brief   現在のフレーム番号
+ *
+ * @fn      uint32_t RateScheduler::getFrame()
+ * @return  uint32_t frame: 開始からのフレーム数
+ */
+inline uint32_t RateScheduler::getFrame()
+{
+    return frame;
+}
+
+/**
+ * @brief   次のフレームへ進める
+ *
+ * @fn      void RateScheduler::advance()
+ * @return  無し
+ * @note    tracer_task の周期の終わりに1回呼ぶ
+ */
+inline void RateScheduler::advance()
+{
+    frame++;
+    if (hyper != 0)
+    {
+        if (++index == hyper)
+            index = 0;
+        due = masks[index];
+        return;
+    }
+
+    uint32_t next = 0;
+    for (int i = 0; i < ntasks; i++)
+    {
+        if (countdown[i] == 0)
+            countdown[i] = table[i].period;
+        if (--countdown[i] == 0)
+            next |= RATE_BIT(i);
+    }
+    due = next;
+}
+
+/**
+ * @brief   決定した位相の取得
+ *
+ * @fn      int RateScheduler::getPhase(int id)
+ * @param   id  (int)表の番号
+ * @return  int 位相[フレーム]
+ */
+inline int RateScheduler::getPhase(int id)
+{
+    return phase[id];
+}
+
+/**
+ * @brief   任意のフレームのマスク
+ *
+ * @fn      uint32_t RateScheduler::dueAt(uint32_t frame)
+ * @param   frame   (uint32_t)フレーム番号
+ * @return  uint32_t ビット i が表の i 番目の処理
+ * @note    解析,確認用。制御周期では advance/getDue を使うこと
+ */
+uint32_t RateScheduler::dueAt(uint32_t frame)
+{
+    uint32_t mask = 0;
+    for (int i = 0; i < ntasks; i++)
+        if (frame % table[i].period == phase[i])
+            mask |= RATE_BIT(i);
+    return mask;
+}
+
+/**
+ * @brief   全周期の最小公倍数
+ *
+ * @fn      uint32_t RateScheduler::hyperPeriod()
+ * @return  uint32_t ハイパーピリオド[フレーム], RATE_HYPER_MAX 以上のときは RATE_HYPER_MAX
+ */
+uint32_t RateScheduler::hyperPeriod()
+{
+    uint32_t h = 1;
+    for (int i = 0; i < ntasks; i++)
+    {
+        uint32_t a = h, b = table[i].period;
+        while (b != 0) // 最大公約数
+        {
+            uint32_t t = a % b;
+            a = b;
+            b = t;
+        }
+        h = h / a * table[i].period;
+        if (h >= RATE_HYPER_MAX)
+            return RATE_HYPER_MAX;
+    }
+    return h;
+}
+
+/**
+ * @brief   マスクの見積もり処理時間の合計
+ *
+ * @fn      int RateScheduler::frameCost(uint32_t mask)
+ * @param   mask    (uint32_t)処理のマスク
+ * @return  int 見積もり処理時間[us]
+ */
+int RateScheduler::frameCost(uint32_t mask)
+{
+    int cost = 0;
+    for (int i = 0; i < ntasks; i++)
+        if (mask & RATE_BIT(i))
+            cost += table[i].cost;
+    return cost;
+}
+
+/**
+ * @brief   ハイパーピリオド内の最大フレーム負荷
+ *
+ * @fn      int RateScheduler::worstFrameCost()
+ * @return  int 見積もり処理時間[us]
+ */
+int RateScheduler::worstFrameCost()
+{
+    int worst = 0;
+    uint32_t hyper = hyperPeriod();
+    for (uint32_t k = 0; k < hyper; k++)
+    {
+        int c = frameCost(dueAt(k));
+        if (c > worst)
+            worst = c;
+    }
+    return worst;
+}
+
+#endif // EV3_APP_RATESCHEDULER_H
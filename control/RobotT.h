@@ -0,0 +1,195 @@
+/**
+ * @file RobotT.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief 1台分の制御の状態と入出力をまとめたコンテキスト
+ * @version 0.1
+ * @date 2021-07-18
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef EV3_APP_ROBOTT_H
+#define EV3_APP_ROBOTT_H
+
+#include "ev3api.h"
+#include "etrobo_env.h"
+#include "control/TracerCore.h"
+#include "control/MotorRunner.h"
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   1台分のセンサとモーターのポート
+ *
+ * @struct  robotports_t
+ */
+typedef struct
+{
+    sensor_port_t color; /* カラーセンサ */
+    sensor_port_t gyro;  /* ジャイロセンサ */
+    sensor_port_t sonar; /* 超音波センサ */
+    motor_port_t left;   /* 左車輪 */
+    motor_port_t right;  /* 右車輪 */
+    motor_port_t arm;    /* アーム */
+} robotports_t;
+
+static const robotports_t ROBOT_DEFAULT_PORTS = {color_sensor, gyro_sensor, sonar_sensor,
+                                                 left_motor,   right_motor, arm_motor};
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   走行モーターとアームの出力(入出力ポリシーの出力側)
+ *
+ * @class   MotorOutputT
+ * @tparam  Drv ドライバポリシー (例: Ev3MotorDriver, ホストでは SimMotorDriver)
+ * @note    実機とシミュレータで同じ出力の手順(MotorRunner, 前回と同じ指令を省く)を通す
+ */
+template <class Drv>
+class MotorOutputT
+{
+public:
+    MotorRunnerT<Drv> motor; // 走行モーター(回転速度のフィードバックの状態を持つ)
+
+    MotorOutputT(motor_port_t left, motor_port_t right, motor_port_t arm, const Drv &drv = Drv())
+        : motor(left, right, drv), drv(drv), arm(arm), arm_cmd(MOTOR_CMD_KEEP), arm_power(0)
+    {
+    }
+
+    void write(const cycleinput_t *in, const cycleoutput_t *out); // 出力の反映
+
+private:
+    Drv drv;            // アームのドライバ
+    motor_port_t arm;   // アームのポート
+    int arm_cmd;        // 前回ドライバに出したアームの指令 MOTOR_CMD_*, MOTOR_CMD_KEEP なら出していない
+    int arm_power;      // 前回ドライバに出したアームのパワー
+};
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   ev3api の入出力ポリシー(実機,HostKernel のホストビルド)
+ *
+ * @class   Ev3RobotIo
+ * @note    ポートはインスタンスごとに持つ。コンストラクタは ev3api を呼ばない(静的に確保するので)
+ */
+class Ev3RobotIo : public MotorOutputT<Ev3MotorDriver>
+{
+public:
+    robotports_t ports; // センサとモーターのポート
+
+    Ev3RobotIo(const robotports_t &ports = ROBOT_DEFAULT_PORTS)
+        : MotorOutputT<Ev3MotorDriver>(ports.left, ports.right, ports.arm), ports(ports)
+    {
+    }
+
+    void read(uint32_t due, cycleinput_t *in); // 入力値の取得
+};
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   1台分の制御のコンテキスト
+ *
+ * @class   RobotT
+ * @tparam  Io  入出力ポリシー, read(due, in) と write(in, out) を持つ (例: Ev3RobotIo, ホストでは SimRobotIo)
+ * @note    状態はすべてこのオブジェクトの中にあり(TracerCore と,取得しない周期に使う前回の入力値),
+ *          グローバルな状態を持たないので,ホストでは何台でも作って別々のスレッドで進められる。
+ *          締め切りの監視,区間時間,ログ,タスクの起床はこの外(tracer_task)で行う
+ */
+template <class Io>
+class RobotT
+{
+private:
+    cycleinput_t in; // 今回の入力値(取得しない値は前回のまま)
+    uint32_t due;    // 今回の周期で実行するレートグループのマスク
+
+public:
+    TracerCore core; // 制御の本体
+    Io io;           // 入出力
+
+    RobotT() : in(), due(0) {}
+    template <class Arg>
+    explicit RobotT(Arg &arg) : in(), due(0), io(arg) {}
+
+    /**
+     * @brief   入力値の取得
+     * @return  uint32_t 今回の周期で実行するレートグループのマスク(縮退中は間引く)
+     */
+    uint32_t read()
+    {
+        due = core.getDue();
+        io.read(due, &in);
+        return due;
+    }
+
+    /** 1周期の制御(TracerCore::step) */
+    void step(cycleoutput_t *out, logframe_t *frame) { core.step(&in, out, frame); }
+
+    /** 出力の反映 */
+    void write(const cycleoutput_t *out) { io.write(&in, out); }
+
+    /**
+     * @brief   1周期(入力,制御,出力)
+     * @return  uint32_t 今回の周期で実行したレートグループのマスク(RATE_LOG ならフレームをログに積む)
+     */
+    uint32_t cycle(cycleoutput_t *out, logframe_t *frame)
+    {
+        read();
+        step(out, frame);
+        write(out);
+        return due;
+    }
+
+    const cycleinput_t &getInput() const { return in; } // 今回の入力値
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   入力値の取得
+ * @fn      void Ev3RobotIo::read(uint32_t due, cycleinput_t *in)
+ * @param   due (uint32_t)今回の周期で実行するレートグループのマスク
+ * @param   in  (cycleinput_t*)入力値,取得しない値は前回のまま
+ * @note    ev3apiの入力はここだけ。取得した値はログに記録され,ログ再生で使う
+ */
+inline void Ev3RobotIo::read(uint32_t due, cycleinput_t *in)
+{
+    if (due & RATE_BIT(RATE_IN_COLOR))
+        ev3_color_sensor_get_rgb_raw(ports.color, &in->rgb);
+    if (due & RATE_BIT(RATE_IN_WHEEL))
+    {
+        in->left_count = ev3_motor_get_counts(ports.left);
+        in->right_count = ev3_motor_get_counts(ports.right);
+    }
+    if (due & RATE_BIT(RATE_IN_ARM))
+        in->arm_count = ev3_motor_get_counts(ports.arm);
+    if (due & RATE_BIT(RATE_IN_GYRO))
+        in->gyro_angle = ev3_gyro_sensor_get_angle(ports.gyro);
+    if (due & RATE_BIT(RATE_IN_SONAR))
+        in->sonar = ev3_ultrasonic_sensor_get_distance(ports.sonar);
+    if (due & RATE_BIT(RATE_IN_BUTTON))
+        in->back_button = ev3_button_is_pressed(BACK_BUTTON);
+}
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   出力の反映
+ * @fn      void MotorOutputT::write(const cycleinput_t *in, const cycleoutput_t *out)
+ * @param   in  (const cycleinput_t*)今回の入力値(走行モーターの回転速度のフィードバックに使う)
+ * @param   out (const cycleoutput_t*)今回の出力
+ * @note    モーターの出力はここだけ。アームも前回と同じ指令ならドライバを呼ばない(走行モーターは MotorRunner が省く)
+ */
+template <class Drv>
+inline void MotorOutputT<Drv>::write(const cycleinput_t *in, const cycleoutput_t *out)
+{
+    if (out->drive == MOTOR_CMD_RUN)
+        motor.run(out->drive_power, out->drive_turn, in->left_count, in->right_count);
+    else if (out->drive == MOTOR_CMD_STOP)
+        motor.stop();
+
+    if (out->arm == MOTOR_CMD_RUN && (arm_cmd != MOTOR_CMD_RUN || out->arm_power != arm_power))
+    {
+        drv.setPower(arm, out->arm_power);
+        arm_cmd = MOTOR_CMD_RUN;
+        arm_power = out->arm_power;
+    }
+    else if (out->arm == MOTOR_CMD_STOP && arm_cmd != MOTOR_CMD_STOP)
+    {
+        drv.stop(arm, false);
+        arm_cmd = MOTOR_CMD_STOP;
+    }
+}
+
+#endif // EV3_APP_ROBOTT_H
@@ -0,0 +1,170 @@
+/**
+ * @file SpeedProfiler.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief
+ * @version 0.1
+ * @date 2021-08-22
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef EV3_APP_SPEEDPROFILER_H
+#define EV3_APP_SPEEDPROFILER_H
+
+#include <stdint.h>
+
+#define SPEED_CYCLE_MS 4       // calc を呼ぶ周期[ms] (tracer_task)
+#define SPEED_Q 16             // 内部の前進速度と加速の固定小数点の桁
+#define SPEED_RESPONSE_SHIFT 3 // 目標との差の 1/2^3 を1周期の加速の目安にする(約32msで追いつく)
+#define SPEED_POWER_MAX 100
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   前進速度の調整値
+ *
+ * @struct  speedprofile_t
+ * @note    accel が 0 なら調整しない(要求された前進速度のまま, SPEED_FIXED_PROFILE)
+ */
+typedef struct
+{
+    int power_straight; /* 直進中(TurnAngleCalculator の MODE_straight)の前進速度, 要求より小さければ要求のまま */
+    int power_min;      /* 減速の下限 */
+    int turn_slow;      /* |舵角| 1 あたりの減速 [1/256] */
+    int error_slow;     /* |ラインからの偏差| 1 あたりの減速 [1/256] */
+    int accel;          /* 加速の上限 [power/s], 0 で調整なし */
+    int decel;          /* 減速の上限 [power/s] */
+    int jerk;           /* 加速の変化の上限 [power/s^2] */
+} speedprofile_t;
+
+static const speedprofile_t SPEED_FIXED_PROFILE = {0, 0, 0, 0, 0, 0, 0};
+static const speedprofile_t SPEED_ADAPTIVE_PROFILE = {100, 50, 96, 128, 300, 1500, 10000};
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   加速と加速の変化を制限した前進速度 クラス
+ *
+ * @class   SpeedProfiler
+ * @note    LineTracer の舵角と MotorRunner の出力の間で,毎周期の前進速度を決める。
+ *          目標は直進中なら power_straight,舵角とラインからの偏差が大きいほど下げる。
+ *          前進速度は目標へ加速(accel,decel)と加速の変化(jerk)を制限して近づけ,目標を越えない。
+ *          除算は setProfile だけで,calc は整数の加減算とシフト。
+ */
+class SpeedProfiler
+{
+private:
+    speedprofile_t cfg;
+    int32_t power_q;            // 前進速度 Q(SPEED_Q)
+    int32_t accel_q;            // 1周期の加速 Q(SPEED_Q)
+    int32_t up_q, down_q;       // 1周期の加速,減速の上限 Q(SPEED_Q)
+    int32_t jerk_q;             // 1周期の加速の変化の上限 Q(SPEED_Q)
+    int target;                 // 今回の目標
+    bool started;               // 最初の calc を済ませた
+
+public:
+    SpeedProfiler(); // Constructor
+
+    void setProfile(const speedprofile_t *profile);               // 調整値の設定
+    int calc(int request, bool straight, int turn, int error);   // 今回の前進速度
+    int getTarget();                                             // 今回の目標
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+// Constructor
+SpeedProfiler::SpeedProfiler()
+    : power_q(0),
+      accel_q(0),
+      target(0),
+      started(false)
+{
+    setProfile(&SPEED_FIXED_PROFILE);
+}
+
+/**
+ * @brief   調整値の設定
+ *
+ * @fn      void SpeedProfiler::setProfile(const speedprofile_t *profile)
+ * @param   profile (const speedprofile_t*)調整値
+ * @return  無し
+ * @note    走行前に設定すること
+ */
+void SpeedProfiler::setProfile(const speedprofile_t *profile)
+{
+    cfg = *profile;
+    up_q = (int32_t)(((int64_t)cfg.accel << SPEED_Q) * SPEED_CYCLE_MS / 1000);
+    down_q = (int32_t)(((int64_t)cfg.decel << SPEED_Q) * SPEED_CYCLE_MS / 1000);
+    jerk_q = (int32_t)(((int64_t)cfg.jerk << SPEED_Q) * SPEED_CYCLE_MS * SPEED_CYCLE_MS / 1000000);
+    if (jerk_q < 1)
+        jerk_q = 1;
+}
+
+/**
+ * @brief   今回の前進速度
+ *
+ * @fn      int SpeedProfiler::calc(int request, bool straight, int turn, int error)
+ * @param   request     (int)要求された前進速度(設定値,コースマップの速度計画)
+ * @param   straight    (bool)直進中
+ * @param   turn        (int)舵角 (-100 to 100)
+ * @param   error       (int)ラインからの偏差(PIDの目標とセンサ値の差)
+ * @return  int 前進速度
+ * @note    毎周期呼ぶ。最初の周期は要求された前進速度から始める(固定の前進速度と同じ発進)
+ */
+int SpeedProfiler::calc(int request, bool straight, int turn, int error)
+{
+    if (cfg.accel <= 0) // 調整なし
+    {
+        target = request;
+        return request;
+    }
+
+    // -------- 目標 --------
+    int goal = (straight && cfg.power_straight > request) ? cfg.power_straight : request;
+    goal -= ((turn < 0 ? -turn : turn) * cfg.turn_slow + (error < 0 ? -error : error) * cfg.error_slow) >> 8;
+    int floor = (cfg.power_min < request) ? cfg.power_min : request;
+    if (goal < floor)
+        goal = floor;
+    if (goal > SPEED_POWER_MAX)
+        goal = SPEED_POWER_MAX;
+    target = goal;
+
+    if (!started)
+    {
+        power_q = (int32_t)request << SPEED_Q;
+        started = true;
+    }
+
+    // -------- 加速の変化を制限して目標へ --------
+    const int32_t goal_q = (int32_t)goal << SPEED_Q;
+    const int32_t diff = goal_q - power_q;
+    int32_t want = diff >> SPEED_RESPONSE_SHIFT; // 欲しい加速
+    if (want > up_q)
+        want = up_q;
+    else if (want < -down_q)
+        want = -down_q;
+    if (want > accel_q + jerk_q)
+        accel_q += jerk_q;
+    else if (want < accel_q - jerk_q)
+        accel_q -= jerk_q;
+    else
+        accel_q = want;
+
+    int32_t next = power_q + accel_q;
+    if ((diff >= 0 && next > goal_q) || (diff <= 0 && next < goal_q)) // 目標を越えない
+    {
+        next = goal_q;
+        accel_q = 0;
+    }
+    power_q = next;
+    return (power_q + (1 << (SPEED_Q - 1))) >> SPEED_Q;
+}
+
+/**
+ * @brief   今回の目標
+ *
+ * @fn      int SpeedProfiler::getTarget()
+ * @return  int 目標の前進速度(加速の制限の前)
+ */
+inline int SpeedProfiler::getTarget()
+{
+    return target;
+}
+
+#endif // EV3_APP_SPEEDPROFILER_H
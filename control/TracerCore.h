@@ -0,0 +1,772 @@
+/**
+ * @file TracerCore.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief
+ * @version 0.1
+ * @date 2021-07-18
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef EV3_APP_TRACERCORE_H
+#define EV3_APP_TRACERCORE_H
+
+#include "ev3api.h"
+#include "etrobo_env.h"
+#include "odometry/ColorSensorCalculator.h"
+#include "odometry/TurnAngleCalculator.h"
+#include "odometry/HeadingFilter.h"
+#include "odometry/CourseMap.h"
+#include "control/LineTracerT.h"
+#include "control/LookaheadPlanner.h"
+#include "control/SpeedProfiler.h"
+#include "control/RateScheduler.h"
+#include "control/DeadlineMonitor.h"
+#include "control/TracerParams.h"
+#include "control/DoubleBuffer.h"
+#include "logging/DataLogger.h"
+#include "logging/Telemetry.h"
+#include "logging/CycleProfiler.h"
+
+#define MAIN_CYCLE 4      // メインサイクル周期[ms]
+#define ARM_SPEED 20      // アームのモーター速度
+#define ARM_ZERO -53      // アームのゼロ点角度
+#define ARM_SWINGUP 40    // アームの振り上げ最大角
+#define ARM_SWINGBACK -70 // アームの後方振り最大角
+static_assert(HF_CYCLE_MS == MAIN_CYCLE, "HeadingFilter runs every tracer_task cycle");
+static_assert(SPEED_CYCLE_MS == MAIN_CYCLE, "SpeedProfiler runs every tracer_task cycle");
+static_assert(DEADLINE_PERIOD_US == MAIN_CYCLE * 1000, "DeadlineMonitor watches the tracer_task period");
+static_assert(TLM_PERIOD_MS == MAIN_CYCLE, "Telemetry samples every tracer_task cycle");
+
+/**
+ * @brief   前進速度の既定の調整値
+ * @note    MAKE_SPEED_PROFILE で直進/カーブと舵角による加減速,なければ設定の前進速度のまま
+ */
+#if defined(MAKE_SPEED_PROFILE)
+#define SPEED_DEFAULT_PROFILE SPEED_ADAPTIVE_PROFILE
+#else
+#define SPEED_DEFAULT_PROFILE SPEED_FIXED_PROFILE
+#endif
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   ライントレースの調整値(PIDゲインと前進速度)
+ *
+ * @struct  tracergains_t
+ * @note    既定値は PIDController.h, LineTracer.h のマクロ(TRACER_DEFAULT_GAINS)
+ */
+typedef struct
+{
+    float kp_reflect, ki_reflect, kd_reflect; /* HSV明度PIDのゲイン */
+    float kp_hsv, ki_hsv, kd_hsv;             /* HSV彩度PIDのゲイン */
+    int power;                                /* 前進速度 */
+} tracergains_t;
+
+static const tracergains_t TRACER_DEFAULT_GAINS = {
+    Kp_reflect, Ki_reflect, Kd_reflect,
+    Kp_hsv, Ki_hsv, Kd_hsv,
+    MOTOR_POWER};
+
+#define SONAR_MEDIAN_MAX 9 // 超音波センサ距離の移動中央値の窓の最大
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   センサ値のフィルタの設定
+ *
+ * @struct  sensorfilter_t
+ * @note    SENSOR_RAW_FILTER はフィルタなし(センサ値のまま)
+ */
+typedef struct
+{
+    int color_shift;   /* HSV明度,彩度の指数移動平均 1/2^shift, 0 でなし */
+    int sonar_median;  /* 超音波センサ距離の移動中央値の窓(奇数, 取得ごと), 1 でなし */
+    int sonar_confirm; /* 障害物と判定するのに続けて要る検知の数, 1 でなし */
+} sensorfilter_t;
+
+static const sensorfilter_t SENSOR_RAW_FILTER = {0, 1, 1};
+static const sensorfilter_t SENSOR_NOISE_FILTER = {0, 7, 2};
+
+/**
+ * @brief   センサ値の既定のフィルタ
+ * @note    MAKE_SENSOR_FILTER で超音波センサの外れ値を除く,なければセンサ値のまま
+ */
+#if defined(MAKE_SENSOR_FILTER)
+#define SENSOR_DEFAULT_FILTER SENSOR_NOISE_FILTER
+#else
+#define SENSOR_DEFAULT_FILTER SENSOR_RAW_FILTER
+#endif
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   tracer_task のレートグループ(表の番号 = 実行順)
+ * @note    in.* は RobotT::read (Ev3RobotIo::read) でのセンサ取得,それ以外は TracerCore::step の処理
+ */
+enum
+{
+    RATE_IN_COLOR = 0, /* カラーセンサ RGB Raw値 */
+    RATE_IN_WHEEL,     /* 左右ホイール回転角 */
+    RATE_IN_ARM,       /* アーム回転角 */
+    RATE_IN_GYRO,      /* ジャイロ角(方位の補正) */
+    RATE_IN_SONAR,     /* 超音波センサ距離 */
+    RATE_IN_BUTTON,    /* バックボタン */
+    RATE_COLOR,        /* ColorSensorCalculator::calc */
+    RATE_TURNANGLE,    /* TurnAngleCalculator::calc, HeadingFilter::update, CourseMap::record */
+    RATE_LINETRACE,    /* LineTracerT::calc (SpeedProfiler::calc は毎周期) */
+    RATE_OBSTACLE,     /* ObstacleCalc, 超音波センサ取得と同じフレーム */
+    RATE_LOG,          /* DataLogger::put, ログ再生のため毎周期 */
+    RATE_LOG_POSE,     /* ログの姿勢と補正した方位の更新(間引き,それ以外のフレームは前回の値) */
+    RATE_TASKS
+};
+
+/**
+ * @brief   tracer_task のレートグループ表
+ * @note    cost は実機で測っていない仮の値[us]で,位相の自動配置(重いものを別のフレームに散らす)と
+ *          bench_deadline の模擬にだけ使う。大小の順だけが意味を持ち,フレームの処理時間の見積もりには使えない。
+ *          実機の値は MAKE_PROFILE の区間時間(in, step, out, log)で測ってから入れること。
+ */
+static const ratetask_t TRACER_RATE_TABLE[RATE_TASKS] = {
+    /* name         period phase            cost with */
+    {"in.color",    1,     0,               40,  RATE_NONE},
+    {"in.wheel",    1,     0,               20,  RATE_NONE},
+    {"in.arm",      1,     0,               10,  RATE_NONE},
+    {"in.gyro",     5,     RATE_PHASE_AUTO, 30,  RATE_NONE},
+    {"in.sonar",    10,    RATE_PHASE_AUTO, 30,  RATE_NONE},
+    {"in.button",   25,    RATE_PHASE_AUTO, 10,  RATE_NONE},
+    {"color",       1,     0,               30,  RATE_NONE},
+    {"turnangle",   1,     0,               30,  RATE_NONE},
+    {"linetrace",   1,     0,               65,  RATE_NONE},
+    {"obstacle",    10,    RATE_PHASE_AUTO, 5,   RATE_IN_SONAR},
+    {"log",         1,     0,               15,  RATE_NONE},
+    {"log.pose",    25,    RATE_PHASE_AUTO, 5,   RATE_NONE}};
+
+/**
+ * @brief   締め切り超過の縮退中に止める処理
+ * @note    モーター出力に要らないもの(ジャイロ,超音波センサと障害物検知,ロギング)。
+ *          ジャイロがなければ方位はオドメトリだけで進める。縮退中のフレームはログに残らない
+ */
+#define TRACER_SHED_MASK (RATE_BIT(RATE_IN_GYRO) | RATE_BIT(RATE_IN_SONAR) | RATE_BIT(RATE_OBSTACLE) | RATE_BIT(RATE_LOG) | \
+                          RATE_BIT(RATE_LOG_POSE))
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   1周期分の入力値
+ *
+ * @struct  cycleinput_t
+ * @note    tracer_task が周期の始めにレートグループの表に従って取得する(取得しない値は前回のまま)。
+ *          ログにも記録する
+ */
+typedef struct
+{
+    rgb_raw_t rgb;      /* カラーセンサ RGB Raw値 */
+    int left_count;     /* 左ホイール回転角 */
+    int right_count;    /* 右ホイール回転角 */
+    int arm_count;      /* アーム回転角 */
+    int gyro_angle;     /* ジャイロ角 */
+    int sonar;          /* 超音波センサ距離[cm] */
+    int back_button;    /* バックボタン押下 */
+} cycleinput_t;
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   モーター指令
+ */
+enum
+{
+    MOTOR_CMD_KEEP = 0, /* 何もしない */
+    MOTOR_CMD_RUN,      /* パワー(走行モーターは舵角も)を設定 */
+    MOTOR_CMD_STOP      /* 停止 */
+};
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   1周期分の出力
+ *
+ * @struct  cycleoutput_t
+ * @note    同じ周期で複数回指令したときは最後の指令だけが残る
+ */
+typedef struct
+{
+    int drive;              /* 走行モーター指令 MOTOR_CMD_*, 停止はブレーキ */
+    int drive_power;        /* 走行モーター 前進速度 */
+    int drive_turn;         /* 走行モーター 舵角 */
+    int arm;                /* アーム指令 MOTOR_CMD_*, 停止はフロート */
+    int arm_power;          /* アーム パワー */
+    bool wakeup_main;       /* main_task を起こす(走行終了) */
+} cycleoutput_t;
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   ログに残す姿勢と補正した方位
+ *
+ * @struct  logpose_t
+ * @note    RATE_LOG_POSE の周期だけ更新し,それ以外のフレームは前回の値を残す(符号化した差分が 0 になる)。
+ *          ログ再生も同じレートグループで動くので,毎フレーム比べられる
+ */
+typedef struct
+{
+    int x;            /* 位置 x[mm] */
+    int y;            /* 位置 y[mm] */
+    int heading;      /* 方位[deg] */
+    int fuse_heading; /* ジャイロで補正した方位[deg] */
+    int fuse_rate;    /* ジャイロで補正した角速度[deg/s] */
+} logpose_t;
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   tracer_task の制御本体 クラス
+ *
+ * @class   TracerCore
+ * @note    入力値から出力とログフレームを計算するだけで ev3api を呼ばない。
+ *          実機では tracer_task が入出力を行い,ホストではログ再生(host/replay)が
+ *          記録した入力値を流して同じ出力になることを確かめる。
+ */
+class TracerCore
+{
+private:
+    ColorSensorCalculator colorSensor; // RGB=>HSVへの変換
+    TurnAngleCalculator turnAngle;     // 回転半径と回転角の計算
+    HeadingFilter headingFilter;       // ジャイロとオドメトリの方位の統合
+    CourseMap courseMap;               // 今回の走行のコースマップ(次の走行で使う)
+    LookaheadPlanner planner;          // 前回の走行のコースマップによる速度計画
+    DualPIDSteering<PIDControllerType> steering; // 明度PIDと彩度PIDの舵角計算
+    LineTracerT<ColorSensorCalculator, DualPIDSteering<PIDControllerType> > lineTracer; // ライントレース
+    SpeedProfiler speedProfiler;       // 前進速度の加減速
+    RateScheduler sched;               // レートグループ
+    MedianFilter<SONAR_MEDIAN_MAX> sonarMedian; // 超音波センサ距離の外れ値除去
+    Debounce obstacleDebounce;         // 障害物検知のチャタリング除去
+
+    turnangle_t st_angle;    // 車両回転角情報の構造体
+    logpose_t log_pose;      // ログに残す姿勢(RATE_LOG_POSE で更新)
+    unsigned int COUNT_time; // 開始からの経過時間[ms]
+    int DrivingStage;        // 区間判定モード兼走行モード
+    int distance;            // 障害物との距離[cm]
+    int arm_deg;             // アーム角
+    int gyro_deg;            // ジャイロ角
+    int motor_power;         // 前進速度
+    int climb_left_ref;      // 段差を上がり始めたときの左ホイール回転角
+    tracergains_t gains;     // PIDゲインと前進速度(setGains, 調整値の読み出し用)
+    DeadlineMonitor *deadline; // 締め切り超過の検出(縮退と記録)
+    DoubleBuffer<tracerparams_t> *params; // 走行中の調整値の受け取り
+    uint32_t stage_req;      // 反映した DrivingStage の設定の回数
+    Telemetry *telemetry;    // テレメトリ(チャンネルごとの間引き)
+#if defined(MAKE_PROFILE)
+    CycleProfiler *prof; // 区間時間の計測先
+#endif
+
+    int ObstacleCalc(const cycleinput_t *in);                       // 障害物検知
+    int SwingArm(const cycleinput_t *in, cycleoutput_t *out,
+                 int power, int degree);                           // アームを動かす
+
+public:
+    TracerCore(); // Constructor
+
+    void step(const cycleinput_t *in, cycleoutput_t *out, logframe_t *frame); // 1周期の制御
+    int getStage();                    // DrivingStage の取得
+    uint32_t getDue();                 // 今回の周期で実行するレートグループのマスク
+    void setRateTable(const ratetask_t *table); // レートグループ表の差し替え(走行前,位相の比較用)
+    void setGains(const tracergains_t *gains); // PIDゲインと前進速度の設定
+    void calibrateGyro(int bias_mdps, int zero_mdeg); // ジャイロのバイアスと開始時の角度の設定
+    void setSpeedProfile(const speedprofile_t *profile); // 前進速度の加減速の調整値の設定
+    void setCalibration(const linecalib_t *calib); // ラインのしきい値の設定
+    void setSensorFilter(const sensorfilter_t *filter); // センサ値のフィルタの設定
+    bool loadCourseMap(const uint8_t *buf, int size); // 前回の走行のコースマップの読み込み
+    int saveCourseMap(uint8_t *buf, int size);        // 今回の走行のコースマップの書き出し
+    void setDeadline(DeadlineMonitor *d);             // 締め切り超過の検出の設定
+    void setParamBuffer(DoubleBuffer<tracerparams_t> *b); // 走行中の調整値の受け取り先の設定
+    void applyParams(const tracerparams_t *p);        // 調整値の反映
+    void getParams(tracerparams_t *p);                // 今の調整値の取得
+    void setTelemetry(Telemetry *t);                  // テレメトリの設定と変数の登録
+#if defined(MAKE_PROFILE)
+    void setProfiler(CycleProfiler *p); // 区間時間の計測先の設定
+#endif
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+// Constructor
+TracerCore::TracerCore()
+    : lineTracer(colorSensor, steering),
+      sched(TRACER_RATE_TABLE, RATE_TASKS),
+      st_angle({0}),
+      log_pose({0}),
+      COUNT_time(0),
+      DrivingStage(0),
+      distance(0),
+      arm_deg(0),
+      gyro_deg(0),
+      motor_power(MOTOR_POWER),
+      climb_left_ref(0),
+      gains(TRACER_DEFAULT_GAINS),
+      deadline(NULL),
+      params(NULL),
+      stage_req(0),
+      telemetry(NULL)
+#if defined(MAKE_PROFILE)
+      ,
+      prof(NULL)
+#endif
+{
+    setGains(&TRACER_DEFAULT_GAINS);
+    setSpeedProfile(&SPEED_DEFAULT_PROFILE);
+    setSensorFilter(&SENSOR_DEFAULT_FILTER);
+}
+
+/**
+ * @brief 障害物検知
+ *
+ * @fn      int TracerCore::ObstacleCalc(const cycleinput_t *in)
+ * @param   in  (const cycleinput_t*)今回の入力値
+ * @return  true : 障害物を検知, false : 未検知
+ * @note    RATE_OBSTACLE のフレーム(超音波センサを取得したフレーム)だけ呼ぶ。
+ *          距離は移動中央値,検知は続けて sonar_confirm 回(setSensorFilter)
+ */
+int TracerCore::ObstacleCalc(const cycleinput_t *in)
+{
+    // 障害物検知
+    distance = sonarMedian.update(in->sonar);
+    bool near = (distance <= SONAR_ALERT_DISTANCE) && (distance >= 0);
+    return obstacleDebounce.update(near);
+}
+
+/**
+ * @brief   アームを動かす
+ *
+ * @fn      int TracerCore::SwingArm(const cycleinput_t *in, cycleoutput_t *out, int power, int degree)
+ * @param   in      (const cycleinput_t*)今回の入力値
+ * @param   out     (cycleoutput_t*)今回の出力
+ * @param   power   (int)アームのモーター速度[deg]
+ * @param   degree  (int)アームの角度[deg]
+ * @return  true: 引数degreeに到達, false: 引数degreeに未到達
+ */
+int TracerCore::SwingArm(const cycleinput_t *in, cycleoutput_t *out, int power, int degree)
+{
+    arm_deg = in->arm_count;
+
+    out->arm = MOTOR_CMD_RUN;
+    out->arm_power = power;
+
+    if (arm_deg == degree)
+        return true;
+    else
+        return false;
+}
+
+/**
+ * @brief   1周期の制御
+ *
+ * @fn      void TracerCore::step(const cycleinput_t *in, cycleoutput_t *out, logframe_t *frame)
+ * @param   in      (const cycleinput_t*)今回の入力値
+ * @param   out     (cycleoutput_t*)今回の出力
+ * @param   frame   (logframe_t*)今回のログフレーム
+ * @return  無し
+ * @note    レートグループ(getDue)の処理だけ行い,最後に次の周期へ進める
+ */
+void TracerCore::step(const cycleinput_t *in, cycleoutput_t *out, logframe_t *frame)
+{
+    const uint32_t due = getDue(); // 今回の周期で実行する処理
+    int obstacle = false;                // 障害物検知結果
+
+    // 走行中の調整値(公開されていなければ seq を1回読むだけ)
+    tracerparams_t p;
+    if (params && params->fetch(&p))
+        applyParams(&p);
+
+    out->drive = MOTOR_CMD_KEEP;
+    out->arm = MOTOR_CMD_KEEP;
+    out->wakeup_main = (in->back_button != 0); // バックボタン押下
+
+    //カラーセンサー計算
+    if (due & RATE_BIT(RATE_COLOR))
+        colorSensor.calc(&in->rgb);
+    PROF_LAP(prof, PROF_COLOR);
+    //車両姿勢計算
+    if (due & RATE_BIT(RATE_TURNANGLE))
+    {
+        turnAngle.calc(&st_angle, in->left_count, in->right_count);
+        headingFilter.update(turnAngle.getPose().heading, in->gyro_angle, (due & RATE_BIT(RATE_IN_GYRO)) != 0);
+        if (DrivingStage == 0)
+            courseMap.record(turnAngle.getPose().s, headingFilter.getHeading(), colorSensor.getHSVsat() >= lineTracer.getTargetHsv());
+    }
+    gyro_deg = in->gyro_angle;
+    PROF_LAP(prof, PROF_TURNANGLE);
+
+    //状態遷移
+    switch (DrivingStage)
+    {
+    case 0:
+        // 走行
+        out->drive = MOTOR_CMD_RUN;
+        if (due & RATE_BIT(RATE_LINETRACE))
+            lineTracer.calc();
+        out->drive_turn = lineTracer.getTurnRatio();
+        out->drive_power = speedProfiler.calc(planner.getPower(turnAngle.getPose().s, motor_power),
+                                              st_angle.MODE_straight != 0, out->drive_turn, lineTracer.getError());
+        PROF_LAP(prof, PROF_LINETRACER);
+
+        //障害物検知
+        if (due & RATE_BIT(RATE_OBSTACLE))
+            obstacle = ObstacleCalc(in);
+        PROF_LAP(prof, PROF_OBSTACLE);
+        if (obstacle)
+        {
+            out->drive = MOTOR_CMD_STOP;
+            DrivingStage = 101;
+        }
+        break;
+
+    case 101: // 段差を上る為にアームを上げる
+        out->drive = MOTOR_CMD_STOP;
+        if (SwingArm(in, out, ARM_SPEED, ARM_SWINGUP))
+        {
+            climb_left_ref = in->left_count; // エンコーダーはリセットしないので,ここからの回転角で測る
+            DrivingStage = 102;
+        }
+        break;
+
+    case 102: // 段差を上がる
+        out->drive = MOTOR_CMD_RUN;
+        out->drive_power = 30;
+        out->drive_turn = 0;
+        if (in->left_count - climb_left_ref >= 480)
+            DrivingStage = 103;
+        break;
+
+    case 103: // 止まってアームを下げる
+        out->drive = MOTOR_CMD_STOP;
+        if (SwingArm(in, out, -1 * ARM_SPEED, ARM_ZERO))
+        {
+            out->arm = MOTOR_CMD_STOP;
+            DrivingStage = 999;
+        }
+        break;
+
+    case 999:
+        out->wakeup_main = true;
+        break;
+    default:
+        break;
+    }
+    PROF_LAP(prof, PROF_STAGE);
+
+    // -------- ログフレーム --------
+    frame->count_time = COUNT_time;
+    frame->drivin = st_angle.MODE_straight * 100; // 直進コーナー判定:ログ見づらいので適当にN*100倍する
+    frame->turn = lineTracer.getTurnRatio();       // 舵角取得
+    frame->omega = st_angle.omega;
+    frame->hsv_val = colorSensor.getHSVval(); // 現在センサ値取得
+    frame->distance = distance;
+    frame->gyro_deg = gyro_deg;
+    frame->stage = DrivingStage;
+    frame->rgb_r = in->rgb.r;
+    frame->rgb_g = in->rgb.g;
+    frame->rgb_b = in->rgb.b;
+    frame->left_count = in->left_count;
+    frame->right_count = in->right_count;
+    frame->arm_count = in->arm_count;
+    frame->sonar = in->sonar;
+    frame->button = in->back_button;
+    if (due & RATE_BIT(RATE_LOG_POSE))
+    {
+        const pose_t &pose = turnAngle.getPose();
+        log_pose.x = pose.x >> ODO_POS_Q;
+        log_pose.y = pose.y >> ODO_POS_Q;
+        log_pose.heading = PoseOdometry::headingToDeg((int32_t)pose.heading);
+        log_pose.fuse_heading = headingFilter.getHeadingDeg();
+        log_pose.fuse_rate = headingFilter.getRateDps();
+    }
+    frame->pose_x = log_pose.x;
+    frame->pose_y = log_pose.y;
+    frame->pose_heading = log_pose.heading;
+    frame->fuse_heading = log_pose.fuse_heading;
+    frame->fuse_rate = log_pose.fuse_rate;
+    frame->fuse_bias = headingFilter.getBiasMdps();
+    frame->fuse_zero = headingFilter.getZeroMdeg();
+    frame->power = (out->drive == MOTOR_CMD_RUN) ? out->drive_power : 0;
+    frame->cal_reflect = lineTracer.getTargetReflect();
+    frame->cal_hsv = lineTracer.getTargetHsv();
+    frame->dl_miss = deadline ? deadline->getMisses() : 0;
+    frame->dl_late = deadline ? deadline->getWorstLateUs() : 0;
+    frame->dl_shed = deadline ? deadline->getShedCycles() : 0;
+    frame->prm_seq = params ? params->getFetched() : 0;
+
+    // テレメトリ(ロギングと同じく縮退中は止める)
+    if (telemetry && (due & RATE_BIT(RATE_LOG)))
+        telemetry->sample(COUNT_time / MAIN_CYCLE);
+
+    // ログ計算用ループカウンタ
+    COUNT_time += MAIN_CYCLE;
+    sched.advance();
+}
+
+/**
+ * @brief   DrivingStage の取得
+ *
+ * @fn      int TracerCore::getStage()
+ * @return  int DrivingStage: 区間判定モード兼走行モード
+ */
+inline int TracerCore::getStage()
+{
+    return DrivingStage;
+}
+
+/**
+ * @brief   今回の周期で実行するレートグループのマスク
+ *
+ * @fn      uint32_t TracerCore::getDue()
+ * @return  uint32_t ビット RATE_* が立っている処理を今回の周期で実行する
+ * @note    tracer_task は step の前に呼び,センサ取得とロギングを間引く。
+ *          締め切り超過の縮退中(setDeadline)は TRACER_SHED_MASK の処理を除く
+ */
+inline uint32_t TracerCore::getDue()
+{
+    const uint32_t due = sched.getDue();
+    return (deadline && deadline->isDegraded()) ? (due & ~TRACER_SHED_MASK) : due;
+}
+
+/**
+ * @brief   レートグループ表の差し替え
+ *
+ * @fn      void TracerCore::setRateTable(const ratetask_t *table)
+ * @param   table   (const ratetask_t*)RATE_TASKS 個の表, 並びは TRACER_RATE_TABLE と同じ(呼び出し側が持ち続けること)
+ * @return  無し
+ * @note    走行前に呼ぶこと(フレーム0から始める)。bench_sched が位相なし,毎周期の表と
+ *          最大の周期時間を比べるのに使う
+ */
+void TracerCore::setRateTable(const ratetask_t *table)
+{
+    sched = RateScheduler(table, RATE_TASKS);
+}
+
+/**
+ * @brief   PIDゲインと前進速度の設定
+ *
+ * @fn      void TracerCore::setGains(const tracergains_t *gains)
+ * @param   gains   (const tracergains_t*)調整値
+ * @return  無し
+ * @note    走行前に設定すること(PIDの内部状態は変えない)
+ */
+void TracerCore::setGains(const tracergains_t *gains)
+{
+    this->gains = *gains;
+    steering.getReflectPID().setPIDparam(gains->kp_reflect, gains->ki_reflect, gains->kd_reflect);
+    steering.getHsvPID().setPIDparam(gains->kp_hsv, gains->ki_hsv, gains->kd_hsv);
+    motor_power = gains->power;
+}
+
+/**
+ * @brief   ジャイロのバイアスと開始時の角度の設定
+ *
+ * @fn      void TracerCore::calibrateGyro(int bias_mdps, int zero_mdeg)
+ * @param   bias_mdps   (int)バイアス [mdeg/s] 時計回りが正
+ * @param   zero_mdeg   (int)開始時のジャイロ角 [mdeg]
+ * @return  無し
+ * @note    走行前(sta_cyc の前)に,スタート待ちの間に推定した値(GyroBiasEstimator)を設定する
+ */
+inline void TracerCore::calibrateGyro(int bias_mdps, int zero_mdeg)
+{
+    headingFilter.calibrate(bias_mdps, zero_mdeg);
+}
+
+/**
+ * @brief   前進速度の加減速の調整値の設定
+ *
+ * @fn      void TracerCore::setSpeedProfile(const speedprofile_t *profile)
+ * @param   profile (const speedprofile_t*)調整値, SPEED_FIXED_PROFILE で設定の前進速度のまま
+ * @return  無し
+ * @note    走行前に設定すること
+ */
+inline void TracerCore::setSpeedProfile(const speedprofile_t *profile)
+{
+    speedProfiler.setProfile(profile);
+}
+
+/**
+ * @brief   ラインのしきい値の設定
+ *
+ * @fn      void TracerCore::setCalibration(const linecalib_t *calib)
+ * @param   calib   (const linecalib_t*)走行前の自動調整(LineCalibrator)の結果, LINE_DEFAULT_CALIB でマクロの値
+ * @return  無し
+ * @note    走行前に設定すること。ログの cal.reflect, cal.hsv に記録する
+ */
+inline void TracerCore::setCalibration(const linecalib_t *calib)
+{
+    lineTracer.setCalibration(calib);
+}
+
+/**
+ * @brief   センサ値のフィルタの設定
+ *
+ * @fn      void TracerCore::setSensorFilter(const sensorfilter_t *filter)
+ * @param   filter  (const sensorfilter_t*)設定, SENSOR_RAW_FILTER でセンサ値のまま
+ * @return  無し
+ * @note    走行前に設定すること(フィルタの内容は捨てる)
+ */
+void TracerCore::setSensorFilter(const sensorfilter_t *filter)
+{
+    colorSensor.setFilter(filter->color_shift);
+    sonarMedian.setWindow(filter->sonar_median);
+    obstacleDebounce.setCounts(filter->sonar_confirm, 1);
+}
+
+/**
+ * @brief   前回の走行のコースマップの読み込み
+ *
+ * @fn      bool TracerCore::loadCourseMap(const uint8_t *buf, int size)
+ * @param   buf     (const uint8_t*)saveCourseMap で書き出したバイト列
+ * @param   size    (int)バイト数
+ * @return  true: 読み込んで速度計画を作った, false: 形式が違う(速度計画なし,常に設定の前進速度)
+ * @note    走行前(sta_cyc の前)に呼ぶ。読み込んだマップは速度計画を作るのに使うだけで,
+ *          今回の走行の記録は空から始める
+ */
+bool TracerCore::loadCourseMap(const uint8_t *buf, int size)
+{
+    // 今回の走行の記録の領域を借りて読み込む(ヒープを使わない)
+    bool ok = courseMap.load(buf, size);
+    planner.build(&courseMap);
+    courseMap.clear();
+    return ok;
+}
+
+/**
+ * @brief   今回の走行のコースマップの書き出し
+ *
+ * @fn      int TracerCore::saveCourseMap(uint8_t *buf, int size)
+ * @param   buf     (uint8_t*)書き出し先
+ * @param   size    (int)書き出し先の大きさ, CMAP_FILE_MAX あれば足りる
+ * @return  int 書き出したバイト数, 足りなければ 0
+ * @note    走行後(stp_cyc の後)に呼ぶ
+ */
+inline int TracerCore::saveCourseMap(uint8_t *buf, int size)
+{
+    return courseMap.save(buf, size);
+}
+
+/**
+ * @brief   締め切り超過の検出の設定
+ *
+ * @fn      void TracerCore::setDeadline(DeadlineMonitor *d)
+ * @param   d   (DeadlineMonitor*)検出先, NULL なら縮退しない(ログ再生)
+ * @return  無し
+ * @note    tracer_task は getDue の前に d->begin を呼ぶこと。ログの dl.* に累計を記録する
+ */
+inline void TracerCore::setDeadline(DeadlineMonitor *d)
+{
+    deadline = d;
+}
+
+/**
+ * @brief   テレメトリの設定と変数の登録
+ *
+ * @fn      void TracerCore::setTelemetry(Telemetry *t)
+ * @param   t   (Telemetry*)登録先, NULL ならサンプルしない
+ * @return  無し
+ * @note    走行前に1回だけ呼ぶこと。PIDの各項,HSV,区間のホイール回転角・回転半径・回転角,アーム角,DrivingStage を登録し,
+ *          step の最後(ロギングする周期)に t->sample を呼ぶ。間引きは t->configure で設定する
+ */
+void TracerCore::setTelemetry(Telemetry *t)
+{
+    telemetry = t;
+    if (t == NULL)
+        return;
+    PIDControllerType &pidReflect = steering.getReflectPID();
+    PIDControllerType &pidHsv = steering.getHsvPID();
+    for (int k = 0; k < 3; k++)
+    {
+#if defined(MAKE_PID_FIXED)
+        t->addFixed(TLM_PID_REFLECT_P + k, &pidReflect.getTermQ(k), PID_FIXED_Q);
+        t->addFixed(TLM_PID_HSV_P + k, &pidHsv.getTermQ(k), PID_FIXED_Q);
+#else
+        const float *const reflect[3] = {&pidReflect.getStatus().p_value, &pidReflect.getStatus().i_value, &pidReflect.getStatus().d_value};
+        const float *const hsv[3] = {&pidHsv.getStatus().p_value, &pidHsv.getStatus().i_value, &pidHsv.getStatus().d_value};
+        t->add(TLM_PID_REFLECT_P + k, reflect[k]);
+        t->add(TLM_PID_HSV_P + k, hsv[k]);
+#endif
+    }
+    t->add(TLM_HSV_HUE, &colorSensor.getHSV().hue);
+    t->add(TLM_HSV_SAT, &colorSensor.getHSV().sat);
+    t->add(TLM_HSV_VAL, &colorSensor.getHSV().val);
+    t->add(TLM_WHEEL_LEFT, &st_angle.leftWheel_deg);
+    t->add(TLM_WHEEL_RIGHT, &st_angle.rightWheel_deg);
+    t->add(TLM_RADIUS, TurnAngleCalculator::readRadius, &turnAngle); // 除算するので送る周期だけ求める
+    t->add(TLM_OMEGA, &st_angle.omega);
+    t->add(TLM_ARM_DEG, &arm_deg);
+    t->add(TLM_STAGE, &DrivingStage);
+}
+
+/**
+ * @brief   走行中の調整値の受け取り先の設定
+ *
+ * @fn      void TracerCore::setParamBuffer(DoubleBuffer<tracerparams_t> *b)
+ * @param   b   (DoubleBuffer<tracerparams_t>*)受け取り先, NULL なら受け取らない(ログ再生)
+ * @return  無し
+ * @note    step の始め(周期の境目)に新しい組があれば applyParams で反映する。
+ *          ログの prm.seq に反映した組の番号を記録する(0 なら走行中に変えていない)
+ */
+inline void TracerCore::setParamBuffer(DoubleBuffer<tracerparams_t> *b)
+{
+    params = b;
+}
+
+/**
+ * @brief   調整値の反映
+ *
+ * @fn      void TracerCore::applyParams(const tracerparams_t *p)
+ * @param   p   (const tracerparams_t*)調整値, set のビットが立った値だけ反映する
+ * @return  無し
+ * @note    PIDの内部状態は変えない。ゲインの float への変換(除算)は反映するときだけ
+ */
+void TracerCore::applyParams(const tracerparams_t *p)
+{
+    const uint32_t GAIN_BITS = PARAM_BIT(PARAM_KP_REFLECT) | PARAM_BIT(PARAM_KI_REFLECT) | PARAM_BIT(PARAM_KD_REFLECT) |
+                               PARAM_BIT(PARAM_KP_HSV) | PARAM_BIT(PARAM_KI_HSV) | PARAM_BIT(PARAM_KD_HSV);
+
+    if (p->set & (GAIN_BITS | PARAM_BIT(PARAM_POWER)))
+    {
+        tracergains_t g = gains;
+        float *const gain[6] = {&g.kp_reflect, &g.ki_reflect, &g.kd_reflect, &g.kp_hsv, &g.ki_hsv, &g.kd_hsv};
+        for (int i = 0; i < 6; i++)
+            if (p->set & PARAM_BIT(PARAM_KP_REFLECT + i))
+                *gain[i] = (float)p->value[PARAM_KP_REFLECT + i] / PARAM_GAIN_SCALE;
+        if (p->set & PARAM_BIT(PARAM_POWER))
+            g.power = p->value[PARAM_POWER];
+        setGains(&g);
+    }
+    if (p->set & (PARAM_BIT(PARAM_TARGET_REFLECT) | PARAM_BIT(PARAM_TARGET_HSV)))
+        lineTracer.setTargets((p->set & PARAM_BIT(PARAM_TARGET_REFLECT)) ? p->value[PARAM_TARGET_REFLECT] : lineTracer.getTargetReflect(),
+                              (p->set & PARAM_BIT(PARAM_TARGET_HSV)) ? p->value[PARAM_TARGET_HSV] : lineTracer.getTargetHsv());
+    if ((p->set & PARAM_BIT(PARAM_STAGE)) && p->stage_req != stage_req)
+    {
+        DrivingStage = p->value[PARAM_STAGE];
+        stage_req = p->stage_req;
+    }
+}
+
+/**
+ * @brief   今の調整値の取得
+ *
+ * @fn      void TracerCore::getParams(tracerparams_t *p)
+ * @param   p   (tracerparams_t*)取得先, set は全部のビットを立てる
+ * @return  無し
+ * @note    ゲインは PARAM_GAIN_SCALE 倍して丸める。DrivingStage は今の区間。
+ *          走行中に bt_task から呼んでよい(値はどれも1語なので,値ごとには壊れない)
+ */
+void TracerCore::getParams(tracerparams_t *p)
+{
+    const float gain[6] = {gains.kp_reflect, gains.ki_reflect, gains.kd_reflect, gains.kp_hsv, gains.ki_hsv, gains.kd_hsv};
+    for (int i = 0; i < 6; i++)
+        p->value[PARAM_KP_REFLECT + i] = (int32_t)(gain[i] * PARAM_GAIN_SCALE + (gain[i] >= 0 ? 0.5f : -0.5f));
+    p->value[PARAM_TARGET_REFLECT] = lineTracer.getTargetReflect();
+    p->value[PARAM_TARGET_HSV] = lineTracer.getTargetHsv();
+    p->value[PARAM_POWER] = motor_power;
+    p->value[PARAM_STAGE] = DrivingStage;
+    p->set = PARAM_BIT(PARAM_COUNT) - 1;
+    p->stage_req = stage_req;
+}
+
+#if defined(MAKE_PROFILE)
+/**
+ * @brief   区間時間の計測先の設定
+ *
+ * @fn      void TracerCore::setProfiler(CycleProfiler *p)
+ * @param   p   (CycleProfiler*)計測先
+ * @return  無し
+ */
+inline void TracerCore::setProfiler(CycleProfiler *p)
+{
+    prof = p;
+}
+#endif
+
+#endif // EV3_APP_TRACERCORE_H
@@ -0,0 +1,96 @@
+/**
+ * @file TracerParams.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief
+ * @version 0.1
+ * @date 2021-10-03
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef EV3_APP_TRACERPARAMS_H
+#define EV3_APP_TRACERPARAMS_H
+
+#include <stdint.h>
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   走行中に変えられる調整値の番号
+ * @note    Bluetooth のコマンド(CommandChannel)の番号を兼ねる。並びを変えないこと(足すのは最後に)
+ */
+enum
+{
+    PARAM_KP_REFLECT = 0, /* HSV明度PIDのゲイン x PARAM_GAIN_SCALE */
+    PARAM_KI_REFLECT,
+    PARAM_KD_REFLECT,
+    PARAM_KP_HSV,         /* HSV彩度PIDのゲイン x PARAM_GAIN_SCALE */
+    PARAM_KI_HSV,
+    PARAM_KD_HSV,
+    PARAM_TARGET_REFLECT, /* PID目標,HSV明度[%] (TARGET_REFLECT) */
+    PARAM_TARGET_HSV,     /* PID目標,HSV彩度[%] (TARGET_HSV) */
+    PARAM_POWER,          /* 前進速度 (MOTOR_POWER) */
+    PARAM_STAGE,          /* DrivingStage, 設定したら1回だけその区間に移る */
+    PARAM_COUNT
+};
+
+#define PARAM_BIT(id) (1UL << (id))
+#define PARAM_GAIN_SCALE 1000 // ゲインは整数 x 1/1000 でやり取りする
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   調整値の名前と範囲
+ *
+ * @struct  paramdef_t
+ */
+typedef struct
+{
+    const char *name;
+    int32_t min, max;
+} paramdef_t;
+
+static const paramdef_t PARAM_TABLE[PARAM_COUNT] = {
+    {"kp.reflect", 0, 100 * PARAM_GAIN_SCALE},
+    {"ki.reflect", 0, 100 * PARAM_GAIN_SCALE},
+    {"kd.reflect", 0, 100 * PARAM_GAIN_SCALE},
+    {"kp.hsv", 0, 100 * PARAM_GAIN_SCALE},
+    {"ki.hsv", 0, 100 * PARAM_GAIN_SCALE},
+    {"kd.hsv", 0, 100 * PARAM_GAIN_SCALE},
+    {"target.reflect", 0, 100},
+    {"target.hsv", 0, 100},
+    {"power", -100, 100},
+    {"stage", 0, 999},
+};
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   調整値のひとそろい
+ *
+ * @struct  tracerparams_t
+ * @note    CommandChannel が作って DoubleBuffer で tracer_task に渡し,TracerCore が周期の始めに反映する。
+ *          set のビットが立っていない値は TracerCore の値のまま(走行前の自動調整の PID目標など)。
+ *          set はそれまでに設定した値の和で,前の組が反映される前に次の組に置き換わっても設定は失われない。
+ *          DrivingStage は stage_req が変わったときだけ移る(同じ組を何度反映しても区間は戻らない)
+ */
+typedef struct
+{
+    int32_t value[PARAM_COUNT]; /* 値, 単位は PARAM_* */
+    uint32_t set;               /* PARAM_BIT: 設定した値 */
+    uint32_t stage_req;         /* DrivingStage を設定した回数 */
+} tracerparams_t;
+
+/**
+ * @brief   調整値が範囲内か
+ *
+ * @fn      bool paramValid(int id, int32_t value)
+ * @param   id      (int)PARAM_*
+ * @param   value   (int32_t)値
+ * @return  true: 範囲内, false: 番号か値が範囲外
+ * @note    DrivingStage は TracerCore の区間(0, 101, 102, 103, 999)だけ
+ */
+inline bool paramValid(int id, int32_t value)
+{
+    if (id < 0 || id >= PARAM_COUNT || value < PARAM_TABLE[id].min || value > PARAM_TABLE[id].max)
+        return false;
+    if (id == PARAM_STAGE)
+        return value == 0 || value == 101 || value == 102 || value == 103 || value == 999;
+    return true;
+}
+
+#endif // EV3_APP_TRACERPARAMS_H
@@ -77,6 +77,47 @@ static const motor_port_t
 //#define PASS_KEY        "1234" // パスキー    sdcard:\ev3rt\etc\rc.conf.ini PinCodeで設定
 #define CMD_START '1' // リモートスタートコマンド
 
+/**
+ * コースマップ(走行距離ごとのコースの曲がり具合)の保存先を定義します
+ * 走行前に前回の記録を読み込んで速度計画に使い,走行後に今回の記録で上書きします。空なら使いません
+ * ホストビルドは ev3api.h が hostsim --map のファイルに置き換えます
+ */
+#if !defined(COURSEMAP_FILE)
+#if defined(MAKE_COURSEMAP)
+#define COURSEMAP_FILE "/ev3rt/res/coursemap.bin"
+#else
+#define COURSEMAP_FILE ""
+#endif
+#endif
+
+/**
+ * 走行前にラインの上でその場旋回してラインのしきい値(PID目標)を決めるかを定義します
+ * 0 なら LineTracer.h のマクロの値で走ります
+ * ホストビルドは ev3api.h が hostsim --calib に置き換えます
+ */
+#if !defined(LINE_AUTOCALIB)
+#if defined(MAKE_AUTOCALIB)
+#define LINE_AUTOCALIB 1
+#else
+#define LINE_AUTOCALIB 0
+#endif
+#endif
+
+/**
+ * テレメトリ(logging/Telemetry.h)のチャンネルと間引きを定義します "名前:間引き[周期],..."
+ * 名前は "." までの先頭でもよく("pid" で PID の6項),空なら全部無効です。走行中は Bluetooth のコマンドで変えられます
+ * ホストビルドは ev3api.h が hostsim --telemetry に置き換えます
+ */
+#if !defined(TELEMETRY_CONFIG)
+#if defined(MAKE_TELEMETRY_CLIMB)
+#define TELEMETRY_CONFIG "hsv.val:5,wheel:1,radius:5,arm_deg:1,stage:1" // 段差
+#elif defined(MAKE_TELEMETRY)
+#define TELEMETRY_CONFIG "pid:1,hsv.sat:1,hsv.val:1,stage:25" // PIDの調整
+#else
+#define TELEMETRY_CONFIG ""
+#endif
+#endif
+
 // LCDフォントサイズ
 #define CALIB_FONT (EV3_FONT_SMALL)
 #define CALIB_FONT_WIDTH (6 /*TODO: magic number*/)
@@ -0,0 +1,327 @@
+/**
+ * @file HostKernel.cpp
+ * @brief ホスト(Linux)ビルド用 仮想クロックの協調スケジューラ
+ */
+#include "HostKernel.h"
+
+#include <cstdarg>
+#include <cstdio>
+
+thread_local HostKernel *HostKernel::current = NULL;
+thread_local HostKernel::task_ctl *HostKernel::tls_task = NULL;
+
+static const size_t TASK_STACK_SIZE = 256 * 1024;
+
+HostKernel::HostKernel()
+    : cyc_id(0), cyc_tskid(0), cyc_task_fn(NULL), cyc_period(0), cyc_phase(0), cyc_priority(0),
+      cyc_active(false), cyc_next(0), cyc_count(0),
+      now_us(0)
+{
+}
+
+HostKernel::~HostKernel()
+{
+    // 眠ったままのタスクは ter_tsk と同じく巻き戻して終了させる
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+        task_ctl *t = tasks[i];
+        if (t->started && t->state != FINISHED)
+        {
+            t->terminate = true;
+            resume(t);
+        }
+        delete t;
+    }
+}
+
+void HostKernel::setTask(ID id, task_t task, int priority, bool act)
+{
+    task_ctl *t = new task_ctl();
+    t->id = id;
+    t->fn = task;
+    t->priority = priority;
+    t->act = act;
+    t->state = act ? READY : DORMANT;
+    t->wake_at = 0;
+    t->wupcnt = 0;
+    t->terminate = false;
+    t->resumer = NULL;
+    t->started = false;
+    tasks.push_back(t);
+}
+
+void HostKernel::setCyclic(ID cycid, ID tskid, task_t task, RELTIM period, RELTIM phase, int priority)
+{
+    cyc_id = cycid;
+    cyc_tskid = tskid;
+    cyc_task_fn = task;
+    cyc_period = period;
+    cyc_phase = phase;
+    cyc_priority = priority;
+}
+
+HostKernel::task_ctl *HostKernel::find(ID id)
+{
+    for (size_t i = 0; i < tasks.size(); i++)
+        if (tasks[i]->id == id)
+            return tasks[i];
+    return NULL;
+}
+
+void HostKernel::advanceTo(uint64_t t)
+{
+    if (t > now_us)
+    {
+        if (advance)
+            advance(t);
+        now_us = t;
+    }
+}
+
+bool HostKernel::allFinished() const
+{
+    for (size_t i = 0; i < tasks.size(); i++)
+        if (tasks[i]->act && tasks[i]->state != FINISHED)
+            return false;
+    return true;
+}
+
+/**
+ * @brief タスクのコルーチン入口
+ * @note  戻らずに実行権を渡した側へ切り替える
+ */
+void HostKernel::taskEntry()
+{
+    task_ctl *t = tls_task;
+    try
+    {
+        if (!t->terminate)
+            t->fn(0);
+    }
+    catch (terminated_t &)
+    {
+    }
+    t->state = FINISHED;
+    tls_task = t->resumer;
+    ucontext_t dummy;
+    swapcontext(&dummy, t->resumer ? &t->resumer->ctx : &current->sim_ctx);
+}
+
+void HostKernel::resume(task_ctl *t)
+{
+    task_ctl *self = tls_task;
+    if (!t->started)
+    {
+        t->stack.resize(TASK_STACK_SIZE);
+        getcontext(&t->ctx);
+        t->ctx.uc_stack.ss_sp = &t->stack[0];
+        t->ctx.uc_stack.ss_size = t->stack.size();
+        t->ctx.uc_link = NULL;
+        makecontext(&t->ctx, &HostKernel::taskEntry, 0);
+        t->started = true;
+    }
+    if (t->state != FINISHED)
+        t->state = RUNNING;
+    t->resumer = self;
+    tls_task = t;
+    HostKernel *saved = current;
+    current = this;
+    swapcontext(self ? &self->ctx : &sim_ctx, &t->ctx);
+    current = saved;
+    tls_task = self;
+}
+
+void HostKernel::yield(task_ctl *t)
+{
+    tls_task = t->resumer;
+    swapcontext(&t->ctx, t->resumer ? &t->resumer->ctx : &sim_ctx);
+    tls_task = t;
+    if (t->terminate)
+        throw terminated_t();
+}
+
+/**
+ * @brief 仮想クロックで実行する
+ *
+ * @param limit_us 仮想時刻の上限[us]
+ */
+void HostKernel::run(uint64_t limit_us)
+{
+    current = this;
+
+    while (!allFinished())
+    {
+        // -------- 時刻 now_us で実行可能なものを優先度順に実行 --------
+        for (;;)
+        {
+            task_ctl *best = NULL;
+            for (size_t i = 0; i < tasks.size(); i++)
+            {
+                task_ctl *t = tasks[i];
+                if (t->state == SLEEP_TIMED && t->wake_at <= now_us)
+                    t->state = READY;
+                if (t->state == READY && (best == NULL || t->priority < best->priority))
+                    best = t;
+            }
+            bool cyc_due = cyc_active && cyc_next <= now_us;
+            if (cyc_due && (best == NULL || cyc_priority < best->priority))
+            {
+                cyc_next += cyc_period;
+                cyc_count++;
+                cyc_task_fn(0);
+                if (cycle_hook && !cycle_hook(now_us))
+                {
+                    current = NULL;
+                    return;
+                }
+            }
+            else if (best != NULL)
+                resume(best);
+            else
+                break;
+        }
+        if (allFinished())
+            break;
+
+        // -------- 次のイベント時刻まで進める --------
+        bool has_event = false;
+        uint64_t next = 0;
+        for (size_t i = 0; i < tasks.size(); i++)
+        {
+            if (tasks[i]->state == SLEEP_TIMED && (!has_event || tasks[i]->wake_at < next))
+            {
+                next = tasks[i]->wake_at;
+                has_event = true;
+            }
+        }
+        if (cyc_active && (!has_event || cyc_next < next))
+        {
+            next = cyc_next;
+            has_event = true;
+        }
+        if (!has_event || next > limit_us)
+            break; // 起床要因なし or 時間切れ
+        advanceTo(next);
+    }
+    current = NULL;
+}
+
+ER HostKernel::actTsk(ID id)
+{
+    task_ctl *t = find(id);
+    if (t != NULL && t->state == DORMANT && !t->started)
+        t->state = READY;
+    return E_OK; // 未登録のタスクは起動しない
+}
+
+ER HostKernel::terTsk(ID id)
+{
+    task_ctl *t = find(id);
+    if (t != NULL && t->started && t->state != FINISHED)
+    {
+        t->terminate = true;
+        resume(t);
+    }
+    else if (t != NULL && t->state == READY)
+        t->state = DORMANT;
+    return E_OK;
+}
+
+ER HostKernel::slpTsk()
+{
+    task_ctl *t = tls_task;
+    if (t == NULL)
+        return E_OK; // 周期タスクは眠らない
+    if (t->wupcnt > 0)
+    {
+        t->wupcnt--;
+        return E_OK;
+    }
+    t->state = SLEEP;
+    yield(t);
+    return E_OK;
+}
+
+ER HostKernel::tslpTsk(TMO tmout)
+{
+    task_ctl *t = tls_task;
+    if (t == NULL)
+        return E_OK;
+    if (t->wupcnt > 0)
+    {
+        t->wupcnt--;
+        return E_OK;
+    }
+    t->state = SLEEP_TIMED;
+    t->wake_at = now_us + (uint64_t)tmout;
+    yield(t);
+    return E_OK;
+}
+
+ER HostKernel::wupTsk(ID id)
+{
+    task_ctl *t = find(id);
+    if (t == NULL)
+        return E_ID;
+    if (t->state == SLEEP || t->state == SLEEP_TIMED)
+        t->state = READY;
+    else if (t->state == RUNNING || t->state == READY)
+        t->wupcnt++;
+    return E_OK;
+}
+
+ER HostKernel::staCyc(ID id)
+{
+    if (id != cyc_id)
+        return E_ID;
+    if (!cyc_active)
+    {
+        cyc_active = true;
+        cyc_next = now_us + cyc_phase;
+    }
+    return E_OK;
+}
+
+ER HostKernel::stpCyc(ID id)
+{
+    if (id != cyc_id)
+        return E_ID;
+    cyc_active = false;
+    return E_OK;
+}
+
+// ******** カーネルサービスコール ******** ******** ******** ******** ********
+
+extern "C" {
+
+ER act_tsk(ID tskid) { return HostKernel::current->actTsk(tskid); }
+ER ter_tsk(ID tskid) { return HostKernel::current->terTsk(tskid); }
+void ext_tsk(void) {} // タスク関数の末尾でのみ呼ばれる前提,そのまま戻る
+ER slp_tsk(void) { return HostKernel::current->slpTsk(); }
+ER tslp_tsk(TMO tmout) { return HostKernel::current->tslpTsk(tmout); }
+ER wup_tsk(ID tskid) { return HostKernel::current->wupTsk(tskid); }
+ER sta_cyc(ID cycid) { return HostKernel::current->staCyc(cycid); }
+ER stp_cyc(ID cycid) { return HostKernel::current->stpCyc(cycid); }
+
+ER get_tim(SYSTIM *p_systim)
+{
+    *p_systim = HostKernel::current->now();
+    return E_OK;
+}
+
+HRTCNT fch_hrt(void)
+{
+    return (HRTCNT)HostKernel::current->now();
+}
+
+void host_syslog(int prio, const char *format, ...)
+{
+    va_list ap;
+    (void)prio;
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+} // extern "C"
@@ -0,0 +1,107 @@
+/**
+ * @file HostKernel.h
+ * @brief ホスト(Linux)ビルド用 仮想クロックの協調スケジューラ
+ *
+ * @note TOPPERS/HRP3 の必要最小限の振る舞いだけを再現する。
+ *       - 時刻は実時間と無関係な仮想クロック[us]で、イベントのたびに飛ばす
+ *       - 登録したタスク(main_task等)はそれぞれ専用スタックのコルーチン(ucontext)で動かす。
+ *         常に1つだけが走る(単一CPU相当)
+ *       - 周期ハンドラで起動されるタスク(tracer_task)はシミュレータのスレッドで直接呼ぶ
+ *       - 同時刻に実行可能なものは優先度順(値が小さいほど高い)に実行する。
+ *         ただし実行中のタスクを途中で横取りはしない(処理時間は0とみなす)
+ *       - 登録していないタスクへの act_tsk は無視する
+ */
+#ifndef EV3_HOST_HOSTKERNEL_H
+#define EV3_HOST_HOSTKERNEL_H
+
+#include <functional>
+#include <vector>
+#include <ucontext.h>
+
+#include "kernel.h"
+
+class HostKernel
+{
+public:
+    typedef void (*task_t)(intptr_t);
+    typedef std::function<void(uint64_t now_us)> advance_t; // 仮想時刻を進めるときのフック(物理モデル更新)
+    typedef std::function<bool(uint64_t now_us)> stop_t;    // 周期ごとの終了判定フック
+
+    HostKernel();
+    ~HostKernel();
+
+    void setTask(ID id, task_t task, int priority, bool act = false); // act: TA_ACT 相当
+    void setMainTask(ID id, task_t task) { setTask(id, task, 1, true); }
+    void setCyclic(ID cycid, ID tskid, task_t task, RELTIM period, RELTIM phase, int priority = 3);
+    void onAdvance(advance_t fn) { advance = fn; }
+    void onCycle(stop_t fn) { cycle_hook = fn; }
+
+    void run(uint64_t limit_us); // TA_ACT のタスクが全て終了するか limit_us 経過まで実行
+    uint64_t now() const { return now_us; }
+    unsigned long cycles() const { return cyc_count; }
+
+    // -------- カーネルサービスコールの実体 --------
+    ER actTsk(ID id);
+    ER terTsk(ID id);
+    ER slpTsk();
+    ER tslpTsk(TMO tmout);
+    ER wupTsk(ID id);
+    ER staCyc(ID id);
+    ER stpCyc(ID id);
+
+    static thread_local HostKernel *current; // ev3api/kernel スタンドインの接続先(スレッドごと)
+
+private:
+    enum State
+    {
+        DORMANT,
+        RUNNING,
+        SLEEP,       /* slp_tsk */
+        SLEEP_TIMED, /* tslp_tsk */
+        READY,       /* 起床済み,再開待ち */
+        FINISHED,
+    };
+    struct task_ctl
+    {
+        ID id;
+        task_t fn;
+        int priority;
+        bool act;
+        State state;
+        uint64_t wake_at;
+        int wupcnt;
+        bool terminate; /* ter_tsk 要求 */
+        task_ctl *resumer; /* 実行権を渡した側, 休止時にここへ返す */
+        bool started;      /* コンテキスト作成済み */
+        ucontext_t ctx;
+        std::vector<char> stack;
+    };
+    struct terminated_t
+    {
+    }; // ter_tsk されたタスクのスレッドを巻き戻す
+
+    task_ctl *find(ID id);
+    static void taskEntry();
+    void resume(task_ctl *t);  // 呼び出し側からタスクに実行権を渡し,戻るまで待つ
+    void yield(task_ctl *t);   // タスク側から実行権を渡した側に返し,再開まで待つ
+    void advanceTo(uint64_t t);
+    bool allFinished() const;
+
+    static thread_local task_ctl *tls_task; // 実行中のタスク, NULL ならシミュレータ(周期タスク)
+    ucontext_t sim_ctx;                      // シミュレータ(周期タスク)のコンテキスト
+    std::vector<task_ctl *> tasks;
+
+    ID cyc_id, cyc_tskid;
+    task_t cyc_task_fn;
+    RELTIM cyc_period, cyc_phase;
+    int cyc_priority;
+    bool cyc_active;
+    uint64_t cyc_next;
+    unsigned long cyc_count;
+
+    uint64_t now_us;
+    advance_t advance;
+    stop_t cycle_hook;
+};
+
+#endif // EV3_HOST_HOSTKERNEL_H
@@ -0,0 +1,451 @@
+/**
+ * @file LogAnalyzer.h
+ * @brief ホスト(Linux)ツール用 走行ログの解析(周回時間,舵角,DrivingStage,障害物,ジャイロのドリフト)
+ *
+ * @note ログファイルを mmap し,コピーせずに先頭から1回だけ読んで走行の指標を積算する(フレームを溜めない)。
+ *       KHLG 形式(LogDecoder)と MAKE_LOG_RAW の 'Iiiiiii' 形式(28byte 固定長)を読む。
+ *       'Iiiiiii' 形式にないチャンネル(DrivingStage,姿勢など)を使う指標は NaN にする。
+ *       1ファイルの解析は1スレッドで,ファイルごとに並列に解析できる(状態は runmetrics_t と呼び出し側の変数だけ)。
+ *       LogEncoder.h をインクルードするので,インクルードは1つの翻訳単位だけにすること。
+ */
+#ifndef EV3_HOST_LOGANALYZER_H
+#define EV3_HOST_LOGANALYZER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "logging/LogDecoder.h"
+
+#define LA_PERIOD_MS 4         // tracer_task の周期[ms], これより空いたフレームは欠落
+#define LA_RAW_BYTES 28        // MAKE_LOG_RAW の1フレーム('Iiiiiii')
+#define LA_OBSTACLE_CM 13      // 'Iiiiiii' 形式の障害物検知距離[cm], etrobo_env.h の SONAR_ALERT_DISTANCE
+#define LA_LAP_SLACK_DEG 45    // 周回: 累積の回転が 360deg x 周回数 からこれだけ手前まで来ていること(ジャイロのドリフトの分)
+#define LA_LAP_RADIUS_MM 100   // 周回: 走り出した位置にこれより近づいたら1周(SimWorld の周回判定と同じ)
+#define LA_OSC_EMA_SHIFT 6     // 舵角の振動: 64周期(256ms)の移動平均からの符号の変化を数える
+#define LA_OSC_HYST 2          // 舵角の振動: 符号の変化とみなす移動平均からの差
+#define LA_STAGES 5            // DrivingStage ごとの時間の列の数(LA_STAGE_ID)
+#define LA_BIN_MAGIC "KHLA"    // 列形式のバイナリのマジック
+#define LA_BIN_VERSION 1
+
+static const int LA_STAGE_ID[LA_STAGES] = {0, 101, 102, 103, 999};
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   1回の走行(1ファイル)の指標
+ *
+ * @struct  runvalues_t
+ * @note    数値の指標だけを LA_COLUMNS の並びで持つ(列形式の出力のため)。runmetrics_t はパスと形式を足したもの。
+ *          時間は最初のフレームの経過時間(COUNT_time)から,周回は走行モーターが初めて回った周期から数える。
+ *          周回は補正した方位(なければオドメトリの方位,ジャイロ角)の累積の回転が 360deg 近く進んでから,
+ *          姿勢が走り出した位置に戻ったら1周('Iiiiiii' 形式は姿勢がないので,ジャイロ角の累積の回転だけで数える)。
+ */
+struct runvalues_t
+{
+    double bytes;            /* ファイルのバイト数 */
+    double frames;           /* フレーム数 */
+    double gaps;             /* フレームの欠落(経過時間の飛び)の数 */
+    double duration_s;       /* 最初から最後のフレームまでの時間[s] */
+    double laps;             /* 周回数 */
+    double lap_s;            /* 最初の周回の時間[s] */
+    double best_lap_s;       /* 最速の周回の時間[s] */
+    double turn_rms;         /* 走行中(DrivingStage 0)の舵角のRMS */
+    double osc_hz;           /* 走行中の舵角の振動の周波数[Hz] */
+    double stage_s[LA_STAGES]; /* DrivingStage ごとの時間[s] */
+    double other_s;          /* それ以外の DrivingStage の時間[s] */
+    double obstacles;        /* 障害物検知の数(DrivingStage 0 -> 101, 'Iiiiiii' は距離がしきい値に入った数) */
+    double first_obstacle_s; /* 最初の障害物検知の時刻[s] */
+    double gyro_drift_dps;   /* ジャイロ角とオドメトリの方位の差の変化の割合[deg/s] 時計回りが正 */
+    double gyro_bias_dps;    /* HeadingFilter が推定したジャイロのバイアス(最後のフレーム)[deg/s] */
+    double dl_miss;          /* tracer_task の締め切り超過の累計(最後のフレーム) */
+};
+
+struct runmetrics_t : runvalues_t
+{
+    std::string path;
+    int format; /* 0: 読めない, 1: KHLG, 2: 'Iiiiiii' */
+};
+
+/** 列の名前, runvalues_t の並び */
+static const char *const LA_COLUMNS[] = {
+    "bytes", "frames", "gaps", "duration_s", "laps", "lap_s", "best_lap_s", "turn_rms", "osc_hz",
+    "stage0_s", "stage101_s", "stage102_s", "stage103_s", "stage999_s", "other_s",
+    "obstacles", "first_obstacle_s", "gyro_drift_dps", "gyro_bias_dps", "dl_miss"};
+#define LA_NCOLUMNS (int)(sizeof(LA_COLUMNS) / sizeof(LA_COLUMNS[0]))
+static_assert(sizeof(runvalues_t) == LA_NCOLUMNS * sizeof(double), "LA_COLUMNS must match runvalues_t");
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   走行ログの解析 クラス
+ *
+ * @class   LogAnalyzer
+ * @note    analyzeFile で mmap したファイルを,analyze でメモリ上のログを解析する
+ */
+class LogAnalyzer
+{
+public:
+    static bool analyzeFile(const char *path, runmetrics_t *m);          // ファイルを mmap して解析する
+    static void analyze(const uint8_t *p, size_t n, runmetrics_t *m);    // メモリ上のログを解析する
+    static const double *columns(const runvalues_t &m) { return &m.bytes; } // 数値の列(LA_COLUMNS の並び)
+
+    static void writeCsv(FILE *fp, const std::vector<runmetrics_t> &runs);
+    static void writeBinary(FILE *fp, const std::vector<runmetrics_t> &runs);
+    static bool readBinary(const uint8_t *p, size_t n, std::vector<runmetrics_t> *runs);
+
+private:
+    /** チャンネルの列番号, -1 はログにない */
+    struct index_t
+    {
+        int time, turn, distance, gyro, stage, heading, pose_x, pose_y, pose_heading, power, bias, miss;
+    };
+
+    /** 1ファイル分の積算 */
+    struct state_t
+    {
+        bool first;
+        int32_t t0, prev_t, prev_stage, prev_heading, prev_pose, gyro0;
+        bool have_start, near;
+        int32_t t_start, x0, y0; /* 走り出した時刻と位置 */
+        double rot, pose_rot;  /* 累積の回転[deg] */
+        double next_lap;       /* 次の周回の回転[deg] */
+        int32_t t_lap;         /* 前の周回の終わりの時刻 */
+        double turn2;          /* 舵角の2乗の和 */
+        long turn_n;
+        int32_t ema;           /* 舵角の移動平均 x 2^LA_OSC_EMA_SHIFT */
+        int sign;
+        long crossings;
+        double stage_ms[LA_STAGES + 1];
+    };
+
+    static void begin(state_t *s, runmetrics_t *m);
+    static void frame(const index_t &ix, const int32_t *v, state_t *s, runmetrics_t *m);
+    static void finish(const index_t &ix, const int32_t *v, state_t *s, runmetrics_t *m);
+};
+
+/**
+ * @brief ファイルを mmap して解析する
+ * @return false: 開けない(m->format は 0)
+ */
+bool LogAnalyzer::analyzeFile(const char *path, runmetrics_t *m)
+{
+    *m = runmetrics_t();
+    m->path = path;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+    analyze((const uint8_t *)map, (size_t)st.st_size, m);
+    m->path = path;
+    munmap(map, (size_t)st.st_size);
+    return true;
+}
+
+/**
+ * @brief メモリ上のログを解析する
+ * @note  KHLG は LogDecoder で1フレームずつ,'Iiiiiii' はその場で読む。途中で切れたフレームは捨てる
+ */
+void LogAnalyzer::analyze(const uint8_t *p, size_t n, runmetrics_t *m)
+{
+    const std::string path = m->path;
+    *m = runmetrics_t();
+    m->path = path;
+    m->bytes = (double)n;
+    state_t s;
+    begin(&s, m);
+    index_t ix;
+    if (LogDecoder::isEncoded(p, n))
+    {
+        m->format = 1;
+        LogDecoder dec;
+        const uint8_t *end = p + n;
+        bool schema = false;
+        while (dec.next(p, end))
+        {
+            if (!schema) // 最初のフレームの前にスキーマが来る
+            {
+                ix.time = dec.channelIndex("COUNT_time");
+                ix.turn = dec.channelIndex("turn");
+                ix.distance = dec.channelIndex("distance");
+                ix.gyro = dec.channelIndex("gyro_deg");
+                ix.stage = dec.channelIndex("stage");
+                ix.heading = dec.channelIndex("fuse.heading");
+                ix.pose_x = dec.channelIndex("pose.x");
+                ix.pose_y = dec.channelIndex("pose.y");
+                ix.pose_heading = dec.channelIndex("pose.heading");
+                ix.power = dec.channelIndex("power");
+                ix.bias = dec.channelIndex("fuse.bias");
+                ix.miss = dec.channelIndex("dl.miss");
+                schema = true;
+                if (ix.time < 0)
+                    break;
+            }
+            frame(ix, dec.values(), &s, m);
+        }
+        if (m->frames > 0)
+            finish(ix, dec.values(), &s, m);
+    }
+    else
+    {
+        m->format = 2;
+        const index_t raw = {0, 2, 5, 6, -1, -1, -1, -1, -1, -1, -1, -1};
+        int32_t v[LA_RAW_BYTES / 4];
+        for (size_t off = 0; off + LA_RAW_BYTES <= n; off += LA_RAW_BYTES)
+        {
+            memcpy(v, p + off, LA_RAW_BYTES); // 境界合わせのため(コンパイラがロードにする)
+            frame(raw, v, &s, m);
+        }
+        if (m->frames > 0)
+            finish(raw, v, &s, m);
+    }
+}
+
+void LogAnalyzer::begin(state_t *s, runmetrics_t *m)
+{
+    memset(s, 0, sizeof(*s));
+    s->first = true;
+    s->next_lap = 360.0;
+    m->lap_s = m->best_lap_s = m->first_obstacle_s = NAN;
+}
+
+/**
+ * @brief 1フレーム分を積算する
+ */
+void LogAnalyzer::frame(const index_t &ix, const int32_t *v, state_t *s, runmetrics_t *m)
+{
+    const int32_t t = v[ix.time];
+    const int stage = (ix.stage >= 0) ? v[ix.stage] : 0;
+    const int32_t heading = (ix.heading >= 0) ? v[ix.heading] : (ix.pose_heading >= 0) ? v[ix.pose_heading] : -v[ix.gyro];
+    m->frames++;
+    if (s->first)
+    {
+        s->first = false;
+        s->t0 = s->prev_t = t;
+        s->prev_stage = stage;
+        s->prev_heading = heading;
+        s->prev_pose = (ix.pose_heading >= 0) ? v[ix.pose_heading] : 0;
+        s->gyro0 = v[ix.gyro];
+    }
+    else
+    {
+        // -------- 時間: 前のフレームの DrivingStage に足す --------
+        const int32_t dt = t - s->prev_t;
+        if (dt > LA_PERIOD_MS)
+            m->gaps++;
+        int k = 0;
+        while (k < LA_STAGES && LA_STAGE_ID[k] != s->prev_stage)
+            k++;
+        s->stage_ms[k] += dt;
+        s->prev_t = t;
+
+        // -------- 累積の回転(-180 to 179 の折り返しを戻す) --------
+        int32_t d = heading - s->prev_heading;
+        if (ix.heading >= 0 || ix.pose_heading >= 0)
+            d = ((d + 540) % 360 + 360) % 360 - 180;
+        s->rot += d;
+        s->prev_heading = heading;
+        if (ix.pose_heading >= 0)
+        {
+            int32_t dp = v[ix.pose_heading] - s->prev_pose;
+            s->pose_rot += ((dp + 540) % 360 + 360) % 360 - 180;
+            s->prev_pose = v[ix.pose_heading];
+        }
+    }
+
+    // -------- 周回: 走り出してから累積の回転が 360deg 近く進み,走り出した位置に戻るごと --------
+    // 姿勢と補正した方位は 100ms ごとの値(RATE_LOG_POSE)なので,周回の終わりは最大 100ms 遅れる
+    const bool pose = (ix.pose_x >= 0 && ix.pose_y >= 0);
+    if (!s->have_start && (ix.power < 0 || v[ix.power] != 0))
+    {
+        s->have_start = true;
+        s->t_start = s->t_lap = t;
+        s->x0 = pose ? v[ix.pose_x] : 0;
+        s->y0 = pose ? v[ix.pose_y] : 0;
+        s->rot = 0;
+    }
+    if (s->have_start && std::fabs(s->rot) >= s->next_lap - LA_LAP_SLACK_DEG &&
+        (!pose || std::hypot((double)(v[ix.pose_x] - s->x0), (double)(v[ix.pose_y] - s->y0)) < LA_LAP_RADIUS_MM))
+    {
+        const double lap = (t - s->t_lap) * 1e-3;
+        if (m->laps == 0)
+            m->lap_s = lap;
+        if (!(lap >= m->best_lap_s))
+            m->best_lap_s = lap;
+        m->laps++;
+        s->next_lap += 360.0;
+        s->t_lap = t;
+    }
+
+    // -------- 舵角: 走行中の RMS と移動平均からの符号の変化 --------
+    if (stage == 0)
+    {
+        const int32_t turn = v[ix.turn];
+        s->turn2 += (double)turn * turn;
+        s->turn_n++;
+        s->ema += turn - (s->ema >> LA_OSC_EMA_SHIFT);
+        const int32_t diff = turn - (s->ema >> LA_OSC_EMA_SHIFT);
+        const int sign = (diff > LA_OSC_HYST) ? 1 : (diff < -LA_OSC_HYST) ? -1 : 0;
+        if (sign != 0 && sign != s->sign)
+        {
+            if (s->sign != 0)
+                s->crossings++;
+            s->sign = sign;
+        }
+    }
+
+    // -------- 障害物検知 --------
+    bool detect;
+    if (ix.stage >= 0)
+        detect = (s->prev_stage == 0 && stage == 101);
+    else
+    {
+        const bool near = (v[ix.distance] >= 0 && v[ix.distance] <= LA_OBSTACLE_CM);
+        detect = near && !s->near;
+        s->near = near;
+    }
+    if (detect)
+    {
+        if (m->obstacles == 0)
+            m->first_obstacle_s = (t - s->t0) * 1e-3;
+        m->obstacles++;
+    }
+    s->prev_stage = stage;
+}
+
+/**
+ * @brief 最後のフレームで指標をまとめる
+ */
+void LogAnalyzer::finish(const index_t &ix, const int32_t *v, state_t *s, runmetrics_t *m)
+{
+    m->duration_s = (s->prev_t - s->t0) * 1e-3;
+    for (int k = 0; k < LA_STAGES; k++)
+        m->stage_s[k] = (ix.stage >= 0) ? s->stage_ms[k] * 1e-3 : NAN;
+    m->other_s = (ix.stage >= 0) ? s->stage_ms[LA_STAGES] * 1e-3 : NAN;
+    m->turn_rms = (s->turn_n > 0) ? std::sqrt(s->turn2 / s->turn_n) : NAN;
+    m->osc_hz = (s->turn_n > 0) ? s->crossings / 2.0 / (s->turn_n * LA_PERIOD_MS * 1e-3) : NAN;
+    // ジャイロ角は時計回り,オドメトリの方位は左回りが正なので,足したものがジャイロの誤差
+    m->gyro_drift_dps = (ix.pose_heading >= 0 && m->duration_s > 0)
+                            ? ((v[ix.gyro] - s->gyro0) + s->pose_rot) / m->duration_s
+                            : NAN;
+    m->gyro_bias_dps = (ix.bias >= 0) ? v[ix.bias] * 1e-3 : NAN;
+    m->dl_miss = (ix.miss >= 0) ? v[ix.miss] : NAN;
+}
+
+/**
+ * @brief CSV で書く(1行1ファイル, 値のない指標は空欄)
+ */
+void LogAnalyzer::writeCsv(FILE *fp, const std::vector<runmetrics_t> &runs)
+{
+    fprintf(fp, "path,format");
+    for (int c = 0; c < LA_NCOLUMNS; c++)
+        fprintf(fp, ",%s", LA_COLUMNS[c]);
+    fprintf(fp, "\n");
+    for (size_t i = 0; i < runs.size(); i++)
+    {
+        fprintf(fp, "%s,%s", runs[i].path.c_str(), runs[i].format == 1 ? "khlg" : runs[i].format == 2 ? "raw" : "");
+        const double *col = columns(runs[i]);
+        for (int c = 0; c < LA_NCOLUMNS; c++)
+        {
+            if (std::isnan(col[c]))
+                fprintf(fp, ",");
+            else
+                fprintf(fp, ",%.6g", col[c]);
+        }
+        fprintf(fp, "\n");
+    }
+}
+
+/**
+ * @brief 列形式のバイナリで書く
+ * @note  "KHLA", version(1byte), 行数(uint32), 列数(uint32),
+ *        { 名前長(1byte), 名前 } x 列数, { 長さ(uint16), パス, 形式(1byte) } x 行数,
+ *        { double x 行数 } x 列数(列ごとに連続, リトルエンディアン, NaN は値なし)
+ */
+void LogAnalyzer::writeBinary(FILE *fp, const std::vector<runmetrics_t> &runs)
+{
+    const uint32_t rows = (uint32_t)runs.size(), cols = LA_NCOLUMNS;
+    const uint8_t ver = LA_BIN_VERSION;
+    fwrite(LA_BIN_MAGIC, 1, 4, fp);
+    fwrite(&ver, 1, 1, fp);
+    fwrite(&rows, 4, 1, fp);
+    fwrite(&cols, 4, 1, fp);
+    for (int c = 0; c < LA_NCOLUMNS; c++)
+    {
+        const uint8_t len = (uint8_t)strlen(LA_COLUMNS[c]);
+        fwrite(&len, 1, 1, fp);
+        fwrite(LA_COLUMNS[c], 1, len, fp);
+    }
+    for (size_t i = 0; i < runs.size(); i++)
+    {
+        const uint16_t len = (uint16_t)std::min(runs[i].path.size(), (size_t)0xffff);
+        const uint8_t format = (uint8_t)runs[i].format;
+        fwrite(&len, 2, 1, fp);
+        fwrite(runs[i].path.data(), 1, len, fp);
+        fwrite(&format, 1, 1, fp);
+    }
+    std::vector<double> column(rows);
+    for (int c = 0; c < LA_NCOLUMNS; c++)
+    {
+        for (size_t i = 0; i < runs.size(); i++)
+            column[i] = columns(runs[i])[c];
+        fwrite(column.data(), sizeof(double), rows, fp);
+    }
+}
+
+/**
+ * @brief 列形式のバイナリを読む
+ * @return false: 壊れているか列が違う
+ */
+bool LogAnalyzer::readBinary(const uint8_t *p, size_t n, std::vector<runmetrics_t> *runs)
+{
+    const uint8_t *end = p + n;
+    uint32_t rows, cols;
+    if (n < 13 || memcmp(p, LA_BIN_MAGIC, 4) != 0 || p[4] != LA_BIN_VERSION)
+        return false;
+    memcpy(&rows, p + 5, 4);
+    memcpy(&cols, p + 9, 4);
+    p += 13;
+    if (cols != (uint32_t)LA_NCOLUMNS)
+        return false;
+    for (int c = 0; c < LA_NCOLUMNS; c++)
+    {
+        if (p >= end || end - p < 1 + *p || strncmp((const char *)p + 1, LA_COLUMNS[c], *p) != 0)
+            return false;
+        p += 1 + *p;
+    }
+    runs->assign(rows, runmetrics_t());
+    for (uint32_t i = 0; i < rows; i++)
+    {
+        uint16_t len;
+        if (end - p < 2)
+            return false;
+        memcpy(&len, p, 2);
+        if (end - p < 3 + len)
+            return false;
+        (*runs)[i].path.assign((const char *)p + 2, len);
+        (*runs)[i].format = p[2 + len];
+        p += 3 + len;
+    }
+    if ((size_t)(end - p) < (size_t)rows * cols * sizeof(double))
+        return false;
+    for (int c = 0; c < LA_NCOLUMNS; c++)
+        for (uint32_t i = 0; i < rows; i++, p += sizeof(double))
+            memcpy((double *)columns((*runs)[i]) + c, p, sizeof(double));
+    return true;
+}
+
+#endif // EV3_HOST_LOGANALYZER_H
@@ -0,0 +1,527 @@
+/**
+ * @file LogCapture.h
+ * @brief ホスト(Linux)ツール用 Bluetooth の出力(シミュレータの __ev3rt_bt_out)の取り込み
+ *
+ * @note 追記されていくファイルを inotify で待って読み,KHLG のストリームをレコードの境目で走行ごとに分けて,
+ *       走行ごとに時刻付きのファイルに書く。走行はストリームヘッダ("KHLG")で始まり,'U' レコード(起動時間,
+ *       app.cpp が最後に書く)で終わる。'U' がないまま次のヘッダが来るか,元のファイルが切り詰められたら
+ *       (シミュレータの再起動)そこで打ち切る。KHLG でないストリーム(MAKE_LOG_RAW)は切り詰めまでを1走行にする。
+ *       書き込みは CAP_WRITE_BYTES ずつまとめ,読み込みが止まったら CAP_FLUSH_MS ごとに書き出す。
+ *       最新のフレームを LogDecoder で復号して,テキストのファイル(ライブビュー)に置き換えで書く。
+ *       LogEncoder.h をインクルードするので,インクルードは1つの翻訳単位だけにすること。
+ */
+#ifndef EV3_HOST_LOGCAPTURE_H
+#define EV3_HOST_LOGCAPTURE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fcntl.h>
+#include <poll.h>
+#include <string>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "logging/LogDecoder.h"
+
+#define CAP_READ_BYTES (1 << 20)  // 1回の読み込みの最大バイト数
+#define CAP_WRITE_BYTES (1 << 20) // これだけ溜まったら書き出す
+#define CAP_FLUSH_MS 200          // 読み込みが止まってからこの間隔で書き出しとライブビューを更新する
+#define CAP_LIVE_FRAMES 8         // ライブビューに出すフレーム数
+#define CAP_RAW_BYTES 28          // MAKE_LOG_RAW の1フレーム('Iiiiiii')
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   取り込みの設定
+ *
+ * @struct  capconfig_t
+ */
+struct capconfig_t
+{
+    std::string dir;    /* 走行ごとのファイルの置き場所 */
+    std::string prefix; /* ファイル名の先頭, 後ろに -YYYYmmdd-HHMMSS-NNN.dat */
+    std::string live;   /* ライブビューのファイル, 空なら書かない */
+    std::string latest; /* 最後に閉じた走行へのシンボリックリンク(logdata_plot.py の log.dat), 空なら作らない */
+    int keep;           /* 残す走行のファイル数, 0 なら全部残す */
+    bool verbose;       /* 走行を閉じるたびに標準エラーに出す */
+};
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   Bluetooth の出力の取り込み クラス
+ *
+ * @class   LogCapture
+ * @note    feed で受けたバイト列をレコードに区切って走行ごとのファイルに書く(tail が元のファイルを読んで呼ぶ)。
+ *          統計(getConsumed など)は別スレッドから読んでよい。
+ */
+class LogCapture
+{
+public:
+    /** 閉じた走行 */
+    struct run_t
+    {
+        std::string path;
+        unsigned long frames;
+        unsigned long bytes;
+        bool complete; /* 'U' レコードで終わった */
+    };
+
+    explicit LogCapture(const capconfig_t &config); // Constructor
+    ~LogCapture();
+
+    void feed(const uint8_t *p, size_t n); // 元のストリームのバイト列
+    void restart();                        // 元のファイルが切り詰められた(走行を打ち切る)
+    void idle();                           // 読み込みが止まった(書き出しとライブビュー)
+    void finish();                         // 走行を打ち切って全部書き出す
+    int tail(const char *path, const std::atomic<bool> &stop, bool once); // 元のファイルを追いかけて読む
+
+    const std::vector<run_t> &runs() const { return closed; } // 閉じた走行(tail と同じスレッドから)
+    uint64_t getConsumed() const { return consumed.load(); } // 元のファイルの読んだバイト数
+    unsigned long getFrames() const { return frames_total.load(); }
+    unsigned long getSkipped() const { return skipped.load(); } // 走行の外のバイト数(区切りを探して捨てた)
+
+private:
+    enum
+    {
+        CAP_IDLE = 0, /* ヘッダ待ち */
+        CAP_KHLG,     /* KHLG の走行 */
+        CAP_RAW       /* MAKE_LOG_RAW の走行 */
+    };
+
+    bool record(const uint8_t *p, size_t n, size_t *len, uint8_t *tag); // 1レコードの長さ
+    void begin(int mode);
+    void end(bool complete);
+    void append(const uint8_t *p, size_t n);
+    void writeOut();
+    void onFrame(const int32_t *v, size_t n);
+    void publish();
+
+    capconfig_t cfg;
+    int state;
+    bool at_start;              // 元のストリームの先頭(KHLG か MAKE_LOG_RAW かを決める)
+    std::vector<uint8_t> pending; // レコードの途中まで
+    std::vector<uint8_t> outbuf;  // 書き出し待ち
+    int fd;                     // 走行のファイル
+    run_t cur;
+    uint32_t nch;               // スキーマのチャンネル数
+    LogDecoder *dec;            // ライブビュー用
+    size_t raw_carry;           // MAKE_LOG_RAW: 前回のフレームの途中のバイト数
+    uint8_t raw_frame[CAP_RAW_BYTES];
+    int seq;                    // ファイル名の通し番号
+    std::vector<run_t> closed;
+    std::deque<std::string> kept;
+    std::vector<std::string> live_names;
+    int32_t live_ring[CAP_LIVE_FRAMES][LOG_MAX_CHANNELS]; // ライブビューの最新のフレーム
+    size_t live_width;          // ライブビューのチャンネル数
+    unsigned long live_count;   // 走行の始めから ring に入れたフレーム数
+    bool live_dirty;
+    std::atomic<uint64_t> consumed;
+    std::atomic<unsigned long> frames_total, skipped;
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+// Constructor
+LogCapture::LogCapture(const capconfig_t &config)
+    : cfg(config), state(CAP_IDLE), at_start(true), fd(-1), cur(), nch(0), dec(NULL), raw_carry(0), seq(0),
+      live_width(0), live_count(0), live_dirty(false), consumed(0), frames_total(0), skipped(0)
+{
+    outbuf.reserve(CAP_WRITE_BYTES + CAP_READ_BYTES);
+}
+
+LogCapture::~LogCapture()
+{
+    finish();
+}
+
+/**
+ * @brief 1レコードの長さ
+ * @param len   (size_t*)レコードのバイト数(タグを含む)
+ * @return true: レコードが全部ある, false: 途中まで(len は 0)か壊れている(len は 1 以上, 読み飛ばす)
+ */
+bool LogCapture::record(const uint8_t *p, size_t n, size_t *len, uint8_t *tag)
+{
+    const uint8_t *q = p + 1;
+    const uint8_t *end = p + n;
+    uint32_t v;
+    *len = 0;
+    *tag = p[0];
+    if (*tag == LOG_TAG_KEY || *tag == LOG_TAG_DELTA)
+    {
+        if (nch == 0)
+        {
+            *len = 1; // スキーマより先のフレーム
+            return false;
+        }
+        uint32_t count = nch;
+        if (*tag == LOG_TAG_DELTA)
+        {
+            if (!LogDecoder::getVarint(q, end, &v))
+                return false;
+            count = __builtin_popcount(v & (nch < 32 ? (1u << nch) - 1 : ~0u));
+        }
+        for (uint32_t i = 0; i < count; i++)
+            if (!LogDecoder::getVarint(q, end, &v))
+                return false;
+    }
+    else
+    {
+        if (!LogDecoder::getVarint(q, end, &v))
+            return false;
+        if ((size_t)(end - q) < v)
+            return false;
+        if (*tag == LOG_TAG_SCHEMA)
+        {
+            const uint8_t *s = q;
+            if (!LogDecoder::getVarint(s, q + v, &nch) || nch > LOG_MAX_CHANNELS)
+            {
+                nch = 0;
+                *len = 1;
+                return false;
+            }
+        }
+        q += v;
+    }
+    *len = (size_t)(q - p);
+    return true;
+}
+
+/**
+ * @brief 元のストリームのバイト列
+ * @note  レコードの途中で切れた分は次の feed まで持つ
+ */
+void LogCapture::feed(const uint8_t *p, size_t n)
+{
+    consumed += n;
+    pending.insert(pending.end(), p, p + n);
+    const uint8_t *b = pending.data();
+    const uint8_t *e = b + pending.size();
+    const uint8_t *q = b;
+
+    while (q < e)
+    {
+        if (state == CAP_RAW)
+        {
+            append(q, (size_t)(e - q)); // 区切りはない, 切り詰められるまで1走行
+            q = e;
+            break;
+        }
+        if (memcmp(q, LOG_MAGIC, std::min(e - q, (ptrdiff_t)4)) == 0) // 新しい走行
+        {
+            if (e - q < 5)
+                break; // ヘッダかどうかまだ分からない
+            if (state == CAP_KHLG)
+                end(false); // 'U' がないまま次の走行が始まった
+            begin(CAP_KHLG);
+            append(q, 5);
+            const uint8_t *h = q;
+            dec->next(h, q + 5); // ヘッダだけ, フレームはない
+            q += 5;
+            continue;
+        }
+        if (state == CAP_IDLE)
+        {
+            if (at_start)
+            {
+                begin(CAP_RAW);
+                continue;
+            }
+            const uint8_t *h = (const uint8_t *)memmem(q, e - q, LOG_MAGIC, 4); // 次のヘッダまで捨てる
+            const uint8_t *to = h ? h : (e - q > 3 ? e - 3 : q);
+            skipped += (unsigned long)(to - q);
+            q = to;
+            if (h == NULL)
+                break;
+            continue;
+        }
+
+        size_t len;
+        uint8_t tag;
+        if (!record(q, (size_t)(e - q), &len, &tag))
+        {
+            if (len == 0)
+                break; // 途中まで
+            end(false); // 壊れている: 次のヘッダを探す
+            skipped += len;
+            q += len;
+            continue;
+        }
+        append(q, len);
+        const uint8_t *r = q;
+        while (dec->next(r, q + len))
+            onFrame(dec->values(), dec->channels().size());
+        q += len;
+        if (tag == LOG_TAG_STARTUP)
+            end(true); // 走行の最後のレコード
+    }
+    pending.erase(pending.begin(), pending.begin() + (q - b));
+    if (outbuf.size() >= CAP_WRITE_BYTES)
+        writeOut();
+}
+
+/**
+ * @brief 元のファイルが切り詰められた
+ */
+void LogCapture::restart()
+{
+    if (state != CAP_IDLE)
+        end(false);
+    skipped += (unsigned long)pending.size();
+    pending.clear();
+    at_start = true;
+}
+
+/**
+ * @brief 読み込みが止まった
+ */
+void LogCapture::idle()
+{
+    writeOut();
+    publish();
+}
+
+/**
+ * @brief 走行を打ち切って全部書き出す
+ */
+void LogCapture::finish()
+{
+    if (state != CAP_IDLE)
+        end(false);
+    publish();
+}
+
+/** 走行を始める(時刻付きのファイルを作る) */
+void LogCapture::begin(int mode)
+{
+    char stamp[32];
+    const time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+    char name[64];
+    snprintf(name, sizeof(name), "-%s-%03d.dat", stamp, ++seq);
+    cur = run_t();
+    cur.path = cfg.dir + "/" + cfg.prefix + name;
+    fd = open(cur.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        perror(cur.path.c_str());
+    state = mode;
+    at_start = false;
+    nch = 0;
+    raw_carry = 0;
+    delete dec;
+    dec = new LogDecoder();
+    live_count = 0;
+    live_names.clear();
+    if (mode == CAP_RAW)
+    {
+        static const char *const RAW_NAMES[CAP_RAW_BYTES / 4] = {"COUNT_time", "drivinstage", "turn", "omega",
+                                                                 "hsv.val", "distance", "gyro_deg"};
+        live_names.assign(RAW_NAMES, RAW_NAMES + CAP_RAW_BYTES / 4);
+    }
+}
+
+/** 走行を閉じる */
+void LogCapture::end(bool complete)
+{
+    writeOut();
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+    cur.complete = complete;
+    closed.push_back(cur);
+    state = CAP_IDLE;
+    if (cfg.verbose)
+        fprintf(stderr, "btcapture: %s %lu frames %lu bytes%s\n", cur.path.c_str(), cur.frames, cur.bytes,
+                complete ? "" : " (incomplete)");
+    if (!cfg.latest.empty()) // 置き換えでリンクを張り直す
+    {
+        char abs[4096];
+        const std::string target = realpath(cur.path.c_str(), abs) ? std::string(abs) : cur.path;
+        const std::string tmp = cfg.latest + ".tmp";
+        unlink(tmp.c_str());
+        if (symlink(target.c_str(), tmp.c_str()) != 0 || rename(tmp.c_str(), cfg.latest.c_str()) != 0)
+            perror(cfg.latest.c_str());
+    }
+    kept.push_back(cur.path);
+    while (cfg.keep > 0 && (int)kept.size() > cfg.keep)
+    {
+        unlink(kept.front().c_str());
+        kept.pop_front();
+    }
+    live_dirty = true;
+    publish();
+}
+
+/** 走行のファイルに足す(CAP_WRITE_BYTES ずつまとめて書く) */
+void LogCapture::append(const uint8_t *p, size_t n)
+{
+    outbuf.insert(outbuf.end(), p, p + n);
+    cur.bytes += (unsigned long)n;
+    if (state != CAP_RAW)
+        return;
+    while (n > 0) // MAKE_LOG_RAW: 28byte ごとのフレーム
+    {
+        const size_t k = std::min(n, (size_t)CAP_RAW_BYTES - raw_carry);
+        memcpy(raw_frame + raw_carry, p, k);
+        raw_carry += k;
+        p += k;
+        n -= k;
+        if (raw_carry == CAP_RAW_BYTES)
+        {
+            int32_t v[CAP_RAW_BYTES / 4];
+            memcpy(v, raw_frame, CAP_RAW_BYTES);
+            onFrame(v, CAP_RAW_BYTES / 4);
+            raw_carry = 0;
+        }
+    }
+}
+
+void LogCapture::writeOut()
+{
+    size_t off = 0;
+    while (fd >= 0 && off < outbuf.size())
+    {
+        const ssize_t w = write(fd, outbuf.data() + off, outbuf.size() - off);
+        if (w <= 0)
+        {
+            perror(cur.path.c_str());
+            break;
+        }
+        off += (size_t)w;
+    }
+    outbuf.clear();
+}
+
+/** 復号したフレーム(ライブビューの最新 CAP_LIVE_FRAMES 件を残す) */
+void LogCapture::onFrame(const int32_t *v, size_t n)
+{
+    cur.frames++;
+    frames_total++;
+    if (cfg.live.empty())
+        return;
+    if (live_names.size() != n && state == CAP_KHLG)
+    {
+        live_names.clear();
+        for (size_t i = 0; i < dec->channels().size(); i++)
+            live_names.push_back(dec->channels()[i].name);
+    }
+    live_width = std::min(n, (size_t)LOG_MAX_CHANNELS);
+    memcpy(live_ring[live_count % CAP_LIVE_FRAMES], v, live_width * sizeof(int32_t));
+    live_count++;
+    live_dirty = true;
+}
+
+/**
+ * @brief ライブビューを書く
+ * @note  1行目に走行のファイルとフレーム数,2行目にチャンネル名,続いて最新のフレーム(タブ区切り)。
+ *        一時ファイルに書いてから置き換えるので,読む側は途中まで書いたものを見ない
+ */
+void LogCapture::publish()
+{
+    if (cfg.live.empty() || !live_dirty)
+        return;
+    const std::string tmp = cfg.live + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "w");
+    if (fp == NULL)
+        return;
+    const run_t &r = (state != CAP_IDLE || closed.empty()) ? cur : closed.back();
+    fprintf(fp, "run %s frames %lu%s\n", r.path.c_str(), r.frames,
+            state != CAP_IDLE ? " (running)" : r.complete ? " (complete)" : " (incomplete)");
+    for (size_t i = 0; i < live_names.size(); i++)
+        fprintf(fp, "%s%s", i ? "\t" : "", live_names[i].c_str());
+    fprintf(fp, "\n");
+    for (unsigned long k = (live_count > CAP_LIVE_FRAMES) ? live_count - CAP_LIVE_FRAMES : 0; k < live_count; k++)
+    {
+        for (size_t i = 0; i < live_width; i++)
+            fprintf(fp, "%s%d", i ? "\t" : "", live_ring[k % CAP_LIVE_FRAMES][i]);
+        fprintf(fp, "\n");
+    }
+    fclose(fp);
+    rename(tmp.c_str(), cfg.live.c_str());
+    live_dirty = false;
+}
+
+/**
+ * @brief 元のファイルを追いかけて読む
+ * @param path  元のファイル(なければできるまで待つ)
+ * @param stop  true になったら残りを読んで戻る
+ * @param once  今ある分だけ読んで戻る(btcat2 と同じ使い方)
+ * @return 0: 正常, 1: inotify が使えない
+ * @note  元のファイルのあるディレクトリを inotify で見て,変化があるたびに読めるだけ読む。
+ *        元のファイルが短くなったか作り直されたら先頭から読み直す(走行を打ち切る)
+ */
+int LogCapture::tail(const char *path, const std::atomic<bool> &stop, bool once)
+{
+    int ino = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    std::string dir = path;
+    const size_t slash = dir.rfind('/');
+    dir = (slash == std::string::npos) ? "." : dir.substr(0, slash + 1);
+    if (ino < 0 || inotify_add_watch(ino, dir.c_str(), IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                                                           IN_MOVED_TO | IN_MOVED_FROM) < 0)
+    {
+        perror("inotify");
+        if (ino >= 0)
+            close(ino);
+        return 1;
+    }
+
+    std::vector<uint8_t> buf(CAP_READ_BYTES);
+    int src = -1;
+    ino_t inode = 0;
+    uint64_t offset = 0;
+    bool quit = false;
+    auto last_idle = std::chrono::steady_clock::now();
+    while (!quit)
+    {
+        quit = once || stop.load();
+        // -------- 読めるだけ読む --------
+        struct stat st;
+        if (stat(path, &st) == 0 && (src < 0 || st.st_ino != inode || (uint64_t)st.st_size < offset))
+        {
+            if (src >= 0) // 作り直されたか切り詰められた
+            {
+                close(src);
+                restart();
+            }
+            src = open(path, O_RDONLY);
+            inode = st.st_ino;
+            offset = 0;
+        }
+        bool got = false;
+        ssize_t n;
+        while (src >= 0 && (n = pread(src, buf.data(), buf.size(), (off_t)offset)) > 0)
+        {
+            feed(buf.data(), (size_t)n);
+            offset += (uint64_t)n;
+            got = true;
+        }
+        if (quit)
+            break;
+        // -------- 変化を待つ --------
+        struct pollfd pfd = {ino, POLLIN, 0};
+        if (poll(&pfd, 1, got ? 0 : CAP_FLUSH_MS) > 0)
+        {
+            char ev[4096];
+            while (read(ino, ev, sizeof(ev)) > 0) // 中身は見ない(毎回 stat で確かめる)
+                ;
+        }
+        const auto now = std::chrono::steady_clock::now(); // 書き続けられていても CAP_FLUSH_MS ごとに書き出す
+        if (now - last_idle >= std::chrono::milliseconds(CAP_FLUSH_MS))
+        {
+            idle();
+            last_idle = now;
+        }
+    }
+    if (src >= 0)
+        close(src);
+    close(ino);
+    finish();
+    return 0;
+}
+
+#endif // EV3_HOST_LOGCAPTURE_H
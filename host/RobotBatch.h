@@ -0,0 +1,192 @@
+/**
+ * @file RobotBatch.h
+ * @brief ホスト(Linux)ビルド用 多数のロボット(RobotT<SimRobotIo>)をまとめて進めるバッチ
+ *
+ * @note ロボットごとに SimWorld と RobotT(TracerCore と前回の入力値)を持ち,CourseImage だけを読み出しのみで共有する。
+ *       BATCH_EPOCH_CYCLES 周期ずつ,ロボットを block 台ずつのタスクに分けてスレッドプールで進める
+ *       (タスクの中では周期ごとに block 台を順に1周期ずつ進めるので,インスタンスが状態を共有していれば結果が変わる)。
+ *       ロボットごとの違い(ジャイロのバイアス,センサの感度,モーターの時定数,前進速度)は seed と番号から決める。
+ *       SimLoop.h と同じくヘッダのみで実装するので,インクルードは1つの翻訳単位だけにすること。
+ */
+#ifndef EV3_HOST_ROBOTBATCH_H
+#define EV3_HOST_ROBOTBATCH_H
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "SimLoop.h"
+#include "WorkStealingPool.h"
+
+#define BATCH_EPOCH_CYCLES 250 // 1回のスレッドプールの実行で進める周期数(1秒)
+#define BATCH_BLOCK 16          // 1タスクのロボット数の既定値
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   バッチの集計
+ *
+ * @struct  batchstat_t
+ */
+typedef struct
+{
+    long cycles;     /* 全ロボットの周期数の和 */
+    int finished;    /* 所定の周回数を走りきったか走行を終えたロボット */
+    int laps;        /* 全ロボットの周回数の和 */
+    double wall_s;   /* 実時間[s] */
+} batchstat_t;
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   多数のロボットのバッチ
+ *
+ * @class   RobotBatch
+ * @note    コースの距離場(CourseImage::buildLineDistance)は作ってから渡すこと
+ */
+class RobotBatch
+{
+public:
+    RobotBatch(const CourseImage &course, int robots, unsigned int seed, int laps);
+    ~RobotBatch();
+
+    void setHash(bool on) { hashing = on; } // ロボットごとにログフレームのハッシュを取る(既定 false)
+    batchstat_t run(WorkStealingPool &pool, double time_s, int block = BATCH_BLOCK); // time_s まで進める(1回だけ)
+
+    int size() const { return (int)units.size(); }
+    uint64_t getHash(int i) const { return units[i]->hash; }  // ログフレームの FNV-1a
+    long getCycles(int i) const { return units[i]->cycles; }
+    int getLaps(int i) const { return units[i]->world.laps; }
+
+    static void variant(unsigned int seed, int i, simconfig_t *cfg, tracergains_t *gains); // ロボットごとの違い
+
+private:
+    /** 1台分 */
+    struct unit_t
+    {
+        SimWorld world;
+        RobotT<SimRobotIo> robot;
+        uint64_t hash;
+        long cycles;
+        bool done;
+
+        unit_t(const CourseImage &course, const simconfig_t &cfg)
+            : world(course, cfg), robot(world), hash(14695981039346656037ull), cycles(0), done(false)
+        {
+        }
+    };
+
+    void stepBlock(int first, int last, long to_cycle);
+
+    std::vector<unit_t *> units;
+    int laps;
+    bool hashing;
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+RobotBatch::RobotBatch(const CourseImage &course, int robots, unsigned int seed, int laps)
+    : laps(laps), hashing(false)
+{
+    units.reserve(robots);
+    for (int i = 0; i < robots; i++)
+    {
+        simconfig_t cfg;
+        tracergains_t gains;
+        variant(seed, i, &cfg, &gains);
+        unit_t *u = new unit_t(course, cfg);
+        u->robot.core.setGains(&gains);
+        units.push_back(u);
+    }
+}
+
+RobotBatch::~RobotBatch()
+{
+    for (size_t i = 0; i < units.size(); i++)
+        delete units[i];
+}
+
+/**
+ * @brief ロボットごとの違い
+ * @note  seed と番号 i だけで決まる(スレッドの数や順序によらない)
+ */
+void RobotBatch::variant(unsigned int seed, int i, simconfig_t *cfg, tracergains_t *gains)
+{
+    std::mt19937 rng(seed * 1000003u + (unsigned int)i);
+    std::uniform_real_distribution<double> u(-1.0, 1.0);
+    *cfg = SIM_DEFAULT_CONFIG;
+    cfg->gyro_bias_dps = u(rng);
+    cfg->raw_gain *= 1.0 + 0.05 * u(rng);
+    cfg->motor_tau_s *= 1.0 + 0.2 * u(rng);
+    *gains = TRACER_DEFAULT_GAINS;
+    gains->power += (int)std::lround(5.0 * u(rng));
+}
+
+/**
+ * @brief first..last-1 のロボットを to_cycle まで進める
+ * @note  周期ごとに block 内のロボットを順に1周期ずつ進める
+ */
+void RobotBatch::stepBlock(int first, int last, long to_cycle)
+{
+    cycleoutput_t out;
+    logframe_t frame;
+    bool active = true;
+    while (active)
+    {
+        active = false;
+        for (int i = first; i < last; i++)
+        {
+            unit_t *u = units[i];
+            if (u->done || u->cycles >= to_cycle)
+                continue;
+            u->world.advanceTo(SIM_CYCLE_PHASE_US + (uint64_t)u->cycles * SIM_CYCLE_US);
+            if (u->world.laps >= laps)
+            {
+                u->done = true;
+                continue;
+            }
+            u->robot.cycle(&out, &frame);
+            u->cycles++;
+            if (hashing)
+            {
+                const uint8_t *p = (const uint8_t *)&frame;
+                uint64_t h = u->hash;
+                for (size_t k = 0; k < sizeof(frame); k++)
+                    h = (h ^ p[k]) * 1099511628211ull;
+                u->hash = h;
+            }
+            if (out.wakeup_main)
+                u->done = true;
+            active = true;
+        }
+    }
+}
+
+/**
+ * @brief 全ロボットを time_s まで(周回を終えたロボットはそこまで)進める
+ * @param pool   スレッドプール
+ * @param time_s 走行時間[s]
+ * @param block  1タスクのロボット数
+ */
+batchstat_t RobotBatch::run(WorkStealingPool &pool, double time_s, int block)
+{
+    batchstat_t st = batchstat_t();
+    const long cycles = (long)(time_s * 1e6 / SIM_CYCLE_US);
+    const int n = size();
+    if (block < 1)
+        block = 1;
+    const int tasks = (n + block - 1) / block;
+    auto t0 = std::chrono::steady_clock::now();
+    for (long to = 0; to < cycles;)
+    {
+        to = std::min(cycles, to + BATCH_EPOCH_CYCLES);
+        pool.run(tasks, [&](int t) { stepBlock(t * block, std::min(n, (t + 1) * block), to); });
+    }
+    st.wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    for (int i = 0; i < n; i++)
+    {
+        st.cycles += units[i]->cycles;
+        st.laps += units[i]->world.laps;
+        st.finished += units[i]->done ? 1 : 0;
+    }
+    return st;
+}
+
+#endif // EV3_HOST_ROBOTBATCH_H
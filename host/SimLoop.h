@@ -0,0 +1,256 @@
+/**
+ * @file SimLoop.h
+ * @brief ホスト(Linux)ビルド用 TracerCore と SimWorld の直結ループ
+ *
+ * @note カーネル(HostKernel)も ev3api も通さず,4ms周期で
+ *       SimWorld から入力値を作る -> TracerCore::step -> 出力を SimWorld に反映 を繰り返す。
+ *       状態は SimLoop::run の中だけに持つので,スレッドごとに並列に評価できる
+ *       (CourseImage は読み出しのみで共有する)。
+ *       TracerCore.h と同じくヘッダのみで実装するので,インクルードは1つの翻訳単位だけにすること。
+ */
+#ifndef EV3_HOST_SIMLOOP_H
+#define EV3_HOST_SIMLOOP_H
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "SimWorld.h"
+#include "control/RobotT.h"
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   1回の走行の評価結果
+ *
+ * @struct  simresult_t
+ */
+typedef struct
+{
+    bool completed;    /* 所定の周回数を走りきった */
+    bool lost;         /* ラインを見失った(センサがラインから SIM_LOST_MM 以上離れた) */
+    int laps;          /* 完了した周回数 */
+    double time_s;     /* 終了までの時間[s],完走ならゴールの時刻 */
+    double last_lap_s; /* 最後の周回タイム[s] */
+    double progress;   /* 所定の距離に対する走行距離の割合 */
+    double cte_rms_mm; /* センサ位置のラインからの距離のRMS[mm] */
+    double cte_max_mm; /* センサ位置のラインからの距離の最大[mm] */
+    int excursions;    /* センサがラインから SIM_EXCURSION_MM 以上離れた回数 */
+    double osc;        /* 舵角の周期ごとの変化量の平均(振動の目安) */
+    long cycles;       /* tracer_task 相当の周期数 */
+} simresult_t;
+
+#define SIM_CYCLE_US 4000      // tracer_task の周期[us], app.cfg と同じ
+#define SIM_CYCLE_PHASE_US 1000 // 最初の起動[us]
+#define SIM_LOST_MM 150.0      // これ以上ラインから離れたら走行失敗
+#define SIM_EXCURSION_MM 8.0   // これ以上ラインから離れたらラインを外れたと数える(センサの視野が全部白)
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   SimWorld に直接出すモーター出力(MotorRunnerT のドライバポリシー)
+ *
+ * @struct  SimMotorDriver
+ * @note    ev3api(グローバルな host_world)を通さないので,ロボットごとの SimWorld に出せる
+ */
+struct SimMotorDriver
+{
+    SimWorld *world;
+
+    SimMotorDriver(SimWorld *world = NULL) : world(world) {}
+
+    void config(motor_port_t port) { (void)port; }
+    void setPower(motor_port_t port, int power) { world->setPower(port, power); }
+    void stop(motor_port_t port, bool brake) { world->stopMotor(port, brake); }
+    void steer(motor_port_t left, motor_port_t right, int power, int turn) { world->steer(left, right, power, turn); }
+    void resetCounts(motor_port_t port) { world->resetCounts(port); }
+};
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   SimWorld の入出力ポリシー(RobotT<SimRobotIo>)
+ *
+ * @class   SimRobotIo
+ * @note    ev3api を通さずに SimWorld を直接読み書きする。SimWorld は1台ごとに作ること。
+ *          出力は実機と同じ MotorOutputT(MotorRunner, MAKE_MOTOR_SPEED_LOOP, 前回と同じ指令を省く)を通す
+ */
+class SimRobotIo : public MotorOutputT<SimMotorDriver>
+{
+public:
+    SimWorld &world;
+
+    explicit SimRobotIo(SimWorld &world)
+        : MotorOutputT<SimMotorDriver>((motor_port_t)world.left_port, (motor_port_t)world.right_port, EV3_PORT_A,
+                                       SimMotorDriver(&world)),
+          world(world)
+    {
+    }
+
+    void read(uint32_t due, cycleinput_t *in); // SimLoop::readInputs
+};
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   TracerCore と SimWorld の直結ループ
+ *
+ * @class   SimLoop
+ * @note    コースの距離場(CourseImage::buildLineDistance)は作ってから渡すこと
+ */
+class SimLoop
+{
+public:
+    SimLoop(const CourseImage &course, const simconfig_t &config = SIM_DEFAULT_CONFIG);
+
+    void setSpeedProfile(const speedprofile_t &profile); // 前進速度の加減速の調整値(既定 SPEED_DEFAULT_PROFILE)
+    void setCalibration(const linecalib_t &calib);       // ラインのしきい値(既定 LINE_DEFAULT_CALIB)
+    void setSensorFilter(const sensorfilter_t &filter);  // センサ値のフィルタ(既定 SENSOR_DEFAULT_FILTER)
+
+    simresult_t run(const tracergains_t *gains, int laps, double time_limit_s,
+                    const std::vector<uint8_t> *map_in = NULL, std::vector<uint8_t> *map_out = NULL) const;
+
+    static void readInputs(const SimWorld &world, uint32_t due, cycleinput_t *in); // SimWorld から入力値を作る
+
+private:
+    const CourseImage &course;
+    simconfig_t cfg;
+    speedprofile_t speed;
+    linecalib_t calib;
+    sensorfilter_t filter;
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+SimLoop::SimLoop(const CourseImage &course, const simconfig_t &config)
+    : course(course), cfg(config), speed(SPEED_DEFAULT_PROFILE), calib(LINE_DEFAULT_CALIB), filter(SENSOR_DEFAULT_FILTER)
+{
+}
+
+/**
+ * @brief 前進速度の加減速の調整値(TracerCore::setSpeedProfile)
+ */
+void SimLoop::setSpeedProfile(const speedprofile_t &profile)
+{
+    speed = profile;
+}
+
+/**
+ * @brief ラインのしきい値(TracerCore::setCalibration)
+ */
+void SimLoop::setCalibration(const linecalib_t &calib)
+{
+    this->calib = calib;
+}
+
+/**
+ * @brief センサ値のフィルタ(TracerCore::setSensorFilter)
+ */
+void SimLoop::setSensorFilter(const sensorfilter_t &filter)
+{
+    this->filter = filter;
+}
+
+/**
+ * @brief SimWorld から入力値を作る(Ev3RobotIo::read と同じ値)
+ * @note  レートグループ due に入っていない値は前回のまま
+ */
+void SimLoop::readInputs(const SimWorld &world, uint32_t due, cycleinput_t *in)
+{
+    if (due & RATE_BIT(RATE_IN_COLOR))
+        world.colorRaw(&in->rgb);
+    if (due & RATE_BIT(RATE_IN_WHEEL))
+    {
+        in->left_count = world.getCounts(world.left_port);
+        in->right_count = world.getCounts(world.right_port);
+    }
+    if (due & RATE_BIT(RATE_IN_ARM))
+        in->arm_count = world.getCounts(EV3_PORT_A);
+    if (due & RATE_BIT(RATE_IN_GYRO))
+        in->gyro_angle = world.gyroAngle();
+    if (due & RATE_BIT(RATE_IN_SONAR))
+        in->sonar = world.sonarDistance();
+    if (due & RATE_BIT(RATE_IN_BUTTON))
+        in->back_button = world.back_button;
+}
+
+/**
+ * @brief SimWorld から入力値を作る
+ */
+inline void SimRobotIo::read(uint32_t due, cycleinput_t *in)
+{
+    SimLoop::readInputs(world, due, in);
+}
+
+/**
+ * @brief 1回走らせて評価する
+ *
+ * @param gains         PIDゲインと前進速度
+ * @param laps          走る周回数
+ * @param time_limit_s  打ち切り時間[s]
+ * @param map_in        前回の走行のコースマップ(TracerCore::loadCourseMap), NULL なら速度計画なし
+ * @param map_out       今回の走行のコースマップの書き出し先(TracerCore::saveCourseMap), NULL なら書き出さない
+ * @note  ラインを見失うか,走行終了(DrivingStage 999 など)で打ち切る
+ */
+simresult_t SimLoop::run(const tracergains_t *gains, int laps, double time_limit_s,
+                         const std::vector<uint8_t> *map_in, std::vector<uint8_t> *map_out) const
+{
+    SimWorld world(course, cfg);
+    RobotT<SimRobotIo> robot(world);
+    TracerCore &core = robot.core;
+    cycleoutput_t out;
+    logframe_t frame;
+    simresult_t res = simresult_t();
+    const uint64_t limit_us = (uint64_t)(time_limit_s * 1e6);
+    double cte2 = 0, osc = 0;
+    int prev_turn = 0;
+    bool off_line = false;
+
+    core.setGains(gains);
+    core.setSpeedProfile(&speed);
+    core.setCalibration(&calib);
+    core.setSensorFilter(&filter);
+    if (map_in != NULL)
+        core.loadCourseMap(map_in->data(), (int)map_in->size());
+    for (uint64_t t = SIM_CYCLE_PHASE_US; t <= limit_us; t += SIM_CYCLE_US)
+    {
+        world.advanceTo(t);
+        if (world.laps >= laps)
+        {
+            res.completed = true;
+            break;
+        }
+
+        robot.cycle(&out, &frame);
+        res.cycles++;
+
+        double sx, sy;
+        world.sensorPosition(&sx, &sy);
+        double d = course.lineDistance(sx, sy);
+        cte2 += d * d;
+        res.cte_max_mm = std::max(res.cte_max_mm, d);
+        if (d > SIM_EXCURSION_MM && !off_line)
+            res.excursions++;
+        off_line = (d > SIM_EXCURSION_MM);
+        osc += std::abs(frame.turn - prev_turn);
+        prev_turn = frame.turn;
+        if (d > SIM_LOST_MM)
+        {
+            res.lost = true;
+            break;
+        }
+        if (out.wakeup_main)
+            break;
+    }
+
+    res.laps = world.laps;
+    res.time_s = res.completed ? (world.lap_start_us * 1e-6) : (world.now_us * 1e-6);
+    res.last_lap_s = world.last_lap_us * 1e-6;
+    double goal = laps * course.lap_length_mm;
+    res.progress = (goal > 0) ? std::min(1.0, world.travelled_mm / goal) : 0.0;
+    if (res.cycles > 0)
+    {
+        res.cte_rms_mm = std::sqrt(cte2 / res.cycles);
+        res.osc = osc / res.cycles;
+    }
+    if (map_out != NULL)
+    {
+        map_out->resize(CMAP_FILE_MAX);
+        map_out->resize(core.saveCourseMap(map_out->data(), CMAP_FILE_MAX));
+    }
+    return res;
+}
+
+#endif // EV3_HOST_SIMLOOP_H
@@ -0,0 +1,461 @@
+/**
+ * @file SimWorld.cpp
+ * @brief ホスト(Linux)ビルド用 二輪差動ロボットの物理モデルとラスタコース
+ */
+#include "SimWorld.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+static const double PI = 3.14159265358979323846;
+static const double LINE_HALFWIDTH_MM = 10.0; // ライン幅20mm
+static const double SUBSTEP_S = 0.001;        // 積分の最大刻み幅
+
+const simconfig_t SIM_DEFAULT_CONFIG = {
+    50.0,  /* wheel_radius_mm */
+    77.0,  /* half_track_mm */
+    10.0,  /* motor_dps_per_pow: パワー100で1000deg/s */
+    0.08,  /* motor_tau_s */
+    0.02,  /* brake_tau_s */
+    0.30,  /* coast_tau_s */
+    90.0,  /* sensor_offset_mm */
+    6.0,   /* sensor_radius_mm */
+    60.0,  /* sonar_offset_mm */
+    15.0,  /* sonar_halfcone_deg */
+    0.39,  /* raw_gain: 白(255) -> 約104 */
+    5.0,   /* raw_offset: 黒(0) -> 5 */
+    0.0,   /* gyro_bias_dps */
+    0.0,   /* yaw_slip */
+    0.0,   /* grip_mps2 */
+};
+
+// ******** CourseImage ******** ******** ******** ******** ******** ********
+
+CourseImage::CourseImage()
+    : width(0), height(0), mm_per_px(1.0),
+      start_x(0), start_y(0), start_heading(0), lap_length_mm(0)
+{
+}
+
+/**
+ * @brief P6(バイナリPPM)形式のコース画像を読み込む
+ *
+ * @param path      ファイルパス
+ * @param mm_per_px 1画素あたりの長さ[mm]
+ * @return 成功したら true
+ */
+bool CourseImage::loadPPM(const std::string &path, double mm_per_px)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (fp == NULL)
+        return false;
+
+    char magic[3] = {0};
+    int header[3]; // width, height, maxval
+    bool ok = (fread(magic, 1, 2, fp) == 2) && (strcmp(magic, "P6") == 0);
+    for (int i = 0; ok && i < 3; i++)
+    {
+        int c = fgetc(fp);
+        while (c == '#' || isspace(c)) // 空白とコメント行を読み飛ばす
+        {
+            if (c == '#')
+                while (c != '\n' && c != EOF)
+                    c = fgetc(fp);
+            c = fgetc(fp);
+        }
+        ungetc(c, fp);
+        ok = (fscanf(fp, "%d", &header[i]) == 1);
+    }
+    ok = ok && (header[2] == 255) && (fgetc(fp) != EOF);
+    if (ok)
+    {
+        width = header[0];
+        height = header[1];
+        this->mm_per_px = mm_per_px;
+        rgb.resize((size_t)width * height * 3);
+        ok = (fread(&rgb[0], 1, rgb.size(), fp) == rgb.size());
+    }
+    fclose(fp);
+    return ok;
+}
+
+/**
+ * @brief 長円(直線2本と半円2つ)のコースを生成する
+ *
+ * @param straight_mm 直線部の長さ
+ * @param radius_mm   カーブの半径(ライン中心)
+ * @note  黒ライン幅20mm,上側直線の中央30%を青ラインにする。
+ *        反時計回りに走り,ラインの右エッジ(外周側)から開始する。
+ */
+void CourseImage::generateOval(double straight_mm, double radius_mm)
+{
+    const double margin = 250.0;
+    mm_per_px = 2.0;
+    width = (int)((straight_mm + 2 * radius_mm + 2 * margin) / mm_per_px);
+    height = (int)((2 * radius_mm + 2 * margin) / mm_per_px);
+    rgb.assign((size_t)width * height * 3, 255);
+
+    const double cy = margin + radius_mm;
+    const double c1x = margin + radius_mm;
+    const double c2x = c1x + straight_mm;
+    const double blue_from = c1x + 0.35 * straight_mm;
+    const double blue_to = c1x + 0.65 * straight_mm;
+
+    for (int j = 0; j < height; j++)
+    {
+        for (int i = 0; i < width; i++)
+        {
+            double px = (i + 0.5) * mm_per_px;
+            double py = (height - j - 0.5) * mm_per_px;
+            double d;
+            if (px >= c1x && px <= c2x)
+                d = std::fabs(std::fabs(py - cy) - radius_mm);
+            else
+            {
+                double cx = (px < c1x) ? c1x : c2x;
+                d = std::fabs(std::hypot(px - cx, py - cy) - radius_mm);
+            }
+            if (d > LINE_HALFWIDTH_MM)
+                continue;
+
+            uint8_t *p = &rgb[((size_t)j * width + i) * 3];
+            if (py > cy && px >= blue_from && px <= blue_to)
+            {
+                p[0] = 40;
+                p[1] = 70;
+                p[2] = 230;
+            }
+            else
+            {
+                p[0] = p[1] = p[2] = 0;
+            }
+        }
+    }
+
+    start_x = c1x + 0.1 * straight_mm;
+    start_y = cy - radius_mm - LINE_HALFWIDTH_MM;
+    start_heading = 0.0;
+    lap_length_mm = 2 * straight_mm + 2 * PI * radius_mm;
+}
+
+/**
+ * @brief コース画像のバイリニア補間
+ *
+ * @note  画像外は白として扱う
+ */
+void CourseImage::sample(double x_mm, double y_mm, double *r, double *g, double *b) const
+{
+    double u = x_mm / mm_per_px - 0.5;
+    double v = height - y_mm / mm_per_px - 0.5;
+    if (u < 0 || v < 0 || u >= width - 1 || v >= height - 1)
+    {
+        *r = *g = *b = 255.0;
+        return;
+    }
+    int i = (int)u;
+    int j = (int)v;
+    double fu = u - i;
+    double fv = v - j;
+    const uint8_t *p00 = &rgb[((size_t)j * width + i) * 3];
+    const uint8_t *p01 = p00 + 3;
+    const uint8_t *p10 = p00 + (size_t)width * 3;
+    const uint8_t *p11 = p10 + 3;
+    double w00 = (1 - fu) * (1 - fv), w01 = fu * (1 - fv), w10 = (1 - fu) * fv, w11 = fu * fv;
+    *r = w00 * p00[0] + w01 * p01[0] + w10 * p10[0] + w11 * p11[0];
+    *g = w00 * p00[1] + w01 * p01[1] + w10 * p10[1] + w11 * p11[1];
+    *b = w00 * p00[2] + w01 * p01[2] + w10 * p10[2] + w11 * p11[2];
+}
+
+/**
+ * @brief ラインまでの距離場を作る
+ *
+ * @note  暗い画素(RGB平均 < 160,青ラインも含む)をラインとし,
+ *        3-4 チャンファー距離変換(2パス)で各画素からの距離を求める。誤差は数%以内
+ */
+void CourseImage::buildLineDistance()
+{
+    const float INF = 1e9f;
+    const float D1 = 1.0f, D2 = 1.3333f; // 3-4 重み /3
+    line_dist.assign((size_t)width * height, INF);
+    for (size_t k = 0; k < line_dist.size(); k++)
+    {
+        const uint8_t *p = &rgb[k * 3];
+        if (p[0] + p[1] + p[2] < 3 * 160)
+            line_dist[k] = 0.0f;
+    }
+    for (int j = 0; j < height; j++) // 前進パス
+        for (int i = 0; i < width; i++)
+        {
+            float &d = line_dist[(size_t)j * width + i];
+            if (i > 0)
+                d = std::min(d, line_dist[(size_t)j * width + i - 1] + D1);
+            if (j > 0)
+            {
+                const float *up = &line_dist[(size_t)(j - 1) * width + i];
+                d = std::min(d, up[0] + D1);
+                if (i > 0)
+                    d = std::min(d, up[-1] + D2);
+                if (i < width - 1)
+                    d = std::min(d, up[1] + D2);
+            }
+        }
+    for (int j = height - 1; j >= 0; j--) // 後退パス
+        for (int i = width - 1; i >= 0; i--)
+        {
+            float &d = line_dist[(size_t)j * width + i];
+            if (i < width - 1)
+                d = std::min(d, line_dist[(size_t)j * width + i + 1] + D1);
+            if (j < height - 1)
+            {
+                const float *down = &line_dist[(size_t)(j + 1) * width + i];
+                d = std::min(d, down[0] + D1);
+                if (i < width - 1)
+                    d = std::min(d, down[1] + D2);
+                if (i > 0)
+                    d = std::min(d, down[-1] + D2);
+            }
+        }
+    for (size_t k = 0; k < line_dist.size(); k++)
+        line_dist[k] *= (float)mm_per_px;
+}
+
+/**
+ * @brief ラインまでの距離[mm]
+ *
+ * @note  buildLineDistance の後に使う。画像外は画像端の値
+ */
+double CourseImage::lineDistance(double x_mm, double y_mm) const
+{
+    int i = (int)(x_mm / mm_per_px);
+    int j = height - 1 - (int)(y_mm / mm_per_px);
+    i = std::max(0, std::min(width - 1, i));
+    j = std::max(0, std::min(height - 1, j));
+    return line_dist[(size_t)j * width + i];
+}
+
+// ******** SimWorld ******** ******** ******** ******** ******** ******** ********
+
+SimWorld::SimWorld(const CourseImage &course, const simconfig_t &config)
+    : left_port(EV3_PORT_C), right_port(EV3_PORT_B),
+      course(course), cfg(config)
+{
+    alpha_motor = 1.0 - std::exp(-SUBSTEP_S / cfg.motor_tau_s);
+    alpha_brake = 1.0 - std::exp(-SUBSTEP_S / cfg.brake_tau_s);
+    alpha_coast = 1.0 - std::exp(-SUBSTEP_S / cfg.coast_tau_s);
+    reset();
+}
+
+void SimWorld::reset()
+{
+    now_us = 0;
+    x = course.start_x;
+    y = course.start_y;
+    heading = course.start_heading;
+    travelled_mm = 0;
+    laps = 0;
+    lap_start_us = 0;
+    last_lap_us = 0;
+    back_button = false;
+    touch_pressed = true; // 既定では即スタート
+    drive_load = 0;
+    memset(motor, 0, sizeof(motor));
+    gyro_zero = heading;
+    gyro_drift = 0;
+    yaw_rate = 0;
+    lap_mark_mm = 0;
+}
+
+void SimWorld::addObstacle(double x_mm, double y_mm, double r_mm)
+{
+    obstacle_t o = {x_mm, y_mm, r_mm};
+    obstacles.push_back(o);
+}
+
+/**
+ * @brief 仮想時刻 t_us まで積分する
+ */
+void SimWorld::advanceTo(uint64_t t_us)
+{
+    if (t_us <= now_us)
+        return;
+    double remain = (t_us - now_us) * 1e-6;
+    while (remain > 1e-9)
+    {
+        double dt = (remain > SUBSTEP_S) ? SUBSTEP_S : remain;
+        integrate(dt);
+        remain -= dt;
+    }
+    now_us = t_us;
+}
+
+void SimWorld::integrate(double dt)
+{
+    for (int i = 0; i < TNUM_MOTOR_PORT; i++)
+    {
+        motor_t &m = motor[i];
+        double tau = cfg.motor_tau_s;
+        if (m.power == 0)
+            tau = m.braking ? cfg.brake_tau_s : cfg.coast_tau_s;
+        double target = m.power * cfg.motor_dps_per_pow;
+        if (m.power != 0 && (i == left_port || i == right_port))
+            target -= drive_load * cfg.motor_dps_per_pow;
+        double prev = m.speed_dps;
+        double alpha;
+        if (dt == SUBSTEP_S) // 定常の刻み幅は事前計算した係数を使う
+            alpha = (tau == cfg.motor_tau_s) ? alpha_motor : ((tau == cfg.brake_tau_s) ? alpha_brake : alpha_coast);
+        else
+            alpha = 1.0 - std::exp(-dt / tau);
+        m.speed_dps += (target - m.speed_dps) * alpha;
+        m.angle_deg += 0.5 * (prev + m.speed_dps) * dt;
+    }
+
+    const double k = PI / 180.0 * cfg.wheel_radius_mm;
+    double vl = motor[left_port].speed_dps * k;
+    double vr = motor[right_port].speed_dps * k;
+    double v = 0.5 * (vl + vr);
+    yaw_rate = (vr - vl) / (2.0 * cfg.half_track_mm);
+    if (cfg.yaw_slip != 0.0)
+        yaw_rate /= 1.0 + cfg.yaw_slip * (v * 1e-3) * (v * 1e-3);
+    if (cfg.grip_mps2 > 0.0 && std::fabs(v) > 1.0) // 横方向の加速度 v*ω の限界
+    {
+        double max_yaw = cfg.grip_mps2 * 1e3 / std::fabs(v);
+        if (yaw_rate > max_yaw)
+            yaw_rate = max_yaw;
+        else if (yaw_rate < -max_yaw)
+            yaw_rate = -max_yaw;
+    }
+    gyro_drift += cfg.gyro_bias_dps * PI / 180.0 * dt;
+
+    double mid = heading + 0.5 * yaw_rate * dt;
+    x += v * std::cos(mid) * dt;
+    y += v * std::sin(mid) * dt;
+    heading += yaw_rate * dt;
+    travelled_mm += std::fabs(v) * dt;
+
+    // -------- 周回判定: 一定距離走ってから開始位置付近に戻ったら1周 --------
+    double min_lap = (course.lap_length_mm > 0) ? 0.8 * course.lap_length_mm : 1000.0;
+    if (travelled_mm - lap_mark_mm > min_lap &&
+        std::hypot(x - course.start_x, y - course.start_y) < 100.0)
+    {
+        uint64_t t = now_us + (uint64_t)(dt * 1e6);
+        laps++;
+        last_lap_us = t - lap_start_us;
+        lap_start_us = t;
+        lap_mark_mm = travelled_mm;
+    }
+}
+
+void SimWorld::setPower(int port, int power)
+{
+    if (power > 100)
+        power = 100;
+    else if (power < -100)
+        power = -100;
+    motor[port].power = power;
+    motor[port].braking = false;
+}
+
+/**
+ * @brief EV3RT の ev3_motor_steer と同じ配分: 曲がる側の車輪を turn_ratio/50 だけ減速する
+ */
+void SimWorld::steer(int left, int right, int power, int turn_ratio)
+{
+    int left_power = power;
+    int right_power = power;
+    if (turn_ratio > 0)
+        right_power = power - power * turn_ratio / 50;
+    else if (turn_ratio < 0)
+        left_power = power + power * turn_ratio / 50;
+    setPower(left, left_power);
+    setPower(right, right_power);
+}
+
+void SimWorld::stopMotor(int port, bool brake)
+{
+    motor[port].power = 0;
+    motor[port].braking = brake;
+}
+
+int32_t SimWorld::getCounts(int port) const
+{
+    return (int32_t)std::floor(motor[port].angle_deg - motor[port].offset_deg);
+}
+
+void SimWorld::resetCounts(int port)
+{
+    motor[port].offset_deg = motor[port].angle_deg;
+}
+
+/**
+ * @brief カラーセンサの視野内の平均色をRGB Raw値で返す
+ */
+void SimWorld::colorRaw(rgb_raw_t *val) const
+{
+    static const double dx[5] = {0, 1, -1, 0, 0};
+    static const double dy[5] = {0, 0, 0, 1, -1};
+    double sx, sy;
+    sensorPosition(&sx, &sy);
+    double r = 0, g = 0, b = 0;
+    for (int i = 0; i < 5; i++)
+    {
+        double pr, pg, pb;
+        course.sample(sx + dx[i] * cfg.sensor_radius_mm, sy + dy[i] * cfg.sensor_radius_mm, &pr, &pg, &pb);
+        r += pr;
+        g += pg;
+        b += pb;
+    }
+    val->r = (uint16_t)(cfg.raw_offset + cfg.raw_gain * r / 5);
+    val->g = (uint16_t)(cfg.raw_offset + cfg.raw_gain * g / 5);
+    val->b = (uint16_t)(cfg.raw_offset + cfg.raw_gain * b / 5);
+}
+
+void SimWorld::sensorPosition(double *sx, double *sy) const
+{
+    *sx = x + cfg.sensor_offset_mm * std::cos(heading);
+    *sy = y + cfg.sensor_offset_mm * std::sin(heading);
+}
+
+/**
+ * @brief 超音波センサの距離[cm],検知なしは255
+ */
+int16_t SimWorld::sonarDistance() const
+{
+    double c = std::cos(heading), s = std::sin(heading);
+    double sx = x + cfg.sonar_offset_mm * c;
+    double sy = y + cfg.sonar_offset_mm * s;
+    double best = 2550.0;
+    for (size_t i = 0; i < obstacles.size(); i++)
+    {
+        double ox = obstacles[i].x - sx, oy = obstacles[i].y - sy;
+        double along = ox * c + oy * s;
+        double lateral = -ox * s + oy * c;
+        double dist = std::hypot(ox, oy);
+        if (along <= 0 || dist <= obstacles[i].r)
+            continue;
+        double half = cfg.sonar_halfcone_deg * PI / 180.0 + std::asin(obstacles[i].r / dist);
+        if (std::fabs(std::atan2(lateral, along)) > half)
+            continue;
+        if (dist - obstacles[i].r < best)
+            best = dist - obstacles[i].r;
+    }
+    return (int16_t)(best / 10.0);
+}
+
+int16_t SimWorld::gyroAngle() const
+{
+    return (int16_t)std::lround((-(heading - gyro_zero) + gyro_drift) * 180.0 / PI); // 時計回り正
+}
+
+int16_t SimWorld::gyroRate() const
+{
+    return (int16_t)std::lround(-yaw_rate * 180.0 / PI + cfg.gyro_bias_dps);
+}
+
+void SimWorld::gyroReset()
+{
+    gyro_zero = heading;
+    gyro_drift = 0;
+}
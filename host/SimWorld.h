@@ -0,0 +1,142 @@
+/**
+ * @file SimWorld.h
+ * @brief ホスト(Linux)ビルド用 二輪差動ロボットの物理モデルとラスタコース
+ *
+ * @note ev3api スタンドインの入出力先。
+ *       - モーター: パワー指令(走行モーターは負荷を差し引く) -> 一次遅れの回転速度 -> エンコーダ角度
+ *       - 車体: 左右車輪速度からの差動二輪キネマティクス(速いカーブでは横滑りで車輪の差ほど曲がらず,
+ *               横方向の加速度がグリップの限界を超えるとそれ以上曲がれない)
+ *       - カラーセンサ: 車軸前方の位置でコース画像をサンプリングしてRGB Raw値を返す
+ *       - 超音波センサ: 円柱障害物へのレイキャスト
+ *       - ジャイロ: 車体の方位に一定のバイアス(ドリフト)を足して 1deg 単位に丸める
+ */
+#ifndef EV3_HOST_SIMWORLD_H
+#define EV3_HOST_SIMWORLD_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "ev3api.h"
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   ラスタ化されたコース画像
+ *
+ * @class   CourseImage
+ * @note    座標系は[mm],原点は画像左下,y軸上向き.1画素 mm_per_px [mm]
+ */
+class CourseImage
+{
+public:
+    CourseImage();
+
+    bool loadPPM(const std::string &path, double mm_per_px); // P6形式を読み込む
+    void generateOval(double straight_mm, double radius_mm); // 楕円(長円)コースを生成する
+
+    void sample(double x_mm, double y_mm, double *r, double *g, double *b) const; // バイリニア補間
+    void buildLineDistance();                          // ラインまでの距離場を作る(評価用)
+    double lineDistance(double x_mm, double y_mm) const; // ラインまでの距離[mm],ライン上は0
+
+    int width, height;
+    double mm_per_px;
+    std::vector<uint8_t> rgb; // 行優先,先頭行が画像の上端
+    std::vector<float> line_dist; // buildLineDistance の結果[mm], rgb と同じ並び
+
+    // 開始姿勢とコース長の目安(周回判定用)
+    double start_x, start_y, start_heading;
+    double lap_length_mm;
+};
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   シミュレーション定数
+ *
+ * @struct  simconfig_t
+ */
+typedef struct
+{
+    double wheel_radius_mm;    /* 車輪半径 */
+    double half_track_mm;      /* 1/2トレッド */
+    double motor_dps_per_pow;  /* パワー1あたりの定常回転速度[deg/s] */
+    double motor_tau_s;        /* モーター一次遅れ時定数[s] */
+    double brake_tau_s;        /* ブレーキ停止時の時定数[s] */
+    double coast_tau_s;        /* フロート停止時の時定数[s] */
+    double sensor_offset_mm;   /* 車軸からカラーセンサまでの前方距離 */
+    double sensor_radius_mm;   /* カラーセンサの視野半径 */
+    double sonar_offset_mm;    /* 車軸から超音波センサまでの前方距離 */
+    double sonar_halfcone_deg; /* 超音波センサの半頂角 */
+    double raw_gain, raw_offset; /* 画素値[0-255] -> RGB Raw値 */
+    double gyro_bias_dps;      /* ジャイロのバイアス[deg/s],時計回りが正 */
+    double yaw_slip;           /* 横滑り: 車体の角速度 = 車輪の差からの角速度 / (1 + yaw_slip * v[m/s]^2) */
+    double grip_mps2;          /* 横方向の最大加速度[m/s^2],超えると曲がりきれない. 0 で制限なし */
+} simconfig_t;
+
+extern const simconfig_t SIM_DEFAULT_CONFIG;
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   二輪差動ロボットの物理モデル
+ *
+ * @class   SimWorld
+ */
+class SimWorld
+{
+public:
+    SimWorld(const CourseImage &course, const simconfig_t &config = SIM_DEFAULT_CONFIG);
+
+    void reset();                 // 開始姿勢に戻す
+    void advanceTo(uint64_t t_us); // 仮想時刻 t_us まで積分する
+    void addObstacle(double x_mm, double y_mm, double r_mm);
+
+    // -------- ev3api の入出力 --------
+    void setPower(int port, int power);
+    void steer(int left, int right, int power, int turn_ratio); // ev3_motor_steer と同じ配分
+    int getPower(int port) const { return motor[port].power; }
+    void stopMotor(int port, bool brake);
+    int32_t getCounts(int port) const;
+    void resetCounts(int port);
+    void colorRaw(rgb_raw_t *val) const;
+    int16_t sonarDistance() const;
+    int16_t gyroAngle() const;
+    int16_t gyroRate() const;
+    void gyroReset();
+    void sensorPosition(double *sx, double *sy) const; // カラーセンサの位置[mm]
+
+    // -------- 状態 --------
+    uint64_t now_us;
+    double x, y, heading;   /* 車軸中心[mm],方位[rad](反時計回り正) */
+    double travelled_mm;    /* 走行距離 */
+    int laps;               /* 完了した周回数 */
+    uint64_t lap_start_us;  /* 現在の周回の開始時刻 */
+    uint64_t last_lap_us;   /* 直前の周回タイム */
+    bool back_button;       /* BACK_BUTTON 押下状態 */
+    bool touch_pressed;     /* タッチセンサ押下状態 */
+    double drive_load;      /* 走行モーターの負荷[パワー] (登坂など),回転中はパワーから差し引く */
+
+    int left_port, right_port;
+
+private:
+    struct motor_t
+    {
+        int power;
+        bool braking;
+        double speed_dps;
+        double angle_deg;
+        double offset_deg;
+    };
+    struct obstacle_t
+    {
+        double x, y, r;
+    };
+
+    void integrate(double dt);
+
+    const CourseImage &course;
+    simconfig_t cfg;
+    motor_t motor[TNUM_MOTOR_PORT];
+    std::vector<obstacle_t> obstacles;
+    double gyro_zero, yaw_rate;
+    double gyro_drift; /* バイアスの積算[rad],時計回りが正 */
+    double lap_mark_mm; /* 周回判定の走行距離基準 */
+    double alpha_motor, alpha_brake, alpha_coast; /* 1刻みあたりの一次遅れ係数 */
+};
+
+#endif // EV3_HOST_SIMWORLD_H
@@ -0,0 +1,109 @@
+/**
+ * @file WorkStealingPool.h
+ * @brief ホスト(Linux)ツール用 ワークスティーリングのスレッドプール
+ *
+ * @note run() のたびにスレッドを起こし,タスク番号を各スレッドの両端キューに連続区間で配る。
+ *       自分のキューは後ろから取り,空になったら他のスレッドのキューの前から盗む。
+ *       ライン逸脱で早く終わる評価などで処理時間がばらついても全スレッドが最後まで働く。
+ *       1タスクはシミュレーション1回(ミリ秒単位)なので,キューはスレッドごとの mutex で守る。
+ */
+#ifndef EV3_HOST_WORKSTEALINGPOOL_H
+#define EV3_HOST_WORKSTEALINGPOOL_H
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool
+{
+public:
+    typedef std::function<void(int task)> task_fn;
+
+    explicit WorkStealingPool(int threads = 0)
+        : nthreads(threads > 0 ? threads : (int)std::thread::hardware_concurrency()),
+          stolen(0)
+    {
+        if (nthreads < 1)
+            nthreads = 1;
+    }
+
+    int threads() const { return nthreads; }
+    unsigned long steals() const { return stolen; }
+
+    /**
+     * @brief タスク 0..ntasks-1 を全て実行して戻る
+     */
+    void run(int ntasks, const task_fn &fn)
+    {
+        std::vector<queue_t> queues(nthreads);
+        for (int w = 0; w < nthreads; w++) // 連続区間で配る
+        {
+            int from = (int)((long)ntasks * w / nthreads);
+            int to = (int)((long)ntasks * (w + 1) / nthreads);
+            for (int t = from; t < to; t++)
+                queues[w].tasks.push_back(t);
+        }
+
+        std::vector<std::thread> workers;
+        for (int w = 1; w < nthreads; w++)
+            workers.push_back(std::thread(&WorkStealingPool::work, this, w, std::ref(queues), std::cref(fn)));
+        work(0, queues, fn); // 呼び出し元もワーカー0として働く
+        for (size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+
+private:
+    struct queue_t
+    {
+        std::mutex lock;
+        std::deque<int> tasks;
+    };
+
+    void work(int self, std::vector<queue_t> &queues, const task_fn &fn)
+    {
+        int task;
+        while (true)
+        {
+            if (popBack(queues[self], &task))
+            {
+                fn(task);
+                continue;
+            }
+            bool found = false;
+            for (int k = 1; k < nthreads && !found; k++) // 隣から順に盗む
+                found = popFront(queues[(self + k) % nthreads], &task);
+            if (!found)
+                return; // 全キューが空: 新しいタスクは増えないので終了してよい
+            stolen++;
+            fn(task);
+        }
+    }
+
+    static bool popBack(queue_t &q, int *task)
+    {
+        std::lock_guard<std::mutex> guard(q.lock);
+        if (q.tasks.empty())
+            return false;
+        *task = q.tasks.back();
+        q.tasks.pop_back();
+        return true;
+    }
+
+    static bool popFront(queue_t &q, int *task)
+    {
+        std::lock_guard<std::mutex> guard(q.lock);
+        if (q.tasks.empty())
+            return false;
+        *task = q.tasks.front();
+        q.tasks.pop_front();
+        return true;
+    }
+
+    int nthreads;
+    std::atomic<unsigned long> stolen;
+};
+
+#endif // EV3_HOST_WORKSTEALINGPOOL_H
@@ -0,0 +1,106 @@
+/**
+ * @file batchsim.cpp
+ * @brief 多数のロボット(RobotT<SimRobotIo>)を1つのプロセスで全コアに分けて走らせるバッチ
+ *
+ * @note ロボットごとに TracerCore と SimWorld を持ち(RobotBatch),ジャイロのバイアス,センサの感度,
+ *       モーターの時定数,前進速度を少しずつ変えて同じコースを走らせる。
+ *       1秒あたりに進めた周期数と実時間の何倍か(ロボット台数 x 走行時間 / 実時間)を出す。
+ *       --scaling ではスレッド数を 1, 2, 4, ... コア数 と変えて同じバッチを走らせ,速度の伸びを比べる。
+ *       ハードウェアスレッドが1つしかないときの伸びは測れていないので,その旨を表示する。
+ *
+ *  使い方:
+ *    batchsim [--oval STRAIGHT,RADIUS] [--robots N] [--time SEC] [--laps N] [--threads N] [--block N]
+ *             [--seed S] [--scaling]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "RobotBatch.h"
+
+static void usage()
+{
+    fprintf(stderr, "usage: batchsim [--oval STRAIGHT,RADIUS] [--robots N] [--time SEC] [--laps N] [--threads N] "
+                    "[--block N]\n"
+                    "                [--seed S] [--scaling]\n");
+    exit(2);
+}
+
+/** 1回のバッチ */
+static batchstat_t run_batch(const CourseImage &course, int robots, unsigned int seed, int laps, double time_s,
+                             int threads, int block)
+{
+    RobotBatch batch(course, robots, seed, laps);
+    WorkStealingPool pool(threads);
+    return batch.run(pool, time_s, block);
+}
+
+int main(int argc, char **argv)
+{
+    double straight = 2000.0, radius = 600.0;
+    int robots = 1000;
+    double time_s = 10.0;
+    int laps = 100;
+    int threads = 0;
+    int block = BATCH_BLOCK;
+    unsigned int seed = 1;
+    bool scaling = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string a = argv[i];
+        bool more = (i + 1 < argc);
+        if (a == "--oval" && more)
+            sscanf(argv[++i], "%lf,%lf", &straight, &radius);
+        else if (a == "--robots" && more)
+            robots = atoi(argv[++i]);
+        else if (a == "--time" && more)
+            time_s = atof(argv[++i]);
+        else if (a == "--laps" && more)
+            laps = atoi(argv[++i]);
+        else if (a == "--threads" && more)
+            threads = atoi(argv[++i]);
+        else if (a == "--block" && more)
+            block = atoi(argv[++i]);
+        else if (a == "--seed" && more)
+            seed = (unsigned int)atoi(argv[++i]);
+        else if (a == "--scaling")
+            scaling = true;
+        else
+            usage();
+    }
+    if (robots < 1)
+        usage();
+
+    CourseImage course;
+    course.generateOval(straight, radius);
+    course.buildLineDistance();
+
+    const int cores = (threads > 0) ? threads : (int)std::thread::hardware_concurrency();
+    std::vector<int> counts;
+    if (scaling)
+    {
+        for (int t = 1; t < cores; t *= 2)
+            counts.push_back(t);
+    }
+    counts.push_back(cores);
+
+    printf("robots %d, %.1f s each, %.1f MB of state\n", robots, time_s,
+           robots * (double)(sizeof(TracerCore) + sizeof(SimWorld)) * 1e-6);
+    printf("threads  Mcycles/s  x realtime  speedup  finished  laps\n");
+    double base = 0;
+    for (size_t k = 0; k < counts.size(); k++)
+    {
+        batchstat_t st = run_batch(course, robots, seed, laps, time_s, counts[k], block);
+        const double rate = st.cycles / st.wall_s;
+        if (k == 0)
+            base = rate;
+        printf("%7d  %9.3f  %10.0f  %7.2f  %8d  %4d\n", counts[k], rate * 1e-6, rate * SIM_CYCLE_US * 1e-6,
+               rate / base, st.finished, st.laps);
+    }
+    if (scaling && std::thread::hardware_concurrency() <= 1)
+        printf("speedup unverified: 1 hardware thread, the threads shared one core\n");
+    return 0;
+}
@@ -0,0 +1,206 @@
+/**
+ * @file bench_calib.cpp
+ * @brief 走行前のラインのしきい値の自動調整(LineCalibrator)の照明条件ごとの比較
+ *
+ * @note シミュレータの照明(画素値 -> RGB Raw値の倍率と底上げ)を変えて,
+ *        - 開始位置でその場旋回してしきい値を決め(app.cpp の calibrate_line と同じ手順)
+ *        - マクロの値(LINE_DEFAULT_CALIB)と決めた値で長円コースを RUN_LAPS 周走らせる
+ *       白と黒の画素から求めた明度の中間(真の値)と比べ,走行のラインからの距離と外れた回数を比べる。
+ *
+ *       確認項目(どれかが合わなければ終了コード 1):
+ *        - どの照明でも CALIB_TIME_MS 以内に終わり,分かれ方が CALIB_MIN_QUALITY 以上で,
+ *          明度の目標が真の値と CALIB_TOL 以内,旋回後の向きが開始の向きと CALIB_HEADING_TOL_DEG 以内
+ *        - 決めた値の走行がどの照明でも完走し,全照明の合計でラインを外れた回数がマクロの値以下
+ *        - 青のラインの上では彩度の目標が白と青の間になり,その値で完走する
+ *        - ラインのない所では LINE_CALIB_POOR でマクロの値のまま
+ */
+#include <cmath>
+#include <cstdio>
+
+#include "ev3api_stub.h"
+#include "SimLoop.h"
+#include "control/LineCalibrator.h"
+
+#define RUN_LAPS 2
+#define RUN_LIMIT_S 60.0
+#define CALIB_TOL 3                // 明度の目標の許容誤差
+#define CALIB_HEADING_TOL_DEG 5.0  // 旋回後の向きの許容誤差[deg]
+#define CALIB_SETTLE_US 200000     // 止めてから向きを測るまで[us]
+
+typedef struct
+{
+    const char *name;
+    double gain, offset; /* 画素値[0-255] -> RGB Raw値 */
+} light_t;
+
+static const light_t LIGHTS[] = {
+    {"default", 0.39, 5.0},
+    {"dim", 0.20, 5.0},
+    {"dark", 0.14, 3.0},
+    {"bright", 0.70, 5.0},
+    {"glare", 0.39, 40.0},
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char *scenario, const char *what)
+{
+    if (!ok)
+    {
+        printf("FAIL  %s: %s\n", scenario, what);
+        failures++;
+    }
+}
+
+/** 1画素の色の HSV (センサの視野が全部その色のとき) */
+static void pixel_hsv(const simconfig_t &cfg, int r, int g, int b, int *val, int *sat)
+{
+    rgb_raw_t raw;
+    raw.r = (uint16_t)(cfg.raw_offset + cfg.raw_gain * r);
+    raw.g = (uint16_t)(cfg.raw_offset + cfg.raw_gain * g);
+    raw.b = (uint16_t)(cfg.raw_offset + cfg.raw_gain * b);
+    ColorSensorCalculator color;
+    color.calc(&raw);
+    *val = color.getHSVval();
+    *sat = color.getHSVsat();
+}
+
+/** app.cpp の calibrate_line と同じ手順, heading_deg には旋回後の向きの開始からのずれ */
+static linecalib_t calibrate(const CourseImage &course, const simconfig_t &cfg, double *heading_deg)
+{
+    SimWorld world(course, cfg);
+    LineCalibrator calibrator;
+    rgb_raw_t rgb;
+    int turn = 0;
+    uint64_t t = 0;
+    while (true)
+    {
+        world.advanceTo(t);
+        world.colorRaw(&rgb);
+        if (!calibrator.step(&rgb, world.getCounts(world.left_port), world.getCounts(world.right_port), &turn))
+            break;
+        world.steer(world.left_port, world.right_port, CALIB_POWER, turn);
+        t += CALIB_CYCLE_MS * 1000;
+    }
+    world.stopMotor(world.left_port, true);
+    world.stopMotor(world.right_port, true);
+    world.advanceTo(t + CALIB_SETTLE_US);
+    *heading_deg = std::remainder(world.heading - course.start_heading, 2 * M_PI) * 180.0 / M_PI;
+
+    linecalib_t calib;
+    calibrator.finish(&calib);
+    return calib;
+}
+
+static void print_calib(const char *scenario, const linecalib_t &c, int truth, double heading)
+{
+    printf("%-8s %-6s %4d %5d %5d %5d %5d %4d %4d %4d %6.1f\n", scenario,
+           c.status == LINE_CALIB_OK ? "ok" : "poor", c.quality, c.black_val, c.white_val, c.target_reflect, truth,
+           c.blue_sat, c.target_hsv, c.time_ms, heading);
+}
+
+static void print_run(const char *scenario, const char *mode, const simresult_t &r)
+{
+    printf("%-8s %-10s %4s %4s %7.2f %6.1f %6.1f %5d\n", scenario, mode, r.completed ? "yes" : "no",
+           r.lost ? "LOST" : "-", r.time_s, r.cte_rms_mm, r.cte_max_mm, r.excursions);
+}
+
+int main()
+{
+    CourseImage course;
+    course.generateOval(2000.0, 600.0);
+    course.buildLineDistance();
+    tracergains_t gains = TRACER_DEFAULT_GAINS;
+
+    static linecalib_t calibs[sizeof(LIGHTS) / sizeof(LIGHTS[0])];
+    const int n_lights = (int)(sizeof(LIGHTS) / sizeof(LIGHTS[0]));
+
+    printf("line calibration, sweep %d deg at power %d, bound %d ms\n", CALIB_SWEEP_DEG, CALIB_POWER, CALIB_TIME_MS);
+    printf("%-8s %-6s %4s %5s %5s %5s %5s %4s %4s %4s %6s\n", "light", "status", "qual", "black", "white",
+           "tgt", "true", "blue", "hsv", "ms", "head");
+    for (int i = 0; i < n_lights; i++)
+    {
+        const light_t &l = LIGHTS[i];
+        simconfig_t cfg = SIM_DEFAULT_CONFIG;
+        cfg.raw_gain = l.gain;
+        cfg.raw_offset = l.offset;
+        int white, black, sat;
+        pixel_hsv(cfg, 255, 255, 255, &white, &sat);
+        pixel_hsv(cfg, 0, 0, 0, &black, &sat);
+        const int truth = (white + black) / 2;
+        double heading;
+        calibs[i] = calibrate(course, cfg, &heading);
+        const linecalib_t &c = calibs[i];
+        print_calib(l.name, c, truth, heading);
+
+        check(c.status == LINE_CALIB_OK, l.name, "calibration succeeds on the line");
+        check(c.time_ms <= CALIB_TIME_MS, l.name, "calibration finishes within CALIB_TIME_MS");
+        check(c.quality >= CALIB_MIN_QUALITY, l.name, "black and white separate");
+        check(std::abs(c.target_reflect - truth) <= CALIB_TOL, l.name, "value target matches the black/white midpoint");
+        check(std::fabs(heading) <= CALIB_HEADING_TOL_DEG, l.name, "robot turns back to the start heading");
+    }
+
+    // -------- 青のラインの上: 上側の直線の青の区間(左向き,外側のエッジ) --------
+    {
+        CourseImage blue = course;
+        blue.start_x = course.start_x + 0.4 * 2000.0;
+        blue.start_y = course.start_y + 2 * 600.0 + 2 * 10.0;
+        blue.start_heading = M_PI;
+        simconfig_t cfg = SIM_DEFAULT_CONFIG;
+        int val, white_sat, blue_sat;
+        pixel_hsv(cfg, 255, 255, 255, &val, &white_sat);
+        pixel_hsv(cfg, 40, 70, 230, &val, &blue_sat);
+        double heading;
+        linecalib_t c = calibrate(blue, cfg, &heading);
+        print_calib("blue", c, (c.black_val + c.white_val) / 2, heading);
+        printf("%-8s white sat %d, blue sat %d\n", "blue", white_sat, blue_sat);
+        check(c.status == LINE_CALIB_OK, "blue", "calibration succeeds on the blue line");
+        check(c.target_reflect == TARGET_REFLECT, "blue", "value target stays at the default without black");
+        check(c.blue_sat > 0 && c.target_hsv > white_sat && c.target_hsv < blue_sat, "blue",
+              "saturation target lies between white and blue");
+        SimLoop loop(course, cfg);
+        loop.setCalibration(c);
+        simresult_t r = loop.run(&gains, RUN_LAPS, RUN_LIMIT_S);
+        print_run("blue", "calibrated", r);
+        check(r.completed && !r.lost, "blue", "run with the blue calibration completes");
+    }
+
+    // -------- ラインのない所 --------
+    {
+        CourseImage off = course;
+        off.start_y = course.start_y - 200.0;
+        double heading;
+        linecalib_t c = calibrate(off, SIM_DEFAULT_CONFIG, &heading);
+        print_calib("offline", c, 0, heading);
+        check(c.status == LINE_CALIB_POOR, "offline", "no line is reported as poor");
+        check(c.target_reflect == TARGET_REFLECT && c.target_hsv == TARGET_HSV, "offline",
+              "poor calibration keeps the default targets");
+    }
+
+    // -------- 走行: マクロの値と決めた値 --------
+    printf("%-8s %-10s %4s %4s %7s %6s %6s %5s\n", "light", "mode", "done", "lost", "time", "cte", "max", "off");
+    int off_default = 0, off_calib = 0;
+    for (int i = 0; i < n_lights; i++)
+    {
+        const light_t &l = LIGHTS[i];
+        simconfig_t cfg = SIM_DEFAULT_CONFIG;
+        cfg.raw_gain = l.gain;
+        cfg.raw_offset = l.offset;
+        SimLoop loop(course, cfg);
+        simresult_t d = loop.run(&gains, RUN_LAPS, RUN_LIMIT_S);
+        print_run(l.name, "default", d);
+        loop.setCalibration(calibs[i]);
+        simresult_t c = loop.run(&gains, RUN_LAPS, RUN_LIMIT_S);
+        print_run(l.name, "calibrated", c);
+        off_default += d.completed ? d.excursions : d.excursions + 1000; // 完走しなければ大きく数える
+        off_calib += c.completed ? c.excursions : c.excursions + 1000;
+        check(c.completed && !c.lost, l.name, "calibrated run completes without losing the line");
+    }
+    printf("%-8s default off %d, calibrated off %d (+1000 per unfinished run)\n", "total", off_default, off_calib);
+    check(off_calib <= off_default, "total", "calibrated runs leave the line no more often than the defaults");
+
+    printf("columns    qual = between/total variance of the value [%%], tgt/true = value target and the\n"
+           "           black/white midpoint, hsv = saturation target, head = heading after the sweep [deg]\n");
+    printf("checks     %s (%d failed)\n", failures ? "FAILED" : "ok", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,286 @@
+/**
+ * @file bench_capture.cpp
+ * @brief Bluetooth の出力の取り込み(LogCapture)の確認と取り込みの速度
+ *
+ * @note 一時ディレクトリの元のファイルに,実機の RATE_X 倍の速さで KHLG のストリームを追記していき
+ *       (シミュレータの __ev3rt_bt_out の代わり),別スレッドの LogCapture::tail が走行ごとのファイルに分ける。
+ *       ストリームは DataLogger で作り,フレームの間に応答('C')を,最後に 'P' と 'U' を書く。
+ *       走行は 完走 -> 完走 -> 途中で止まる('U' なし) -> 完走 -> 元のファイルの切り詰め -> 途中で止まる。
+ *
+ *       確認項目(どれかが合わなければ終了コード 1):
+ *        - 走行ごとのファイルは書いた走行のバイト列と1byteも違わない(フレームを落とさない)
+ *        - 'U' で終わった走行だけ complete, ファイルは LogDecoder で欠けずに復号できる
+ *        - --latest のリンクは最後の走行を,ライブビューは最後のフレームを指す
+ *        - 1byte ずつ渡しても同じに分ける, MAKE_LOG_RAW のストリームは1走行でフレームを数える
+ *        - 書き込みを終えてから CATCHUP_MS 以内に全部読む
+ *       最後に待たずに全部渡したときの取り込みの速度[MB/s]を出す(確認はしない)。
+ */
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "bench_util.h"
+#include "logging/DataLogger.h"
+#include "LogCapture.h"
+
+#define FRAMES 100000       // 1走行のフレーム数(実機の 400 秒分)
+#define RATE_X 1000         // 実機(4ms 周期)の何倍の速さで書くか
+#define TICK_US 1000        // 書き込みの間隔[us]
+#define CATCHUP_MS 2000     // 書き込みを終えてから読み終えるまでの上限[ms]
+#define RUNS 5
+
+static int failures = 0;
+
+static void check(bool ok, const char *scenario, const char *what)
+{
+    if (!ok)
+    {
+        printf("FAIL  %s: %s\n", scenario, what);
+        failures++;
+    }
+}
+
+/** 1走行のストリーム, complete なら最後に 'P' と 'U' を書く */
+static std::vector<uint8_t> make_run(int seed, int frames, bool complete, logframe_t *last)
+{
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *fp = open_memstream(&buf, &size);
+    DataLogger *logger = new DataLogger();
+    logframe_t f = logframe_t();
+    uint32_t x = (uint32_t)seed * 2654435761u + 1;
+    for (int i = 0; i < frames; i++)
+    {
+        f.count_time = (unsigned int)i * 4;
+        int32_t w[LOG_CHANNELS];
+        memcpy(w, &f, sizeof(w));
+        for (int k = 1; k < LOG_CHANNELS; k++) // 小さな変化(ほとんど1byte の残差)
+        {
+            x = x * 1103515245u + 12345u;
+            if ((x >> 28) < 4)
+                w[k] += (int32_t)((x >> 16) & 7) - 3;
+        }
+        memcpy(&f, w, sizeof(w));
+        logger->put(f);
+        if ((i & 31) == 31)
+            logger->drain(fp);
+        if (i % 1000 == 999)
+        {
+            logger->drain(fp);
+            const uint8_t reply[] = {0xA5, 2, 0x81, (uint8_t)i, 0, 0x5a};
+            logger->writeRecord(fp, LOG_TAG_COMMAND, reply, sizeof(reply));
+        }
+    }
+    logger->drain(fp);
+    if (complete)
+    {
+        logger->writeRecord(fp, LOG_TAG_PROFILE, "profile\n", 8);
+        logger->writeRecord(fp, LOG_TAG_STARTUP, "startup\n", 8);
+    }
+    fclose(fp);
+    std::vector<uint8_t> out(buf, buf + size);
+    free(buf);
+    delete logger;
+    *last = f;
+    return out;
+}
+
+static std::vector<uint8_t> read_file(const std::string &path)
+{
+    std::vector<uint8_t> data;
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (fp == NULL)
+        return data;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        data.insert(data.end(), buf, buf + n);
+    fclose(fp);
+    return data;
+}
+
+/** 欠けずに復号できるフレーム数, 壊れていれば -1 */
+static long decode_frames(const std::vector<uint8_t> &data)
+{
+    LogDecoder dec;
+    const uint8_t *p = data.data();
+    const uint8_t *end = p + data.size();
+    long n = 0;
+    while (dec.next(p, end))
+        n++;
+    return (dec.error() || p != end) ? -1 : n;
+}
+
+static void remove_dir(const std::string &dir)
+{
+    std::string cmd = "rm -rf '" + dir + "'";
+    if (system(cmd.c_str()) != 0)
+        perror("rm");
+}
+
+int main()
+{
+    // -------- 走行のストリーム --------
+    const bool complete[RUNS] = {true, true, false, true, false};
+    std::vector<uint8_t> run[RUNS];
+    logframe_t last[RUNS];
+    size_t total = 0;
+    for (int r = 0; r < RUNS; r++)
+    {
+        run[r] = make_run(r + 1, FRAMES, complete[r], &last[r]);
+        total += run[r].size();
+    }
+    const double bytes_per_frame = (double)total / (RUNS * FRAMES);
+    const size_t chunk = (size_t)(bytes_per_frame * 250 * RATE_X * TICK_US / 1e6); // 実機は 250 frames/s
+
+    char tmpl[] = "/tmp/bench_capture_XXXXXX";
+    const std::string dir = mkdtemp(tmpl);
+    const std::string src = dir + "/__ev3rt_bt_out";
+    capconfig_t cfg;
+    cfg.dir = dir + "/logs";
+    cfg.prefix = "log";
+    cfg.live = dir + "/live.txt";
+    cfg.latest = dir + "/log.dat";
+    cfg.keep = 0;
+    cfg.verbose = false;
+    mkdir(cfg.dir.c_str(), 0755);
+
+    // -------- 取り込み(別スレッド)と書き込み --------
+    LogCapture cap(cfg);
+    std::atomic<bool> stop(false);
+    std::thread reader([&] { cap.tail(src.c_str(), stop, false); });
+
+    int fd = open(src.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    size_t written = 0, max_lag = 0;
+    const uint64_t t0 = bench_now_ns();
+    uint64_t next = t0;
+    for (int r = 0; r < RUNS; r++)
+    {
+        if (r == RUNS - 1) // シミュレータの再起動: 読み終えてから切り詰める
+        {
+            while (cap.getConsumed() < written)
+                usleep(1000);
+            if (ftruncate(fd, 0) != 0)
+                perror("ftruncate");
+            written = 0;
+        }
+        for (size_t off = 0; off < run[r].size(); off += chunk)
+        {
+            const size_t n = std::min(chunk, run[r].size() - off);
+            if (write(fd, run[r].data() + off, n) != (ssize_t)n)
+                perror("write");
+            written += n;
+            const uint64_t consumed = cap.getConsumed();
+            if (written > consumed && r < RUNS - 1)
+                max_lag = std::max(max_lag, (size_t)(written - consumed));
+            next += TICK_US * 1000ull;
+            const uint64_t now = bench_now_ns();
+            if (next > now)
+                usleep((useconds_t)((next - now) / 1000));
+        }
+    }
+    const uint64_t t1 = bench_now_ns();
+    close(fd);
+    const uint64_t target = written;
+    while (bench_now_ns() - t1 < CATCHUP_MS * 1000000ull && cap.getConsumed() < target + (total - run[RUNS - 1].size()))
+        usleep(1000);
+    const double catchup_ms = (bench_now_ns() - t1) * 1e-6;
+    stop = true;
+    reader.join();
+    const double secs = (t1 - t0) * 1e-9;
+
+    // -------- 確認 --------
+    {
+        const char *sc = "tail";
+        const std::vector<LogCapture::run_t> &runs = cap.runs();
+        check(runs.size() == RUNS, sc, "one file per run");
+        for (size_t r = 0; r < runs.size() && r < RUNS; r++)
+        {
+            const std::vector<uint8_t> data = read_file(runs[r].path);
+            char what[64];
+            snprintf(what, sizeof(what), "run %zu bytes equal the stream", r);
+            check(data == run[r], sc, what);
+            snprintf(what, sizeof(what), "run %zu complete flag", r);
+            check(runs[r].complete == complete[r], sc, what);
+            snprintf(what, sizeof(what), "run %zu decodes all frames", r);
+            check(decode_frames(data) == FRAMES && runs[r].frames == FRAMES, sc, what);
+        }
+        char link[4096];
+        const ssize_t n = readlink(cfg.latest.c_str(), link, sizeof(link) - 1);
+        check(n > 0 && !runs.empty() && std::string(link, n).find(runs.back().path.substr(runs.back().path.rfind('/'))) !=
+                                             std::string::npos,
+              sc, "latest link points to the last run");
+        const std::vector<uint8_t> live = read_file(cfg.live);
+        const std::string text(live.begin(), live.end());
+        char want[32];
+        snprintf(want, sizeof(want), "\n%u\t", last[RUNS - 1].count_time);
+        check(text.find("COUNT_time") != std::string::npos && text.find(want) != std::string::npos, sc,
+              "live view shows the last frame");
+        check(cap.getSkipped() == 0, sc, "no bytes skipped");
+        check(catchup_ms < CATCHUP_MS, sc, "caught up after the writer stopped");
+    }
+
+    // -------- 1byte ずつ, MAKE_LOG_RAW --------
+    {
+        const char *sc = "feed";
+        capconfig_t c2 = cfg;
+        c2.dir = dir + "/bytes";
+        c2.live = "";
+        c2.latest = "";
+        mkdir(c2.dir.c_str(), 0755);
+        std::vector<LogCapture::run_t> runs;
+        {
+            LogCapture one(c2);
+            for (int r = 0; r < 2; r++)
+                for (size_t i = 0; i < run[r].size(); i++)
+                    one.feed(&run[r][i], 1);
+            one.finish();
+            runs = one.runs();
+        }
+        check(runs.size() == 2 && read_file(runs[0].path) == run[0] && read_file(runs[1].path) == run[1], sc,
+              "byte-by-byte feed splits the same runs");
+
+        std::vector<uint8_t> raw;
+        for (int i = 0; i < 1000; i++)
+        {
+            int32_t v[7] = {i * 4, 0, i % 50, 0, 0, 0, 0};
+            raw.insert(raw.end(), (const uint8_t *)v, (const uint8_t *)v + sizeof(v));
+        }
+        LogCapture rawcap(c2);
+        for (size_t off = 0; off < raw.size(); off += 100)
+            rawcap.feed(&raw[off], std::min((size_t)100, raw.size() - off));
+        rawcap.finish();
+        check(rawcap.runs().size() == 1 && rawcap.runs()[0].frames == 1000 && read_file(rawcap.runs()[0].path) == raw, sc,
+              "raw stream is one run");
+    }
+
+    // -------- 取り込みだけの速度(待たずに CAP_READ_BYTES ずつ渡す) --------
+    double feed_mbs;
+    {
+        capconfig_t c3 = cfg;
+        c3.dir = dir + "/fast";
+        c3.latest = "";
+        mkdir(c3.dir.c_str(), 0755);
+        LogCapture fast(c3);
+        const uint64_t f0 = bench_now_ns();
+        for (int r = 0; r < RUNS; r++)
+            for (size_t off = 0; off < run[r].size(); off += CAP_READ_BYTES)
+                fast.feed(run[r].data() + off, std::min((size_t)CAP_READ_BYTES, run[r].size() - off));
+        fast.finish();
+        feed_mbs = total / ((bench_now_ns() - f0) * 1e-9) * 1e-6;
+        check(fast.getFrames() == (unsigned long)RUNS * FRAMES, "fast", "all frames");
+    }
+
+    printf("capture: %d runs, %.1f MB in %.2f s (%.1f MB/s, %.0fx the robot's %.1f KB/s), max lag %zu bytes, "
+           "caught up %.0f ms after the writer stopped; unpaced %.0f MB/s\n",
+           RUNS, total * 1e-6, secs, total / secs * 1e-6, total / secs / (bytes_per_frame * 250), bytes_per_frame * 250 * 1e-3,
+           max_lag, catchup_ms, feed_mbs);
+    remove_dir(dir);
+    printf("%s (%d failures)\n", failures ? "FAIL" : "PASS", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,549 @@
+/**
+ * @file bench_command.cpp
+ * @brief Bluetooth のコマンド(CommandChannel)と走行中の調整値の反映(DoubleBuffer)の確認
+ *
+ * @note 疑似端末(pty)を Bluetooth のシリアルの代わりにする。スレーブ側がロボット,マスター側がPC。
+ *       ロボット側は SimLoop と同じく TracerCore と SimWorld を直結し,4ms周期ごとに
+ *       受信したバイトを feed/handle する(bt_task) -> TracerCore::step(tracer_task) ->
+ *       ログのフレームと応答の 'C' レコードを書き出す(logger_task) を繰り返す。
+ *       PC側は決めた周期にコマンドのフレームを書き,走行の後でログを LogDecoder で読んで
+ *       応答(records)とフレームの値を確かめる。
+ *       最後に,DoubleBuffer の読み出しの途中(印を付けた直後と面のコピーの途中)に公開を挟み
+ *       (EV3 では bt_task が tracer_task より優先度が高いので起きる。hostsim は bt_task を動かさない),
+ *       別スレッドの書き込み側と読み出し側でも組が途中で混ざらないことを確かめる。
+ *
+ *       確認項目(どれかが合わなければ終了コード 1):
+ *        - CMD_GET は既定の調整値を返す
+ *        - CMD_SET だけでは反映しない(CMD_COMMIT までフレームの値も CMD_GET も変わらない)
+ *        - CMD_COMMIT した組は次の周期の始めに反映し,その周期のフレームから prm.seq が付く
+ *        - CRC の壊れたフレームとごみは応答せずに数え,次のフレームは受け付ける
+ *        - 知らない番号,範囲外の値,知らないコマンド,長さ違いはそれぞれのエラーを返す
+ *        - CMD_REMOTE_START とフレームの外の '1' でリモートスタートする
+ *        - DrivingStage 999 を反映すると走行を終える
+ *        - ログは欠けずに復号できる
+ *        - DoubleBuffer は読み出しの途中に公開されても組が混ざらず,読んでいる面への公開だけ断り,次に最新の組を読む
+ *        - DoubleBuffer は別スレッドでも読み出した組が途中で混ざらず,最後の組を読む
+ */
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * DoubleBuffer の順序保証に,読み出しの途中に bt_task が割り込む代わりのフックを挟む
+ * (ホストビルドと同じフェンスのあとで dbuf_hook を1回だけ呼ぶ)
+ */
+static void (*dbuf_hook)() = NULL;
+static inline void dbuf_fence()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    void (*f)() = dbuf_hook;
+    if (f != NULL)
+    {
+        dbuf_hook = NULL;
+        f();
+    }
+}
+#define DBUF_FENCE() dbuf_fence()
+
+#include "bench_util.h"
+#include "ev3api_stub.h"
+#include "SimLoop.h"
+#include "comm/CommandChannel.h"
+#include "logging/LogDecoder.h"
+
+#define RUN_CYCLES 600         // 走行の上限の周期数
+#define STRESS_FETCH 20000     // DoubleBuffer の読み出し側がこれだけ読むまで書き込み側が公開し続ける
+#define STRESS_PACE_NS 500     // 書き込み側の公開の間隔[ns]
+
+static int failures = 0;
+
+static void check(bool ok, const char *scenario, const char *what)
+{
+    if (!ok)
+    {
+        printf("FAIL  %s: %s\n", scenario, what);
+        failures++;
+    }
+}
+
+/** PC側が送るもの: 周期 cycle の始めまでに bytes を書く */
+struct send_t
+{
+    int cycle;
+    std::vector<uint8_t> bytes;
+};
+
+static std::vector<send_t> script;
+static uint8_t next_seq = 1;
+
+/** コマンドのフレームを送る, 通し番号を返す */
+static uint8_t send(int cycle, uint8_t cmd, const uint8_t *payload, int len, bool corrupt = false)
+{
+    cmdmsg_t m;
+    m.cmd = cmd;
+    m.seq = next_seq++;
+    m.len = (uint8_t)len;
+    memcpy(m.payload, payload, len);
+    uint8_t buf[CMD_FRAME_MAX];
+    int n = CommandChannel::encode(&m, buf);
+    if (corrupt)
+        buf[n - 1] ^= 0x5a;
+    send_t s;
+    s.cycle = cycle;
+    s.bytes.assign(buf, buf + n);
+    script.push_back(s);
+    return m.seq;
+}
+
+static uint8_t send_get(int cycle, uint8_t id)
+{
+    return send(cycle, CMD_GET, &id, 1);
+}
+
+static uint8_t send_set(int cycle, uint8_t id, int32_t value, bool corrupt = false)
+{
+    uint8_t p[5];
+    p[0] = id;
+    CommandChannel::putValue(&p[1], value);
+    return send(cycle, CMD_SET, p, 5, corrupt);
+}
+
+static void send_raw(int cycle, const uint8_t *bytes, int n)
+{
+    send_t s;
+    s.cycle = cycle;
+    s.bytes.assign(bytes, bytes + n);
+    script.push_back(s);
+}
+
+/** fd から読めるだけ読む(ノンブロッキング) */
+static void read_all(int fd, std::vector<uint8_t> *out)
+{
+    uint8_t buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        out->insert(out->end(), buf, buf + n);
+}
+
+/** 走行の結果 */
+struct result_t
+{
+    std::vector<logframe_t> frames;    /* 復号したフレーム */
+    std::map<int, cmdmsg_t> replies;   /* 通し番号 -> 応答 */
+    bool decode_error;
+    int bad_replies;                   /* 復号できなかった 'C' レコード */
+    int wakeup_cycle;                  /* 走行を終えた周期, -1 なら終えなかった */
+    bool start;
+    uint32_t frames_rx, errors, commits;
+};
+
+static bool run(const CourseImage &course, result_t *r)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+    {
+        perror("posix_openpt");
+        return false;
+    }
+    int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    if (slave < 0)
+    {
+        perror("open pty");
+        return false;
+    }
+    struct termios tio;
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio); // バイナリをそのまま通す(エコー, 改行の変換なし)
+    tcsetattr(slave, TCSANOW, &tio);
+    fcntl(master, F_SETFL, O_NONBLOCK);
+    fcntl(slave, F_SETFL, O_NONBLOCK);
+    FILE *bt = fdopen(dup(slave), "wb"); // ロボット側の書き出し(logger_task)
+
+    SimWorld world(course);
+
+    SimRobotIo io(world);
+    static TracerCore core; // 1つの翻訳単位に1つ
+    static DataLogger logger;
+    static CommandChannel channel;
+    static DoubleBuffer<tracerparams_t> params;
+    core.setParamBuffer(&params);
+    cycleinput_t in = cycleinput_t();
+    cycleoutput_t out;
+    logframe_t frame;
+    std::vector<uint8_t> rx; // PC側の受信
+    r->wakeup_cycle = -1;
+
+    size_t next = 0;
+    for (int cycle = 0; cycle < RUN_CYCLES; cycle++)
+    {
+        // -------- PC側: 送る --------
+        for (; next < script.size() && script[next].cycle <= cycle; next++)
+            if (write(master, script[next].bytes.data(), script[next].bytes.size()) < 0)
+                perror("write pty");
+
+        // -------- bt_task: 受信したバイトを実行する --------
+        uint8_t c;
+        while (read(slave, &c, 1) == 1)
+            if (channel.feed(c))
+            {
+                tracerparams_t live;
+                core.getParams(&live);
+                channel.handle(&live, &params);
+            }
+
+        // -------- tracer_task --------
+        world.advanceTo(SIM_CYCLE_PHASE_US + (uint64_t)cycle * SIM_CYCLE_US);
+        io.read(core.getDue(), &in);
+        core.step(&in, &out, &frame);
+        io.write(&in, &out);
+        logger.put(frame);
+
+        // -------- logger_task --------
+        logger.drain(bt);
+        cmdframe_t f;
+        while (channel.popReply(&f))
+            logger.writeRecord(bt, LOG_TAG_COMMAND, f.buf, f.len);
+        fflush(bt);
+        read_all(master, &rx);
+
+        if (out.wakeup_main && r->wakeup_cycle < 0)
+            r->wakeup_cycle = cycle;
+        if (r->wakeup_cycle >= 0 && cycle >= r->wakeup_cycle + 10 && next == script.size())
+            break;
+    }
+    fclose(bt);
+    usleep(10000);
+    read_all(master, &rx);
+    close(slave);
+    close(master);
+
+    // -------- PC側: ログを読む --------
+    LogDecoder dec;
+    const uint8_t *p = rx.data();
+    const uint8_t *end = p + rx.size();
+    while (dec.next(p, end))
+    {
+        logframe_t f;
+        memcpy(&f, dec.values(), sizeof(f));
+        r->frames.push_back(f);
+    }
+    r->decode_error = dec.error() || p != end;
+    r->bad_replies = 0;
+    for (size_t i = 0; i < dec.records().size(); i++)
+    {
+        if (dec.records()[i].first != LOG_TAG_COMMAND)
+            continue;
+        const std::string &s = dec.records()[i].second;
+        cmdmsg_t m;
+        if (CommandChannel::decode((const uint8_t *)s.data(), (int)s.size(), &m) && (m.cmd & CMD_REPLY))
+            r->replies[m.seq] = m;
+        else
+            r->bad_replies++;
+    }
+    r->start = channel.isStartRequested();
+    r->frames_rx = channel.getFrames();
+    r->errors = channel.getErrors();
+    r->commits = channel.getCommits();
+    return true;
+}
+
+/** 応答の結果, 応答がなければ -1 */
+static int status(const result_t &r, uint8_t seq)
+{
+    std::map<int, cmdmsg_t>::const_iterator it = r.replies.find(seq);
+    return (it == r.replies.end() || it->second.len < 1) ? -1 : it->second.payload[0];
+}
+
+/** CMD_GET の応答の値 */
+static bool value(const result_t &r, uint8_t seq, int32_t *v)
+{
+    std::map<int, cmdmsg_t>::const_iterator it = r.replies.find(seq);
+    if (it == r.replies.end() || it->second.len != 6 || it->second.payload[0] != CMD_OK)
+        return false;
+    *v = CommandChannel::getValue(&it->second.payload[2]);
+    return true;
+}
+
+/** DoubleBuffer の読み出しの途中に公開を挟む組, 値はどれも公開の回数 */
+struct probe_t
+{
+    int32_t value[PARAM_COUNT];
+
+    probe_t() : value() {}
+    explicit probe_t(int32_t gen)
+    {
+        for (int i = 0; i < PARAM_COUNT; i++)
+            value[i] = gen;
+    }
+    probe_t &operator=(const probe_t &o);
+};
+
+static DoubleBuffer<probe_t> probe_buf;
+static probe_t *probe_dest = NULL;  // fetch の読み出し先
+static void (*copy_hook)() = NULL;  // 読み出し先へのコピーの途中で1回だけ呼ぶ
+static int32_t probe_gen = 0;       // 最後に公開しようとした組
+static int probe_ok = 0, probe_busy = 0;
+
+/** 面のコピー, 読み出し先へのコピーなら半分書いたところで copy_hook を呼ぶ */
+probe_t &probe_t::operator=(const probe_t &o)
+{
+    for (int i = 0; i < PARAM_COUNT; i++)
+    {
+        if (i == PARAM_COUNT / 2 && this == probe_dest && copy_hook != NULL)
+        {
+            void (*f)() = copy_hook;
+            copy_hook = NULL;
+            f();
+        }
+        value[i] = o.value[i];
+    }
+    return *this;
+}
+
+/** bt_task の代わり: 次の組を1回公開する */
+static void probe_publish()
+{
+    if (probe_buf.publish(probe_t(++probe_gen)))
+        probe_ok++;
+    else
+        probe_busy++;
+}
+
+/** bt_task の代わり: 続けて2回公開する(2回目は読んでいる面に当たる) */
+static void probe_publish2()
+{
+    probe_publish();
+    probe_publish();
+}
+
+static bool probe_whole(const probe_t &t, int32_t gen)
+{
+    bool ok = true;
+    for (int i = 0; i < PARAM_COUNT; i++)
+        ok = ok && t.value[i] == gen;
+    return ok;
+}
+
+/**
+ * @brief 読み出しの途中に公開を挟む
+ * @param mark true: 印を付けた直後(確認の前)に挟む, false: 面のコピーの途中に挟む
+ * @param twice 2回公開する
+ */
+static void interleave(const char *sc, bool mark, bool twice)
+{
+    probe_t t;
+    while (probe_buf.fetch(&t)) // 前の分を読み切る
+        ;
+    probe_publish();
+    const int32_t base = probe_gen;
+    probe_ok = probe_busy = 0;
+    probe_dest = &t;
+    if (mark)
+        dbuf_hook = twice ? probe_publish2 : probe_publish;
+    else
+        copy_hook = twice ? probe_publish2 : probe_publish;
+    const bool got = probe_buf.fetch(&t);
+    probe_dest = NULL;
+    dbuf_hook = NULL;
+    copy_hook = NULL;
+
+    // 印の直後なら読み直して最初に挟んだ組を,コピーの途中ならはじめの組を混ぜずに読む
+    const int32_t want = mark ? base + 1 : base;
+    check(got && probe_whole(t, want), sc, "the fetched set is whole and is the newest one the reader saw");
+    check(probe_ok == 1 && probe_busy == (twice ? 1 : 0), sc,
+          "a publish into the other face succeeds and only the face being read is refused");
+    if (twice)
+    {
+        probe_gen--; // 断られた組をやり直す(CMD_ERR_BUSY を受けた PC が送り直す)
+        probe_publish();
+        check(probe_ok == 2, sc, "the refused set is accepted after the fetch");
+    }
+    if (want != probe_gen) // 読んだ組より新しい組が残っている
+        check(probe_buf.fetch(&t) && probe_whole(t, probe_gen), sc, "the next fetch returns the latest set");
+    check(!probe_buf.fetch(&t), sc, "nothing more to fetch");
+}
+
+/** DoubleBuffer: 別スレッドの書き込み側と読み出し側, 組の値はどれも公開の回数 */
+static void stress(long *published, long *fetched, long *torn, long *busy, bool *last)
+{
+    DoubleBuffer<tracerparams_t> buf;
+    std::atomic<long> nfetched(0);
+    std::atomic<bool> done(false);
+    long nbusy = 0;
+    uint32_t gen = 0;
+
+    std::thread writer([&] {
+        tracerparams_t t;
+        while (nfetched.load(std::memory_order_relaxed) < STRESS_FETCH)
+        {
+            gen++;
+            for (int i = 0; i < PARAM_COUNT; i++)
+                t.value[i] = (int32_t)gen;
+            t.set = t.stage_req = gen;
+            while (!buf.publish(t))
+                nbusy++;
+            // 読み出し側は読む間に次が公開されるとやり直すので,休まず公開し続けると追いつけない
+            // (bt_task はコマンド1つにつき1回だけ公開する)。1コアのマシンでは読み出し側に譲る
+            std::this_thread::yield();
+            const uint64_t until = bench_now_ns() + STRESS_PACE_NS;
+            while (bench_now_ns() < until)
+                ;
+        }
+        done.store(true);
+    });
+
+    uint32_t prev = 0;
+    long ntorn = 0;
+    tracerparams_t t;
+    while (true)
+    {
+        const bool finished = done.load();
+        while (buf.fetch(&t))
+        {
+            bool ok = t.set > prev && t.stage_req == t.set;
+            for (int i = 0; i < PARAM_COUNT; i++)
+                ok = ok && t.value[i] == (int32_t)t.set;
+            if (!ok)
+                ntorn++;
+            prev = t.set;
+            nfetched.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (finished)
+            break;
+        std::this_thread::yield();
+    }
+    writer.join();
+    *published = gen;
+    *fetched = nfetched.load();
+    *torn = ntorn;
+    *busy = nbusy;
+    *last = (prev == gen);
+}
+
+int main()
+{
+    CourseImage course;
+    course.generateOval(2000.0, 600.0);
+    course.buildLineDistance();
+
+    // -------- PC側の台本 --------
+    const uint8_t get_power = send_get(20, PARAM_POWER);
+    const uint8_t get_kp = send_get(20, PARAM_KP_REFLECT);
+    const uint8_t get_target = send_get(20, PARAM_TARGET_REFLECT);
+    const uint8_t set_target = send_set(40, PARAM_TARGET_REFLECT, 40);
+    const uint8_t set_power = send_set(40, PARAM_POWER, 50);
+    const uint8_t get_staged = send_get(80, PARAM_POWER);
+    const int COMMIT_CYCLE = 120;
+    const uint8_t commit = send(COMMIT_CYCLE, CMD_COMMIT, NULL, 0);
+    const uint8_t get_applied = send_get(130, PARAM_POWER);
+    const uint8_t set_corrupt = send_set(140, PARAM_POWER, 10, true);
+    const uint8_t garbage[] = {0x00, 0xff, 'x', CMD_SOF, 200}; // フレームの外のごみ, 長さの壊れたフレーム
+    send_raw(140, garbage, sizeof(garbage));
+    const uint8_t get_after = send_get(140, PARAM_POWER);
+    const uint8_t get_bad_id = send_get(150, 99);
+    const uint8_t set_range = send_set(150, PARAM_POWER, 150);
+    const uint8_t set_bad_stage = send_set(150, PARAM_STAGE, 5);
+    const uint8_t bad_cmd = send(160, 0x30, NULL, 0);
+    const uint8_t get_no_id = send(160, CMD_GET, NULL, 0);
+    const uint8_t start = send(170, CMD_REMOTE_START, NULL, 0);
+    const int STAGE_CYCLE = 400;
+    const uint8_t set_stage = send_set(STAGE_CYCLE, PARAM_STAGE, 999);
+    const uint8_t commit_stage = send(STAGE_CYCLE, CMD_COMMIT, NULL, 0);
+    const uint8_t get_stage = send_get(STAGE_CYCLE + 5, PARAM_STAGE);
+
+    result_t r = result_t();
+    if (!run(course, &r))
+        return 1;
+
+    printf("command channel over pty: %zu frames, %zu replies, rx frames %u, errors %u, commits %u\n",
+           r.frames.size(), r.replies.size(), (unsigned)r.frames_rx, (unsigned)r.errors, (unsigned)r.commits);
+    check(!r.decode_error && r.bad_replies == 0, "log", "log and reply records decode");
+    check(r.wakeup_cycle >= 0 && r.frames.size() == (size_t)r.wakeup_cycle + 11, "log", "every cycle is logged");
+
+    int32_t v;
+    check(value(r, get_power, &v) && v == MOTOR_POWER, "get", "power returns the default");
+    check(value(r, get_kp, &v) && v == (int32_t)(TRACER_DEFAULT_GAINS.kp_reflect * PARAM_GAIN_SCALE + 0.5f), "get",
+          "kp.reflect returns the default gain x1000");
+    const int32_t target0 = r.frames.empty() ? -1 : r.frames[0].cal_reflect;
+    check(value(r, get_target, &v) && v == target0, "get", "target.reflect returns the live target");
+
+    // -------- SET だけでは変わらない, COMMIT の次の周期の始めに反映する --------
+    check(status(r, set_target) == CMD_OK && status(r, set_power) == CMD_OK, "set", "set is accepted");
+    check(value(r, get_staged, &v) && v == MOTOR_POWER, "set", "set without commit keeps the live value");
+    bool before = true, after = true;
+    int max_before = 0, max_after = 0;
+    for (int k = 0; k < (int)r.frames.size(); k++)
+    {
+        const logframe_t &f = r.frames[k];
+        if (k < COMMIT_CYCLE)
+        {
+            before = before && f.cal_reflect == target0 && f.prm_seq == 0;
+            max_before = std::max(max_before, f.power);
+        }
+        else
+        {
+            after = after && f.cal_reflect == 40 && f.prm_seq >= 1;
+            if (k >= COMMIT_CYCLE + 50 && f.stage == 0)
+                max_after = std::max(max_after, f.power);
+        }
+    }
+    check(before, "commit", "nothing changes before commit");
+    check(after, "commit", "the committed set applies from the next cycle");
+    check(status(r, commit) == CMD_OK && CommandChannel::getValue(&r.replies[commit].payload[1]) == 1, "commit",
+          "commit replies the set number");
+    check(value(r, get_applied, &v) && v == 50, "commit", "get returns the committed power");
+    check(max_before > 50 && max_after > 0 && max_after <= 50, "commit", "frames run at the committed power");
+
+    // -------- 壊れたフレーム, エラー --------
+    check(status(r, set_corrupt) == -1, "crc", "a corrupted frame gets no reply");
+    check(r.errors == 2, "crc", "the corrupted and the bad-length frames are counted");
+    check(value(r, get_after, &v) && v == 50, "crc", "the next frame is accepted and the value is unchanged");
+    check(status(r, get_bad_id) == CMD_ERR_ID, "error", "unknown id");
+    check(status(r, set_range) == CMD_ERR_RANGE, "error", "power out of range");
+    check(status(r, set_bad_stage) == CMD_ERR_RANGE, "error", "unknown stage");
+    check(status(r, bad_cmd) == CMD_ERR_CMD, "error", "unknown command");
+    check(status(r, get_no_id) == CMD_ERR_LEN, "error", "wrong payload length");
+    check(status(r, start) == CMD_OK && r.start, "start", "remote start");
+
+    // -------- DrivingStage --------
+    check(status(r, set_stage) == CMD_OK && status(r, commit_stage) == CMD_OK, "stage", "stage 999 is committed");
+    check(r.wakeup_cycle == STAGE_CYCLE, "stage", "stage 999 ends the run at the next cycle");
+    check(value(r, get_stage, &v) && v == 999, "stage", "get returns the live stage");
+    check(r.commits == 2 && r.frames.back().prm_seq == 2, "stage", "the log carries the second set");
+
+    // 単独の '1' のリモートスタート
+    {
+        CommandChannel ch;
+        ch.feed(CMD_LEGACY_START);
+        check(ch.isStartRequested() && ch.getFrames() == 0, "start", "legacy '1' outside a frame");
+    }
+
+    // -------- DoubleBuffer: 読み出しの途中に bt_task が割り込む --------
+    interleave("dbuf mark", true, false);
+    interleave("dbuf mark x2", true, true);
+    interleave("dbuf copy", false, false);
+    interleave("dbuf copy x2", false, true);
+    printf("double buffer interleave: publish after the mark and in the middle of the copy, %u sets\n",
+           (unsigned)probe_buf.getSeq());
+
+    // -------- DoubleBuffer: 別スレッド --------
+    long published, fetched, torn, busy;
+    bool last;
+    const uint64_t t0 = bench_now_ns();
+    stress(&published, &fetched, &torn, &busy, &last);
+    const double ms = (bench_now_ns() - t0) * 1e-6;
+    printf("double buffer: %ld published, %ld fetched, %ld torn, %ld busy retries, %.1f ms\n", published, fetched,
+           torn, busy, ms);
+    check(torn == 0, "dbuf", "no torn or out-of-order sets");
+    check(fetched >= STRESS_FETCH && last, "dbuf", "the reader sees the last set");
+
+    printf("checks     %s (%d failed)\n", failures ? "FAILED" : "ok", failures);
+    return failures ? 1 : 0;
+}
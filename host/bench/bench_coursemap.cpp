@@ -0,0 +1,136 @@
+/**
+ * @file bench_coursemap.cpp
+ * @brief コースマップ(CourseMap)と先読みの速度計画(LookaheadPlanner)の周回タイムの比較
+ *
+ * @note 長円コースを SimLoop で RUN_LAPS 周走らせ,
+ *        - 固定の前進速度 MOTOR_POWER (この走行でコースマップを記録する)
+ *        - 固定の前進速度 PLAN_POWER_MAX
+ *        - 前の走行のマップによる速度計画(MOTOR_POWER to PLAN_POWER_MAX)を2回続けて(マップは毎回記録し直す)
+ *       の時間を比べる。シミュレータには横方向の最大加速度(grip)を入れ,速すぎるとカーブで膨らむようにする。
+ *
+ *       確認項目(どれかが合わなければ終了コード 1):
+ *        - 保存したマップを読み込んで保存し直すと同じバイト列になり,壊れたマップは読み込まない
+ *        - 記録した方位の変化の合計が周回数 x 360deg と MAP_TURN_TOL_DEG 以内で合う
+ *        - 速度計画の走行がラインを見失わずに完走し,固定 MOTOR_POWER より PLAN_GAIN_MIN 以上速い
+ *        - grip のある条件で,速度計画の走行がラインからの距離(RMS)で固定 PLAN_POWER_MAX より小さい
+ */
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "ev3api_stub.h"
+#include "SimLoop.h"
+
+#define RUN_LAPS 2
+#define RUN_LIMIT_S 90.0
+#define MAP_TURN_TOL_DEG 10.0 // 記録した方位の変化の合計の許容誤差[deg]
+#define PLAN_GAIN_MIN 0.05    // 固定 MOTOR_POWER に対して短くなる時間の割合の下限
+
+typedef struct
+{
+    const char *name;
+    double straight, radius; /* 長円コース[mm] */
+    double grip_mps2;        /* 横方向の最大加速度 */
+} scenario_t;
+
+static const scenario_t SCENARIOS[] = {
+    {"oval r600", 2000.0, 600.0, 0.0},
+    {"oval r400", 2000.0, 400.0, 0.0},
+    {"r600 grip", 2000.0, 600.0, 0.6},
+    {"r400 grip", 2000.0, 400.0, 0.5},
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char *scenario, const char *what)
+{
+    if (!ok)
+    {
+        printf("FAIL  %s: %s\n", scenario, what);
+        failures++;
+    }
+}
+
+static void print(const char *scenario, const char *mode, const simresult_t &r, size_t map_bytes)
+{
+    printf("%-10s %-12s %4s %4s %7.2f %7.2f %6.1f %6zu\n", scenario, mode, r.completed ? "yes" : "no",
+           r.lost ? "LOST" : "-", r.time_s, r.last_lap_s, r.cte_rms_mm, map_bytes);
+}
+
+/** マップの形式の確認: 保存し直しが一致し,壊れたマップは読み込まない */
+static bool roundtrip(const std::vector<uint8_t> &bytes)
+{
+    CourseMap map;
+    if (!map.load(bytes.data(), (int)bytes.size()))
+        return false;
+    std::vector<uint8_t> again(CMAP_FILE_MAX);
+    again.resize(map.save(again.data(), (int)again.size()));
+    if (again != bytes)
+        return false;
+    std::vector<uint8_t> bad = bytes;
+    bad[0] ^= 0xff; // magic
+    if (map.load(bad.data(), (int)bad.size()) || map.getLength() != 0)
+        return false;
+    return !map.load(bytes.data(), (int)bytes.size() - 1); // 途中で切れている
+}
+
+/** 記録した方位の変化の合計[deg] */
+static double total_turn_deg(const std::vector<uint8_t> &bytes)
+{
+    CourseMap map;
+    map.load(bytes.data(), (int)bytes.size());
+    long sum = 0;
+    for (int i = 0; i < map.getLength(); i++)
+        sum += map.getCurv(i);
+    return sum * 360.0 / 65536.0;
+}
+
+static void run(const scenario_t &sc)
+{
+    CourseImage course;
+    course.generateOval(sc.straight, sc.radius);
+    course.buildLineDistance();
+    simconfig_t cfg = SIM_DEFAULT_CONFIG;
+    cfg.grip_mps2 = sc.grip_mps2;
+    SimLoop loop(course, cfg);
+
+    tracergains_t base = TRACER_DEFAULT_GAINS;
+    tracergains_t fast = TRACER_DEFAULT_GAINS;
+    fast.power = PLAN_POWER_MAX;
+    std::vector<uint8_t> map1, map2, map3;
+
+    simresult_t fixed = loop.run(&base, RUN_LAPS, RUN_LIMIT_S, NULL, &map1);
+    print(sc.name, "fixed base", fixed, map1.size());
+    simresult_t full = loop.run(&fast, RUN_LAPS, RUN_LIMIT_S);
+    print(sc.name, "fixed max", full, 0);
+    simresult_t plan1 = loop.run(&base, RUN_LAPS, RUN_LIMIT_S, &map1, &map2);
+    print(sc.name, "planned", plan1, map2.size());
+    simresult_t plan2 = loop.run(&base, RUN_LAPS, RUN_LIMIT_S, &map2, &map3);
+    print(sc.name, "planned x2", plan2, map3.size());
+
+    check(roundtrip(map1), sc.name, "course map saves, loads and rejects corrupt data");
+    check(std::fabs(total_turn_deg(map1) - 360.0 * RUN_LAPS) <= MAP_TURN_TOL_DEG, sc.name,
+          "recorded heading changes add up to the laps");
+    const simresult_t *plans[2] = {&plan1, &plan2};
+    for (int k = 0; k < 2; k++)
+    {
+        const simresult_t &p = *plans[k];
+        check(p.completed && !p.lost, sc.name, "planned run completes without losing the line");
+        check(p.time_s < fixed.time_s * (1.0 - PLAN_GAIN_MIN), sc.name, "planned run beats fixed base power");
+        if (sc.grip_mps2 > 0.0)
+            check(p.cte_rms_mm < full.cte_rms_mm, sc.name, "planned run tracks the line better than fixed max power");
+    }
+}
+
+int main()
+{
+    printf("lap time with the course map planner, %d laps (base power %d, max %d)\n", RUN_LAPS, MOTOR_POWER,
+           PLAN_POWER_MAX);
+    printf("%-10s %-12s %4s %4s %7s %7s %6s %6s\n", "scenario", "mode", "done", "lost", "time", "lastlap",
+           "cte", "map");
+    for (size_t i = 0; i < sizeof(SCENARIOS) / sizeof(SCENARIOS[0]); i++)
+        run(SCENARIOS[i]);
+    printf("columns    time, lastlap [s], cte = sensor distance from the line rms [mm], map = saved bytes\n");
+    printf("checks     %s (%d failed)\n", failures ? "FAILED" : "ok", failures);
+    return failures ? 1 : 0;
+}
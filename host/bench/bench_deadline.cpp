@@ -0,0 +1,237 @@
+/**
+ * @file bench_deadline.cpp
+ * @brief tracer_task の締め切り超過の検出(DeadlineMonitor)と縮退の比較
+ *
+ * @note SimLoop と同じく TracerCore と SimWorld を直結し,tracer_task の処理時間を模擬する。
+ *       処理時間はレートグループ表の仮の値(TRACER_RATE_TABLE の cost, 実機では測っていない)で,決めた時間帯だけ
+ *       センサ取得やロギングを遅くする(遅いスタブ: 超音波センサの応答待ち, Bluetooth の書き込み待ちなど)。
+ *       TRACER_CYC の起動要求は1つまでしか溜まらない(周期中の2つ目以降の起動は失われる)。
+ *       モーター出力は入力の取得と計算の後,ロギングの前に SimWorld に反映する。
+ *       検出だけ(off: 縮退しない)と縮退あり(on)で,超過の数とモーター出力のなかった周期の数を比べる。
+ *
+ *       確認項目(どれかが合わなければ終了コード 1):
+ *        - 遅いスタブなしでは超過も縮退もなく,全周期のフレームがログに残り,完走する
+ *        - off は超過してモーター出力のない周期が出る
+ *        - on はモーター出力のない周期が off の MISS_RATIO 以下で,遅い時間帯の後に縮退を抜け,完走する
+ *        - ログのフレームに超過の累計(dl.*)が残る
+ */
+#include <cstdio>
+#include <vector>
+
+#include "ev3api_stub.h"
+#include "SimLoop.h"
+
+#define RUN_LAPS 2
+#define RUN_LIMIT_S 60.0
+#define OUTPUT_US 20      // モーター出力の処理時間[us]
+#define MISS_RATIO 0.1    // on に求める off に対するモーター出力のない周期の割合の上限
+#define RECOVER_SLACK_MS (DEADLINE_RECOVER_MAX_CYCLES * MAIN_CYCLE + 100) // 遅い時間帯の終わりから縮退を抜けるまでの許容[ms]
+
+/** 遅いスタブ: 時間帯 [from_ms, to_ms) の間,処理 task の時間を extra_us 延ばす */
+typedef struct
+{
+    const char *name;
+    int task; /* RATE_* */
+    int from_ms, to_ms;
+    int extra_us;
+} fault_t;
+
+static const fault_t FAULTS[] = {
+    {"sonar", RATE_IN_SONAR, 4000, 7000, 6000},  // 超音波センサの応答待ち
+    {"bt", RATE_LOG, 10000, 12000, 4500},        // ログの書き込み待ち
+    {"gyro", RATE_IN_GYRO, 15000, 17000, 4500},  // ジャイロの応答待ち
+    {"spike", RATE_IN_COLOR, 21000, 21004, 9000}, // 止められない処理の1回の遅れ
+};
+#define FAULT_COUNT (int)(sizeof(FAULTS) / sizeof(FAULTS[0]))
+
+static int failures = 0;
+
+static void check(bool ok, const char *scenario, const char *what)
+{
+    if (!ok)
+    {
+        printf("FAIL  %s: %s\n", scenario, what);
+        failures++;
+    }
+}
+
+/** 1回の走行の結果 */
+struct result_t
+{
+    simresult_t sim;
+    long activations;    /* tracer_task の実行回数 */
+    long lost;           /* 失われた起動 */
+    long no_output;      /* モーター出力のなかった周期 */
+    long logged;         /* ログに残ったフレーム */
+    uint32_t misses, worst_late_us, shed;
+    long recover_ms[FAULT_COUNT]; /* 時間帯の終わりから縮退を抜けるまで[ms], -1 なら抜けなかった */
+    logframe_t last_frame;        /* 最後にログに残ったフレーム */
+};
+
+/** 処理 task の今の時刻での処理時間[us] */
+static int task_cost(int task, uint64_t t_us, bool faulty)
+{
+    int cost = TRACER_RATE_TABLE[task].cost;
+    if (faulty)
+        for (int i = 0; i < FAULT_COUNT; i++)
+            if (FAULTS[i].task == task && t_us >= FAULTS[i].from_ms * 1000ULL && t_us < FAULTS[i].to_ms * 1000ULL)
+                cost += FAULTS[i].extra_us;
+    return cost;
+}
+
+/** マスクの処理時間の合計[us] */
+static int mask_cost(uint32_t due, uint32_t mask, uint64_t t_us, bool faulty)
+{
+    int cost = 0;
+    for (int i = 0; i < RATE_TASKS; i++)
+        if (due & mask & RATE_BIT(i))
+            cost += task_cost(i, t_us, faulty);
+    return cost;
+}
+
+static result_t run(const CourseImage &course, bool faulty, bool degrade)
+{
+    const uint32_t INPUTS = RATE_BIT(RATE_IN_COLOR) | RATE_BIT(RATE_IN_WHEEL) | RATE_BIT(RATE_IN_ARM) |
+                            RATE_BIT(RATE_IN_GYRO) | RATE_BIT(RATE_IN_SONAR) | RATE_BIT(RATE_IN_BUTTON);
+    const uint32_t LOGGING = RATE_BIT(RATE_LOG);
+    SimWorld world(course);
+    SimRobotIo io(world);
+    TracerCore core;
+    DeadlineMonitor monitor;
+    if (degrade)
+        core.setDeadline(&monitor);
+    cycleinput_t in = cycleinput_t();
+    cycleoutput_t out;
+    logframe_t frame;
+    result_t r = result_t();
+    const uint64_t limit_us = (uint64_t)(RUN_LIMIT_S * 1e6);
+    std::vector<bool> written(limit_us / SIM_CYCLE_US + 2, false); // 周期ごとのモーター出力
+    for (int i = 0; i < FAULT_COUNT; i++)
+        r.recover_ms[i] = -1;
+
+    uint64_t now = SIM_CYCLE_PHASE_US;
+    uint64_t release = SIM_CYCLE_PHASE_US - SIM_CYCLE_US;
+    while (true)
+    {
+        // -------- 次の起動: 実行中の起動要求は1つだけ溜まり,残りは失われる --------
+        uint64_t next = release + SIM_CYCLE_US;
+        uint64_t start;
+        if (now >= next)
+        {
+            uint64_t k = (now - next) / SIM_CYCLE_US;
+            r.lost += (long)k;
+            release = next + k * SIM_CYCLE_US;
+            start = now;
+        }
+        else
+        {
+            release = next;
+            start = next;
+        }
+        if (start > limit_us)
+            break;
+        world.advanceTo(start);
+        if (world.laps >= RUN_LAPS)
+        {
+            r.sim.completed = true;
+            break;
+        }
+
+        // -------- tracer_task --------
+        monitor.begin((uint32_t)start);
+        const uint32_t due = core.getDue();
+        io.read(due, &in);
+        core.step(&in, &out, &frame);
+        const uint64_t write_at = start + mask_cost(due, INPUTS, start, faulty) +
+                                  mask_cost(due, ~(INPUTS | LOGGING), start, faulty) + OUTPUT_US;
+        world.advanceTo(write_at);
+        io.write(&in, &out);
+        written[(write_at - SIM_CYCLE_PHASE_US) / SIM_CYCLE_US] = true;
+        if (due & LOGGING)
+        {
+            r.logged++;
+            r.last_frame = frame;
+        }
+        now = write_at + mask_cost(due, LOGGING, start, faulty);
+        monitor.end((uint32_t)now);
+        r.activations++;
+
+        for (int i = 0; i < FAULT_COUNT; i++) // 時間帯の後の最初の通常の周期
+            if (r.recover_ms[i] < 0 && now >= FAULTS[i].to_ms * 1000ULL && !monitor.isDegraded())
+                r.recover_ms[i] = (long)(now / 1000) - FAULTS[i].to_ms;
+
+        double sx, sy;
+        world.sensorPosition(&sx, &sy);
+        if (course.lineDistance(sx, sy) > SIM_LOST_MM)
+        {
+            r.sim.lost = true;
+            break;
+        }
+        if (out.wakeup_main)
+            break;
+    }
+
+    const long periods = (long)((std::min(now, limit_us) - SIM_CYCLE_PHASE_US) / SIM_CYCLE_US);
+    for (long k = 0; k < periods; k++)
+        if (!written[k])
+            r.no_output++;
+    r.sim.laps = world.laps;
+    r.sim.time_s = r.sim.completed ? world.lap_start_us * 1e-6 : world.now_us * 1e-6;
+    r.misses = monitor.getMisses();
+    r.worst_late_us = monitor.getWorstLateUs();
+    r.shed = monitor.getShedCycles();
+    return r;
+}
+
+static void print_result(const char *scenario, const char *mode, const result_t &r)
+{
+    printf("%-8s %-4s %4s %4s %7.2f %7ld %5ld %6ld %6lu %7.1f %6lu %7ld |", scenario, mode,
+           r.sim.completed ? "yes" : "no", r.sim.lost ? "LOST" : "-", r.sim.time_s, r.activations, r.lost,
+           r.no_output, (unsigned long)r.misses, r.worst_late_us * 1e-3, (unsigned long)r.shed, r.logged);
+    for (int i = 0; i < FAULT_COUNT; i++)
+        printf(" %5ld", r.recover_ms[i]);
+    printf("\n");
+}
+
+int main()
+{
+    CourseImage course;
+    course.generateOval(2000.0, 600.0);
+    course.buildLineDistance();
+
+    printf("tracer_task deadline, period %d us, recover after %d cycles <= %d us\n", DEADLINE_PERIOD_US,
+           DEADLINE_RECOVER_CYCLES, DEADLINE_RECOVER_US);
+    for (int i = 0; i < FAULT_COUNT; i++)
+        printf("slow stub %-6s %-10s +%5d us  %6d..%6d ms\n", FAULTS[i].name, TRACER_RATE_TABLE[FAULTS[i].task].name,
+               FAULTS[i].extra_us, FAULTS[i].from_ms, FAULTS[i].to_ms);
+    printf("%-8s %-4s %4s %4s %7s %7s %5s %6s %6s %7s %6s %7s | recover[ms]\n", "scenario", "dl", "done", "lost",
+           "time", "cycles", "qovr", "no_out", "miss", "late", "shed", "logged");
+
+    // -------- 遅いスタブなし --------
+    result_t clean = run(course, false, true);
+    print_result("clean", "on", clean);
+    check(clean.misses == 0 && clean.shed == 0 && clean.lost == 0 && clean.no_output == 0, "clean",
+          "no overruns without slow stubs");
+    check(clean.logged == clean.activations, "clean", "every cycle is logged");
+    check(clean.sim.completed && !clean.sim.lost, "clean", "run completes");
+
+    // -------- 遅いスタブ: 検出だけ / 縮退あり --------
+    result_t off = run(course, true, false);
+    result_t on = run(course, true, true);
+    print_result("slow", "off", off);
+    print_result("slow", "on", on);
+    check(off.misses > 0 && off.no_output > 0, "off", "slow stubs overrun the period and lose motor outputs");
+    check(on.no_output <= off.no_output * MISS_RATIO, "on", "degraded mode keeps motor outputs on time");
+    check(on.misses < off.misses, "on", "degraded mode reduces the overruns");
+    for (int i = 0; i < FAULT_COUNT; i++)
+        check(on.recover_ms[i] >= 0 && on.recover_ms[i] <= RECOVER_SLACK_MS, FAULTS[i].name,
+              "degraded mode ends after the slow period");
+    check(on.sim.completed && !on.sim.lost, "on", "degraded run completes");
+    check(on.last_frame.dl_miss > 0 && on.last_frame.dl_shed > 0 && on.last_frame.dl_late > 0, "on",
+          "log frames carry the overrun counters");
+
+    printf("columns    qovr = lost activations, no_out = 4 ms periods without a motor output, late = worst [ms],\n"
+           "           shed = cycles in degraded mode, recover = from the end of each slow stub to normal mode\n");
+    printf("checks     %s (%d failed)\n", failures ? "FAILED" : "ok", failures);
+    return failures ? 1 : 0;
+}
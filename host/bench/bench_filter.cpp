@@ -0,0 +1,360 @@
+/**
+ * @file bench_filter.cpp
+ * @brief センサ値のストリーミングフィルタ(StreamFilter)の更新コストと,超音波センサの雑音による誤検知の比較
+ *
+ * @note 1. EmaFilter, MedianFilter, MinMaxFilter, Debounce の1回の更新の時間[ns]を窓の長さごとに測り,
+ *          中央値,最小値/最大値は窓の全部を見る素朴な計算と一致することを確かめる。
+ *       2. 記録したログの入力値で TracerCore を再生し,超音波センサの取得ごとに
+ *          雑音(ゴースト反射で近い値, 無反射で 255)を入れる。ログの途中から本物の障害物が近づく。
+ *          SENSOR_RAW_FILTER と SENSOR_NOISE_FILTER で,本物の障害物の前に止まった回数(誤検知)と,
+ *          本物の障害物が SONAR_ALERT_DISTANCE に入ってから止まるまでの時間を比べる。
+ *       3. 長円コースを SimLoop で走らせ,HSVの平滑化(color_shift)ごとのラインからの距離を比べる。
+ *
+ *       確認項目(どれかが合わなければ終了コード 1):
+ *        - 中央値,最小値/最大値が素朴な計算と一致する
+ *        - フィルタなしは誤検知し,SENSOR_NOISE_FILTER の誤検知はその FILTER_FALSE_RATIO 以下で見逃しはなく,
+ *          雑音なしの遅れの増分は FILTER_DELAY_MAX_MS 以下
+ *        - SENSOR_NOISE_FILTER で完走する
+ *
+ *  使い方:
+ *    bench_filter LOG.dat
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "ev3api_stub.h"
+#include "SimLoop.h"
+#include "logging/LogDecoder.h"
+#include "bench_util.h"
+
+#define COST_SAMPLES 1000000   // 更新コストを測るサンプル数
+#define TRIALS 200             // 雑音を変えた再生の回数
+#define NOISE_GHOST_PCT 5      // 近い値の雑音の割合[%]
+#define NOISE_DROP_PCT 4       // 無反射(255)の割合[%]
+#define OBSTACLE_FROM_CM 40    // 本物の障害物が見え始める距離[cm]
+#define OBSTACLE_STEP 1        // 取得ごとに近づく距離[cm]
+#define FILTER_DELAY_MAX_MS 200 // 雑音なしで SENSOR_NOISE_FILTER が増やしてよい遅れ[ms]
+#define FILTER_FALSE_RATIO 0.1  // フィルタなしに対する誤検知の割合の上限
+#define RUN_LAPS 2
+#define RUN_LIMIT_S 60.0
+
+static int failures = 0;
+
+static void check(bool ok, const char *scenario, const char *what)
+{
+    if (!ok)
+    {
+        printf("FAIL  %s: %s\n", scenario, what);
+        failures++;
+    }
+}
+
+static unsigned int seed = 12345;
+static int next_rand()
+{
+    seed = seed * 1103515245u + 12345u;
+    return (int)((seed >> 16) & 0x7fff);
+}
+
+// ******** 1. 更新コスト ******** ******** ******** ******** ******** ********
+
+static std::vector<int16_t> inputs;
+
+static void print_cost(const char *name, int window, uint64_t ns, int acc)
+{
+    bench_keep(acc);
+    printf("%-12s %6d %8.2f\n", name, window, (double)ns / COST_SAMPLES);
+}
+
+template <int N>
+static void cost_median(int window)
+{
+    MedianFilter<N> f;
+    f.setWindow(window);
+    int acc = 0;
+    uint64_t t0 = bench_now_ns();
+    for (int i = 0; i < COST_SAMPLES; i++)
+        acc += f.update(inputs[i]);
+    print_cost("median", window, bench_now_ns() - t0, acc);
+
+    // 素朴な計算との一致
+    f.setWindow(window);
+    bool ok = true;
+    std::vector<int16_t> w;
+    for (int i = 0; i < 20000 && ok; i++)
+    {
+        int got = f.update(inputs[i]);
+        w.push_back(inputs[i]);
+        if ((int)w.size() > window)
+            w.erase(w.begin());
+        std::vector<int16_t> s = w;
+        std::sort(s.begin(), s.end());
+        ok = (got == s[(s.size() - 1) / 2]);
+    }
+    check(ok, "median", "matches the sorted window");
+}
+
+template <int N>
+static void cost_minmax(int window)
+{
+    MinMaxFilter<N> f;
+    f.setWindow(window);
+    int acc = 0;
+    uint64_t t0 = bench_now_ns();
+    for (int i = 0; i < COST_SAMPLES; i++)
+    {
+        f.update(inputs[i]);
+        acc += f.getMin() + f.getMax();
+    }
+    print_cost("minmax", window, bench_now_ns() - t0, acc);
+
+    f.setWindow(window);
+    bool ok = true;
+    for (int i = 0; i < 20000 && ok; i++)
+    {
+        f.update(inputs[i]);
+        int from = std::max(0, i - window + 1);
+        int lo = *std::min_element(&inputs[from], &inputs[i] + 1);
+        int hi = *std::max_element(&inputs[from], &inputs[i] + 1);
+        ok = (f.getMin() == lo && f.getMax() == hi);
+    }
+    check(ok, "minmax", "matches the window minimum and maximum");
+}
+
+static void run_costs()
+{
+    inputs.resize(COST_SAMPLES);
+    for (int i = 0; i < COST_SAMPLES; i++)
+        inputs[i] = (int16_t)(next_rand() % 256);
+
+    printf("per-update cost, %d samples\n", COST_SAMPLES);
+    printf("%-12s %6s %8s\n", "filter", "window", "ns");
+    {
+        EmaFilter f;
+        f.setShift(2);
+        int acc = 0;
+        uint64_t t0 = bench_now_ns();
+        for (int i = 0; i < COST_SAMPLES; i++)
+            acc += f.update(inputs[i]);
+        print_cost("ema", 1, bench_now_ns() - t0, acc);
+    }
+    cost_median<SONAR_MEDIAN_MAX>(3);
+    cost_median<SONAR_MEDIAN_MAX>(5);
+    cost_median<SONAR_MEDIAN_MAX>(9);
+    cost_median<32>(31);
+    cost_minmax<32>(5);
+    cost_minmax<32>(9);
+    cost_minmax<32>(31);
+    {
+        Debounce f;
+        f.setCounts(2, 1);
+        int acc = 0;
+        uint64_t t0 = bench_now_ns();
+        for (int i = 0; i < COST_SAMPLES; i++)
+            acc += f.update(inputs[i] < 32);
+        print_cost("debounce", 2, bench_now_ns() - t0, acc);
+    }
+}
+
+// ******** 2. 超音波センサの雑音による誤検知 ******** ******** ******** ********
+
+static bool load_inputs(const char *path, std::vector<cycleinput_t> *out)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return false;
+    std::vector<uint8_t> data;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        data.insert(data.end(), buf, buf + n);
+    fclose(fp);
+    if (!LogDecoder::isEncoded(data.data(), data.size()))
+        return false;
+
+    LogDecoder dec;
+    const uint8_t *p = data.data();
+    const uint8_t *end = p + data.size();
+    int idx[LOG_CHANNELS];
+    bool mapped = false;
+    while (dec.next(p, end))
+    {
+        if (!mapped)
+        {
+            for (int i = 0; i < LOG_CHANNELS; i++)
+                if ((idx[i] = dec.channelIndex(LOG_SCHEMA[i].name)) < 0 && strncmp(LOG_SCHEMA[i].name, "in.", 3) == 0)
+                    return false;
+            mapped = true;
+        }
+        int32_t v[LOG_CHANNELS];
+        logframe_t f;
+        for (int i = 0; i < LOG_CHANNELS; i++)
+            v[i] = (idx[i] >= 0) ? dec.values()[idx[i]] : 0;
+        memcpy(&f, v, sizeof(f));
+
+        cycleinput_t in;
+        in.rgb.r = f.rgb_r;
+        in.rgb.g = f.rgb_g;
+        in.rgb.b = f.rgb_b;
+        in.left_count = f.left_count;
+        in.right_count = f.right_count;
+        in.arm_count = f.arm_count;
+        in.gyro_angle = f.gyro_deg;
+        in.sonar = f.sonar;
+        in.back_button = 0; // 途中で走行終了しない
+        out->push_back(in);
+    }
+    return !out->empty();
+}
+
+/** 1回の再生の結果 */
+struct trial_t
+{
+    long trigger; // 止まったフレーム, -1 なら止まらなかった
+    long cross;   // 本物の障害物が SONAR_ALERT_DISTANCE に入ったフレーム
+};
+
+static trial_t replay_trial(const std::vector<cycleinput_t> &log, const sensorfilter_t &filter, long obstacle_at,
+                            unsigned int noise_seed, bool noisy)
+{
+    TracerCore core;
+    core.setSensorFilter(&filter);
+    cycleoutput_t out;
+    logframe_t frame;
+    trial_t r = {-1, -1};
+    unsigned int s = noise_seed;
+    int truth = 255;
+    int sonar = 255; // 取得しない周期は前回の値
+    for (size_t i = 0; i < log.size(); i++)
+    {
+        cycleinput_t in = log[i];
+        if (core.getDue() & RATE_BIT(RATE_IN_SONAR))
+        {
+            if ((long)i >= obstacle_at)
+                truth = (truth == 255) ? OBSTACLE_FROM_CM : std::max(3, truth - OBSTACLE_STEP);
+            if (truth <= SONAR_ALERT_DISTANCE && r.cross < 0)
+                r.cross = (long)i;
+            s = s * 1103515245u + 12345u;
+            int u = (int)((s >> 16) % 100);
+            if (noisy && u < NOISE_GHOST_PCT)
+                sonar = (int)((s >> 8) % (SONAR_ALERT_DISTANCE + 1)); // ゴースト反射
+            else if (noisy && u < NOISE_GHOST_PCT + NOISE_DROP_PCT)
+                sonar = 255; // 無反射
+            else
+                sonar = truth;
+        }
+        in.sonar = sonar;
+        core.step(&in, &out, &frame);
+        if (core.getStage() != 0)
+        {
+            r.trigger = (long)i;
+            break;
+        }
+    }
+    return r;
+}
+
+/** 誤検知の回数,見逃しの回数,遅れの平均と最大[ms] */
+struct tally_t
+{
+    int false_stop, missed;
+    double delay_sum_ms, delay_max_ms;
+    int detected;
+};
+
+static tally_t run_trials(const std::vector<cycleinput_t> &log, const sensorfilter_t &filter, bool noisy)
+{
+    tally_t t = {0, 0, 0.0, 0.0, 0};
+    unsigned int s = 777;
+    for (int k = 0; k < TRIALS; k++)
+    {
+        s = s * 1103515245u + 12345u;
+        long at = (long)(log.size() / 4 + (s >> 8) % (log.size() / 2)); // 本物の障害物が見え始めるフレーム
+        trial_t r = replay_trial(log, filter, at, s, noisy);
+        if (r.trigger >= 0 && (r.cross < 0 || r.trigger < r.cross))
+            t.false_stop++;
+        else if (r.trigger < 0)
+            t.missed++;
+        else
+        {
+            double d = (r.trigger - r.cross) * MAIN_CYCLE;
+            t.delay_sum_ms += d;
+            t.delay_max_ms = std::max(t.delay_max_ms, d);
+            t.detected++;
+        }
+    }
+    return t;
+}
+
+static void print_tally(const char *mode, const char *noise, const tally_t &t)
+{
+    printf("%-8s %-6s %6d %6d %8.1f %8.1f\n", mode, noise, t.false_stop, t.missed,
+           t.detected ? t.delay_sum_ms / t.detected : 0.0, t.delay_max_ms);
+}
+
+// ******** 3. HSVの平滑化と周回 ******** ******** ******** ******** ********
+
+static void run_color()
+{
+    CourseImage course;
+    course.generateOval(2000.0, 600.0);
+    course.buildLineDistance();
+    SimLoop loop(course);
+    tracergains_t gains = TRACER_DEFAULT_GAINS;
+    printf("%-14s %4s %4s %7s %6s %6s %5s\n", "filter", "done", "lost", "time", "cte", "max", "off");
+    for (int shift = 0; shift <= 2; shift++)
+    {
+        sensorfilter_t f = SENSOR_NOISE_FILTER;
+        f.color_shift = shift;
+        loop.setSensorFilter(f);
+        simresult_t r = loop.run(&gains, RUN_LAPS, RUN_LIMIT_S);
+        printf("color_shift %-2d %4s %4s %7.2f %6.1f %6.1f %5d\n", shift, r.completed ? "yes" : "no",
+               r.lost ? "LOST" : "-", r.time_s, r.cte_rms_mm, r.cte_max_mm, r.excursions);
+        if (shift == SENSOR_NOISE_FILTER.color_shift)
+            check(r.completed && !r.lost, "color", "SENSOR_NOISE_FILTER completes the laps");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: bench_filter LOG.dat\n");
+        return 2;
+    }
+    run_costs();
+
+    std::vector<cycleinput_t> log;
+    if (!load_inputs(argv[1], &log))
+    {
+        fprintf(stderr, "bench_filter: cannot load %s\n", argv[1]);
+        return 2;
+    }
+    printf("obstacle replay, %s (%zu cycles), %d trials, noise %d%% ghost + %d%% dropout per sonar sample\n",
+           argv[1], log.size(), TRIALS, NOISE_GHOST_PCT, NOISE_DROP_PCT);
+    printf("%-8s %-6s %6s %6s %8s %8s\n", "filter", "noise", "false", "missed", "delay", "max");
+    tally_t raw_clean = run_trials(log, SENSOR_RAW_FILTER, false);
+    tally_t filt_clean = run_trials(log, SENSOR_NOISE_FILTER, false);
+    tally_t raw = run_trials(log, SENSOR_RAW_FILTER, true);
+    tally_t filt = run_trials(log, SENSOR_NOISE_FILTER, true);
+    print_tally("raw", "none", raw_clean);
+    print_tally("filtered", "none", filt_clean);
+    print_tally("raw", "noisy", raw);
+    print_tally("filtered", "noisy", filt);
+    check(raw_clean.false_stop == 0 && filt_clean.false_stop == 0, "obstacle", "no false stops without noise");
+    check(raw.false_stop > 0, "obstacle", "noise makes the unfiltered detector stop early");
+    check(filt.false_stop <= raw.false_stop * FILTER_FALSE_RATIO, "obstacle", "filter removes most early stops");
+    check(filt.missed == 0 && filt_clean.missed == 0, "obstacle", "filtered detector never misses the obstacle");
+    check(filt_clean.delay_max_ms <= raw_clean.delay_max_ms + FILTER_DELAY_MAX_MS, "obstacle",
+          "filter delay stays within FILTER_DELAY_MAX_MS");
+
+    run_color();
+
+    printf("columns    false = stops before the obstacle reached SONAR_ALERT_DISTANCE, missed = no stop,\n"
+           "           delay = from the real crossing to the stop [ms], cte/max = sensor distance from the line [mm]\n");
+    printf("checks     %s (%d failed)\n", failures ? "FAILED" : "ok", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,185 @@
+/**
+ * @file bench_heading.cpp
+ * @brief ジャイロとオドメトリの方位の統合(HeadingFilter)の誤差の比較
+ *
+ * @note 長円コースを SimLoop と同じ直結ループで2周走らせ,シミュレータの真の方位に対する誤差を
+ *       オドメトリだけ / ジャイロだけ(バイアス補正なし,あり) / 統合 で比べる。
+ *       走行前に止まったまま GYRO_WAIT_MS 待ち,app.cpp の main_task と同じくジャイロのバイアスを推定する。
+ *       シミュレータのジャイロにはバイアス,車体には速さに応じた横滑り(車輪の差ほど曲がらない)を入れる。
+ *
+ *       確認項目(どれかが合わなければ終了コード 1):
+ *        - バイアスの推定値が真の値から GYRO_BIAS_TOL_MDPS 以内
+ *        - TracerCore のログフレームの方位,角速度が同じ入力の HeadingFilter と一致する
+ *        - 統合の誤差: RMS がバイアス補正したジャイロより小さく,最大が FUSED_MAX_DEG 以下
+ *        - 横滑りのある条件でオドメトリの,バイアスのある条件で補正なしのジャイロの RMS の 1/10 以下
+ */
+#include <cmath>
+#include <cstdio>
+
+#include "ev3api_stub.h"
+#include "SimLoop.h"
+
+#define GYRO_WAIT_MS 5000      // スタート待ち[ms]
+#define GYRO_BIAS_TOL_MDPS 100 // バイアスの推定の許容誤差[mdeg/s]
+#define FUSED_MAX_DEG 1.5      // 統合した方位の最大誤差[deg]
+#define RUN_LAPS 2
+#define RUN_LIMIT_S 60.0
+
+typedef struct
+{
+    const char *name;
+    double gyro_bias_dps; /* ジャイロのバイアス */
+    double yaw_slip;      /* 横滑り */
+    int power;            /* 前進速度 */
+} scenario_t;
+
+static const scenario_t SCENARIOS[] = {
+    {"ideal", 0.0, 0.0, MOTOR_POWER},
+    {"gyro bias", 0.5, 0.0, MOTOR_POWER},
+    {"slip", 0.0, 0.25, MOTOR_POWER},
+    {"bias+slip", 0.5, 0.25, MOTOR_POWER},
+    {"bias+slip fast", -0.8, 0.25, 85},
+};
+
+/** 誤差の集計 */
+struct errstat_t
+{
+    double sum2, max;
+    long n;
+    void add(double e)
+    {
+        sum2 += e * e;
+        if (std::fabs(e) > max)
+            max = std::fabs(e);
+        n++;
+    }
+    double rms() const { return n ? std::sqrt(sum2 / n) : 0.0; }
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char *scenario, const char *what)
+{
+    if (!ok)
+    {
+        printf("FAIL  %s: %s\n", scenario, what);
+        failures++;
+    }
+}
+
+/** [deg] を -180 to 180 に折り返す */
+static double wrap_deg(double d)
+{
+    d = std::fmod(d, 360.0);
+    if (d >= 180.0)
+        d -= 360.0;
+    else if (d < -180.0)
+        d += 360.0;
+    return d;
+}
+
+static double bam_to_deg(uint32_t bam)
+{
+    return (int32_t)bam * (360.0 / 4294967296.0);
+}
+
+static void run(const CourseImage &course, const scenario_t &sc)
+{
+    simconfig_t cfg = SIM_DEFAULT_CONFIG;
+    cfg.gyro_bias_dps = sc.gyro_bias_dps;
+    cfg.yaw_slip = sc.yaw_slip;
+    SimWorld world(course, cfg);
+    SimRobotIo io(world);
+
+    // -------- スタート待ち: 止まったままジャイロのバイアスを推定(main_task と同じ10ms間隔) --------
+    GyroBiasEstimator est;
+    for (int t = 0; t <= GYRO_WAIT_MS; t += 10)
+    {
+        world.advanceTo((uint64_t)t * 1000);
+        est.add(t, world.gyroAngle());
+    }
+    const int bias = est.getBiasMdps();
+    const int zero = est.getZeroMdeg();
+    const uint64_t start_us = (uint64_t)GYRO_WAIT_MS * 1000;
+
+    // -------- 走行 --------
+    tracergains_t gains = TRACER_DEFAULT_GAINS;
+    gains.power = sc.power;
+    TracerCore core;
+    core.setGains(&gains);
+    core.calibrateGyro(bias, zero);
+    PoseOdometry odo;    // core と同じ入力で,誤差を細かく見るための推定
+    HeadingFilter fused; // 同上
+    fused.calibrate(bias, zero);
+    cycleinput_t in = cycleinput_t();
+    cycleoutput_t out;
+    logframe_t frame;
+    errstat_t e_odo = errstat_t(), e_gyro = errstat_t(), e_gyro_cal = errstat_t(), e_fused = errstat_t();
+    errstat_t e_rate = errstat_t();
+    bool same = true, started = false;
+    const double heading0 = world.heading;
+    uint64_t t = start_us + SIM_CYCLE_PHASE_US;
+    uint64_t limit = start_us + (uint64_t)(RUN_LIMIT_S * 1e6);
+
+    for (; t <= limit; t += SIM_CYCLE_US)
+    {
+        world.advanceTo(t);
+        if (world.laps >= RUN_LAPS)
+            break;
+        uint32_t due = core.getDue();
+        io.read(due, &in);
+        if (!started)
+        {
+            odo.reset(in.left_count, in.right_count);
+            started = true;
+        }
+        core.step(&in, &out, &frame);
+        io.write(&in, &out);
+
+        odo.update(in.left_count, in.right_count);
+        fused.update(odo.getPose().heading, in.gyro_angle, (due & RATE_BIT(RATE_IN_GYRO)) != 0);
+        if (due & RATE_BIT(RATE_LOG_POSE)) // ログの方位は間引いて更新する
+            same &= (frame.fuse_heading == fused.getHeadingDeg()) && (frame.fuse_rate == fused.getRateDps());
+
+        double truth = (world.heading - heading0) * 180.0 / M_PI;
+        double elapsed = (t - start_us) * 1e-6;
+        double gyro = -(in.gyro_angle - zero * 1e-3); // 左回り正, 開始時の角度は推定値(補正なしも同じ原点)
+        e_odo.add(wrap_deg(bam_to_deg(odo.getPose().heading) - truth));
+        e_gyro.add(wrap_deg(gyro - truth));
+        e_gyro_cal.add(wrap_deg(gyro + bias * 1e-3 * elapsed - truth));
+        e_fused.add(wrap_deg(bam_to_deg(fused.getHeading()) - truth));
+        e_rate.add(fused.getRateDps() - world.gyroRate() * -1.0 - sc.gyro_bias_dps);
+        if (out.wakeup_main)
+            break;
+    }
+
+    printf("%-15s %5.2f %5.2f %5d %6d %6.1f | %5.2f %5.2f | %5.2f %5.2f | %5.2f %5.2f | %5.2f %5.2f | %5.2f\n",
+           sc.name, sc.gyro_bias_dps, sc.yaw_slip, sc.power, bias, (t - start_us) * 1e-6,
+           e_odo.rms(), e_odo.max, e_gyro.rms(), e_gyro.max, e_gyro_cal.rms(), e_gyro_cal.max,
+           e_fused.rms(), e_fused.max, e_rate.rms());
+
+    check(std::abs(bias - (int)std::lround(sc.gyro_bias_dps * 1000)) <= GYRO_BIAS_TOL_MDPS, sc.name,
+          "gyro bias estimated at standstill");
+    check(same, sc.name, "TracerCore logs the same fused heading and rate as HeadingFilter");
+    check(world.laps >= RUN_LAPS, sc.name, "robot completes the laps");
+    check(e_fused.rms() < e_gyro_cal.rms(), sc.name, "fused heading beats the bias-corrected gyro alone (RMS)");
+    check(e_fused.max <= FUSED_MAX_DEG, sc.name, "fused heading max error within FUSED_MAX_DEG");
+    if (sc.yaw_slip != 0.0)
+        check(e_fused.rms() * 10 < e_odo.rms(), sc.name, "fused heading removes the odometry slip error");
+    if (sc.gyro_bias_dps != 0.0)
+        check(e_fused.rms() * 10 < e_gyro.rms(), sc.name, "fused heading removes the gyro drift");
+}
+
+int main()
+{
+    CourseImage course;
+    course.generateOval(2000.0, 600.0);
+    printf("heading error vs simulator truth [deg] over %d laps (rms max)\n", RUN_LAPS);
+    printf("%-15s %5s %5s %5s %6s %6s | %-11s | %-11s | %-11s | %-11s | %5s\n", "scenario", "bias", "slip",
+           "power", "est", "time", "odometry", "gyro raw", "gyro-bias", "fused", "rate");
+    for (size_t i = 0; i < sizeof(SCENARIOS) / sizeof(SCENARIOS[0]); i++)
+        run(course, SCENARIOS[i]);
+    printf("columns       bias [deg/s], est = estimated bias [mdeg/s], time [s], rate = fused yaw rate rms [deg/s]\n");
+    printf("checks        %s (%d failed)\n", failures ? "FAILED" : "ok", failures);
+    return failures ? 1 : 0;
+}
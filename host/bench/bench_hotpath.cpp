@@ -0,0 +1,576 @@
+/**
+ * @file bench_hotpath.cpp
+ * @brief tracer_task の各処理(ホットパス)の ns/call, 命令数/call とベースラインとの比較
+ *
+ * @note 入力は走行ログ(KHLG)に記録した1周期ごとの入力値を使う(無ければ合成する)。
+ *       舵角は直進(|turn|<=10)とカーブを一定周期で切り替える(MotorRunner に渡す)。
+ *       TurnAngleCalculator は記録したホイール回転角から直進/カーブを判定する(長円コースで両方通る)。
+ *       ev3api はスタブ(呼び出し回数を数えるだけ)。
+ *
+ *  使い方:
+ *    bench_hotpath [--baseline FILE] [--update] [--threshold PCT] [--instr-threshold PCT]
+ *                  [--repeat N] [LOG.dat]
+ *
+ *  --baseline があれば各項目を比べ,増えていたら終了コード 1 を返す。--update はベースラインを書き直す。
+ *  命令数は perf_event_open(PERF_COUNT_HW_INSTRUCTIONS)で数え,数えられたら命令数/call が
+ *  instr PCT[%](既定 HOTPATH_INSTR_THRESHOLD_PCT)を超えて増えたら失敗にする。
+ *  数えられない環境(仮想マシンなど)では時間で比べる。ns/call はマシンの速さや混み具合で変わるので,
+ *  同じ実行の中で各項目の計測と交互に回した校正ループ(calibrate)の時間で割った値(cal/call)も求め,
+ *  ns/call と cal/call の両方が PCT[%](既定 HOTPATH_THRESHOLD_PCT)を超えて増えたときだけ失敗にする。
+ *  混み具合で遅くなると ns/call だけが,校正ループだけ速くなると cal/call だけが増えるので,片方では判定しない。
+ *  ベースラインはコンパイラに固有なので,変えたら --update で作り直すこと。
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "bench_util.h"
+#include "ev3api_stub.h"
+#include "control/RobotT.h"
+#include "logging/LogDecoder.h"
+
+#define HOTPATH_THRESHOLD_PCT 30      // --threshold の既定値[%] (校正した時間, make bench も使う)
+#define HOTPATH_INSTR_THRESHOLD_PCT 3 // --instr-threshold の既定値[%]
+#define HOTPATH_CAL_ITER 4096         // 校正ループ1回で回すサンプル数(上限)
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief 命令数カウンタ(perf_event)と計時をまとめたもの
+ */
+class HotpathCounter
+{
+public:
+    HotpathCounter() : ns(0), instr(0), fd(-1), t0(0)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    ~HotpathCounter()
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool hasInstructions() const { return fd >= 0; }
+
+    void clear()
+    {
+        ns = 0;
+        instr = 0;
+    }
+    void start()
+    {
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+        t0 = bench_now_ns();
+    }
+    void stop()
+    {
+        uint64_t t1 = bench_now_ns();
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t n = 0;
+            if (read(fd, &n, sizeof(n)) == (ssize_t)sizeof(n))
+                instr += n;
+        }
+        ns += t1 - t0;
+    }
+
+    uint64_t ns, instr;
+
+private:
+    int fd;
+    uint64_t t0;
+};
+
+/** 1周期分の記録(入力値と,入力として使う記録済みの出力) */
+struct sample_t
+{
+    cycleinput_t in;
+    int turn;    // 舵角(直進/カーブの切り替えを入れたもの)
+    int hsv_val; // 明度
+};
+
+/** 計測結果 */
+struct result_t
+{
+    std::string name;
+    double ns_per_call;
+    double cal_per_call;   // ns/call を校正ループ1回の ns で割った値
+    double instr_per_call; // 数えられなければ -1
+    double cal_ns;         // 校正ループ1回の ns(計測中の最小値)
+};
+
+/** ベースラインの1行 */
+struct baseline_t
+{
+    std::string name;
+    double ns_per_call;
+    double cal_per_call;
+    double instr_per_call;
+};
+
+static const int TURN_PERIOD = 250; // 直進/カーブの切り替え周期[周期], 1秒
+static const int TURN_STRAIGHT = 0; // 直進区間の舵角
+
+/**
+ * @brief ログから入力値を読む
+ */
+static bool load_samples(const char *path, std::vector<sample_t> *out)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return false;
+    std::vector<uint8_t> data;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        data.insert(data.end(), buf, buf + n);
+    fclose(fp);
+    if (!LogDecoder::isEncoded(data.data(), data.size()))
+        return false;
+
+    LogDecoder dec;
+    const uint8_t *p = data.data();
+    const uint8_t *end = p + data.size();
+    int idx[LOG_CHANNELS];
+    bool mapped = false;
+    while (dec.next(p, end))
+    {
+        if (!mapped)
+        {
+            for (int i = 0; i < LOG_CHANNELS; i++)
+                if ((idx[i] = dec.channelIndex(LOG_SCHEMA[i].name)) < 0 && strncmp(LOG_SCHEMA[i].name, "in.", 3) == 0)
+                    return false;
+            mapped = true;
+        }
+        int32_t v[LOG_CHANNELS];
+        logframe_t f;
+        for (int i = 0; i < LOG_CHANNELS; i++)
+            v[i] = (idx[i] >= 0) ? dec.values()[idx[i]] : 0;
+        memcpy(&f, v, sizeof(f));
+
+        sample_t s;
+        s.in.rgb.r = f.rgb_r;
+        s.in.rgb.g = f.rgb_g;
+        s.in.rgb.b = f.rgb_b;
+        s.in.left_count = f.left_count;
+        s.in.right_count = f.right_count;
+        s.in.arm_count = f.arm_count;
+        s.in.gyro_angle = f.gyro_deg;
+        s.in.sonar = f.sonar;
+        s.in.back_button = 0; // 途中で走行終了しない
+        s.turn = f.turn;
+        s.hsv_val = f.hsv_val;
+        out->push_back(s);
+    }
+    return !out->empty();
+}
+
+/**
+ * @brief ログが無いときの合成入力(ライン端を左右に振れる明度と,回転角の増加)
+ */
+static void synth_samples(std::vector<sample_t> *out)
+{
+    unsigned int seed = 12345;
+    int left = 0, right = 0;
+    for (int i = 0; i < 8192; i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        int x = 150 + (int)(120 * std::sin(i * 0.05)) + (int)((seed >> 16) % 21) - 10;
+        sample_t s;
+        s.in.rgb.r = (uint16_t)x;
+        s.in.rgb.g = (uint16_t)(x + 10);
+        s.in.rgb.b = (uint16_t)(x + ((seed >> 8) % 64 == 0 ? 200 : 20)); // 時々青
+        left += 5 + (int)((seed >> 12) % 3);
+        right += 5 + (int)((seed >> 20) % 3);
+        s.in.left_count = left;
+        s.in.right_count = right;
+        s.in.arm_count = 0;
+        s.in.gyro_angle = 0;
+        s.in.sonar = 255;
+        s.in.back_button = 0;
+        s.turn = (int)(40 * std::sin(i * 0.05));
+        s.hsv_val = x * 100 / 1023;
+        out->push_back(s);
+    }
+}
+
+/**
+ * @brief 舵角に直進/カーブの切り替えを入れる
+ */
+static void shape_turns(std::vector<sample_t> *samples)
+{
+    for (size_t i = 0; i < samples->size(); i++)
+        if ((i / TURN_PERIOD) % 2 == 0)
+            (*samples)[i].turn = TURN_STRAIGHT;
+        else if ((*samples)[i].turn >= -10 && (*samples)[i].turn <= 10)
+            (*samples)[i].turn = ((i / TURN_PERIOD) % 4 == 1) ? 30 : -30;
+}
+
+/**
+ * @brief 校正ループ1回(1サンプル)の ns
+ * @note  ホットパスに似せた,アプリのコードを使わない固定の処理(RGB の最大/最小と除算,
+ *        浮動小数の PID に似た積和,分岐)を同じ入力列に対して回す。アプリを変えても変わらないので,
+ *        ホットパスの時間をこれで割ればマシンの速さや混み具合の影響をおおむね打ち消せる。
+ *        結果は bench_keep で捨てる
+ */
+static double calibrate(const std::vector<sample_t> &samples)
+{
+    const size_t n = std::min(samples.size(), (size_t)HOTPATH_CAL_ITER);
+    float integral = 0, prev = 0;
+    int acc = 0;
+    uint64_t t0 = bench_now_ns();
+    for (size_t i = 0; i < n; i++)
+    {
+        const sample_t &s = samples[i];
+        int mx = std::max(s.in.rgb.r, std::max(s.in.rgb.g, s.in.rgb.b));
+        int mn = std::min(s.in.rgb.r, std::min(s.in.rgb.g, s.in.rgb.b));
+        int val = mx * 100 / 1023;
+        int sat = mx ? (mx - mn) * 255 / mx : 0;
+        float e = (float)(val - TARGET_REFLECT);
+        integral += e * 0.004f;
+        float u = 0.8f * e + 0.1f * integral + 0.25f * (e - prev);
+        prev = e;
+        acc += (sat >= TARGET_HSV) ? (int)u : -(int)u;
+        acc += (s.in.left_count - s.in.right_count) / (1 + (s.in.left_count & 7));
+    }
+    uint64_t t1 = bench_now_ns();
+    bench_keep(acc + (int)integral);
+    return (double)(t1 - t0) / n;
+}
+
+/**
+ * @brief body(全サンプル分)を repeat 回実行し,最小値を1回あたりにして返す
+ * @note  body は計測区間の中で呼ぶ。区間の外で行う準備は setup(区間の前に1回)で行う。
+ *        毎回 body の前後に校正ループを回し,同じ時間帯の最小値どうしで割る(cal/call)
+ */
+static result_t measure(HotpathCounter &ctr, const std::vector<sample_t> &samples, const char *name, size_t n, int repeat,
+                        const std::function<void()> &setup,
+                        const std::function<void(HotpathCounter &)> &body)
+{
+    result_t r;
+    double cal = 1e30;
+    r.name = name;
+    r.ns_per_call = 1e30;
+    r.instr_per_call = ctr.hasInstructions() ? 1e30 : -1;
+    for (int k = 0; k < repeat; k++)
+    {
+        setup();
+        cal = std::min(cal, calibrate(samples));
+        ctr.clear();
+        body(ctr);
+        r.ns_per_call = std::min(r.ns_per_call, (double)ctr.ns / n);
+        if (ctr.hasInstructions())
+            r.instr_per_call = std::min(r.instr_per_call, (double)ctr.instr / n);
+        cal = std::min(cal, calibrate(samples));
+    }
+    r.cal_per_call = r.ns_per_call / cal;
+    r.cal_ns = cal;
+    return r;
+}
+
+static bool read_baseline(const char *path, std::vector<baseline_t> *out)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return false;
+    char line[256];
+    while (fgets(line, sizeof(line), fp))
+    {
+        char name[128];
+        baseline_t b;
+        if (line[0] == '#')
+            continue;
+        if (sscanf(line, "%127s %lf %lf %lf", name, &b.ns_per_call, &b.cal_per_call, &b.instr_per_call) == 4)
+        {
+            b.name = name;
+            out->push_back(b);
+        }
+    }
+    fclose(fp);
+    return true;
+}
+
+static bool write_baseline(const char *path, const std::vector<result_t> &res)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+        return false;
+    fprintf(fp, "# bench_hotpath baseline: name ns_per_call cal_per_call instr_per_call (-1: not counted)\n");
+    for (size_t i = 0; i < res.size(); i++)
+        fprintf(fp, "%s %.2f %.3f %.1f\n", res[i].name.c_str(), res[i].ns_per_call, res[i].cal_per_call,
+                res[i].instr_per_call);
+    fclose(fp);
+    return true;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: bench_hotpath [--baseline FILE] [--update] [--threshold PCT] "
+                    "[--instr-threshold PCT] [--repeat N] [LOG.dat]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *baseline = NULL;
+    const char *logpath = NULL;
+    bool update = false;
+    double threshold = HOTPATH_THRESHOLD_PCT, instr_threshold = HOTPATH_INSTR_THRESHOLD_PCT;
+    int repeat = 15;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string a = argv[i];
+        bool more = (i + 1 < argc);
+        if (a == "--baseline" && more)
+            baseline = argv[++i];
+        else if (a == "--update")
+            update = true;
+        else if (a == "--threshold" && more)
+            threshold = atof(argv[++i]);
+        else if (a == "--instr-threshold" && more)
+            instr_threshold = atof(argv[++i]);
+        else if (a == "--repeat" && more)
+            repeat = atoi(argv[++i]);
+        else if (a[0] == '-')
+            usage();
+        else
+            logpath = argv[i];
+    }
+    if (repeat < 1)
+        repeat = 1;
+
+    // -------- 入力 --------
+    std::vector<sample_t> samples;
+    if (logpath == NULL || !load_samples(logpath, &samples))
+    {
+        samples.clear();
+        synth_samples(&samples);
+        printf("input         synthetic (%zu cycles)\n", samples.size());
+    }
+    else
+        printf("input         %s (%zu cycles)\n", logpath, samples.size());
+    shape_turns(&samples);
+    const size_t n = samples.size();
+
+    HotpathCounter ctr;
+    std::vector<result_t> res;
+    int acc = 0;
+
+    // ColorSensorCalculator::calc (RGB は記録した値, ev3api は tracer_task の RobotT だけが呼ぶ)
+    {
+        ColorSensorCalculator color;
+        res.push_back(measure(ctr, samples, "ColorSensorCalculator::calc", n, repeat, [] {}, [&](HotpathCounter &c) {
+            c.start();
+            for (size_t i = 0; i < n; i++)
+            {
+                color.calc(&samples[i].in.rgb);
+                acc += color.getHSVval();
+            }
+            c.stop();
+        }));
+    }
+
+    // PIDController::calc (明度PID, 入力は記録した明度)
+    {
+        PIDControllerType pid;
+        res.push_back(measure(ctr, samples, "PIDController::calc", n, repeat, [] {}, [&](HotpathCounter &c) {
+            c.start();
+            for (size_t i = 0; i < n; i++)
+            {
+                pid.setPIDactual(samples[i].hsv_val);
+                pid.calc(TARGET_REFLECT, -1 * _EDGE);
+                acc += (int)pid.getPIDvalue();
+            }
+            c.stop();
+        }));
+    }
+
+    // TurnAngleCalculator::calc (回転角は記録した値)
+    {
+        TurnAngleCalculator turnAngle;
+        turnangle_t angle = {0};
+        res.push_back(measure(ctr, samples, "TurnAngleCalculator::calc", n, repeat, [] {}, [&](HotpathCounter &c) {
+            c.start();
+            for (size_t i = 0; i < n; i++)
+            {
+                turnAngle.calc(&angle, samples[i].in.left_count, samples[i].in.right_count);
+                acc += angle.omega;
+            }
+            c.stop();
+        }));
+    }
+
+    // LineTracer::calc (2つのPID), HSV変換は計測区間の外で済ませておく。モーター出力は MotorRunner::run で測る
+    {
+        std::vector<ColorSensorCalculator> colors(n);
+        for (size_t i = 0; i < n; i++)
+            colors[i].calc(&samples[i].in.rgb);
+        PIDControllerType pidReflect, pidHsv;
+        LineTracer lineTracer;
+        res.push_back(measure(ctr, samples, "LineTracer::calc", n, repeat, [] {}, [&](HotpathCounter &c) {
+            c.start();
+            for (size_t i = 0; i < n; i++)
+                acc += lineTracer.calc(&pidReflect, &pidHsv, &colors[i]);
+            c.stop();
+        }));
+    }
+
+    // MotorRunner::run (記録した舵角)
+    {
+        MotorRunner motor;
+        res.push_back(measure(ctr, samples, "MotorRunner::run", n, repeat, [] {}, [&](HotpathCounter &c) {
+            c.start();
+            for (size_t i = 0; i < n; i++)
+                motor.run(MOTOR_POWER, samples[i].turn);
+            c.stop();
+        }));
+    }
+
+    // tracer_task 1周期 (RobotT<Ev3RobotIo>: レートグループに従う入力, TracerCore::step, 出力, DataLogger::put)
+    // logger_task の drain は計測区間の外で行う(計時の呼び出しを減らすため LOG_RING_SIZE 未満の batch 周期ごと)
+    {
+        RobotT<Ev3RobotIo> *robot = NULL;
+        DataLogger logger;
+        FILE *sink = fopen("/dev/null", "wb");
+        const size_t batch = LOG_RING_SIZE / 2;
+        res.push_back(measure(
+            ctr, samples, "tracer_task", n, repeat,
+            [&] {
+                delete robot;
+                robot = new RobotT<Ev3RobotIo>();
+            },
+            [&](HotpathCounter &c) {
+                for (size_t i = 0; i < n;)
+                {
+                    size_t to = std::min(n, i + batch);
+                    c.start();
+                    for (; i < to; i++)
+                    {
+                        cycleoutput_t out;
+                        logframe_t frame;
+                        ev3stub.rgb = samples[i].in.rgb; // センサ値(物理側)
+                        ev3stub.counts[left_motor] = samples[i].in.left_count;
+                        ev3stub.counts[right_motor] = samples[i].in.right_count;
+                        ev3stub.sonar = (int16_t)samples[i].in.sonar;
+
+                        uint32_t due = robot->cycle(&out, &frame);
+
+                        if (due & RATE_BIT(RATE_LOG))
+                            logger.put(frame);
+                    }
+                    c.stop();
+                    logger.drain(sink);
+                }
+            }));
+        delete robot;
+        if (sink != NULL)
+            fclose(sink);
+    }
+    bench_keep(acc);
+
+    // -------- 結果とベースラインとの比較 --------
+    std::vector<baseline_t> base;
+    bool have_base = (baseline != NULL && !update && read_baseline(baseline, &base));
+    if (baseline != NULL && !update && !have_base)
+        printf("baseline      %s not found (run with --update to create)\n", baseline);
+    int regressed = 0;
+
+    printf("%-28s %10s %10s %12s", "hot path", "ns/call", "cal/call", "instr/call");
+    if (have_base)
+        printf(" %10s %10s %10s", "ns diff", "cal diff", "instr diff");
+    printf("\n");
+    int by_instr = 0, by_time = 0;
+    for (size_t i = 0; i < res.size(); i++)
+    {
+        const result_t &r = res[i];
+        printf("%-28s %10.2f %10.3f", r.name.c_str(), r.ns_per_call, r.cal_per_call);
+        if (r.instr_per_call >= 0)
+            printf(" %12.1f", r.instr_per_call);
+        else
+            printf(" %12s", "-");
+        if (!have_base)
+        {
+            printf("\n");
+            continue;
+        }
+
+        const baseline_t *b = NULL;
+        for (size_t k = 0; k < base.size(); k++)
+            if (base[k].name == r.name)
+                b = &base[k];
+        if (b == NULL)
+        {
+            printf(" %10s\n", "new");
+            continue;
+        }
+        // 命令数が両方にあれば命令数で,無ければ ns/call と cal/call の両方で判定する
+        bool bad;
+        double dns = (r.ns_per_call / b->ns_per_call - 1.0) * 100.0;
+        double dcal = (r.cal_per_call / b->cal_per_call - 1.0) * 100.0;
+        printf(" %+9.1f%% %+9.1f%%", dns, dcal);
+        if (r.instr_per_call >= 0 && b->instr_per_call > 0)
+        {
+            double din = (r.instr_per_call / b->instr_per_call - 1.0) * 100.0;
+            printf(" %+9.1f%%", din);
+            bad = (din > instr_threshold);
+            by_instr++;
+        }
+        else
+        {
+            printf(" %10s", "-");
+            bad = (dns > threshold && dcal > threshold);
+            by_time++;
+        }
+        if (bad)
+        {
+            printf("  REGRESSION");
+            regressed++;
+        }
+        printf("\n");
+    }
+    printf("ev3api calls  %lu\n", ev3stub.calls);
+    double cal_lo = 1e30, cal_hi = 0;
+    for (size_t i = 0; i < res.size(); i++)
+    {
+        cal_lo = std::min(cal_lo, res[i].cal_ns);
+        cal_hi = std::max(cal_hi, res[i].cal_ns);
+    }
+    printf("calibrate     %.2f-%.2f ns/sample, instructions %s\n", cal_lo, cal_hi,
+           ctr.hasInstructions() ? "counted" : "not counted (perf_event unavailable)");
+
+    if (update && baseline != NULL)
+    {
+        if (!write_baseline(baseline, res))
+        {
+            fprintf(stderr, "bench_hotpath: cannot write %s\n", baseline);
+            return 1;
+        }
+        printf("baseline      %s updated\n", baseline);
+    }
+    if (have_base)
+        printf("regressions   %d (%d by instr %+.0f%%, %d by ns and calibrated time %+.0f%%)\n", regressed, by_instr,
+               instr_threshold, by_time, threshold);
+    return regressed ? 1 : 0;
+}
@@ -0,0 +1,145 @@
+/**
+ * @file bench_hsv.cpp
+ * @brief 逆数表によるHSV変換(HsvKernel)と旧 ColorSensorCalculator::calc の比較
+ *
+ * @note 0..255 の全組合せと 0..HSV_RGB_MAX の乱数で旧実装との一致を確認し,
+ *       1サンプルあたりの時間とバッチ変換(SoA)のスループットを表示する。
+ *       旧実装は rgb_max = 0 で0除算するので,その入力だけ sat = 0 として比較する。
+ */
+#include <cstdio>
+#include <vector>
+
+#include "bench_util.h"
+#include "odometry/HsvKernel.h"
+
+/** 旧 ColorSensorCalculator::calc の計算部(比較用の写し) */
+extern "C" __attribute__((noinline)) void hsv_reference(const rgb_raw_t *rgb, hsv_t *hsv)
+{
+    int rgb_max, rgb_min;
+    int r = rgb->r, g = rgb->g, b = rgb->b;
+
+    rgb_max = r;
+    rgb_max = (g > rgb_max) ? g : rgb_max;
+    rgb_max = (b > rgb_max) ? b : rgb_max;
+    rgb_min = r;
+    rgb_min = (g < rgb_min) ? g : rgb_min;
+    rgb_min = (b < rgb_min) ? b : rgb_min;
+
+    hsv->val = 100 * rgb_max / 256;
+    hsv->sat = (rgb_max == 0) ? 0 : 100 * (rgb_max - rgb_min) / rgb_max;
+    if ((rgb_max - rgb_min) == 0)
+    {
+        hsv->hue = 0;
+    }
+    else
+    {
+        hsv->hue = (60 * (r - g)) / (rgb_max - rgb_min) + 240;
+        if (rgb_max == r)
+            hsv->hue = (60 * (g - b)) / (rgb_max - rgb_min);
+        if (rgb_max == g)
+            hsv->hue = (60 * (b - r)) / (rgb_max - rgb_min) + 120;
+        if (hsv->hue < 0)
+            hsv->hue += 360;
+    }
+}
+
+extern "C" __attribute__((noinline)) void hsv_kernel(const rgb_raw_t *rgb, hsv_t *hsv)
+{
+    HsvKernel::convert(rgb, hsv);
+}
+
+static unsigned int seed = 11;
+static int rand_raw(int max)
+{
+    seed = seed * 1103515245u + 12345u;
+    return (int)((seed >> 8) % (unsigned)(max + 1));
+}
+
+static bool same(const rgb_raw_t &rgb)
+{
+    hsv_t a, b;
+    hsv_reference(&rgb, &a);
+    hsv_kernel(&rgb, &b);
+    return a.hue == b.hue && a.sat == b.sat && a.val == b.val;
+}
+
+int main()
+{
+    // -------- 一致確認 --------
+    long checked = 0, mismatch = 0;
+    rgb_raw_t rgb;
+    for (int r = 0; r < 256; r++)
+        for (int g = 0; g < 256; g++)
+            for (int b = 0; b < 256; b++)
+            {
+                rgb.r = r;
+                rgb.g = g;
+                rgb.b = b;
+                mismatch += same(rgb) ? 0 : 1;
+                checked++;
+            }
+    for (int i = 0; i < 4000000; i++)
+    {
+        rgb.r = rand_raw(HSV_RGB_MAX);
+        rgb.g = rand_raw(HSV_RGB_MAX);
+        rgb.b = rand_raw(HSV_RGB_MAX);
+        mismatch += same(rgb) ? 0 : 1;
+        checked++;
+    }
+    printf("hsv mismatch %ld/%ld\n", mismatch, checked);
+
+    // -------- 走行データ相当の入力 --------
+    const int N = 1 << 16;
+    std::vector<rgb_raw_t> aos(N);
+    std::vector<uint16_t> r(N), g(N), b(N);
+    std::vector<int16_t> hue(N), sat(N), val(N);
+    for (int i = 0; i < N; i++)
+    {
+        int v = 20 + rand_raw(300);
+        aos[i].r = r[i] = v;
+        aos[i].g = g[i] = v + rand_raw(20);
+        aos[i].b = b[i] = (i % 16 == 0) ? v + 200 : v + rand_raw(10);
+    }
+
+    const int REPEAT = 100;
+    hsv_t out;
+    int acc = 0;
+    uint64_t t0 = bench_now_ns();
+    for (int k = 0; k < REPEAT; k++)
+        for (int i = 0; i < N; i++)
+        {
+            hsv_reference(&aos[i], &out);
+            acc += out.sat;
+        }
+    uint64_t t1 = bench_now_ns();
+    for (int k = 0; k < REPEAT; k++)
+        for (int i = 0; i < N; i++)
+        {
+            hsv_kernel(&aos[i], &out);
+            acc += out.sat;
+        }
+    uint64_t t2 = bench_now_ns();
+    hsv_soa_t soa = {r.data(), g.data(), b.data(), hue.data(), sat.data(), val.data()};
+    for (int k = 0; k < REPEAT; k++)
+    {
+        HsvKernel::convertBatch(&soa, N);
+        bench_keep(sat[k]);
+    }
+    uint64_t t3 = bench_now_ns();
+    bench_keep(acc);
+
+    // バッチ結果も1サンプル変換と一致すること
+    long batch_mismatch = 0;
+    for (int i = 0; i < N; i++)
+    {
+        hsv_kernel(&aos[i], &out);
+        batch_mismatch += (out.hue != hue[i] || out.sat != sat[i] || out.val != val[i]) ? 1 : 0;
+    }
+
+    double total = (double)REPEAT * N;
+    printf("batch mismatch %ld/%d\n", batch_mismatch, N);
+    printf("reference     %.2f ns/sample\n", (t1 - t0) / total);
+    printf("HsvKernel     %.2f ns/sample\n", (t2 - t1) / total);
+    printf("convertBatch  %.2f ns/sample (%.0f Msample/s)\n", (t3 - t2) / total, total * 1e3 / (t3 - t2));
+    return (mismatch || batch_mismatch) ? 1 : 0;
+}
@@ -0,0 +1,131 @@
+/**
+ * @file bench_linetracer.cpp
+ * @brief LineTracer(ポインタ渡しのクラス) と LineTracerT(ポリシー合成) の比較
+ *
+ * @note 同じセンサ値の列で1周期分(HSV変換 -> PID -> モーター出力)を回し,
+ *       舵角が一致することと ns/cycle を表示する。途中で PID目標を変えても一致すること。
+ *       コードサイズは make bench で nm の出力として表示する(run_class_cycle / run_policy_cycle)。
+ *       RGB は RobotT の Io が読む値の代わりに列から渡す(ev3api のセンサは読まない)。
+ */
+#include <cstdio>
+#include <vector>
+
+#include "bench_util.h"
+#include "ev3api_stub.h"
+#include "control/LineTracerT.h"
+
+typedef DualPIDSteering<PIDControllerType, LineTraceConfig> Steering;
+typedef LineTracerT<ColorSensorCalculator, Steering, MotorRunner> PolicyTracer;
+
+/** 試作コントローラの例: 明度PIDだけで舵角を決める(ポリシーを差し替えるだけで使える) */
+template <class PID, class Config>
+struct ReflectOnlySteering
+{
+    PID reflect;
+    ReflectOnlySteering() { reflect.setPIDparam(Kp_reflect, Ki_reflect, Kd_reflect); }
+    template <class Sensor>
+    int steer(Sensor &sensor)
+    {
+        reflect.setPIDactual(sensor.getHSVval());
+        reflect.calc(Config::target_reflect, -1 * Config::edge);
+        return reflect.getPIDvalue();
+    }
+};
+
+static ColorSensorCalculator *sensor;
+static MotorRunner *motor;
+static PIDControllerType *pid_reflect, *pid_hsv;
+static LineTracer *class_tracer;
+static Steering *steering;
+static PolicyTracer *policy_tracer;
+
+extern "C" __attribute__((noinline)) int run_class_cycle(const rgb_raw_t *rgb)
+{
+    sensor->calc(rgb);
+    int turn = class_tracer->calc(pid_reflect, pid_hsv, sensor);
+    motor->run(MOTOR_POWER, turn);
+    return turn;
+}
+
+extern "C" __attribute__((noinline)) int run_policy_cycle(const rgb_raw_t *rgb)
+{
+    sensor->calc(rgb);
+    policy_tracer->run();
+    return policy_tracer->getTurnRatio();
+}
+
+int main()
+{
+    // -------- センサ値: 白/黒の境界付近と時々青ライン --------
+    const int N = 4096;
+    std::vector<rgb_raw_t> rgb(N);
+    unsigned int seed = 7;
+    for (int i = 0; i < N; i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        int v = 30 + (int)((seed >> 16) % 60);
+        rgb[i].r = v;
+        rgb[i].g = v + 2;
+        rgb[i].b = v;
+        if ((seed >> 8) % 16 == 0)
+        {
+            rgb[i].r = 20;
+            rgb[i].g = 30;
+            rgb[i].b = 95;
+        }
+    }
+
+    sensor = new ColorSensorCalculator();
+    motor = new MotorRunner();
+    pid_reflect = new PIDControllerType();
+    pid_hsv = new PIDControllerType();
+    pid_reflect->setPIDparam(Kp_reflect, Ki_reflect, Kd_reflect);
+    pid_hsv->setPIDparam(Kp_hsv, Ki_hsv, Kd_hsv);
+    class_tracer = new LineTracer();
+    steering = new Steering();
+    policy_tracer = new PolicyTracer(*sensor, *steering, motor);
+
+    // -------- 一致確認 --------
+    // 後半は走行中の PID目標の変更(CMD の調整値, LineCalibrator の結果)を真似て目標を変える
+    int mismatch = 0;
+    for (int i = 0; i < N; i++)
+    {
+        if (i == N / 2)
+        {
+            class_tracer->setTargets(TARGET_REFLECT + 6, TARGET_HSV - 9);
+            policy_tracer->setTargets(TARGET_REFLECT + 6, TARGET_HSV - 9);
+        }
+        if (run_class_cycle(&rgb[i]) != run_policy_cycle(&rgb[i]))
+            mismatch++;
+    }
+
+    const int REPEAT = 500;
+    int acc = 0;
+    uint64_t t0 = bench_now_ns();
+    for (int r = 0; r < REPEAT; r++)
+        for (int i = 0; i < N; i++)
+            acc += run_class_cycle(&rgb[i]);
+    uint64_t t1 = bench_now_ns();
+    for (int r = 0; r < REPEAT; r++)
+        for (int i = 0; i < N; i++)
+            acc += run_policy_cycle(&rgb[i]);
+    uint64_t t2 = bench_now_ns();
+
+    // -------- 試作コントローラの差し替え --------
+    ReflectOnlySteering<PIDControllerType, LineTraceConfig> reflect_only;
+    LineTracerT<ColorSensorCalculator, ReflectOnlySteering<PIDControllerType, LineTraceConfig>, MotorRunner>
+        experimental(*sensor, reflect_only, motor);
+    for (int i = 0; i < N; i++)
+    {
+        sensor->calc(&rgb[i]);
+        experimental.run();
+        acc += experimental.getTurnRatio();
+    }
+    bench_keep(acc);
+
+    double total = (double)REPEAT * N;
+    printf("turn mismatch %d/%d\n", mismatch, N);
+    printf("LineTracer    %.2f ns/cycle\n", (t1 - t0) / total);
+    printf("LineTracerT   %.2f ns/cycle\n", (t2 - t1) / total);
+    return mismatch ? 1 : 0;
+}
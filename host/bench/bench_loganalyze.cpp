@@ -0,0 +1,248 @@
+/**
+ * @file bench_loganalyze.cpp
+ * @brief 走行ログの解析(LogAnalyzer)の確認と解析の速度
+ *
+ * @note SimLoop と同じく TracerCore と SimWorld を直結して走らせ,ログのフレームを KHLG 形式(DataLogger)と
+ *       'Iiiiiii' 形式(先頭28byte)の一時ファイルに書き,LogAnalyzer::analyzeFile(mmap)で読んだ指標を
+ *       シミュレータの値(周回,周回時間,ジャイロのバイアス)と比べる。
+ *       走行は 2周 + 3秒 と,直線に障害物を置いて段差の処理(DrivingStage 101 -> 999)まで の2つ。
+ *
+ *       確認項目(どれかが合わなければ終了コード 1):
+ *        - フレーム数,周回数はシミュレータと同じ,周回時間はシミュレータとの差が LAP_TOLERANCE_S 以内
+ *        - DrivingStage ごとの時間の和は走行時間と同じ,障害物は1回で DrivingStage 101 -> 103 を通る
+ *        - ジャイロのドリフトはシミュレータのバイアスとの差が DRIFT_TOLERANCE_DPS 以内
+ *        - 'Iiiiiii' 形式は周回数と,走行中だけの場合の舵角の指標が KHLG 形式と同じ
+ *        - 途中で切れたファイルは切れたフレームを捨てて読む
+ *        - 列形式のバイナリは書いて読むと同じ値に戻る
+ *       最後に同じファイルを FILES 個並べて,1スレッドと全コアの解析の速度[GB/s]を出す(確認はしない)。
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "bench_util.h"
+#include "ev3api_stub.h"
+#include "SimLoop.h"
+#include "LogAnalyzer.h"
+#include "WorkStealingPool.h"
+
+#define GYRO_BIAS_DPS 0.5       // シミュレータのジャイロのバイアス[deg/s]
+#define LAP_TOLERANCE_S 0.2     // 周回時間のシミュレータとの差の許容[s]
+#define DRIFT_TOLERANCE_DPS 0.1 // ジャイロのドリフトのバイアスとの差の許容[deg/s]
+#define FILES 64                // 速度の測定で並べるファイル数
+
+static int failures = 0;
+
+static void check(bool ok, const char *scenario, const char *what)
+{
+    if (!ok)
+    {
+        printf("FAIL  %s: %s\n", scenario, what);
+        failures++;
+    }
+}
+
+/** 走行の結果 */
+struct drive_t
+{
+    std::string khlg, raw;       /* 一時ファイル */
+    long frames;
+    int laps;                    /* シミュレータの周回数 */
+    double first_lap_s;          /* シミュレータの最初の周回時間[s] */
+    int max_stage;               /* 最後の DrivingStage */
+};
+
+static std::string temp_file(const std::vector<uint8_t> &data)
+{
+    char path[] = "/tmp/bench_loganalyze_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0 || write(fd, data.data(), data.size()) != (ssize_t)data.size())
+        perror("mkstemp");
+    close(fd);
+    return path;
+}
+
+/**
+ * @brief 走らせてログを一時ファイルに書く
+ * @param time_s    走行時間[s], 走行を終えたら(DrivingStage 999)そこで止める
+ * @param obstacle  直線に障害物を置く
+ */
+static void drive(const CourseImage &course, double time_s, bool obstacle, drive_t *d)
+{
+    simconfig_t cfg = SIM_DEFAULT_CONFIG;
+    cfg.gyro_bias_dps = GYRO_BIAS_DPS;
+    SimWorld world(course, cfg);
+    SimRobotIo io(world);
+    if (obstacle)
+        world.addObstacle(course.start_x + 1200.0, course.start_y, 60.0);
+    TracerCore *core = new TracerCore();
+    DataLogger *logger = new DataLogger();
+    cycleinput_t in = cycleinput_t();
+    cycleoutput_t out;
+    logframe_t frame;
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *fp = open_memstream(&buf, &size);
+    std::vector<uint8_t> raw;
+
+    d->frames = 0;
+    d->first_lap_s = NAN;
+    const long cycles = (long)(time_s * 1e6 / SIM_CYCLE_US);
+    for (long cycle = 0; cycle < cycles; cycle++)
+    {
+        world.advanceTo(SIM_CYCLE_PHASE_US + (uint64_t)cycle * SIM_CYCLE_US);
+        if (world.laps == 1 && std::isnan(d->first_lap_s))
+            d->first_lap_s = world.last_lap_us * 1e-6;
+        io.read(core->getDue(), &in);
+        core->step(&in, &out, &frame);
+        io.write(&in, &out);
+        logger->put(frame);
+        logger->drain(fp);
+        raw.insert(raw.end(), (const uint8_t *)&frame, (const uint8_t *)&frame + LA_RAW_BYTES);
+        d->frames++;
+        d->max_stage = frame.stage;
+        if (out.wakeup_main)
+            break;
+    }
+    fclose(fp);
+    d->laps = world.laps;
+    d->khlg = temp_file(std::vector<uint8_t>(buf, buf + size));
+    d->raw = temp_file(raw);
+    free(buf);
+    delete logger;
+    delete core;
+}
+
+static bool near(double a, double b, double tol)
+{
+    return std::fabs(a - b) <= tol;
+}
+
+/** 同じ値(NaN どうしも同じ)か */
+static bool same(const runmetrics_t &a, const runmetrics_t &b)
+{
+    const double *x = LogAnalyzer::columns(a), *y = LogAnalyzer::columns(b);
+    for (int c = 0; c < LA_NCOLUMNS; c++)
+        if (!(x[c] == y[c] || (std::isnan(x[c]) && std::isnan(y[c]))))
+            return false;
+    return a.path == b.path && a.format == b.format;
+}
+
+/** paths を threads スレッドで repeat 回解析した速度[GB/s] */
+static double throughput(const std::vector<std::string> &paths, int threads, int repeat)
+{
+    std::vector<runmetrics_t> runs(paths.size());
+    WorkStealingPool pool(threads);
+    const uint64_t t0 = bench_now_ns();
+    for (int k = 0; k < repeat; k++)
+        pool.run((int)paths.size(), [&](int task) { LogAnalyzer::analyzeFile(paths[task].c_str(), &runs[task]); });
+    const double secs = (bench_now_ns() - t0) * 1e-9;
+    double bytes = 0;
+    for (size_t i = 0; i < runs.size(); i++)
+        bytes += runs[i].bytes;
+    return bytes * repeat / secs * 1e-9;
+}
+
+int main()
+{
+    CourseImage course;
+    course.generateOval(2000.0, 600.0);
+    course.buildLineDistance();
+
+    // -------- 2周 + 3秒 --------
+    drive_t laps;
+    drive(course, 31.0, false, &laps);
+    runmetrics_t k, r;
+    {
+        const char *sc = "laps";
+        check(LogAnalyzer::analyzeFile(laps.khlg.c_str(), &k) && k.format == 1, sc, "KHLG log read");
+        check(LogAnalyzer::analyzeFile(laps.raw.c_str(), &r) && r.format == 2, sc, "raw log read");
+        check(k.frames == laps.frames && r.frames == laps.frames, sc, "frame count");
+        check(k.gaps == 0, sc, "no gaps");
+        check(k.laps == laps.laps && laps.laps == 2, sc, "lap count equals the simulator");
+        check(near(k.lap_s, laps.first_lap_s, LAP_TOLERANCE_S), sc, "first lap time near the simulator");
+        check(near(k.stage_s[0], k.duration_s, 1e-9) && k.other_s == 0, sc, "all time in DrivingStage 0");
+        check(k.obstacles == 0 && std::isnan(k.first_obstacle_s), sc, "no obstacle");
+        check(near(k.gyro_drift_dps, GYRO_BIAS_DPS, DRIFT_TOLERANCE_DPS), sc, "gyro drift near the simulator bias");
+        check(r.laps == laps.laps, sc, "raw lap count from the gyro");
+        check(r.turn_rms == k.turn_rms && r.osc_hz == k.osc_hz, sc, "raw turn metrics equal KHLG");
+        check(std::isnan(r.stage_s[0]) && std::isnan(r.gyro_drift_dps), sc, "raw has no stage or pose metrics");
+        printf("2 laps + 3 s: sim lap %.3f s, log lap %.3f s best %.3f s, laps %.0f (raw %.0f), turn rms %.1f, osc %.1f Hz, "
+               "gyro drift %.3f deg/s (bias %.1f)\n",
+               laps.first_lap_s, k.lap_s, k.best_lap_s, k.laps, r.laps, k.turn_rms, k.osc_hz, k.gyro_drift_dps,
+               GYRO_BIAS_DPS);
+    }
+
+    // -------- 障害物 --------
+    drive_t obst;
+    drive(course, 20.0, true, &obst);
+    {
+        const char *sc = "obstacle";
+        runmetrics_t m;
+        check(LogAnalyzer::analyzeFile(obst.khlg.c_str(), &m), sc, "KHLG log read");
+        check(obst.max_stage == 999, sc, "simulator reached DrivingStage 999");
+        check(m.obstacles == 1 && m.first_obstacle_s > 0, sc, "one obstacle");
+        check(m.stage_s[1] > 0 && m.stage_s[2] > 0 && m.stage_s[3] > 0, sc, "time in DrivingStage 101..103");
+        double sum = m.other_s;
+        for (int s = 0; s < LA_STAGES; s++)
+            sum += m.stage_s[s];
+        check(near(sum, m.duration_s, 1e-9), sc, "stage times add up to the duration");
+        printf("obstacle: detected at %.3f s, stage 0 %.3f s, 101 %.3f s, 102 %.3f s, 103 %.3f s\n", m.first_obstacle_s,
+               m.stage_s[0], m.stage_s[1], m.stage_s[2], m.stage_s[3]);
+    }
+
+    // -------- 途中で切れたファイル --------
+    {
+        const char *sc = "truncated";
+        FILE *fp = fopen(laps.khlg.c_str(), "rb");
+        std::vector<uint8_t> data(1 << 20);
+        data.resize(fread(data.data(), 1, data.size(), fp));
+        fclose(fp);
+        runmetrics_t m;
+        m.path = "cut";
+        LogAnalyzer::analyze(data.data(), data.size() - 3, &m);
+        check(m.frames == k.frames - 1, sc, "KHLG drops the cut frame");
+        LogAnalyzer::analyze((const uint8_t *)"KH", 2, &m);
+        check(m.frames == 0, sc, "short file");
+    }
+
+    // -------- 列形式のバイナリ --------
+    {
+        const char *sc = "binary";
+        std::vector<runmetrics_t> runs;
+        runs.push_back(k);
+        runs.push_back(r);
+        char *buf = NULL;
+        size_t size = 0;
+        FILE *fp = open_memstream(&buf, &size);
+        LogAnalyzer::writeBinary(fp, runs);
+        fclose(fp);
+        std::vector<runmetrics_t> back;
+        check(LogAnalyzer::readBinary((const uint8_t *)buf, size, &back) && back.size() == 2, sc, "read back");
+        check(back.size() == 2 && same(back[0], k) && same(back[1], r), sc, "same values");
+        check(!LogAnalyzer::readBinary((const uint8_t *)buf, size - 1, &back), sc, "truncated binary rejected");
+        printf("columnar binary: %zu bytes for %zu runs x %d columns\n", size, runs.size(), LA_NCOLUMNS);
+        free(buf);
+    }
+
+    // -------- 速度 --------
+    std::vector<std::string> paths(FILES, laps.khlg);
+    const int cores = (int)std::thread::hardware_concurrency();
+    const double one = throughput(paths, 1, 4);
+    const double all = throughput(paths, cores, 4);
+    std::vector<std::string> raws(FILES, laps.raw);
+    printf("throughput: KHLG %.3f GB/s with 1 thread, %.3f GB/s with %d threads; raw %.3f GB/s\n", one, all, cores,
+           throughput(raws, cores, 4));
+
+    unlink(laps.khlg.c_str());
+    unlink(laps.raw.c_str());
+    unlink(obst.khlg.c_str());
+    unlink(obst.raw.c_str());
+    printf("%s (%d failures)\n", failures ? "FAIL" : "PASS", failures);
+    return failures ? 1 : 0;
+}
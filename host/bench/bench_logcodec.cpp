@@ -0,0 +1,141 @@
+/**
+ * @file bench_logcodec.cpp
+ * @brief ログ形式(差分+zigzag varint)の符号化/復号の往復ベンチマーク
+ *
+ * @note 使い方: bench_logcodec [log.dat]
+ *       log.dat は従来の28byte固定長でも KHLG 形式でもよい(一旦フレーム列に戻してから計測する)。
+ *       省略時は合成データを使う。
+ *       圧縮率は従来の形式(MAKE_LOG_RAW, LOG_LEGACY_BYTES/フレーム)に対する値で,
+ *       LOG_RATIO_MIN 倍を下回ると失敗する。
+ *       メモリ上のフレーム(sizeof(logframe_t), 全チャンネル)に対する値は別に表示する。
+ */
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "bench_util.h"
+#include "logging/DataLogger.h"
+#include "logging/LogDecoder.h"
+
+#define LOG_RATIO_MIN 3.0 // 従来の形式に対する圧縮率の下限
+
+static std::vector<logframe_t> load_frames(const char *path)
+{
+    std::vector<logframe_t> frames;
+    std::vector<uint8_t> data;
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return frames;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        data.insert(data.end(), buf, buf + n);
+    fclose(fp);
+
+    if (LogDecoder::isEncoded(data.data(), data.size()))
+    {
+        LogDecoder dec;
+        const uint8_t *p = data.data();
+        while (dec.next(p, data.data() + data.size()))
+        {
+            logframe_t f;
+            int32_t v[LOG_CHANNELS];
+            for (int i = 0; i < LOG_CHANNELS; i++)
+            {
+                int idx = dec.channelIndex(LOG_SCHEMA[i].name);
+                v[i] = (idx >= 0) ? dec.values()[idx] : 0;
+            }
+            memcpy(&f, v, sizeof(f));
+            frames.push_back(f);
+        }
+    }
+    else
+    {
+        // 従来形式は入力値のない28byteフレーム
+        frames.resize(data.size() / LOG_LEGACY_BYTES);
+        for (size_t i = 0; i < frames.size(); i++)
+        {
+            memset(&frames[i], 0, sizeof(logframe_t));
+            memcpy(&frames[i], &data[i * LOG_LEGACY_BYTES], LOG_LEGACY_BYTES);
+        }
+    }
+    return frames;
+}
+
+static std::vector<logframe_t> synth_frames(unsigned int count)
+{
+    std::vector<logframe_t> frames(count);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        logframe_t &f = frames[i];
+        f.count_time = i * 4;
+        f.drivin = ((i / 500) & 1) ? 100 : 0;
+        f.turn = (int)((i * 7919) % 11) - 5;
+        f.omega = (int)(i / 200);
+        f.hsv_val = 20 + (int)((i * 104729) % 5) - 2;
+        f.distance = 255;
+        f.gyro_deg = -(int)(i / 40);
+    }
+    return frames;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<logframe_t> frames = (argc > 1) ? load_frames(argv[1]) : synth_frames(100000);
+    if (frames.empty())
+    {
+        fprintf(stderr, "bench_logcodec: no frames\n");
+        return 1;
+    }
+    const size_t nframes = frames.size();
+    const int REPEAT = (int)(2000000 / nframes) + 1;
+
+    // -------- 符号化 --------
+    std::vector<uint8_t> encoded(LOG_HEADER_MAX_BYTES + nframes * (1 + 5 + 5 * LOG_CHANNELS));
+    size_t len = 0;
+    uint64_t t0 = bench_now_ns();
+    for (int r = 0; r < REPEAT; r++)
+    {
+        LogEncoder enc(LOG_SCHEMA, LOG_CHANNELS);
+        len = enc.header(encoded.data());
+        for (size_t i = 0; i < nframes; i++)
+        {
+            int32_t v[LOG_CHANNELS];
+            memcpy(v, &frames[i], sizeof(v));
+            len += enc.encode(v, &encoded[len]);
+        }
+    }
+    uint64_t t1 = bench_now_ns();
+
+    // -------- 復号と照合 --------
+    size_t decoded = 0;
+    bool match = true;
+    uint64_t t2 = bench_now_ns();
+    for (int r = 0; r < REPEAT; r++)
+    {
+        LogDecoder dec;
+        const uint8_t *p = encoded.data();
+        decoded = 0;
+        while (dec.next(p, encoded.data() + len))
+        {
+            if (r == 0 && memcmp(dec.values(), &frames[decoded], sizeof(logframe_t)) != 0)
+                match = false;
+            decoded++;
+        }
+    }
+    uint64_t t3 = bench_now_ns();
+
+    double total = (double)nframes * REPEAT;
+    printf("frames        %zu\n", nframes);
+    printf("legacy        %zu bytes (%d bytes/frame, MAKE_LOG_RAW 'Iiiiiii')\n", nframes * LOG_LEGACY_BYTES,
+           LOG_LEGACY_BYTES);
+    printf("encoded       %zu bytes (%.2f bytes/frame)\n", len, (double)len / nframes);
+    const double ratio = (double)(nframes * LOG_LEGACY_BYTES) / len;
+    printf("ratio         %.2fx vs legacy (min %.1fx)%s\n", ratio, LOG_RATIO_MIN, ratio < LOG_RATIO_MIN ? "  TOO LOW" : "");
+    printf("frame         %zu bytes/frame in memory (sizeof(logframe_t), %.2fx, all channels)\n",
+           sizeof(logframe_t), (double)(nframes * sizeof(logframe_t)) / len);
+    printf("encode        %.1f ns/frame\n", (t1 - t0) / total);
+    printf("decode        %.1f ns/frame\n", (t3 - t2) / total);
+    printf("roundtrip     %s\n", (match && decoded == nframes) ? "ok" : "MISMATCH");
+    return (match && decoded == nframes && ratio >= LOG_RATIO_MIN) ? 0 : 1;
+}
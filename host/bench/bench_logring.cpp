@@ -0,0 +1,93 @@
+/**
+ * @file bench_logring.cpp
+ * @brief DataLogger(SPSCリングバッファ)の書き込み側コストの計測
+ *
+ * @note 3通りを比べる
+ *       - fwrite x7 : 従来の datalogging() と同じく1フィールドずつ fwrite する
+ *       - put       : リングバッファに積むだけ(読み出し側スレッドが並行して drain)
+ *       - put+drain : 同一スレッドで 5フレームごとに drain(logger_task 20ms周期相当)
+ */
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+#include "bench_util.h"
+#include "logging/DataLogger.h"
+
+static const unsigned int FRAMES = 4000000;
+
+static logframe_t make_frame(unsigned int i)
+{
+    logframe_t f;
+    f.count_time = i * 4;
+    f.drivin = (i >> 6) & 1 ? 100 : 0;
+    f.turn = (int)(i % 41) - 20;
+    f.omega = (int)(i >> 8);
+    f.hsv_val = 20 + (int)(i % 7);
+    f.distance = 255;
+    f.gyro_deg = -(int)(i >> 7);
+    return f;
+}
+
+int main()
+{
+    FILE *null = fopen("/dev/null", "wb");
+    uint64_t t0, t1;
+
+    // -------- 従来: フィールドごとに fwrite --------
+    t0 = bench_now_ns();
+    for (unsigned int i = 0; i < FRAMES; i++)
+    {
+        logframe_t f = make_frame(i);
+        fwrite(&f.count_time, sizeof(f.count_time), 1, null);
+        fwrite(&f.drivin, sizeof(f.drivin), 1, null);
+        fwrite(&f.turn, sizeof(f.turn), 1, null);
+        fwrite(&f.omega, sizeof(f.omega), 1, null);
+        fwrite(&f.hsv_val, sizeof(f.hsv_val), 1, null);
+        fwrite(&f.distance, sizeof(f.distance), 1, null);
+        fwrite(&f.gyro_deg, sizeof(f.gyro_deg), 1, null);
+    }
+    t1 = bench_now_ns();
+    printf("fwrite x7      %7.1f ns/frame\n", (double)(t1 - t0) / FRAMES);
+
+    // -------- put のみ, 読み出し側は別スレッド --------
+    {
+        static DataLogger logger;
+        std::atomic<bool> done(false);
+        std::thread consumer([&] {
+            while (!done.load())
+                logger.drain(null);
+            logger.drain(null);
+        });
+        t0 = bench_now_ns();
+        for (unsigned int i = 0; i < FRAMES; i++)
+            logger.put(make_frame(i));
+        t1 = bench_now_ns();
+        done.store(true);
+        consumer.join();
+        printf("put (threaded) %7.1f ns/frame  dropped=%u highwater=%u/%u\n",
+               (double)(t1 - t0) / FRAMES, logger.getDropped(), logger.getHighWater(), LOG_RING_SIZE);
+    }
+
+    // -------- put + 5フレームごとに drain --------
+    {
+        static DataLogger logger;
+        uint64_t put_ns = 0;
+        t0 = bench_now_ns();
+        for (unsigned int i = 0; i < FRAMES; i += 5)
+        {
+            uint64_t p0 = bench_now_ns();
+            for (unsigned int j = 0; j < 5; j++)
+                logger.put(make_frame(i + j));
+            put_ns += bench_now_ns() - p0;
+            logger.drain(null);
+        }
+        t1 = bench_now_ns();
+        printf("put (+drain)   %7.1f ns/frame  total %.1f ns/frame  dropped=%u highwater=%u/%u\n",
+               (double)put_ns / FRAMES, (double)(t1 - t0) / FRAMES,
+               logger.getDropped(), logger.getHighWater(), LOG_RING_SIZE);
+    }
+
+    fclose(null);
+    return 0;
+}
@@ -0,0 +1,249 @@
+/**
+ * @file bench_motor.cpp
+ * @brief 走行モーター出力(MotorRunner)の回転速度の追従とドライバの呼び出し数の比較
+ *
+ * @note 記録したログの前進速度と舵角を毎周期 MotorRunner に渡し,シミュレータのモーターモデルを回す。
+ *       途中の区間(登坂)で走行モーターに負荷をかける。次の3つを比べる:
+ *        - every   : 毎周期 ev3_motor_steer を呼ぶ(変更前の MotorRunner::run)
+ *        - open    : パワー指令のまま,前回と同じ指令は呼ばない(run(power, turn))
+ *        - speed   : 車輪ごとの回転速度のフィードバック(setSpeedLoop(true), run にエンコーダー値を渡す)
+ *       目標の回転速度(ev3_motor_steer と同じ配分のパワー x MOTOR_DPS_PER_POWER)と
+ *       実際の回転速度(WINDOW_MS ごとのエンコーダーの差)の差の RMS と,1秒あたりのモーター出力の数を比べる。
+ *
+ *       確認項目(どれかが合わなければ終了コード 1):
+ *        - open は every と同じ走り(追従の誤差が同じ)で,出力の数は every 以下
+ *        - speed の追従の誤差は負荷なしで open 以下,負荷ありで open の SPEED_RMS_RATIO 以下
+ *        - speed の出力の数は every 以下
+ *        - 止まった後の stop と,前回と同じアームの指令(Ev3RobotIo::write)はドライバを呼ばない
+ *
+ *  使い方:
+ *    bench_motor LOG.dat
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "ev3api_host.h"
+#include "control/MotorRunner.h"
+#include "control/RobotT.h"
+#include "logging/LogDecoder.h"
+
+#define WINDOW_MS 100          // 実際の回転速度を測る区間[ms]
+#define LOAD_POWER 15          // 登坂の負荷[パワー]
+#define LOAD_FROM_PCT 40       // 負荷をかける区間[%] (ログの長さに対して)
+#define LOAD_TO_PCT 70
+#define SPEED_RMS_RATIO 0.5    // 負荷ありで speed に求める open に対する誤差の割合の上限
+
+static int failures = 0;
+
+static void check(bool ok, const char *scenario, const char *what)
+{
+    if (!ok)
+    {
+        printf("FAIL  %s: %s\n", scenario, what);
+        failures++;
+    }
+}
+
+/** 1周期分の指令 */
+struct command_t
+{
+    int power, turn;
+};
+
+static bool load_commands(const char *path, std::vector<command_t> *out)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return false;
+    std::vector<uint8_t> data;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        data.insert(data.end(), buf, buf + n);
+    fclose(fp);
+    if (!LogDecoder::isEncoded(data.data(), data.size()))
+        return false;
+
+    LogDecoder dec;
+    const uint8_t *p = data.data();
+    const uint8_t *end = p + data.size();
+    int i_power = -1, i_turn = -1;
+    while (dec.next(p, end))
+    {
+        if (i_power < 0)
+        {
+            i_power = dec.channelIndex("power");
+            i_turn = dec.channelIndex("turn");
+            if (i_power < 0 || i_turn < 0)
+                return false;
+        }
+        command_t c = {dec.values()[i_power], dec.values()[i_turn]};
+        if (c.power != 0) // 走行前と停止後は除く
+            out->push_back(c);
+    }
+    return !out->empty();
+}
+
+/** 出力の方式 */
+enum
+{
+    MODE_EVERY = 0,
+    MODE_OPEN,
+    MODE_SPEED
+};
+static const char *MODE_NAMES[] = {"every", "open", "speed"};
+
+/** 1回の走行の結果 */
+struct result_t
+{
+    double rms_free, rms_load; // 負荷なし,負荷ありの区間の追従の誤差[deg/s]
+    double writes_per_s;       // 1秒あたりのモーター出力の数
+    double distance_mm;        // 走行距離
+};
+
+static result_t run_mode(const std::vector<command_t> &log, const CourseImage &course, int mode)
+{
+    SimWorld world(course);
+    host_world = &world;
+    MotorRunner motor;
+    motor.setSpeedLoop(mode == MODE_SPEED);
+    host_motor_writes = 0;
+
+    const int cycles = (int)log.size();
+    const int load_from = cycles * LOAD_FROM_PCT / 100, load_to = cycles * LOAD_TO_PCT / 100;
+    const int window = WINDOW_MS / MOTOR_CYCLE_MS;
+    double sq[2] = {0, 0};
+    int samples[2] = {0, 0};
+    double target_sum[2] = {0, 0}; // 区間の目標[deg/s]の和(左,右)
+    int32_t count0[2] = {0, 0};
+    bool loaded0 = false;
+    uint64_t t = 0;
+    for (int k = 0; k < cycles; k++)
+    {
+        world.advanceTo(t);
+        const bool loaded = (k >= load_from && k < load_to);
+        world.drive_load = loaded ? LOAD_POWER : 0;
+        const int32_t counts[2] = {world.getCounts(world.left_port), world.getCounts(world.right_port)};
+
+        // -------- 区間ごとの追従の誤差(負荷の切り替えを含む区間は捨てる) --------
+        if (k % window == 0)
+        {
+            if (k > 0 && loaded == loaded0)
+                for (int w = 0; w < 2; w++)
+                {
+                    double actual = (counts[w] - count0[w]) * 1000.0 / WINDOW_MS;
+                    double e = actual - target_sum[w] / window;
+                    sq[loaded] += e * e;
+                    samples[loaded]++;
+                }
+            target_sum[0] = target_sum[1] = 0;
+            count0[0] = counts[0];
+            count0[1] = counts[1];
+            loaded0 = loaded;
+        }
+
+        const command_t &c = log[k];
+        int left, right;
+        MotorRunner::steerPower(c.power, c.turn, &left, &right);
+        target_sum[0] += left * MOTOR_DPS_PER_POWER;
+        target_sum[1] += right * MOTOR_DPS_PER_POWER;
+        if (mode == MODE_EVERY)
+            ev3_motor_steer(EV3_PORT_C, EV3_PORT_B, c.power, c.turn);
+        else
+            motor.run(c.power, c.turn, counts[0], counts[1]);
+        t += MOTOR_CYCLE_MS * 1000;
+    }
+    world.advanceTo(t);
+    host_world = NULL;
+
+    result_t r;
+    r.rms_free = samples[0] ? std::sqrt(sq[0] / samples[0]) : 0;
+    r.rms_load = samples[1] ? std::sqrt(sq[1] / samples[1]) : 0;
+    r.writes_per_s = host_motor_writes * 1e6 / t;
+    r.distance_mm = world.travelled_mm;
+    return r;
+}
+
+/** 走行を終えた後(毎周期 stop)とアームを同じパワーで回し続けるときのドライバの呼び出し数 */
+static void idle(const CourseImage &course)
+{
+    const char *sc = "idle";
+    SimWorld world(course);
+    host_world = &world;
+
+    MotorRunner motor;
+    motor.run(30, 0);
+    host_motor_writes = 0;
+    for (int k = 0; k < 100; k++)
+        motor.stop();
+    check(host_motor_writes == 2, sc, "repeated stop calls the driver once per wheel");
+    motor.run(30, 0);
+    motor.stop();
+    check(host_motor_writes == 6 && world.getPower(world.left_port) == 0, sc, "stop after run stops again");
+
+    Ev3RobotIo io;
+    cycleinput_t in = cycleinput_t();
+    cycleoutput_t out = cycleoutput_t();
+    out.drive = MOTOR_CMD_KEEP;
+    out.arm = MOTOR_CMD_RUN;
+    out.arm_power = 20;
+    host_motor_writes = 0;
+    for (int k = 0; k < 100; k++)
+        io.write(&in, &out);
+    check(host_motor_writes == 1, sc, "unchanged arm power calls the driver once");
+    out.arm_power = -20;
+    io.write(&in, &out);
+    out.arm = MOTOR_CMD_STOP;
+    for (int k = 0; k < 100; k++)
+        io.write(&in, &out);
+    check(host_motor_writes == 3, sc, "a new arm power and the first arm stop call the driver");
+    out.arm = MOTOR_CMD_RUN;
+    io.write(&in, &out);
+    check(host_motor_writes == 4 && world.getPower(io.ports.arm) == -20, sc, "arm runs again after a stop");
+    host_world = NULL;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: bench_motor LOG.dat\n");
+        return 2;
+    }
+    std::vector<command_t> log;
+    if (!load_commands(argv[1], &log))
+    {
+        fprintf(stderr, "bench_motor: cannot load %s\n", argv[1]);
+        return 2;
+    }
+    CourseImage course;
+    course.generateOval(2000.0, 600.0);
+
+    printf("drive motor, %s (%zu cycles), load %d power over %d-%d%%\n", argv[1], log.size(), LOAD_POWER,
+           LOAD_FROM_PCT, LOAD_TO_PCT);
+    printf("%-8s %8s %8s %8s %8s\n", "mode", "free", "load", "writes", "dist");
+    result_t r[3];
+    for (int m = MODE_EVERY; m <= MODE_SPEED; m++)
+    {
+        r[m] = run_mode(log, course, m);
+        printf("%-8s %8.1f %8.1f %8.1f %8.0f\n", MODE_NAMES[m], r[m].rms_free, r[m].rms_load, r[m].writes_per_s,
+               r[m].distance_mm);
+    }
+    check(r[MODE_OPEN].rms_free == r[MODE_EVERY].rms_free && r[MODE_OPEN].rms_load == r[MODE_EVERY].rms_load, "open",
+          "skipping unchanged commands does not change the motion");
+    check(r[MODE_OPEN].writes_per_s <= r[MODE_EVERY].writes_per_s, "open", "skipping reduces the driver calls");
+    check(r[MODE_SPEED].rms_free <= r[MODE_OPEN].rms_free, "speed", "speed loop tracks at least as well without load");
+    check(r[MODE_SPEED].rms_load <= r[MODE_OPEN].rms_load * SPEED_RMS_RATIO, "speed",
+          "speed loop holds the wheel speed under load");
+    check(r[MODE_SPEED].writes_per_s <= r[MODE_EVERY].writes_per_s, "speed",
+          "speed loop calls the driver no more often than every-cycle steering");
+    idle(course);
+
+    printf("columns    free/load = wheel speed error RMS without/with load [deg/s] over %d ms windows,\n"
+           "           writes = motor outputs per second (ev3_motor_steer counts 2), dist = travelled [mm]\n",
+           WINDOW_MS);
+    printf("checks     %s (%d failed)\n", failures ? "FAILED" : "ok", failures);
+    return failures ? 1 : 0;
+}
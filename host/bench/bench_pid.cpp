@@ -0,0 +1,117 @@
+/**
+ * @file bench_pid.cpp
+ * @brief PIDController(float) と PIDControllerFixed<Q> の等価性とコストの比較
+ *
+ * @note 入力は目標値のまわりをランダムウォークするセンサ値(明度/彩度を模擬)。
+ *       float版との差(PID値の最大誤差,整数に切り捨てた舵角の不一致)と ns/call を表示する。
+ *       エッジ 0 では両方とも出力 0 で一致すること(合わなければ終了コード 1)。
+ *       ホストはFPUを持つので速度差はEV3(ソフトウェア浮動小数点)より小さく出ることに注意。
+ */
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "bench_util.h"
+#include "control/PIDController.h"
+#include "control/PIDControllerFixed.h"
+
+static const int SAMPLES = 1000000;
+
+static std::vector<int> make_inputs(int target, int lo, int hi, unsigned int seed)
+{
+    std::vector<int> v(SAMPLES);
+    int x = target;
+    for (int i = 0; i < SAMPLES; i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        x += (int)((seed >> 16) % 7) - 3; // ランダムウォーク
+        x += (target - x) / 8;            // 目標へ戻る
+        if ((seed >> 8) % 97 == 0)
+            x = lo + (int)((seed >> 4) % (hi - lo + 1)); // 時々大きく外れる(ライン外れ,青ライン)
+        x = (x < lo) ? lo : (x > hi) ? hi : x;
+        v[i] = x;
+    }
+    return v;
+}
+
+template <int Q>
+static int compare(const char *name, float kp, float ki, float kd, int target, int edge, const std::vector<int> &in)
+{
+    PIDController f;
+    PIDControllerFixed<Q> q;
+    f.setPIDparam(kp, ki, kd);
+    q.setPIDparam(kp, ki, kd);
+    double max_err = 0;
+    int mismatch = 0, max_turn_diff = 0;
+    for (size_t i = 0; i < in.size(); i++)
+    {
+        f.setPIDactual(in[i]);
+        f.calc(target, edge);
+        q.setPIDactual(in[i]);
+        q.calc(target, edge);
+        double err = std::fabs(f.getPIDvalue() - q.getPIDvalueQ() / (double)(1 << Q));
+        if (err > max_err)
+            max_err = err;
+        int d = std::abs((int)f.getPIDvalue() - q.getPIDvalue());
+        if (d != 0)
+            mismatch++;
+        if (d > max_turn_diff)
+            max_turn_diff = d;
+    }
+    printf("%-8s Q%-2d max|pid err| %.6f  turn mismatch %d/%zu (max %d)\n",
+           name, Q, max_err, mismatch, in.size(), max_turn_diff);
+    return (max_err == 0) ? 0 : 1;
+}
+
+template <typename PID>
+static double time_calc(float kp, float ki, float kd, int target, const std::vector<int> &in)
+{
+    PID pid;
+    pid.setPIDparam(kp, ki, kd);
+    int acc = 0;
+    uint64_t t0 = bench_now_ns();
+    for (int r = 0; r < 5; r++)
+    {
+        for (size_t i = 0; i < in.size(); i++)
+        {
+            pid.setPIDactual(in[i]);
+            pid.calc(target, 1);
+            acc += (int)pid.getPIDvalue();
+        }
+    }
+    uint64_t t1 = bench_now_ns();
+    bench_keep(acc);
+    return (double)(t1 - t0) / (5.0 * in.size());
+}
+
+int main()
+{
+    // -------- 積分の移動平均: 逆数乗算が整数除算と一致するか --------
+    int bad = 0;
+    for (int s = -65535; s <= 65535; s++)
+        if (PIDControllerFixed<PID_FIXED_Q>::divHistory(s) != s / I_ARRAY_MAX)
+            bad++;
+    printf("divHistory   %s (|sum| < 2^16)\n", bad ? "MISMATCH" : "exact");
+
+    std::vector<int> reflect = make_inputs(20, 0, 45, 1);
+    std::vector<int> hsv = make_inputs(59, 0, 100, 2);
+
+    compare<8>("reflect", Kp_reflect, Ki_reflect, Kd_reflect, 20, -1, reflect);
+    compare<12>("reflect", Kp_reflect, Ki_reflect, Kd_reflect, 20, -1, reflect);
+    compare<16>("reflect", Kp_reflect, Ki_reflect, Kd_reflect, 20, -1, reflect);
+    compare<20>("reflect", Kp_reflect, Ki_reflect, Kd_reflect, 20, -1, reflect);
+    compare<8>("hsv", Kp_hsv, Ki_hsv, Kd_hsv, 59, 1, hsv);
+    compare<12>("hsv", Kp_hsv, Ki_hsv, Kd_hsv, 59, 1, hsv);
+    compare<16>("hsv", Kp_hsv, Ki_hsv, Kd_hsv, 59, 1, hsv);
+    compare<20>("hsv", Kp_hsv, Ki_hsv, Kd_hsv, 59, 1, hsv);
+    // エッジ 0: float版は edge を掛けるので 0, 固定小数点版も 0 でなければならない
+    const int edge0 = compare<PID_FIXED_Q>("edge 0", Kp_reflect, Ki_reflect, Kd_reflect, 20, 0, reflect);
+
+    double tf = time_calc<PIDController>(Kp_reflect, Ki_reflect, Kd_reflect, 20, reflect);
+    double tq = time_calc<PIDControllerFixed<PID_FIXED_Q> >(Kp_reflect, Ki_reflect, Kd_reflect, 20, reflect);
+    printf("float        %.2f ns/call\n", tf);
+    printf("fixed Q%d    %.2f ns/call (%.2fx)\n", PID_FIXED_Q, tq, tf / tq);
+    if (edge0)
+        printf("edge 0       MISMATCH\n");
+    return (bad || edge0) ? 1 : 0;
+}
@@ -0,0 +1,147 @@
+/**
+ * @file bench_robots.cpp
+ * @brief 多数のロボット(RobotBatch)の独立性とスレッド数による速度の伸び
+ *
+ * @note ROBOTS 台のロボットを RobotBatch で全コアに分け,タスクの中で周期ごとに交互に進めて,
+ *       ロボットごとのログフレームのハッシュを,同じロボットを1台だけ TracerCore と SimRobotIo で
+ *       (RobotT を使わずに)走らせた結果と比べる(インスタンスが状態を共有していれば合わない)。
+ *
+ *       確認項目(どれかが合わなければ終了コード 1):
+ *        - 全コアで交互に進めたバッチと,1台ずつ走らせた結果のハッシュが全ロボットで同じ
+ *        - 1スレッド,1台ずつのタスクのバッチも同じ(スレッドの数と順序によらない)
+ *        - ロボットごとの違いでハッシュは全部違う,全ロボットが1周以上走る
+ *       最後に SCALE_ROBOTS 台をスレッド数 1, 2, 4, ... コア数 で走らせて速度の伸びを出し,
+ *       2スレッドで SCALE_MIN_SPEEDUP 倍以上になることを確かめる。ハードウェアスレッドが1つしかない
+ *       ときは伸びを測れないので確認せず "unverified" と表示する(失敗にはしない)。
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "bench_util.h"
+#include "ev3api_stub.h"
+#include "RobotBatch.h"
+
+#define ROBOTS 64          // 確認に使うロボット数
+#define TIME_S 20.0        // 確認の走行時間[s]
+#define SCALE_ROBOTS 1024  // 速度の測定のロボット数
+#define SCALE_TIME_S 2.0   // 速度の測定の走行時間[s]
+#define SCALE_MIN_SPEEDUP 1.5 // 2スレッドの速度の伸びの下限(ハードウェアスレッドが2つ以上のとき)
+#define SEED 7
+
+static int failures = 0;
+
+static void check(bool ok, const char *scenario, const char *what)
+{
+    if (!ok)
+    {
+        printf("FAIL  %s: %s\n", scenario, what);
+        failures++;
+    }
+}
+
+/** 1台だけ走らせたログフレームのハッシュ(RobotT を使わない) */
+static uint64_t run_alone(const CourseImage &course, int i, int laps, double time_s)
+{
+    simconfig_t cfg;
+    tracergains_t gains;
+    RobotBatch::variant(SEED, i, &cfg, &gains);
+    SimWorld world(course, cfg);
+    SimRobotIo io(world);
+    TracerCore *core = new TracerCore();
+    core->setGains(&gains);
+    cycleinput_t in = cycleinput_t();
+    cycleoutput_t out;
+    logframe_t frame;
+    uint64_t h = 14695981039346656037ull;
+    const long cycles = (long)(time_s * 1e6 / SIM_CYCLE_US);
+    for (long c = 0; c < cycles; c++)
+    {
+        world.advanceTo(SIM_CYCLE_PHASE_US + (uint64_t)c * SIM_CYCLE_US);
+        if (world.laps >= laps)
+            break;
+        io.read(core->getDue(), &in);
+        core->step(&in, &out, &frame);
+        io.write(&in, &out);
+        const uint8_t *p = (const uint8_t *)&frame;
+        for (size_t k = 0; k < sizeof(frame); k++)
+            h = (h ^ p[k]) * 1099511628211ull;
+        if (out.wakeup_main)
+            break;
+    }
+    delete core;
+    return h;
+}
+
+int main()
+{
+    CourseImage course;
+    course.generateOval(2000.0, 600.0);
+    course.buildLineDistance();
+    const int cores = std::max(1, (int)std::thread::hardware_concurrency());
+    const int laps = 100;
+
+    // -------- 1台ずつ --------
+    std::vector<uint64_t> alone(ROBOTS);
+    for (int i = 0; i < ROBOTS; i++)
+        alone[i] = run_alone(course, i, laps, TIME_S);
+
+    // -------- 全コアで交互に / 1スレッドで1台ずつ --------
+    {
+        const char *sc = "independent";
+        RobotBatch all(course, ROBOTS, SEED, laps);
+        all.setHash(true);
+        WorkStealingPool pool(cores);
+        all.run(pool, TIME_S, 4);
+        RobotBatch one(course, ROBOTS, SEED, laps);
+        one.setHash(true);
+        WorkStealingPool single(1);
+        one.run(single, TIME_S, 1);
+
+        int same_all = 0, same_one = 0, lapped = 0;
+        std::set<uint64_t> distinct;
+        for (int i = 0; i < ROBOTS; i++)
+        {
+            same_all += (all.getHash(i) == alone[i]) ? 1 : 0;
+            same_one += (one.getHash(i) == alone[i]) ? 1 : 0;
+            lapped += (all.getLaps(i) >= 1) ? 1 : 0;
+            distinct.insert(all.getHash(i));
+        }
+        check(same_all == ROBOTS, sc, "interleaved batch on all cores equals each robot alone");
+        check(same_one == ROBOTS, sc, "single-thread batch equals each robot alone");
+        check((int)distinct.size() == ROBOTS, sc, "robot variants differ");
+        check(lapped == ROBOTS, sc, "every robot completes a lap");
+        printf("independent: %d robots x %.0f s, %d/%d equal alone (%d threads), %d/%d single thread, "
+               "%zu distinct, %d lapped\n",
+               ROBOTS, TIME_S, same_all, ROBOTS, cores, same_one, ROBOTS, distinct.size(), lapped);
+    }
+
+    // -------- スレッド数による速度の伸び --------
+    printf("scaling: %d robots x %.0f s (%.1f MB of state)\n", SCALE_ROBOTS, SCALE_TIME_S,
+           SCALE_ROBOTS * (double)(sizeof(TracerCore) + sizeof(SimWorld)) * 1e-6);
+    double base = 0, speedup2 = 0;
+    for (int t = 1;; t = std::min(cores, t * 2))
+    {
+        RobotBatch batch(course, SCALE_ROBOTS, SEED, laps);
+        WorkStealingPool pool(t);
+        batchstat_t st = batch.run(pool, SCALE_TIME_S);
+        const double rate = st.cycles / st.wall_s;
+        if (t == 1)
+            base = rate;
+        if (t == 2)
+            speedup2 = rate / base;
+        printf("  %2d threads  %.3f Mcycles/s  %6.0fx realtime  speedup %.2f\n", t, rate * 1e-6,
+               rate * SIM_CYCLE_US * 1e-6, rate / base);
+        if (t == cores)
+            break;
+    }
+    if (cores > 1)
+        check(speedup2 >= SCALE_MIN_SPEEDUP, "scaling", "2 threads run at least SCALE_MIN_SPEEDUP times faster");
+    else
+        printf("scaling: unverified (1 hardware thread, only the 1-thread rate was measured)\n");
+
+    printf("%s (%d failures)\n", failures ? "FAIL" : "PASS", failures);
+    return failures ? 1 : 0;
+}
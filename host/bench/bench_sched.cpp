@@ -0,0 +1,321 @@
+/**
+ * @file bench_sched.cpp
+ * @brief RateScheduler(レートグループ)の実行順の確認と,フレーム負荷の見積もり
+ *
+ * @note 確認項目(どれかが合わなければ終了コード 1):
+ *        - advance(マスク表,カウントダウン)が frame % period == phase と一致する
+ *        - 固定位相はそのまま,自動配置は重い処理を別フレームに散らす,with は先行処理と同じフレーム
+ *        - tracer_task の表: センサ取得が計算より先,障害物検知は超音波センサ取得と同じフレームで後
+ *        - TracerCore::step は RATE_OBSTACLE のフレームでだけ障害物を検知する
+ *        - 自動配置の最大フレーム負荷は位相0のままより大きくない(表の cost の単位で比べる)
+ *        - tracer_task 1周期(RobotT<Ev3RobotIo>::cycle と DataLogger::put)をフレームごとに計測し,
+ *          1フレームのセンサ取得(ev3api 呼び出し)の最大が,以前の表(ジャイロとボタンは毎周期,
+ *          超音波センサは COUNT_time % 40 == 0)と位相0のままの表より少ない
+ *       続けて tracer_task の表の周期と位相と,3つの表のホストでの周期時間を表示する。
+ *       cost は実機で測っていない仮の値。ホストの ev3api はスタブで取得に時間がかからないので,
+ *       周期時間の差は表示するだけで判定しない(実機の値は MAKE_PROFILE の区間時間で測る)。
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "bench_util.h"
+#include "ev3api_stub.h"
+#include "control/RobotT.h"
+
+#define CYCLE_PASSES 2000 // 周期時間を測るハイパーピリオドの回数(フレームごとの最小値を取る)
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok)
+    {
+        printf("FAIL  %s\n", what);
+        failures++;
+    }
+}
+
+/**
+ * @brief advance のマスクが dueAt と一致するか
+ */
+static bool matches_modulo(RateScheduler &s, uint32_t frames)
+{
+    s.reset();
+    for (uint32_t f = 0; f < frames; f++)
+    {
+        if (s.getFrame() != f || s.getDue() != s.dueAt(f))
+            return false;
+        s.advance();
+    }
+    return true;
+}
+
+/**
+ * @brief 表の並び順に処理を実行したときの (フレーム, 番号) の列
+ */
+static std::vector<std::pair<uint32_t, int> > dispatch(RateScheduler &s, int ntasks, uint32_t frames)
+{
+    std::vector<std::pair<uint32_t, int> > order;
+    s.reset();
+    for (uint32_t f = 0; f < frames; f++)
+    {
+        uint32_t due = s.getDue();
+        for (int i = 0; i < ntasks; i++)
+            if (due & RATE_BIT(i))
+                order.push_back(std::make_pair(f, i));
+        s.advance();
+    }
+    return order;
+}
+
+static void test_small_tables()
+{
+    // カウントダウンと剰余の一致(いろいろな周期と固定位相)
+    for (int period = 1; period <= 9; period++)
+        for (int phase = 0; phase < period; phase++)
+        {
+            ratetask_t t[2] = {{"a", (uint8_t)period, (uint8_t)phase, 1, RATE_NONE},
+                               {"b", 7, 3, 1, RATE_NONE}};
+            RateScheduler s(t, 2);
+            check(s.getPhase(0) == phase, "fixed phase is kept");
+            check(matches_modulo(s, 200), "advance() equals frame % period == phase");
+        }
+
+    // ハイパーピリオドが長い(マスク表を作らない)ときのカウントダウン
+    {
+        ratetask_t t[2] = {{"p17", 17, RATE_PHASE_AUTO, 1, RATE_NONE},
+                           {"p19", 19, 5, 1, RATE_NONE}};
+        RateScheduler s(t, 2);
+        check(s.hyperPeriod() == RATE_HYPER_MAX, "long hyperperiod is capped");
+        check(matches_modulo(s, 17 * 19 * 2), "countdown path equals modulo");
+    }
+
+    // 同じ周期の重い処理は別フレームに置く
+    {
+        ratetask_t t[3] = {{"base", 1, 0, 10, RATE_NONE},
+                           {"heavy1", 2, RATE_PHASE_AUTO, 50, RATE_NONE},
+                           {"heavy2", 2, RATE_PHASE_AUTO, 50, RATE_NONE}};
+        RateScheduler s(t, 3);
+        check(s.getPhase(1) != s.getPhase(2), "equal-period heavy tasks get different phases");
+        check(s.worstFrameCost() == 60, "worst frame = base + one heavy task");
+    }
+
+    // 周期の違う処理も重ならない位相を選ぶ(5, 10, 25 フレーム)
+    {
+        ratetask_t t[3] = {{"p5", 5, RATE_PHASE_AUTO, 30, RATE_NONE},
+                           {"p10", 10, RATE_PHASE_AUTO, 30, RATE_NONE},
+                           {"p25", 25, RATE_PHASE_AUTO, 10, RATE_NONE}};
+        RateScheduler s(t, 3);
+        check(s.hyperPeriod() == 50, "hyperperiod of 5,10,25 is 50");
+        check(s.worstFrameCost() == 30, "5/10/25-frame tasks never share a frame");
+    }
+
+    // with は先行処理と同じフレーム,後に実行
+    {
+        ratetask_t t[3] = {{"read", 4, RATE_PHASE_AUTO, 20, RATE_NONE},
+                           {"other", 4, 0, 30, RATE_NONE},
+                           {"judge", 4, RATE_PHASE_AUTO, 5, 0}};
+        RateScheduler s(t, 3);
+        check(s.getPhase(0) != 0, "auto phase avoids the fixed-phase task");
+        check(s.getPhase(2) == s.getPhase(0), "follower shares the leader's phase");
+        std::vector<std::pair<uint32_t, int> > order = dispatch(s, 3, 40);
+        for (size_t k = 0; k < order.size(); k++)
+            if (order[k].second == 2)
+                check(k > 0 && order[k - 1].first == order[k].first && order[k - 1].second == 0,
+                      "follower runs right after its leader in the same frame");
+    }
+}
+
+static void test_tracer_table()
+{
+    RateScheduler s(TRACER_RATE_TABLE, RATE_TASKS);
+    uint32_t hyper = s.hyperPeriod();
+    check(matches_modulo(s, hyper * 4), "tracer table: advance() equals modulo");
+
+    std::vector<std::pair<uint32_t, int> > order = dispatch(s, RATE_TASKS, hyper);
+    std::vector<int> runs(RATE_TASKS, 0);
+    for (size_t k = 0; k < order.size(); k++)
+    {
+        int id = order[k].second;
+        runs[id]++;
+        check(order[k].first % TRACER_RATE_TABLE[id].period == (uint32_t)s.getPhase(id),
+              "tracer table: task runs only in its own frames");
+        if (k > 0 && order[k - 1].first == order[k].first)
+            check(order[k - 1].second < id, "tracer table: dispatch follows table order");
+        if (id == RATE_OBSTACLE)
+        {
+            bool read = false;
+            for (size_t j = 0; j < k; j++)
+                if (order[j].first == order[k].first && order[j].second == RATE_IN_SONAR)
+                    read = true;
+            check(read, "tracer table: obstacle check follows the sonar read in the same frame");
+        }
+    }
+    for (int i = 0; i < RATE_TASKS; i++)
+        check(runs[i] == (int)(hyper / TRACER_RATE_TABLE[i].period), "tracer table: run count per hyperperiod");
+    for (int i = RATE_IN_COLOR; i <= RATE_IN_BUTTON; i++)
+        check(i < RATE_COLOR, "tracer table: sensor reads come before calculators");
+    check(TRACER_RATE_TABLE[RATE_LOG].period == 1, "tracer table: every frame is logged (log replay)");
+
+    // 重い取得(ジャイロ,超音波,ボタン)は同じフレームに重ならない
+    bool overlap = false;
+    for (uint32_t f = 0; f < hyper; f++)
+    {
+        uint32_t m = s.dueAt(f);
+        int heavy = !!(m & RATE_BIT(RATE_IN_GYRO)) + !!(m & RATE_BIT(RATE_IN_SONAR)) + !!(m & RATE_BIT(RATE_IN_BUTTON));
+        overlap |= (heavy > 1);
+    }
+    check(!overlap, "tracer table: gyro, sonar and button reads are in different frames");
+}
+
+static void test_tracer_core()
+{
+    // 障害物は RATE_OBSTACLE のフレームで,取得した超音波センサ値から検知する
+    TracerCore core;
+    RateScheduler s(TRACER_RATE_TABLE, RATE_TASKS);
+    cycleinput_t in = cycleinput_t();
+    cycleoutput_t out;
+    logframe_t frame;
+    in.sonar = 255;
+    int detected_at = -1;
+    for (int f = 0; f < 40 && detected_at < 0; f++)
+    {
+        check(core.getDue() == s.getDue(), "TracerCore::getDue follows the table");
+        if (f >= 12 && (core.getDue() & RATE_BIT(RATE_IN_SONAR)))
+            in.sonar = 5; // 障害物
+        core.step(&in, &out, &frame);
+        if (core.getStage() == 101)
+            detected_at = f;
+        s.advance();
+    }
+    check(detected_at >= 12 && detected_at % 10 == s.getPhase(RATE_OBSTACLE),
+          "TracerCore detects the obstacle in the first obstacle frame after the read");
+}
+
+/** 1つの表で tracer_task を回した結果(フレームごと) */
+struct cycleprofile_t
+{
+    const char *name;
+    std::vector<ratetask_t> table;
+    RobotT<Ev3RobotIo> *robot;
+    DataLogger *logger;
+    std::vector<uint64_t> ns;      // フレームごとの周期時間の最小値
+    std::vector<unsigned> reads;   // フレームごとの ev3api のセンサ取得の回数
+};
+
+/**
+ * @brief 3つの表で tracer_task 1周期をフレームごとに測る
+ * @note  入力は合成(ライン端を左右に振れる明度,回転角の増加,ジャイロのドリフト)。
+ *        表ごとに1ハイパーピリオドずつ交互に回し,マシンの混み具合を揃える。
+ *        センサ取得の回数は出力(モーター)の呼び出しを除くため read の前後で数える
+ */
+static void measure_cycles(std::vector<cycleprofile_t> &prof, uint32_t hyper)
+{
+    FILE *sink = fopen("/dev/null", "wb");
+    for (size_t k = 0; k < prof.size(); k++)
+    {
+        prof[k].robot = new RobotT<Ev3RobotIo>();
+        prof[k].robot->core.setRateTable(prof[k].table.data());
+        prof[k].logger = new DataLogger();
+        prof[k].ns.assign(hyper, ~(uint64_t)0);
+        prof[k].reads.assign(hyper, 0);
+    }
+    for (int pass = 0; pass < CYCLE_PASSES; pass++)
+        for (size_t k = 0; k < prof.size(); k++)
+        {
+            cycleprofile_t &p = prof[k];
+            for (uint32_t f = 0; f < hyper; f++)
+            {
+                const int i = pass * (int)hyper + (int)f;
+                const int x = 150 + (int)(120 * std::sin(i * 0.05));
+                ev3stub.rgb.r = (uint16_t)x;
+                ev3stub.rgb.g = (uint16_t)(x + 10);
+                ev3stub.rgb.b = (uint16_t)(x + 20);
+                ev3stub.counts[left_motor] = i * 6;
+                ev3stub.counts[right_motor] = i * 6 + i / 8;
+                ev3stub.gyro = (int16_t)(-i / 50);
+                ev3stub.sonar = 200;
+
+                cycleoutput_t out;
+                logframe_t frame;
+                const unsigned long calls = ev3stub.calls;
+                const uint64_t t0 = bench_now_ns();
+                const uint32_t due = p.robot->read();
+                const unsigned long read_calls = ev3stub.calls;
+                p.robot->step(&out, &frame);
+                p.robot->write(&out);
+                if (due & RATE_BIT(RATE_LOG))
+                    p.logger->put(frame);
+                const uint64_t t1 = bench_now_ns();
+                p.ns[f] = std::min(p.ns[f], t1 - t0);
+                p.reads[f] = (unsigned)(read_calls - calls);
+            }
+            p.logger->drain(sink);
+        }
+    for (size_t k = 0; k < prof.size(); k++)
+    {
+        delete prof[k].robot;
+        delete prof[k].logger;
+    }
+    if (sink != NULL)
+        fclose(sink);
+}
+
+int main()
+{
+    test_small_tables();
+    test_tracer_table();
+    test_tracer_core();
+
+    // -------- tracer_task の表の位相 --------
+    RateScheduler s(TRACER_RATE_TABLE, RATE_TASKS);
+    std::vector<ratetask_t> zero(TRACER_RATE_TABLE, TRACER_RATE_TABLE + RATE_TASKS);
+    for (int i = 0; i < RATE_TASKS; i++)
+        zero[i].phase = 0;
+    RateScheduler s_zero(zero.data(), RATE_TASKS);
+    check(s.worstFrameCost() <= s_zero.worstFrameCost(), "auto phases do not raise the worst frame of the table");
+
+    // -------- 以前の表,位相0,自動配置の周期時間とセンサ取得 --------
+    std::vector<ratetask_t> before(TRACER_RATE_TABLE, TRACER_RATE_TABLE + RATE_TASKS);
+    for (int i = 0; i < RATE_TASKS; i++)
+    {
+        before[i].phase = 0;
+        if (i != RATE_IN_SONAR && i != RATE_OBSTACLE)
+            before[i].period = 1; // 超音波センサと障害物検知だけ COUNT_time % 40 == 0
+    }
+    std::vector<cycleprofile_t> prof(3);
+    prof[0].name = "before";
+    prof[0].table = before;
+    prof[1].name = "phase 0";
+    prof[1].table = zero;
+    prof[2].name = "auto";
+    prof[2].table.assign(TRACER_RATE_TABLE, TRACER_RATE_TABLE + RATE_TASKS);
+    measure_cycles(prof, s.hyperPeriod());
+    unsigned worst_reads[3];
+    printf("%-12s %10s %10s %10s\n", "schedule", "worst ns", "mean ns", "max reads");
+    for (size_t k = 0; k < prof.size(); k++)
+    {
+        double sum = 0;
+        for (size_t f = 0; f < prof[k].ns.size(); f++)
+            sum += prof[k].ns[f];
+        worst_reads[k] = *std::max_element(prof[k].reads.begin(), prof[k].reads.end());
+        printf("%-12s %10lu %10.1f %10u\n", prof[k].name,
+               (unsigned long)*std::max_element(prof[k].ns.begin(), prof[k].ns.end()), sum / prof[k].ns.size(),
+               worst_reads[k]);
+    }
+    check(worst_reads[2] < worst_reads[0], "auto phases read fewer sensors in the worst frame than before");
+    check(worst_reads[2] < worst_reads[1], "auto phases read fewer sensors in the worst frame than phase 0");
+
+    printf("%-12s %6s %6s %6s\n", "task", "period", "phase", "cost");
+    for (int i = 0; i < RATE_TASKS; i++)
+        printf("%-12s %6d %6d %6d\n", TRACER_RATE_TABLE[i].name, TRACER_RATE_TABLE[i].period,
+               s.getPhase(i), TRACER_RATE_TABLE[i].cost);
+    printf("hyperperiod   %u frames (%u ms)\n", s.hyperPeriod(), s.hyperPeriod() * MAIN_CYCLE);
+    printf("cost          placeholder weights for phase placement, not measured on the EV3\n");
+    printf("host time     ev3api is a stub (reads cost nothing), so ns is shown, not checked\n");
+    printf("checks        %s (%d failed)\n", failures ? "FAILED" : "ok", failures);
+    return failures ? 1 : 0;
+}
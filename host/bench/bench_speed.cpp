@@ -0,0 +1,167 @@
+/**
+ * @file bench_speed.cpp
+ * @brief 前進速度の加減速(SpeedProfiler)の周回タイムとラインを外れた回数の比較
+ *
+ * @note 長円コースを SimLoop で RUN_LAPS 周走らせ,
+ *        - 固定の前進速度 MOTOR_POWER (SPEED_FIXED_PROFILE)
+ *        - 固定の前進速度 SPEED_POWER_MAX
+ *        - 加減速 SPEED_ADAPTIVE_PROFILE (要求は MOTOR_POWER)
+ *        - 加減速 加速と加速の変化の制限なし(目標へ即座に切り替える)
+ *       の時間と,センサがラインから SIM_EXCURSION_MM 以上離れた(視野が全部白になった)回数を比べる。
+ *       シミュレータには横方向の最大加速度(grip)と横滑りを入れ,速すぎるとカーブで膨らむようにする。
+ *
+ *       確認項目(どれかが合わなければ終了コード 1):
+ *        - 加減速の走行がどの条件でも完走する
+ *        - 全条件の合計で,加減速の時間が固定 MOTOR_POWER より SPEED_GAIN_MIN 以上短く,
+ *          ラインを外れた回数が固定 SPEED_POWER_MAX の SPEED_OFF_RATIO 以下
+ *        - SpeedProfiler 単体: 目標の切り替えに対して加速の上限を守り,動き出しは加速の変化の上限で緩やかで,目標を越えない
+ */
+#include <cmath>
+#include <cstdio>
+
+#include "ev3api_stub.h"
+#include "SimLoop.h"
+
+#define RUN_LAPS 2
+#define RUN_LIMIT_S 90.0
+#define SPEED_GAIN_MIN 0.05 // 固定 MOTOR_POWER に対して短くなる時間の割合の下限
+#define SPEED_OFF_RATIO 0.7 // 固定 SPEED_POWER_MAX に対するラインを外れた回数の割合の上限
+
+typedef struct
+{
+    const char *name;
+    double straight, radius; /* 長円コース[mm] */
+    double grip_mps2;        /* 横方向の最大加速度 */
+    double yaw_slip;         /* 横滑り */
+} scenario_t;
+
+static const scenario_t SCENARIOS[] = {
+    {"oval r600", 2000.0, 600.0, 0.0, 0.0},
+    {"r400 g0.5", 2000.0, 400.0, 0.5, 0.25},
+    {"r400 g0.3", 2000.0, 400.0, 0.3, 0.5},
+    {"r300 g0.4", 2000.0, 300.0, 0.4, 0.25},
+    {"r300 g0.3", 2000.0, 300.0, 0.3, 0.5},
+    {"r250 g0.3", 1500.0, 250.0, 0.3, 0.25},
+    {"r200 g0.5", 2000.0, 200.0, 0.5, 0.25},
+};
+
+enum
+{
+    MODE_FIXED = 0,
+    MODE_FULL,
+    MODE_ADAPTIVE,
+    MODE_UNLIMITED,
+    MODES
+};
+static const char *MODE_NAMES[MODES] = {"fixed", "fixed max", "adaptive", "unlimited"};
+
+/** 全条件の合計 */
+static double total_time[MODES];
+static int total_off[MODES];
+
+/** 制限なしの加減速: 目標へ1周期で切り替える */
+static const speedprofile_t SPEED_UNLIMITED_PROFILE = {
+    SPEED_ADAPTIVE_PROFILE.power_straight, SPEED_ADAPTIVE_PROFILE.power_min,
+    SPEED_ADAPTIVE_PROFILE.turn_slow, SPEED_ADAPTIVE_PROFILE.error_slow,
+    1000000, 1000000, 1000000000};
+
+static int failures = 0;
+
+static void check(bool ok, const char *scenario, const char *what)
+{
+    if (!ok)
+    {
+        printf("FAIL  %s: %s\n", scenario, what);
+        failures++;
+    }
+}
+
+static simresult_t run_one(SimLoop &loop, const char *scenario, int mode, int power, const speedprofile_t &profile)
+{
+    tracergains_t gains = TRACER_DEFAULT_GAINS;
+    gains.power = power;
+    loop.setSpeedProfile(profile);
+    simresult_t r = loop.run(&gains, RUN_LAPS, RUN_LIMIT_S);
+    printf("%-10s %-10s %4s %4s %7.2f %7.2f %6.1f %6.1f %5d\n", scenario, MODE_NAMES[mode],
+           r.completed ? "yes" : "no", r.lost ? "LOST" : "-", r.time_s, r.last_lap_s, r.cte_rms_mm, r.cte_max_mm,
+           r.excursions);
+    total_time[mode] += r.time_s;
+    total_off[mode] += r.excursions;
+    return r;
+}
+
+static void run(const scenario_t &sc)
+{
+    CourseImage course;
+    course.generateOval(sc.straight, sc.radius);
+    course.buildLineDistance();
+    simconfig_t cfg = SIM_DEFAULT_CONFIG;
+    cfg.grip_mps2 = sc.grip_mps2;
+    cfg.yaw_slip = sc.yaw_slip;
+    SimLoop loop(course, cfg);
+
+    run_one(loop, sc.name, MODE_FIXED, MOTOR_POWER, SPEED_FIXED_PROFILE);
+    run_one(loop, sc.name, MODE_FULL, SPEED_POWER_MAX, SPEED_FIXED_PROFILE);
+    simresult_t adapt = run_one(loop, sc.name, MODE_ADAPTIVE, MOTOR_POWER, SPEED_ADAPTIVE_PROFILE);
+    run_one(loop, sc.name, MODE_UNLIMITED, MOTOR_POWER, SPEED_UNLIMITED_PROFILE);
+
+    check(adapt.completed && !adapt.lost, sc.name, "adaptive run completes without losing the line");
+}
+
+/** SpeedProfiler 単体: 直進で加速してカーブで減速する目標の切り替えへの応答 */
+static void check_limits()
+{
+    const speedprofile_t &p = SPEED_ADAPTIVE_PROFILE;
+    const double dt = SPEED_CYCLE_MS * 1e-3;
+    SpeedProfiler sp;
+    sp.setProfile(&p);
+    int prev = sp.calc(MOTOR_POWER, false, 0, 0);
+    bool over = false, rate_ok = true;
+    int reach_up = -1, reach_down = -1, early = 0;
+    for (int k = 1; k <= 200; k++)
+    {
+        bool straight = (k <= 100); // 100周期直進して,その後は舵角 60 のカーブ
+        int now = sp.calc(MOTOR_POWER, straight, straight ? 0 : 60, 0);
+        int limit = (int)std::ceil((now >= prev ? p.accel : p.decel) * dt) + 1; // 整数に丸めた分 +1
+        rate_ok &= (std::abs(now - prev) <= limit);
+        over |= (now > prev && now > sp.getTarget()); // 上げながら目標を越える
+        if (k == 5)
+            early = now - MOTOR_POWER;
+        if (reach_up < 0 && now == p.power_straight)
+            reach_up = k;
+        if (!straight && reach_down < 0 && now == sp.getTarget())
+            reach_down = k - 100;
+        prev = now;
+    }
+    double min_up = (p.power_straight - MOTOR_POWER) / (p.accel * dt); // 加速の上限で決まる最短の周期数
+    double jerk_5 = 0.5 * p.jerk * (5 * dt) * (5 * dt) + 1;             // 加速の変化の上限で決まる5周期後の増分
+    printf("limits     ramp %d->%d in %d cycles (min %.0f), +%d after 5 cycles (jerk bound %.1f), brake in %d cycles\n",
+           MOTOR_POWER, p.power_straight, reach_up, min_up, early, jerk_5, reach_down);
+    check(rate_ok, "limits", "power changes within accel/decel per cycle");
+    check(reach_up >= (int)min_up && reach_up > 0, "limits", "ramp to straight power bounded by accel");
+    check(early <= jerk_5, "limits", "start of the ramp bounded by jerk");
+    check(!over, "limits", "no overshoot of the target");
+    check(reach_down > 0, "limits", "brakes to the curve target");
+}
+
+int main()
+{
+    printf("speed profile, %d laps (base power %d, straight %d, accel %d/s, decel %d/s, jerk %d/s^2)\n",
+           RUN_LAPS, MOTOR_POWER, SPEED_ADAPTIVE_PROFILE.power_straight, SPEED_ADAPTIVE_PROFILE.accel,
+           SPEED_ADAPTIVE_PROFILE.decel, SPEED_ADAPTIVE_PROFILE.jerk);
+    printf("%-10s %-10s %4s %4s %7s %7s %6s %6s %5s\n", "scenario", "mode", "done", "lost", "time", "lastlap",
+           "cte", "max", "off");
+    for (size_t i = 0; i < sizeof(SCENARIOS) / sizeof(SCENARIOS[0]); i++)
+        run(SCENARIOS[i]);
+    for (int m = 0; m < MODES; m++)
+        printf("%-10s %-10s %9s %7.2f %15s %5d\n", "total", MODE_NAMES[m], "", total_time[m], "", total_off[m]);
+    check(total_time[MODE_ADAPTIVE] < total_time[MODE_FIXED] * (1.0 - SPEED_GAIN_MIN), "total",
+          "adaptive runs beat fixed base power");
+    check(total_off[MODE_ADAPTIVE] <= total_off[MODE_FULL] * SPEED_OFF_RATIO, "total",
+          "adaptive runs leave the line less often than fixed max power");
+    check_limits();
+    printf("columns    time, lastlap [s], cte = sensor distance from the line rms, max [mm],\n"
+           "           off = times the sensor left the line by SIM_EXCURSION_MM\n");
+    printf("checks     %s (%d failed)\n", failures ? "FAILED" : "ok", failures);
+    return failures ? 1 : 0;
+}
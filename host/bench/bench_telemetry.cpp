@@ -0,0 +1,291 @@
+/**
+ * @file bench_telemetry.cpp
+ * @brief テレメトリ(Telemetry)のチャンネルごとの間引きの確認とサンプルのコスト
+ *
+ * @note SimLoop と同じく TracerCore と SimWorld を直結して走らせ,4ms周期ごとに
+ *       TracerCore::step(tracer_task) -> ログのフレームとテレメトリを書き出す(logger_task) を繰り返す。
+ *       ログはメモリ(open_memstream)に書き,走行の後で LogDecoder と TelemetryDecoder で読む。
+ *       走行の途中で間引きを変える(bt_task の CMD_TELEMETRY と同じく configure する)。
+ *
+ *       確認項目(どれかが合わなければ終了コード 1):
+ *        - チャンネルの時刻は間引き x 4ms 間隔で並び,間引きを変えた後は新しい間引きで並ぶ
+ *        - hsv.val, omega, stage の値は同じ時刻のフレームの値と一致する
+ *        - 無効にしたチャンネルは間引きを変えた後にサンプルがない
+ *        - 全部のチャンネルを無効にすると 'T' レコードを書かない('M' だけ)
+ *        - ログは欠けずに復号でき,サンプルを捨てていない
+ *        - 全部無効の sample は全チャンネルの sample より安い
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include "bench_util.h"
+#include "ev3api_stub.h"
+#include "SimLoop.h"
+#include "logging/TelemetryDecoder.h"
+
+#define RUN_CYCLES 1500      // 走行の周期数(6秒)
+#define SWITCH_CYCLE 750     // 間引きを変える周期
+#define COST_BATCH 32        // コストを測るときに続けて呼ぶ sample の回数(リングバッファに収まる数)
+#define COST_ROUNDS 20000    // コストを測る回数
+
+static int failures = 0;
+
+static void check(bool ok, const char *scenario, const char *what)
+{
+    if (!ok)
+    {
+        printf("FAIL  %s: %s\n", scenario, what);
+        failures++;
+    }
+}
+
+/** 走行の結果 */
+struct result_t
+{
+    std::map<unsigned int, logframe_t> frames; /* 経過時間[ms] -> フレーム */
+    TelemetryDecoder tlm;
+    unsigned long tlm_bytes;   /* 'M' と 'T' のバイト数(タグと長さを含む) */
+    unsigned long total_bytes; /* ログ全体のバイト数 */
+    unsigned long t_records;   /* 'T' レコードの数 */
+    bool decode_error;
+    unsigned int dropped;
+};
+
+/**
+ * @brief 走らせてログを読む
+ * @param first     最初の間引き
+ * @param second    SWITCH_CYCLE からの間引き, NULL なら変えない
+ */
+static bool run(const CourseImage &course, const char *first, const char *second, result_t *r)
+{
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *fp = open_memstream(&buf, &size);
+    if (fp == NULL)
+    {
+        perror("open_memstream");
+        return false;
+    }
+
+    SimWorld world(course);
+
+    SimRobotIo io(world);
+    TracerCore *core = new TracerCore(); // 走行ごとに作り直す
+    DataLogger *logger = new DataLogger();
+    Telemetry *telemetry = new Telemetry();
+    core->setTelemetry(telemetry);
+    tlmconfig_t c;
+    if (!Telemetry::parse(first, &c) || !telemetry->configure(c))
+        return false;
+    cycleinput_t in = cycleinput_t();
+    cycleoutput_t out;
+    logframe_t frame;
+
+    for (int cycle = 0; cycle < RUN_CYCLES; cycle++)
+    {
+        // -------- bt_task: 間引きを変える --------
+        if (cycle == SWITCH_CYCLE && second != NULL)
+            if (!Telemetry::parse(second, &c) || !telemetry->configure(c))
+                return false;
+
+        // -------- tracer_task --------
+        world.advanceTo(SIM_CYCLE_PHASE_US + (uint64_t)cycle * SIM_CYCLE_US);
+        io.read(core->getDue(), &in);
+        core->step(&in, &out, &frame);
+        io.write(&in, &out);
+        logger->put(frame);
+
+        // -------- logger_task --------
+        logger->drain(fp);
+        telemetry->drain(fp, logger);
+    }
+    fclose(fp);
+    r->dropped = telemetry->getDropped() + logger->getDropped();
+    delete telemetry;
+    delete logger;
+    delete core;
+
+    LogDecoder dec;
+    const uint8_t *p = (const uint8_t *)buf;
+    const uint8_t *end = p + size;
+    while (dec.next(p, end))
+    {
+        logframe_t f;
+        memcpy(&f, dec.values(), sizeof(f));
+        r->frames[f.count_time] = f;
+    }
+    r->decode_error = dec.error() || p != end;
+    r->tlm.addAll(dec.records());
+    r->total_bytes = size;
+    r->tlm_bytes = 0;
+    r->t_records = 0;
+    for (size_t i = 0; i < dec.records().size(); i++)
+    {
+        const uint8_t tag = dec.records()[i].first;
+        if (tag != LOG_TAG_TLM_MAP && tag != LOG_TAG_TELEMETRY)
+            continue;
+        uint8_t tmp[5];
+        r->tlm_bytes += 1 + LogEncoder::putVarint(tmp, (uint32_t)dec.records()[i].second.size()) + dec.records()[i].second.size();
+        if (tag == LOG_TAG_TELEMETRY)
+            r->t_records++;
+    }
+    free(buf);
+    return true;
+}
+
+/** チャンネルの時刻が from 以上 to 未満で step[ms] 間隔か(最初のサンプルは from) */
+static bool spaced(const TelemetryDecoder::series_t *s, unsigned int from, unsigned int to, unsigned int step)
+{
+    unsigned int expect = from;
+    for (size_t i = 0; i < s->t_ms.size(); i++)
+    {
+        if (s->t_ms[i] < from || s->t_ms[i] >= to)
+            continue;
+        if (s->t_ms[i] != expect)
+            return false;
+        expect += step;
+    }
+    return expect > from && expect + step >= to; // 区間の終わりまで並んでいる
+}
+
+/** チャンネルの値がフレームの値と一致するか */
+static bool matches(const result_t &r, const TelemetryDecoder::series_t *s, int logframe_t::*field)
+{
+    for (size_t i = 0; i < s->t_ms.size(); i++)
+    {
+        std::map<unsigned int, logframe_t>::const_iterator it = r.frames.find(s->t_ms[i]);
+        if (it == r.frames.end() || (double)(it->second.*field) != s->value[i])
+            return false;
+    }
+    return !s->t_ms.empty();
+}
+
+/** サンプルした件数(from 以上) */
+static size_t count_from(const TelemetryDecoder::series_t *s, unsigned int from)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < s->t_ms.size(); i++)
+        if (s->t_ms[i] >= from)
+            n++;
+    return n;
+}
+
+/** sample 1回のコスト[ns], 変数はダミー */
+static double sample_cost(const char *spec)
+{
+    static int ivar[TLM_CHANNELS];
+    static float fvar[TLM_CHANNELS];
+    Telemetry *t = new Telemetry();
+    for (int id = 0; id < TLM_CHANNELS; id++)
+    {
+        if (id <= TLM_PID_HSV_D)
+            t->add(id, &fvar[id]);
+        else
+            t->add(id, &ivar[id]);
+    }
+    tlmconfig_t c;
+    Telemetry::parse(spec, &c);
+    t->configure(c);
+    FILE *null = fopen("/dev/null", "wb");
+    DataLogger *logger = new DataLogger();
+    uint64_t total = 0;
+    uint32_t cycle = 0;
+    for (int round = 0; round < COST_ROUNDS; round++)
+    {
+        const uint64_t t0 = bench_now_ns();
+        for (int k = 0; k < COST_BATCH; k++)
+        {
+            ivar[TLM_STAGE] = (int)cycle;
+            fvar[TLM_PID_REFLECT_P] = (float)cycle * 0.01f;
+            t->sample(cycle++);
+        }
+        total += bench_now_ns() - t0;
+        t->drain(null, logger); // 計らない
+    }
+    fclose(null);
+    delete logger;
+    delete t;
+    return (double)total / ((double)COST_ROUNDS * COST_BATCH);
+}
+
+int main()
+{
+    CourseImage course;
+    course.generateOval(2000.0, 600.0);
+    course.buildLineDistance();
+
+    const unsigned int switch_ms = SWITCH_CYCLE * TLM_PERIOD_MS;
+    const unsigned int end_ms = RUN_CYCLES * TLM_PERIOD_MS;
+    const char *first = "pid:1,hsv.val:1,omega:2,stage:25";
+    const char *second = "hsv.val:4,wheel:1";
+
+    // -------- 間引きを変える走行 --------
+    {
+        const char *sc = "reconfigure";
+        result_t *r = new result_t();
+        check(run(course, first, second, r), sc, "run");
+        check(!r->decode_error, sc, "log decodes without error");
+        check(!r->tlm.error(), sc, "telemetry decodes without error");
+        check(r->dropped == 0, sc, "no samples dropped");
+        check(r->tlm.maps() == 2, sc, "one 'M' record per configuration");
+        check(r->tlm.periodMs() == TLM_PERIOD_MS, sc, "period in 'M' record");
+
+        const TelemetryDecoder::series_t *val = r->tlm.find("hsv.val");
+        const TelemetryDecoder::series_t *omega = r->tlm.find("omega");
+        const TelemetryDecoder::series_t *stage = r->tlm.find("stage");
+        const TelemetryDecoder::series_t *kp = r->tlm.find("pid.reflect.p");
+        const TelemetryDecoder::series_t *wheel = r->tlm.find("wheel.left");
+        const TelemetryDecoder::series_t *hue = r->tlm.find("hsv.hue");
+        if (val && omega && stage && kp && wheel && hue)
+        {
+            check(spaced(val, 0, switch_ms, 1 * TLM_PERIOD_MS), sc, "hsv.val every 4 ms before the switch");
+            check(spaced(val, switch_ms, end_ms, 4 * TLM_PERIOD_MS), sc, "hsv.val every 16 ms after the switch");
+            check(spaced(omega, 0, switch_ms, 2 * TLM_PERIOD_MS), sc, "omega every 8 ms");
+            check(spaced(stage, 0, switch_ms, 25 * TLM_PERIOD_MS), sc, "stage every 100 ms");
+            check(spaced(kp, 0, switch_ms, 1 * TLM_PERIOD_MS), sc, "pid.reflect.p every 4 ms");
+            check(spaced(wheel, switch_ms, end_ms, 1 * TLM_PERIOD_MS), sc, "wheel.left every 4 ms after the switch");
+            check(count_from(wheel, 0) == count_from(wheel, switch_ms), sc, "wheel.left not sampled before the switch");
+            check(count_from(omega, switch_ms) == 0 && count_from(stage, switch_ms) == 0 && count_from(kp, switch_ms) == 0,
+                  sc, "disabled channels not sampled after the switch");
+            check(hue->t_ms.empty(), sc, "hsv.hue never enabled, never sampled");
+            check(matches(*r, val, &logframe_t::hsv_val), sc, "hsv.val equals the frame value");
+            check(matches(*r, omega, &logframe_t::omega), sc, "omega equals the frame value");
+            check(matches(*r, stage, &logframe_t::stage), sc, "stage equals the frame value");
+            check(val->decim == 4 && stage->decim == 0, sc, "decimation in the last 'M' record");
+        }
+        else
+            check(false, sc, "all registered channels in the 'M' record");
+
+        const double secs = end_ms * 1e-3;
+        printf("telemetry round trip: %lu frames, %lu 'T' records, %zu hsv.val samples\n",
+               (unsigned long)r->frames.size(), r->t_records, val ? val->t_ms.size() : (size_t)0);
+        printf("  telemetry %.0f B/s, frame stream %.0f B/s (%s -> %s)\n", r->tlm_bytes / secs,
+               (r->total_bytes - r->tlm_bytes) / secs, first, second);
+        delete r;
+    }
+
+    // -------- 全部無効 --------
+    {
+        const char *sc = "disabled";
+        result_t *r = new result_t();
+        check(run(course, "", NULL, r), sc, "run");
+        check(!r->decode_error && !r->tlm.error(), sc, "log decodes without error");
+        check(r->t_records == 0, sc, "no 'T' records");
+        check(r->tlm.maps() == 1, sc, "one 'M' record");
+        printf("telemetry disabled: %lu 'T' records, %lu bytes\n", r->t_records, r->tlm_bytes);
+        delete r;
+    }
+
+    // -------- サンプルのコスト --------
+    const double none = sample_cost("");
+    const double pid = sample_cost("pid:1,stage:25");
+    const double all = sample_cost("pid:1,hsv:1,wheel:1,radius:1,omega:1,arm_deg:1,stage:1");
+    printf("sample cost: disabled %.1f ns, pid:1,stage:25 %.1f ns, all channels %.1f ns\n", none, pid, all);
+    check(none < all, "cost", "disabled sample cheaper than all channels");
+
+    printf("%s (%d failures)\n", failures ? "FAIL" : "PASS", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,30 @@
+/**
+ * @file bench_util.h
+ * @brief ホスト(Linux)ベンチマーク共通の計時ユーティリティ
+ */
+#ifndef EV3_HOST_BENCH_UTIL_H
+#define EV3_HOST_BENCH_UTIL_H
+
+#include <chrono>
+#include <stdint.h>
+
+/**
+ * @brief 単調増加時刻[ns]
+ */
+static inline uint64_t bench_now_ns()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/**
+ * @brief 計算結果を最適化で消されないようにする
+ */
+template <typename T>
+static inline void bench_keep(const T &value)
+{
+    __asm__ __volatile__("" : : "g"(&value) : "memory");
+}
+
+#endif // EV3_HOST_BENCH_UTIL_H
@@ -0,0 +1,85 @@
+/**
+ * @file btcapture.cpp
+ * @brief Bluetooth の出力(シミュレータの __ev3rt_bt_out)を走行ごとのログファイルに取り込む常駐プログラム
+ *
+ * @note 元のファイルを inotify で追いかけ,KHLG のストリームを走行の始め(ヘッダ)と終わり('U' レコード)で分けて,
+ *       走行ごとに DIR/PREFIX-YYYYmmdd-HHMMSS-NNN.dat に書く(LogCapture)。
+ *       --latest のシンボリックリンクは最後に閉じた走行を指す(logdata_plot.py, loganalyze でそのまま読める)。
+ *       --live のファイルは最新のフレームを復号したテキストで,CAP_FLUSH_MS ごとに置き換える(watch cat で見る)。
+ *       Ctrl-C(SIGINT, SIGTERM)で残りを読んで書き出してから終わる。
+ *
+ *  使い方:
+ *    btcapture [--dir DIR] [--prefix NAME] [--keep N] [--latest LINK] [--live FILE] [--once] [--quiet] BT_OUT
+ *  --once は今ある分だけ取り込んで終わる(btcat2 のこれまでの使い方)。
+ */
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/stat.h>
+
+#include "LogCapture.h"
+
+static std::atomic<bool> stop_requested(false);
+
+static void on_signal(int)
+{
+    stop_requested = true;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: btcapture [--dir DIR] [--prefix NAME] [--keep N] [--latest LINK] [--live FILE] [--once] "
+                    "[--quiet] BT_OUT\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    capconfig_t cfg;
+    cfg.dir = ".";
+    cfg.prefix = "log";
+    cfg.keep = 0;
+    cfg.verbose = true;
+    bool once = false;
+    const char *src = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string a = argv[i];
+        bool more = (i + 1 < argc);
+        if (a == "--dir" && more)
+            cfg.dir = argv[++i];
+        else if (a == "--prefix" && more)
+            cfg.prefix = argv[++i];
+        else if (a == "--keep" && more)
+            cfg.keep = atoi(argv[++i]);
+        else if (a == "--latest" && more)
+            cfg.latest = argv[++i];
+        else if (a == "--live" && more)
+            cfg.live = argv[++i];
+        else if (a == "--once")
+            once = true;
+        else if (a == "--quiet")
+            cfg.verbose = false;
+        else if (a[0] == '-' || src != NULL)
+            usage();
+        else
+            src = argv[i];
+    }
+    if (src == NULL)
+        usage();
+    mkdir(cfg.dir.c_str(), 0755);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    LogCapture cap(cfg);
+    const int rc = cap.tail(src, stop_requested, once);
+    unsigned long complete = 0;
+    for (size_t i = 0; i < cap.runs().size(); i++)
+        complete += cap.runs()[i].complete ? 1 : 0;
+    fprintf(stderr, "btcapture: %zu runs (%lu complete), %lu frames, %.1f MB read, %lu bytes skipped\n",
+            cap.runs().size(), complete, cap.getFrames(), cap.getConsumed() * 1e-6, cap.getSkipped());
+    return rc;
+}
@@ -0,0 +1,117 @@
+/**
+ * @file btcmd.cpp
+ * @brief Bluetooth のコマンド(CommandChannel)の送信
+ *
+ * @note 走行中の調整値をコマンドのフレームにして Bluetooth のシリアル(rfcomm など)に書く。
+ *       応答はログと同じストリームに 'C' レコードで返るので,ログを受けている側(logdata_plot.py など)で読む。
+ *
+ *  使い方:
+ *    btcmd DEVICE COMMAND...
+ *      start               リモートスタート
+ *      get NAME            調整値の読み出し
+ *      set NAME VALUE      調整値の設定(commit まで反映しない), ゲインは小数で書く
+ *      commit              設定した調整値を次の周期の始めにまとめて反映する
+ *      tlm CHANNEL DECIM   テレメトリのチャンネルの間引き(周期の何回に1回), 0 で無効
+ *    例: btcmd /dev/rfcomm0 set kp.reflect 0.8 set power 60 commit
+ *    CHANNEL: logging/Telemetry.h の TLM_NAME (pid.reflect.p hsv.val wheel.left stage など)
+ *    NAME: kp.reflect ki.reflect kd.reflect kp.hsv ki.hsv kd.hsv target.reflect target.hsv power stage
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "comm/CommandChannel.h"
+#include "logging/Telemetry.h"
+
+static void usage()
+{
+    fprintf(stderr, "usage: btcmd DEVICE [start | get NAME | set NAME VALUE | commit | tlm CHANNEL DECIM]...\n");
+    exit(2);
+}
+
+/** 調整値の名前 -> 番号, 無ければ -1 */
+static int param_id(const char *name)
+{
+    for (int i = 0; i < PARAM_COUNT; i++)
+        if (strcmp(PARAM_TABLE[i].name, name) == 0)
+            return i;
+    return -1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+        usage();
+    FILE *fp = fopen(argv[1], "wb");
+    if (fp == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    uint8_t seq = 0;
+    for (int i = 2; i < argc; i++)
+    {
+        cmdmsg_t m = cmdmsg_t();
+        m.seq = ++seq;
+        if (strcmp(argv[i], "start") == 0)
+            m.cmd = CMD_REMOTE_START;
+        else if (strcmp(argv[i], "commit") == 0)
+            m.cmd = CMD_COMMIT;
+        else if (strcmp(argv[i], "get") == 0 || strcmp(argv[i], "set") == 0)
+        {
+            const bool set = (argv[i][0] == 's');
+            if (i + (set ? 2 : 1) >= argc)
+                usage();
+            const int id = param_id(argv[++i]);
+            if (id < 0)
+            {
+                fprintf(stderr, "btcmd: unknown parameter %s\n", argv[i]);
+                return 2;
+            }
+            m.cmd = set ? CMD_SET : CMD_GET;
+            m.payload[0] = (uint8_t)id;
+            m.len = 1;
+            if (set)
+            {
+                const double v = atof(argv[++i]);
+                const int32_t value = (int32_t)lround(id < PARAM_TARGET_REFLECT ? v * PARAM_GAIN_SCALE : v);
+                if (!paramValid(id, value))
+                {
+                    fprintf(stderr, "btcmd: %s out of range\n", argv[i]);
+                    return 2;
+                }
+                CommandChannel::putValue(&m.payload[1], value);
+                m.len = 5;
+            }
+        }
+        else if (strcmp(argv[i], "tlm") == 0)
+        {
+            if (i + 2 >= argc)
+                usage();
+            int id = 0;
+            while (id < TLM_CHANNELS && strcmp(TLM_NAME[id], argv[i + 1]) != 0)
+                id++;
+            const int decim = atoi(argv[i + 2]);
+            if (id == TLM_CHANNELS || decim < 0 || decim > 255)
+            {
+                fprintf(stderr, "btcmd: bad telemetry %s %s\n", argv[i + 1], argv[i + 2]);
+                return 2;
+            }
+            i += 2;
+            m.cmd = CMD_TELEMETRY;
+            m.payload[0] = (uint8_t)id;
+            m.payload[1] = (uint8_t)decim;
+            m.len = 2;
+        }
+        else
+            usage();
+
+        uint8_t buf[CMD_FRAME_MAX];
+        fwrite(buf, 1, CommandChannel::encode(&m, buf), fp);
+        printf("sent seq %u cmd %u len %u\n", m.seq, m.cmd, m.len);
+    }
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,147 @@
+/**
+ * @file ev3api_host.cpp
+ * @brief ホスト(Linux)ビルド用 ev3api スタンドインの実装
+ *
+ * @note センサ/モーターの呼び出しを host_world(SimWorld) に転送する
+ */
+#include "ev3api.h"
+#include "etroboc_ext.h"
+#include "ev3api_host.h"
+
+SimWorld *host_world = NULL;
+std::string host_bt_path = "log.dat";
+std::string host_map_path;
+bool host_calib = false;
+std::string host_telemetry;
+bool host_completed = false;
+unsigned long host_motor_writes = 0;
+
+extern "C" {
+
+const char *host_coursemap_path(void)
+{
+    return host_map_path.c_str();
+}
+
+int host_autocalib(void)
+{
+    return host_calib ? 1 : 0;
+}
+
+const char *host_telemetry_config(void)
+{
+    return host_telemetry.c_str();
+}
+
+ER ev3_sensor_config(sensor_port_t port, sensor_type_t type)
+{
+    (void)port;
+    (void)type;
+    return E_OK;
+}
+
+void ev3_color_sensor_get_rgb_raw(sensor_port_t port, rgb_raw_t *val)
+{
+    (void)port;
+    host_world->colorRaw(val);
+}
+
+uint8_t ev3_color_sensor_get_reflect(sensor_port_t port)
+{
+    rgb_raw_t rgb;
+    ev3_color_sensor_get_rgb_raw(port, &rgb);
+    return (uint8_t)(100 * (rgb.r + rgb.g + rgb.b) / (3 * 256));
+}
+
+int16_t ev3_ultrasonic_sensor_get_distance(sensor_port_t port)
+{
+    (void)port;
+    return host_world->sonarDistance();
+}
+
+int16_t ev3_gyro_sensor_get_angle(sensor_port_t port)
+{
+    (void)port;
+    return host_world->gyroAngle();
+}
+
+int16_t ev3_gyro_sensor_get_rate(sensor_port_t port)
+{
+    (void)port;
+    return host_world->gyroRate();
+}
+
+ER ev3_gyro_sensor_reset(sensor_port_t port)
+{
+    (void)port;
+    host_world->gyroReset();
+    return E_OK;
+}
+
+bool_t ev3_touch_sensor_is_pressed(sensor_port_t port)
+{
+    (void)port;
+    return host_world->touch_pressed;
+}
+
+ER ev3_motor_config(motor_port_t port, motor_type_t type)
+{
+    (void)port;
+    (void)type;
+    return E_OK;
+}
+
+int32_t ev3_motor_get_counts(motor_port_t port)
+{
+    return host_world->getCounts(port);
+}
+
+ER ev3_motor_reset_counts(motor_port_t port)
+{
+    host_world->resetCounts(port);
+    return E_OK;
+}
+
+ER ev3_motor_set_power(motor_port_t port, int power)
+{
+    host_world->setPower(port, power);
+    host_motor_writes++;
+    return E_OK;
+}
+
+int ev3_motor_get_power(motor_port_t port)
+{
+    return host_world->getPower(port);
+}
+
+ER ev3_motor_stop(motor_port_t port, bool_t brake)
+{
+    host_world->stopMotor(port, brake != 0);
+    host_motor_writes++;
+    return E_OK;
+}
+
+ER ev3_motor_steer(motor_port_t left_motor, motor_port_t right_motor, int power, int turn_ratio)
+{
+    host_world->steer(left_motor, right_motor, power, turn_ratio);
+    host_motor_writes += 2;
+    return E_OK;
+}
+
+bool_t ev3_button_is_pressed(button_t button)
+{
+    return (button == BACK_BUTTON) && host_world->back_button;
+}
+
+FILE *ev3_serial_open_file(serial_port_t port)
+{
+    (void)port;
+    return fopen(host_bt_path.c_str(), "wb");
+}
+
+void ETRoboc_notifyCompletedToSimulator(void)
+{
+    host_completed = true;
+}
+
+} // extern "C"
@@ -0,0 +1,20 @@
+/**
+ * @file ev3api_host.h
+ * @brief ホスト(Linux)ビルド用 ev3api スタンドインの接続設定
+ */
+#ifndef EV3_HOST_EV3API_HOST_H
+#define EV3_HOST_EV3API_HOST_H
+
+#include <string>
+
+#include "SimWorld.h"
+
+extern SimWorld *host_world;      // ev3api の入出力先
+extern std::string host_bt_path;  // EV3_SERIAL_BT の出力先ファイル
+extern std::string host_map_path; // COURSEMAP_FILE, 空ならコースマップを使わない
+extern bool host_calib;           // LINE_AUTOCALIB, 走行前にラインのしきい値を決める
+extern std::string host_telemetry; // TELEMETRY_CONFIG, 空ならテレメトリなし
+extern bool host_completed;       // ETRoboc_notifyCompletedToSimulator が呼ばれたか
+extern unsigned long host_motor_writes; // モーター出力の数(ev3_motor_steer は2つ)
+
+#endif // EV3_HOST_EV3API_HOST_H
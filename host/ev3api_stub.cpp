@@ -0,0 +1,35 @@
+/**
+ * @file ev3api_stub.cpp
+ * @brief マイクロベンチマークとログ再生用の ev3api スタブ
+ */
+#include "ev3api_stub.h"
+
+thread_local ev3stub_t ev3stub;
+
+extern "C" {
+
+ER ev3_sensor_config(sensor_port_t, sensor_type_t) { ev3stub.calls++; return E_OK; }
+void ev3_color_sensor_get_rgb_raw(sensor_port_t, rgb_raw_t *val) { ev3stub.calls++; *val = ev3stub.rgb; }
+uint8_t ev3_color_sensor_get_reflect(sensor_port_t) { ev3stub.calls++; return 0; }
+int16_t ev3_ultrasonic_sensor_get_distance(sensor_port_t) { ev3stub.calls++; return ev3stub.sonar; }
+int16_t ev3_gyro_sensor_get_angle(sensor_port_t) { ev3stub.calls++; return ev3stub.gyro; }
+int16_t ev3_gyro_sensor_get_rate(sensor_port_t) { ev3stub.calls++; return 0; }
+ER ev3_gyro_sensor_reset(sensor_port_t) { ev3stub.calls++; return E_OK; }
+bool_t ev3_touch_sensor_is_pressed(sensor_port_t) { ev3stub.calls++; return false; }
+ER ev3_motor_config(motor_port_t, motor_type_t) { ev3stub.calls++; return E_OK; }
+int32_t ev3_motor_get_counts(motor_port_t port) { ev3stub.calls++; return ev3stub.counts[port]; }
+ER ev3_motor_reset_counts(motor_port_t port) { ev3stub.calls++; ev3stub.counts[port] = 0; return E_OK; }
+ER ev3_motor_set_power(motor_port_t port, int power) { ev3stub.calls++; ev3stub.power[port] = power; return E_OK; }
+int ev3_motor_get_power(motor_port_t port) { ev3stub.calls++; return ev3stub.power[port]; }
+ER ev3_motor_stop(motor_port_t port, bool_t) { ev3stub.calls++; ev3stub.power[port] = 0; return E_OK; }
+ER ev3_motor_steer(motor_port_t left_motor, motor_port_t right_motor, int power, int turn_ratio)
+{
+    ev3stub.calls++;
+    ev3stub.power[left_motor] = power;
+    ev3stub.power[right_motor] = turn_ratio;
+    return E_OK;
+}
+bool_t ev3_button_is_pressed(button_t) { ev3stub.calls++; return false; }
+FILE *ev3_serial_open_file(serial_port_t) { return NULL; }
+
+} // extern "C"
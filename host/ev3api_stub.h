@@ -0,0 +1,24 @@
+/**
+ * @file ev3api_stub.h
+ * @brief マイクロベンチマークとログ再生用の ev3api スタブ
+ *
+ * @note 物理モデルを持たず,次に返すセンサ値を外から設定し,呼び出し回数だけ数える。
+ */
+#ifndef EV3_HOST_EV3API_STUB_H
+#define EV3_HOST_EV3API_STUB_H
+
+#include "ev3api.h"
+
+struct ev3stub_t
+{
+    rgb_raw_t rgb;          /* ev3_color_sensor_get_rgb_raw が返す値 */
+    int32_t counts[TNUM_MOTOR_PORT]; /* ev3_motor_get_counts が返す値 */
+    int power[TNUM_MOTOR_PORT];      /* 最後に設定されたパワー */
+    int16_t gyro;           /* ev3_gyro_sensor_get_angle が返す値 */
+    int16_t sonar;          /* ev3_ultrasonic_sensor_get_distance が返す値 */
+    unsigned long calls;    /* ev3api 呼び出し回数 */
+};
+
+extern thread_local ev3stub_t ev3stub; // スレッドごと(並列評価のため)
+
+#endif // EV3_HOST_EV3API_STUB_H
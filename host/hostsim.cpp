@@ -0,0 +1,168 @@
+/**
+ * @file hostsim.cpp
+ * @brief ホスト(Linux)上の閉ループシミュレータ
+ *
+ * @note app.cpp をそのままリンクし,仮想クロックで tracer_task を実時間より速く回す。
+ *       Unityシミュレータなしでチューニングの試行ができる。
+ *
+ *  使い方:
+ *    hostsim [--oval STRAIGHT,RADIUS] [--course FILE.ppm --mm-per-px S --start X,Y,DEG]
+ *            [--obstacle X,Y,R]... [--time SEC] [--laps N] [--log FILE] [--map FILE]
+ *            [--calib] [--light GAIN[,OFFSET]] [--telemetry NAME:DECIM,...] [--bench]
+ *
+ *  --map FILE は走行前に読み込むコースマップ(なければ速度計画なし)で,走行後に今回の記録で上書きする。
+ *  同じ --map で続けて走らせると,2回目からは直線で加速する。
+ *  --calib は走行前にその場旋回でラインのしきい値を決める(LINE_AUTOCALIB)。
+ *  --light は照明(画素値 -> RGB Raw値の倍率と底上げ)を変える。既定は 0.39,5。
+ *  --telemetry はログに残すテレメトリのチャンネルと間引き(TELEMETRY_CONFIG)。例 pid:1,hsv.val:2,stage:25
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "HostKernel.h"
+#include "SimWorld.h"
+#include "ev3api_host.h"
+#include "kernel_cfg.h"
+#include "app.h"
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: hostsim [--oval STRAIGHT,RADIUS] [--course FILE.ppm --mm-per-px S --start X,Y,DEG]\n"
+            "               [--obstacle X,Y,R]... [--time SEC] [--laps N] [--log FILE|-] [--map FILE]\n"
+            "               [--calib] [--light GAIN[,OFFSET]] [--telemetry NAME:DECIM,...] [--bench]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    CourseImage course;
+    std::string ppm;
+    double mm_per_px = 2.0;
+    double straight = 2000.0, radius = 600.0;
+    double start[3] = {0, 0, 0};
+    bool has_start = false;
+    double obstacles[16][3];
+    int n_obstacles = 0;
+    double time_limit = 60.0;
+    int laps = 1;
+    bool bench = false;
+    simconfig_t cfg = SIM_DEFAULT_CONFIG;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string a = argv[i];
+        bool more = (i + 1 < argc);
+        if (a == "--oval" && more)
+            sscanf(argv[++i], "%lf,%lf", &straight, &radius);
+        else if (a == "--course" && more)
+            ppm = argv[++i];
+        else if (a == "--mm-per-px" && more)
+            mm_per_px = atof(argv[++i]);
+        else if (a == "--start" && more)
+            has_start = (sscanf(argv[++i], "%lf,%lf,%lf", &start[0], &start[1], &start[2]) == 3);
+        else if (a == "--obstacle" && more && n_obstacles < 16)
+        {
+            if (sscanf(argv[++i], "%lf,%lf,%lf", &obstacles[n_obstacles][0],
+                       &obstacles[n_obstacles][1], &obstacles[n_obstacles][2]) == 3)
+                n_obstacles++;
+        }
+        else if (a == "--time" && more)
+            time_limit = atof(argv[++i]);
+        else if (a == "--laps" && more)
+            laps = atoi(argv[++i]);
+        else if (a == "--log" && more)
+            host_bt_path = argv[++i];
+        else if (a == "--map" && more)
+            host_map_path = argv[++i];
+        else if (a == "--calib")
+            host_calib = true;
+        else if (a == "--telemetry" && more)
+            host_telemetry = argv[++i];
+        else if (a == "--light" && more)
+        {
+            if (sscanf(argv[++i], "%lf,%lf", &cfg.raw_gain, &cfg.raw_offset) < 1)
+                usage();
+        }
+        else if (a == "--bench")
+            bench = true;
+        else
+            usage();
+    }
+    if (host_bt_path == "-")
+        host_bt_path = "/dev/null";
+    if (bench)
+    {
+        // ベンチマーク: ログを捨てて長時間走らせる
+        host_bt_path = "/dev/null";
+        if (time_limit == 60.0)
+            time_limit = 3600.0;
+        laps = 0;
+    }
+
+    if (!ppm.empty())
+    {
+        if (!course.loadPPM(ppm, mm_per_px))
+        {
+            fprintf(stderr, "hostsim: cannot load %s\n", ppm.c_str());
+            return 1;
+        }
+    }
+    else
+    {
+        course.generateOval(straight, radius);
+    }
+    if (has_start)
+    {
+        course.start_x = start[0];
+        course.start_y = start[1];
+        course.start_heading = start[2] * M_PI / 180.0;
+    }
+
+    SimWorld world(course, cfg);
+    for (int i = 0; i < n_obstacles; i++)
+        world.addObstacle(obstacles[i][0], obstacles[i][1], obstacles[i][2]);
+    host_world = &world;
+
+    HostKernel kernel;
+    HostKernel::current = &kernel;
+    // app.cfg と同じ優先度と周期, BT_TASK はブロッキング受信なのでホストでは起動しない
+    kernel.setMainTask(MAIN_TASK, main_task);
+    kernel.setTask(LOGGER_TASK, logger_task, 4);
+    kernel.setCyclic(TRACER_CYC, TRACER_TASK, tracer_task, 4 * 1000, 1 * 1000, 3);
+    kernel.onAdvance([&world](uint64_t t) { world.advanceTo(t); });
+
+    // 終了条件: 所定の周回数か時間切れで BACK_BUTTON を押す
+    const uint64_t limit_us = (uint64_t)(time_limit * 1e6);
+    kernel.onCycle([&](uint64_t now) {
+        if ((laps > 0 && world.laps >= laps) || now >= limit_us)
+            world.back_button = true;
+        return true;
+    });
+
+    auto t0 = std::chrono::steady_clock::now();
+    kernel.run(limit_us + 1000 * 1000);
+    auto t1 = std::chrono::steady_clock::now();
+
+    double wall = std::chrono::duration<double>(t1 - t0).count();
+    double sim = kernel.now() * 1e-6;
+    printf("sim_time      %.3f s\n", sim);
+    printf("cycles        %lu\n", kernel.cycles());
+    printf("laps          %d\n", world.laps);
+    if (world.laps > 0)
+        printf("last_lap      %.3f s\n", world.last_lap_us * 1e-6);
+    printf("travelled     %.0f mm\n", world.travelled_mm);
+    printf("pose          %.1f %.1f %.1f deg\n", world.x, world.y, world.heading * 180.0 / M_PI);
+    printf("completed     %s\n", host_completed ? "yes" : "no");
+    printf("wall_time     %.3f s\n", wall);
+    if (wall > 0)
+    {
+        printf("speed         %.0f sim-s/wall-s\n", sim / wall);
+        printf("cycle_rate    %.0f cycles/s\n", kernel.cycles() / wall);
+    }
+    return 0;
+}
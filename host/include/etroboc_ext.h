@@ -0,0 +1,18 @@
+/**
+ * @file etroboc_ext.h
+ * @brief ホスト(Linux)ビルド用 ETロボコンシミュレータ拡張APIのスタンドイン
+ */
+#ifndef EV3_HOST_ETROBOC_EXT_H
+#define EV3_HOST_ETROBOC_EXT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern void ETRoboc_notifyCompletedToSimulator(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EV3_HOST_ETROBOC_EXT_H
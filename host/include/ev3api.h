@@ -0,0 +1,135 @@
+/**
+ * @file ev3api.h
+ * @brief ホスト(Linux)ビルド用 EV3RT API のスタンドイン
+ *
+ * @note アプリが使う関数だけを EV3RT と同じシグネチャで宣言する。
+ *       実装は host/ev3api_host.cpp で、host/SimWorld の物理モデルにつながる。
+ */
+#ifndef EV3_HOST_EV3API_H
+#define EV3_HOST_EV3API_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <assert.h>
+#include "kernel.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef true
+#define true 1
+#endif
+#ifndef false
+#define false 0
+#endif
+
+/* -------- ポート -------- */
+typedef enum
+{
+    EV3_PORT_1 = 0,
+    EV3_PORT_2 = 1,
+    EV3_PORT_3 = 2,
+    EV3_PORT_4 = 3,
+    TNUM_SENSOR_PORT = 4,
+} sensor_port_t;
+
+typedef enum
+{
+    EV3_PORT_A = 0,
+    EV3_PORT_B = 1,
+    EV3_PORT_C = 2,
+    EV3_PORT_D = 3,
+    TNUM_MOTOR_PORT = 4,
+} motor_port_t;
+
+typedef enum
+{
+    NONE_SENSOR = 0,
+    ULTRASONIC_SENSOR,
+    GYRO_SENSOR,
+    TOUCH_SENSOR,
+    COLOR_SENSOR,
+    INFRARED_SENSOR,
+    HT_NXT_ACCEL_SENSOR,
+    NXT_TEMP_SENSOR,
+    TNUM_SENSOR_TYPE
+} sensor_type_t;
+
+typedef enum
+{
+    NONE_MOTOR = 0,
+    MEDIUM_MOTOR,
+    LARGE_MOTOR,
+    UNREGULATED_MOTOR,
+    TNUM_MOTOR_TYPE
+} motor_type_t;
+
+typedef enum
+{
+    LEFT_BUTTON = 0,
+    RIGHT_BUTTON = 1,
+    UP_BUTTON = 2,
+    DOWN_BUTTON = 3,
+    ENTER_BUTTON = 4,
+    BACK_BUTTON = 5,
+    TNUM_BUTTON = 6,
+} button_t;
+
+typedef enum
+{
+    EV3_SERIAL_DEFAULT = 0,
+    EV3_SERIAL_UART = 1,
+    EV3_SERIAL_BT = 2,
+} serial_port_t;
+
+typedef enum
+{
+    EV3_FONT_SMALL = 0,
+    EV3_FONT_MEDIUM = 1,
+} lcdfont_t;
+
+/* -------- カラーセンサ RGB Raw値 -------- */
+typedef struct
+{
+    uint16_t r;
+    uint16_t g;
+    uint16_t b;
+} rgb_raw_t;
+
+/* -------- センサ -------- */
+extern ER ev3_sensor_config(sensor_port_t port, sensor_type_t type);
+extern void ev3_color_sensor_get_rgb_raw(sensor_port_t port, rgb_raw_t *val);
+extern uint8_t ev3_color_sensor_get_reflect(sensor_port_t port);
+extern int16_t ev3_ultrasonic_sensor_get_distance(sensor_port_t port);
+extern int16_t ev3_gyro_sensor_get_angle(sensor_port_t port);
+extern int16_t ev3_gyro_sensor_get_rate(sensor_port_t port);
+extern ER ev3_gyro_sensor_reset(sensor_port_t port);
+extern bool_t ev3_touch_sensor_is_pressed(sensor_port_t port);
+
+/* -------- モーター -------- */
+extern ER ev3_motor_config(motor_port_t port, motor_type_t type);
+extern int32_t ev3_motor_get_counts(motor_port_t port);
+extern ER ev3_motor_reset_counts(motor_port_t port);
+extern ER ev3_motor_set_power(motor_port_t port, int power);
+extern int ev3_motor_get_power(motor_port_t port);
+extern ER ev3_motor_stop(motor_port_t port, bool_t brake);
+extern ER ev3_motor_steer(motor_port_t left_motor, motor_port_t right_motor, int power, int turn_ratio);
+
+/* -------- ボタン/シリアル -------- */
+extern bool_t ev3_button_is_pressed(button_t button);
+extern FILE *ev3_serial_open_file(serial_port_t port);
+
+/* -------- ホストの接続設定 -------- */
+extern const char *host_coursemap_path(void); // hostsim --map で指定したファイル, 指定がなければ空
+#define COURSEMAP_FILE (host_coursemap_path())
+extern int host_autocalib(void); // hostsim --calib で 1
+#define LINE_AUTOCALIB (host_autocalib())
+extern const char *host_telemetry_config(void); // hostsim --telemetry で指定したチャンネル, 指定がなければ空
+#define TELEMETRY_CONFIG (host_telemetry_config())
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EV3_HOST_EV3API_H
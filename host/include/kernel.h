@@ -0,0 +1,59 @@
+/**
+ * @file kernel.h
+ * @brief ホスト(Linux)ビルド用 TOPPERS/HRP3 カーネルAPIのスタンドイン
+ *
+ * @note 実機/シミュレータのカーネルと同名のサービスコールを宣言する。
+ *       実装は host/HostKernel.cpp の仮想クロックと協調スケジューラ。
+ */
+#ifndef EV3_HOST_KERNEL_H
+#define EV3_HOST_KERNEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int ID;             /* オブジェクトID */
+typedef int ER;             /* エラーコード */
+typedef int bool_t;         /* 真偽値 */
+typedef uint32_t RELTIM;    /* 相対時間[us] */
+typedef int32_t TMO;        /* タイムアウト[us] */
+typedef uint64_t SYSTIM;    /* システム時刻[us] */
+typedef uint32_t HRTCNT;    /* 高分解能タイマ[us] */
+
+#define E_OK 0
+#define E_ID (-18)
+#define TMIN_APP_TPRI 1
+
+extern ER act_tsk(ID tskid);
+extern ER ter_tsk(ID tskid);
+extern void ext_tsk(void);
+extern ER slp_tsk(void);
+extern ER tslp_tsk(TMO tmout);
+extern ER wup_tsk(ID tskid);
+extern ER sta_cyc(ID cycid);
+extern ER stp_cyc(ID cycid);
+extern ER get_tim(SYSTIM *p_systim);
+extern HRTCNT fch_hrt(void);
+
+/* システムログ: ホストでは標準エラー出力に書く(glibcのsyslogと名前を分ける) */
+#ifndef LOG_NOTICE
+#define LOG_EMERG 0
+#define LOG_ALERT 1
+#define LOG_CRIT 2
+#define LOG_ERROR 3
+#define LOG_WARNING 4
+#define LOG_NOTICE 5
+#define LOG_INFO 6
+#define LOG_DEBUG 7
+#endif
+#define syslog host_syslog
+extern void host_syslog(int prio, const char *format, ...);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EV3_HOST_KERNEL_H
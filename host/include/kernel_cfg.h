@@ -0,0 +1,19 @@
+/**
+ * @file kernel_cfg.h
+ * @brief ホスト(Linux)ビルド用 app.cfg 相当のオブジェクトID定義
+ *
+ * @note 実機ではコンフィギュレータが app.cfg から生成する。
+ *       app.cfg にタスクや周期ハンドラを追加したらここにも追加すること。
+ */
+#ifndef EV3_HOST_KERNEL_CFG_H
+#define EV3_HOST_KERNEL_CFG_H
+
+#include "kernel.h"
+
+#define MAIN_TASK 1
+#define BT_TASK 2
+#define TRACER_TASK 3
+#define LOGGER_TASK 4
+#define TRACER_CYC 1
+
+#endif // EV3_HOST_KERNEL_CFG_H
@@ -0,0 +1,10 @@
+/**
+ * @file target_test.h
+ * @brief ホスト(Linux)ビルド用 ターゲット依存定義のスタンドイン
+ */
+#ifndef EV3_HOST_TARGET_TEST_H
+#define EV3_HOST_TARGET_TEST_H
+
+#include "kernel.h"
+
+#endif // EV3_HOST_TARGET_TEST_H
@@ -0,0 +1,114 @@
+/**
+ * @file loganalyze.cpp
+ * @brief 走行ログの解析(周回時間,舵角のRMSと振動,DrivingStage ごとの時間,障害物,ジャイロのドリフト)
+ *
+ * @note ログファイルを mmap してコピーせずに読み(LogAnalyzer),ファイルごとにスレッドに分けて解析する。
+ *       1行1ファイルの CSV と,列ごとに値を並べたバイナリ(LogAnalyzer::writeBinary)を書き,
+ *       読んだバイト数と時間から解析の速度[GB/s]を出す。
+ *       logdata_plot.py は1ファイルの CSV とグラフを作るもので,大量の走行ログの集計はこちらを使う。
+ *
+ *  使い方:
+ *    loganalyze [--threads N] [--repeat N] [--csv FILE|-] [--bin FILE] LOG.dat...
+ *
+ *  --csv を付けなければ CSV を標準出力に書く(--csv - も同じ)。--repeat は速度の測定のため解析を繰り返す。
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "LogAnalyzer.h"
+#include "WorkStealingPool.h"
+
+static void usage()
+{
+    fprintf(stderr, "usage: loganalyze [--threads N] [--repeat N] [--csv FILE|-] [--bin FILE] LOG.dat...\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> paths;
+    int threads = 0;
+    int repeat = 1;
+    std::string csv = "-";
+    std::string bin;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string a = argv[i];
+        bool more = (i + 1 < argc);
+        if (a == "--threads" && more)
+            threads = atoi(argv[++i]);
+        else if (a == "--repeat" && more)
+            repeat = atoi(argv[++i]);
+        else if (a == "--csv" && more)
+            csv = argv[++i];
+        else if (a == "--bin" && more)
+            bin = argv[++i];
+        else if (a[0] == '-')
+            usage();
+        else
+            paths.push_back(a);
+    }
+    if (paths.empty())
+        usage();
+    if (repeat < 1)
+        repeat = 1;
+
+    // -------- 解析: ファイルごとにスレッドに分ける --------
+    std::vector<runmetrics_t> runs(paths.size());
+    std::atomic<int> unreadable(0);
+    WorkStealingPool pool(threads);
+    auto t0 = std::chrono::steady_clock::now();
+    for (int k = 0; k < repeat; k++)
+    {
+        unreadable = 0;
+        pool.run((int)paths.size(), [&](int task) {
+            if (!LogAnalyzer::analyzeFile(paths[task].c_str(), &runs[task]))
+                unreadable++;
+        });
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    double wall = std::chrono::duration<double>(t1 - t0).count();
+
+    // -------- 出力 --------
+    FILE *out = (csv == "-") ? stdout : fopen(csv.c_str(), "w");
+    if (out == NULL)
+    {
+        fprintf(stderr, "loganalyze: cannot open %s\n", csv.c_str());
+        return 1;
+    }
+    LogAnalyzer::writeCsv(out, runs);
+    if (out != stdout)
+        fclose(out);
+    if (!bin.empty())
+    {
+        FILE *fp = fopen(bin.c_str(), "wb");
+        if (fp == NULL)
+        {
+            fprintf(stderr, "loganalyze: cannot open %s\n", bin.c_str());
+            return 1;
+        }
+        LogAnalyzer::writeBinary(fp, runs);
+        fclose(fp);
+    }
+
+    double bytes = 0, frames = 0;
+    for (size_t i = 0; i < runs.size(); i++)
+    {
+        bytes += runs[i].bytes;
+        frames += runs[i].frames;
+        if (runs[i].format == 0)
+            fprintf(stderr, "loganalyze: cannot read %s\n", runs[i].path.c_str());
+    }
+    fprintf(stderr, "files         %zu (%d unreadable), %d threads\n", runs.size(), unreadable.load(), pool.threads());
+    fprintf(stderr, "frames        %.0f (%.1f MB)\n", frames, bytes * 1e-6);
+    if (wall > 0)
+        fprintf(stderr, "throughput    %.3f GB/s, %.2f Mframes/s\n", bytes * repeat / wall * 1e-9,
+                frames * repeat / wall * 1e-6);
+    return unreadable ? 1 : 0;
+}
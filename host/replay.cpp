@@ -0,0 +1,288 @@
+/**
+ * @file replay.cpp
+ * @brief 記録した入力値による制御本体(TracerCore)のログ再生
+ *
+ * @note ログに記録した1周期ごとの入力値(RGB,ホイール/アーム回転角,ジャイロ,超音波,
+ *       バックボタン)を TracerCore に流し,出力(舵角,回転角,走行状態など)が
+ *       記録と1bitも違わないことを確かめる(姿勢を記録していない古いログは姿勢を比べない)。ev3api は呼ばない(スタブで呼び出し数を確認する)。
+ *       制御を変えたときに,記録済みの走行ログ一式に対する差分を数秒で確認できる。
+ *
+ *  使い方:
+ *    replay [--repeat N] [--verbose] [--map FILE] LOG.dat...
+ *
+ *  --map は記録したときに読み込んだコースマップ(hostsim --map, 実機の COURSEMAP_FILE)。
+ *  コースマップを使った走行のログは,同じマップを渡さないと前進速度(power)から一致しない。
+ *
+ *  ログは MAKE_PID_FIXED の有無など,制御のビルド条件を揃えて記録したものを使うこと。
+ *  フレームの欠落(COUNT_time の飛び)があるとそこで状態がずれるので,欠落の手前まで比較する。
+ *  走行中に Bluetooth で調整値を変えたログ(prm.seq が 0 でない)は,変えた値がログにないので変える手前まで比較する。
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "ev3api_stub.h"
+#include "control/TracerCore.h"
+#include "logging/LogDecoder.h"
+
+/** 1ファイル分の記録 */
+struct recording_t
+{
+    std::string path;
+    std::vector<cycleinput_t> inputs;
+    std::vector<logframe_t> frames; // 記録された出力
+    std::vector<int> words;         // 比較する出力(logframe_t の語の番号)
+    bool gap;                       // フレームの欠落で打ち切った
+    bool tuned;                     // 走行中の調整値の変更で打ち切った
+    bool calib;                     // ラインのPID目標(cal.*)を記録している
+};
+
+/** 比較する出力, logframe_t の先頭から stage までと姿勢,補正した方位,前進速度,PID目標(記録していない古いログでは比べない) */
+static const int OUTPUT_WORDS[] = {0, 1, 2, 3, 4, 5, 6, 7, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25};
+#define OUTPUT_COUNT (int)(sizeof(OUTPUT_WORDS) / sizeof(OUTPUT_WORDS[0]))
+
+static std::vector<uint8_t> course_map; // --map で読み込んだコースマップ, 空ならなし
+
+static bool load(const char *path, recording_t *rec)
+{
+    std::vector<uint8_t> data;
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "replay: cannot open %s\n", path);
+        return false;
+    }
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        data.insert(data.end(), buf, buf + n);
+    fclose(fp);
+
+    if (!LogDecoder::isEncoded(data.data(), data.size()))
+    {
+        fprintf(stderr, "replay: %s: not a KHLG log (MAKE_LOG_RAW logs have no inputs)\n", path);
+        return false;
+    }
+
+    LogDecoder dec;
+    const uint8_t *p = data.data();
+    const uint8_t *end = data.data() + data.size();
+    int idx[LOG_CHANNELS];
+    bool mapped = false;
+
+    rec->path = path;
+    rec->gap = false;
+    rec->tuned = false;
+    rec->calib = false;
+    while (dec.next(p, end))
+    {
+        if (!mapped)
+        {
+            for (int i = 0; i < LOG_CHANNELS; i++)
+            {
+                idx[i] = dec.channelIndex(LOG_SCHEMA[i].name);
+                if (idx[i] < 0 && strncmp(LOG_SCHEMA[i].name, "in.", 3) == 0)
+                {
+                    fprintf(stderr, "replay: %s: channel %s missing (log has no inputs)\n",
+                            path, LOG_SCHEMA[i].name);
+                    return false;
+                }
+            }
+            for (int k = 0; k < OUTPUT_COUNT; k++)
+                if (idx[OUTPUT_WORDS[k]] >= 0)
+                    rec->words.push_back(OUTPUT_WORDS[k]);
+            rec->calib = (idx[offsetof(logframe_t, cal_reflect) / 4] >= 0 && idx[offsetof(logframe_t, cal_hsv) / 4] >= 0);
+            mapped = true;
+        }
+
+        int32_t v[LOG_CHANNELS];
+        logframe_t f;
+        for (int i = 0; i < LOG_CHANNELS; i++)
+            v[i] = (idx[i] >= 0) ? dec.values()[idx[i]] : 0;
+        memcpy(&f, v, sizeof(f));
+
+        // 欠落検出: COUNT_time は 0 から MAIN_CYCLE ずつ増える
+        if (f.count_time != rec->frames.size() * MAIN_CYCLE)
+        {
+            rec->gap = true;
+            break;
+        }
+        // 走行中に調整値を変えた: 変えた値はログにない
+        if (f.prm_seq != 0)
+        {
+            rec->tuned = true;
+            break;
+        }
+
+        cycleinput_t in;
+        in.rgb.r = f.rgb_r;
+        in.rgb.g = f.rgb_g;
+        in.rgb.b = f.rgb_b;
+        in.left_count = f.left_count;
+        in.right_count = f.right_count;
+        in.arm_count = f.arm_count;
+        in.gyro_angle = f.gyro_deg;
+        in.sonar = f.sonar;
+        in.back_button = f.button;
+        rec->inputs.push_back(in);
+        rec->frames.push_back(f);
+    }
+    return true;
+}
+
+/**
+ * @brief 1ファイル分を再生して記録と比べる
+ * @return 一致しなかったフレーム数, first には最初に一致しなかったフレーム番号
+ * @note   calls には再生中の ev3api 呼び出し数を足す(0のはず)
+ */
+static long replay(const recording_t &rec, long *first, int *first_word, int32_t *got,
+                   unsigned long *calls)
+{
+    TracerCore core; // コンストラクタは ev3api を呼ばない
+    cycleoutput_t out;
+    logframe_t frame;
+    long mismatch = 0;
+    unsigned long calls_before = ev3stub.calls;
+
+    *first = -1;
+    if (!rec.frames.empty())
+        core.calibrateGyro(rec.frames[0].fuse_bias, rec.frames[0].fuse_zero); // 走行前に推定した値(記録していないログは 0)
+    if (rec.calib && !rec.frames.empty())
+    {
+        linecalib_t calib = LINE_DEFAULT_CALIB; // 走行前に決めたPID目標(記録していないログはマクロの値)
+        calib.target_reflect = rec.frames[0].cal_reflect;
+        calib.target_hsv = rec.frames[0].cal_hsv;
+        core.setCalibration(&calib);
+    }
+    if (!course_map.empty())
+        core.loadCourseMap(course_map.data(), (int)course_map.size());
+    for (size_t i = 0; i < rec.inputs.size(); i++)
+    {
+        core.step(&rec.inputs[i], &out, &frame);
+        int32_t a[LOG_CHANNELS], b[LOG_CHANNELS];
+        memcpy(a, &frame, sizeof(a));
+        memcpy(b, &rec.frames[i], sizeof(b));
+        for (size_t k = 0; k < rec.words.size(); k++)
+        {
+            int w = rec.words[k];
+            if (a[w] != b[w])
+            {
+                if (*first < 0)
+                {
+                    *first = (long)i;
+                    *first_word = w;
+                    *got = a[w];
+                }
+                mismatch++;
+                break;
+            }
+        }
+    }
+    *calls += ev3stub.calls - calls_before;
+    return mismatch;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: replay [--repeat N] [--verbose] [--map FILE] LOG.dat...\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<recording_t> recs;
+    int repeat = 1;
+    bool verbose = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string a = argv[i];
+        if (a == "--repeat" && i + 1 < argc)
+            repeat = atoi(argv[++i]);
+        else if (a == "--verbose")
+            verbose = true;
+        else if (a == "--map" && i + 1 < argc)
+        {
+            FILE *fp = fopen(argv[++i], "rb");
+            uint8_t buf[CMAP_FILE_MAX];
+            size_t n = fp ? fread(buf, 1, sizeof(buf), fp) : 0;
+            if (fp)
+                fclose(fp);
+            CourseMap check;
+            if (!check.load(buf, (int)n))
+            {
+                fprintf(stderr, "replay: %s: not a course map\n", argv[i]);
+                return 2;
+            }
+            course_map.assign(buf, buf + n);
+        }
+        else if (a[0] == '-')
+            usage();
+        else
+        {
+            recording_t rec;
+            if (load(argv[i], &rec))
+                recs.push_back(rec);
+        }
+    }
+    if (recs.empty())
+        usage();
+    if (repeat < 1)
+        repeat = 1;
+
+    // -------- 再生と比較 --------
+    long total_cycles = 0;
+    int failed = 0;
+    unsigned long step_calls = 0;
+    for (size_t r = 0; r < recs.size(); r++)
+    {
+        const recording_t &rec = recs[r];
+        long first;
+        int word = 0;
+        int32_t got = 0;
+        long mismatch = replay(rec, &first, &word, &got, &step_calls);
+        total_cycles += (long)rec.inputs.size();
+        if (mismatch)
+            failed++;
+        if (mismatch || verbose)
+            printf("%-40s %7zu cycles  %s", rec.path.c_str(), rec.inputs.size(),
+                   mismatch ? "MISMATCH" : "ok");
+        if (mismatch)
+        {
+            int32_t want;
+            memcpy(&want, (const int32_t *)&rec.frames[first] + word, sizeof(want));
+            printf(" %ld frames, first at %ld (COUNT_time %u): %s = %d, recorded %d",
+                   mismatch, first, rec.frames[first].count_time, LOG_SCHEMA[word].name, got, want);
+        }
+        if (rec.gap)
+            printf("%s(truncated at dropped frame)", (mismatch || verbose) ? " " : rec.path.c_str());
+        if (rec.tuned)
+            printf("%s(truncated at live parameter change)", (mismatch || verbose || rec.gap) ? " " : rec.path.c_str());
+        if (mismatch || verbose || rec.gap || rec.tuned)
+            printf("\n");
+    }
+
+    // -------- 速度 --------
+    unsigned long calls = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int k = 0; k < repeat; k++)
+        for (size_t r = 0; r < recs.size(); r++)
+        {
+            long first;
+            int word;
+            int32_t got;
+            replay(recs[r], &first, &word, &got, &calls);
+        }
+    auto t1 = std::chrono::steady_clock::now();
+    double wall = std::chrono::duration<double>(t1 - t0).count();
+
+    printf("files         %zu (%d mismatched)\n", recs.size(), failed);
+    printf("cycles        %ld (%.1f s of driving)\n", total_cycles, total_cycles * MAIN_CYCLE * 1e-3);
+    printf("ev3api calls  %lu during steps\n", step_calls);
+    if (wall > 0)
+        printf("replay_rate   %.2f Mcycles/s\n", total_cycles * (double)repeat / wall * 1e-6);
+    return failed ? 1 : 0;
+}
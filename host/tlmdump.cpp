@@ -0,0 +1,75 @@
+/**
+ * @file tlmdump.cpp
+ * @brief ログのテレメトリ('M' / 'T' レコード)をチャンネルごとの時系列の CSV にする
+ *
+ * @note 出力は "channel,t_ms,value"。時刻はサンプルした周期数 x 周期[ms] で,
+ *       間引いたチャンネルは間引きの周期ごと,間引きを変えた後は新しい間引きで並ぶ。
+ *
+ *  使い方:
+ *    tlmdump [--channel NAME] LOG.dat
+ *  --channel を付けるとそのチャンネルだけ書く。チャンネルごとのサンプル数を標準エラーに書く。
+ */
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "logging/TelemetryDecoder.h"
+
+int main(int argc, char **argv)
+{
+    const char *only = NULL;
+    const char *path = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--channel") == 0 && i + 1 < argc)
+            only = argv[++i];
+        else
+            path = argv[i];
+    }
+    if (path == NULL)
+    {
+        fprintf(stderr, "usage: tlmdump [--channel NAME] LOG.dat\n");
+        return 2;
+    }
+
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "tlmdump: cannot open %s\n", path);
+        return 1;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        data.insert(data.end(), buf, buf + n);
+    fclose(fp);
+    if (!LogDecoder::isEncoded(data.data(), data.size()))
+    {
+        fprintf(stderr, "tlmdump: %s is not an encoded log\n", path);
+        return 1;
+    }
+
+    LogDecoder dec;
+    const uint8_t *p = data.data();
+    const uint8_t *end = p + data.size();
+    while (dec.next(p, end))
+        ;
+    TelemetryDecoder tlm;
+    tlm.addAll(dec.records());
+    if (tlm.error())
+        fprintf(stderr, "tlmdump: broken telemetry record\n");
+
+    printf("channel,t_ms,value\n");
+    for (size_t k = 0; k < tlm.series().size(); k++)
+    {
+        const TelemetryDecoder::series_t &s = tlm.series()[k];
+        if (only != NULL && s.name != only)
+            continue;
+        for (size_t i = 0; i < s.t_ms.size(); i++)
+            printf("%s,%u,%.10g\n", s.name.c_str(), s.t_ms[i], s.value[i]);
+        fprintf(stderr, "%-14s %7zu samples, decim %u\n", s.name.c_str(), s.t_ms.size(), s.decim);
+    }
+    fprintf(stderr, "period %u ms, %lu sample records, %lu maps\n", tlm.periodMs(), tlm.samples(), tlm.maps());
+    return tlm.error() ? 1 : 0;
+}
@@ -0,0 +1,314 @@
+/**
+ * @file tune.cpp
+ * @brief PIDゲインと前進速度のマルチコア探索(グリッド / CEM)
+ *
+ * @note PIDController.h の6ゲインと LineTracer.h の MOTOR_POWER を実行時の値(tracergains_t)として
+ *       SimLoop でシミュレーション走行させ,周回時間,ラインからの距離,舵角の振動で採点する。
+ *       評価はワークスティーリングのスレッドプールで全コアに分散する。
+ *
+ *  使い方:
+ *    tune [--oval STRAIGHT,RADIUS | --course FILE.ppm --mm-per-px S --start X,Y,DEG]
+ *         [--laps N] [--time SEC] [--threads N] [--params NAME,...] [--span F]
+ *         [--grid N] [--cem ITER [--pop N] [--elite N] [--seed S]]
+ *         [--w-cte W] [--w-osc W] [--top K]
+ *
+ *  採点(小さいほど良い):
+ *    完走      time_s + W_cte * cte_rms_mm + W_osc * osc
+ *    完走せず  1000 + 1000 * (1 - progress)
+ *
+ *  閉ループなので記録したログの再生では評価できない(ゲインを変えると走る経路が変わる)。
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "SimLoop.h"
+#include "WorkStealingPool.h"
+
+/** 探索できるパラメータ, PID ゲイン(PARAM_GAIN の順)と前進速度 */
+#define TUNE_DIMS 7
+#define TUNE_GAINS 6 // そのうち PID ゲインの数
+static const char *const PARAM_NAME[TUNE_DIMS] = {
+    "kp_reflect", "ki_reflect", "kd_reflect", "kp_hsv", "ki_hsv", "kd_hsv", "power"};
+static float tracergains_t::*const PARAM_GAIN[TUNE_GAINS] = {
+    &tracergains_t::kp_reflect, &tracergains_t::ki_reflect, &tracergains_t::kd_reflect,
+    &tracergains_t::kp_hsv,     &tracergains_t::ki_hsv,     &tracergains_t::kd_hsv};
+
+struct candidate_t
+{
+    double x[TUNE_DIMS]; // パラメータ値
+    simresult_t res;
+    double score;
+};
+
+static double get_param(const tracergains_t &g, int k)
+{
+    return (k < TUNE_GAINS) ? g.*PARAM_GAIN[k] : g.power;
+}
+
+static tracergains_t to_gains(const double *x)
+{
+    tracergains_t g;
+    for (int k = 0; k < TUNE_GAINS; k++)
+        g.*PARAM_GAIN[k] = (float)std::max(0.0, x[k]);
+    g.power = std::max(10, std::min(100, (int)std::lround(x[TUNE_GAINS])));
+    return g;
+}
+
+static double score_of(const simresult_t &r, double w_cte, double w_osc)
+{
+    if (!r.completed)
+        return 1000.0 + 1000.0 * (1.0 - r.progress);
+    return r.time_s + w_cte * r.cte_rms_mm + w_osc * r.osc;
+}
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: tune [--oval STRAIGHT,RADIUS | --course FILE.ppm --mm-per-px S --start X,Y,DEG]\n"
+            "            [--laps N] [--time SEC] [--threads N] [--params NAME,...] [--span F]\n"
+            "            [--grid N] [--cem ITER [--pop N] [--elite N] [--seed S]]\n"
+            "            [--w-cte W] [--w-osc W] [--top K]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    CourseImage course;
+    std::string ppm;
+    double mm_per_px = 2.0;
+    double straight = 2000.0, radius = 600.0;
+    double start[3] = {0, 0, 0};
+    bool has_start = false;
+    int laps = 1;
+    double time_limit = 60.0;
+    int threads = 0;
+    std::string params = "kp_reflect,kd_reflect,power";
+    double span = 0.5;
+    int grid = 0, cem = 0, pop = 32, elite = 8;
+    unsigned int seed = 1;
+    double w_cte = 0.05, w_osc = 0.1;
+    int top = 10;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string a = argv[i];
+        bool more = (i + 1 < argc);
+        if (a == "--oval" && more)
+            sscanf(argv[++i], "%lf,%lf", &straight, &radius);
+        else if (a == "--course" && more)
+            ppm = argv[++i];
+        else if (a == "--mm-per-px" && more)
+            mm_per_px = atof(argv[++i]);
+        else if (a == "--start" && more)
+            has_start = (sscanf(argv[++i], "%lf,%lf,%lf", &start[0], &start[1], &start[2]) == 3);
+        else if (a == "--laps" && more)
+            laps = atoi(argv[++i]);
+        else if (a == "--time" && more)
+            time_limit = atof(argv[++i]);
+        else if (a == "--threads" && more)
+            threads = atoi(argv[++i]);
+        else if (a == "--params" && more)
+            params = argv[++i];
+        else if (a == "--span" && more)
+            span = atof(argv[++i]);
+        else if (a == "--grid" && more)
+            grid = atoi(argv[++i]);
+        else if (a == "--cem" && more)
+            cem = atoi(argv[++i]);
+        else if (a == "--pop" && more)
+            pop = atoi(argv[++i]);
+        else if (a == "--elite" && more)
+            elite = atoi(argv[++i]);
+        else if (a == "--seed" && more)
+            seed = (unsigned int)atoi(argv[++i]);
+        else if (a == "--w-cte" && more)
+            w_cte = atof(argv[++i]);
+        else if (a == "--w-osc" && more)
+            w_osc = atof(argv[++i]);
+        else if (a == "--top" && more)
+            top = atoi(argv[++i]);
+        else
+            usage();
+    }
+    if (grid <= 0 && cem <= 0)
+        grid = 3;
+    elite = std::max(1, std::min(elite, pop));
+
+    // -------- 探索する次元 --------
+    std::vector<int> dims;
+    for (size_t p = 0; p <= params.size();)
+    {
+        size_t q = params.find(',', p);
+        if (q == std::string::npos)
+            q = params.size();
+        std::string name = params.substr(p, q - p);
+        int k = 0;
+        while (k < TUNE_DIMS && name != PARAM_NAME[k])
+            k++;
+        if (k == TUNE_DIMS)
+        {
+            fprintf(stderr, "tune: unknown parameter %s\n", name.c_str());
+            usage();
+        }
+        dims.push_back(k);
+        p = q + 1;
+    }
+
+    // -------- コース --------
+    if (!ppm.empty())
+    {
+        if (!course.loadPPM(ppm, mm_per_px))
+        {
+            fprintf(stderr, "tune: cannot load %s\n", ppm.c_str());
+            return 1;
+        }
+    }
+    else
+        course.generateOval(straight, radius);
+    if (has_start)
+    {
+        course.start_x = start[0];
+        course.start_y = start[1];
+        course.start_heading = start[2] * M_PI / 180.0;
+    }
+    course.buildLineDistance();
+
+    SimLoop loop(course);
+    WorkStealingPool pool(threads);
+    std::vector<candidate_t> all;
+    double center[TUNE_DIMS];
+    for (int k = 0; k < TUNE_DIMS; k++)
+        center[k] = get_param(TRACER_DEFAULT_GAINS, k);
+
+    // 候補をまとめて並列に評価する
+    auto evaluate = [&](std::vector<candidate_t> &cands) {
+        pool.run((int)cands.size(), [&](int t) {
+            tracergains_t g = to_gains(cands[t].x);
+            cands[t].res = loop.run(&g, laps, time_limit);
+            cands[t].score = score_of(cands[t].res, w_cte, w_osc);
+        });
+        all.insert(all.end(), cands.begin(), cands.end());
+    };
+
+    auto t0 = std::chrono::steady_clock::now();
+
+    // 既定値(比較用)
+    std::vector<candidate_t> base(1);
+    memcpy(base[0].x, center, sizeof(center));
+    evaluate(base);
+    const candidate_t reference = base[0];
+
+    // -------- グリッド: 各次元 center*(1-span) .. center*(1+span) を grid 点 --------
+    if (grid > 0)
+    {
+        long total = 1;
+        for (size_t d = 0; d < dims.size(); d++)
+            total *= grid;
+        std::vector<candidate_t> cands(total);
+        for (long i = 0; i < total; i++)
+        {
+            memcpy(cands[i].x, center, sizeof(center));
+            long rest = i;
+            for (size_t d = 0; d < dims.size(); d++)
+            {
+                int k = dims[d];
+                int j = (int)(rest % grid);
+                rest /= grid;
+                double f = (grid == 1) ? 0.0 : (2.0 * j / (grid - 1) - 1.0);
+                cands[i].x[k] = center[k] * (1.0 + span * f);
+            }
+        }
+        evaluate(cands);
+    }
+
+    // -------- CEM: 対角ガウス分布から pop 個を引き,上位 elite 個で平均と分散を更新 --------
+    if (cem > 0)
+    {
+        std::mt19937 rng(seed);
+        std::normal_distribution<double> normal(0.0, 1.0);
+        double mean[TUNE_DIMS], sigma[TUNE_DIMS];
+        for (int k = 0; k < TUNE_DIMS; k++)
+        {
+            mean[k] = center[k];
+            sigma[k] = 0.5 * span * center[k];
+        }
+        for (int it = 0; it < cem; it++)
+        {
+            std::vector<candidate_t> cands(pop);
+            for (int i = 0; i < pop; i++)
+            {
+                memcpy(cands[i].x, center, sizeof(center));
+                for (size_t d = 0; d < dims.size(); d++)
+                {
+                    int k = dims[d];
+                    cands[i].x[k] = std::max(0.0, mean[k] + sigma[k] * normal(rng));
+                }
+            }
+            evaluate(cands);
+            std::sort(cands.begin(), cands.end(),
+                      [](const candidate_t &a, const candidate_t &b) { return a.score < b.score; });
+            for (size_t d = 0; d < dims.size(); d++)
+            {
+                int k = dims[d];
+                double m = 0, v = 0;
+                for (int i = 0; i < elite; i++)
+                    m += cands[i].x[k];
+                m /= elite;
+                for (int i = 0; i < elite; i++)
+                    v += (cands[i].x[k] - m) * (cands[i].x[k] - m);
+                v /= elite;
+                // 平滑化して急に分布が潰れないようにする
+                mean[k] = 0.7 * m + 0.3 * mean[k];
+                sigma[k] = 0.7 * std::sqrt(v) + 0.3 * sigma[k];
+            }
+            printf("cem %2d  best %.3f  mean", it, cands[0].score);
+            for (size_t d = 0; d < dims.size(); d++)
+                printf(" %s=%.3f", PARAM_NAME[dims[d]], mean[dims[d]]);
+            printf("\n");
+        }
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    double wall = std::chrono::duration<double>(t1 - t0).count();
+
+    // -------- 結果 --------
+    std::stable_sort(all.begin(), all.end(),
+                     [](const candidate_t &a, const candidate_t &b) { return a.score < b.score; });
+    printf("%4s %9s %8s %8s %7s %6s", "rank", "score", "time_s", "lap_s", "cte_mm", "osc");
+    for (int k = 0; k < TUNE_DIMS; k++)
+        printf(" %10s", PARAM_NAME[k]);
+    printf("\n");
+    auto print_row = [&](const char *rank, const candidate_t &c) {
+        tracergains_t g = to_gains(c.x);
+        printf("%4s %9.3f %8.3f %8.3f %7.2f %6.2f", rank, c.score, c.res.time_s,
+               c.res.last_lap_s, c.res.cte_rms_mm, c.res.osc);
+        for (int k = 0; k < TUNE_DIMS; k++)
+            printf(" %10.4g", get_param(g, k));
+        printf("%s\n", c.res.completed ? "" : (c.res.lost ? "  lost" : "  timeout"));
+    };
+    for (int i = 0; i < top && i < (int)all.size(); i++)
+    {
+        char rank[16];
+        snprintf(rank, sizeof(rank), "%d", i + 1);
+        print_row(rank, all[i]);
+    }
+    print_row("def", reference);
+
+    long cycles = 0;
+    for (size_t i = 0; i < all.size(); i++)
+        cycles += all[i].res.cycles;
+    printf("evaluations   %zu on %d threads (%lu steals)\n", all.size(), pool.threads(), pool.steals());
+    printf("wall_time     %.3f s\n", wall);
+    if (wall > 0)
+    {
+        printf("throughput    %.1f evals/s\n", all.size() / wall);
+        printf("sim_rate      %.2f Mcycles/s\n", cycles / wall * 1e-6);
+    }
+    return 0;
+}
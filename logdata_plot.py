@@ -19,13 +19,85 @@ colorlist = ['black', 'tab:red', 'tab:green', 'tab:blue',
 logdatfile = os.path.join(os.path.dirname(__file__), 'log.dat')
 logcsvfile = os.path.join(os.path.dirname(__file__), 'log.csv')
 
+
+def read_varint(buf, pos):
+    result = 0
+    shift = 0
+    while True:
+        c = buf[pos]
+        pos += 1
+        result |= (c & 0x7f) << shift
+        if c < 0x80:
+            return result, pos
+        shift += 7
+
+
+def unzigzag(v):
+    return (v >> 1) ^ -(v & 1)
+
+
+def decode_khlg(buf):
+    """KHLG形式(差分+zigzag varint)のログを復号する, 戻り値は(チャンネル名リスト, フレームリスト)"""
+    names, orders, cur, step = [], [], [], []
+    frames = []
+    pos = 5  # "KHLG" + version
+    while pos < len(buf):
+        tag = buf[pos]
+        pos += 1
+        try:
+            if tag in (ord('K'), ord('D')):
+                mask = -1
+                if tag == ord('D'):
+                    mask, pos = read_varint(buf, pos)
+                for i in range(len(names)):
+                    if tag == ord('K'):
+                        v, pos = read_varint(buf, pos)
+                        step[i], cur[i] = 0, unzigzag(v)
+                        continue
+                    value = cur[i] + (step[i] if orders[i] else 0)
+                    if mask & (1 << i):
+                        v, pos = read_varint(buf, pos)
+                        value += unzigzag(v)
+                    step[i], cur[i] = value - cur[i], value
+                frames.append(tuple(cur))
+            else:
+                length, pos = read_varint(buf, pos)
+                if tag == ord('S'):
+                    body = buf[pos:pos + length]
+                    n, q = read_varint(body, 0)
+                    names, orders = [], []
+                    for _ in range(n):
+                        namelen, q = read_varint(body, q)
+                        names.append(body[q:q + namelen].decode())
+                        orders.append(body[q + namelen])
+                        q += namelen + 1
+                    cur, step = [0] * n, [0] * n
+                elif tag == ord('P') or tag == ord('U'):
+                    # 'P' tracer_task 区間時間の統計(MAKE_PROFILE)
+                    #     1行1区間: stage section count min max mean | log2[us]ヒストグラム
+                    # 'U' 起動の段階ごとの時間 1行1段階: startup phase us
+                    print(buf[pos:pos + length].decode(), end='')
+                elif tag == ord('C'):
+                    # 'C' Bluetooth のコマンドの応答のフレーム [0xA5][len][cmd|0x80][seq][結果 ...][CRC]
+                    print('command reply', buf[pos:pos + length].hex())
+                pos += length  # 知らないレコードは読み飛ばす
+        except IndexError:
+            break  # 末尾が途中で切れている
+    return names, frames
+
+
 with open(logdatfile, 'rb') as logfile:
+    content = logfile.read()
+if content[:4] == b'KHLG':
+    names, frames = decode_khlg(content)
+    # 既知のチャンネルをlabelの並びに合わせる,新しいチャンネルは後ろに足す
+    label = label + [n for n in names if n not in label]
+    index = [names.index(n) if n in names else None for n in label]
+    logdata = [tuple(f[i] if i is not None else 0 for i in index) for f in frames]
+else:
     size = st.calcsize('Iiiiiii')
-    content = logfile.read(size)
-    while content:
-        decode_data = st.unpack('Iiiiiii', content)
-        logdata.append(decode_data)
-        content = logfile.read(size)
+    for offset in range(0, len(content) - size + 1, size):
+        logdata.append(st.unpack_from('Iiiiiii', content, offset))
 
 with open(logcsvfile, 'w', newline='') as csvfile:
     writer = csv.writer(csvfile, dialect="excel")
@@ -45,6 +117,8 @@ fig = plt.figure(figsize=(18, 7))
 ax = fig.add_subplot()
 
 for i in range(1, len(arr_log)):
+    if label[i].startswith('in.'):
+        continue  # 生の入力値(ログ再生用)はCSVにだけ出す
     ax.plot(arr_log[0], arr_log[i], label=label[i], marker=".")
     #ax.scatter(arr_log[0], arr_log[i], label=label[i])
 
@@ -0,0 +1,262 @@
+/**
+ * @file CycleProfiler.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief 
+ * @version 0.1
+ * @date 2021-07-04
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+#ifndef EV3_APP_CYCLEPROFILER_H
+#define EV3_APP_CYCLEPROFILER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "ev3api.h"
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   計測区間
+ * @note    PROF_LAP(区間) は直前の PROF_LAP/PROF_BEGIN からの経過時間をその区間に積む
+ */
+enum
+{
+    PROF_INPUT = 0,  /* センサ,エンコーダーの取得 */
+    PROF_COLOR,      /* ColorSensorCalculator::calc */
+    PROF_TURNANGLE,  /* TurnAngleCalculator::calc */
+    PROF_LINETRACER, /* LineTracerT::calc */
+    PROF_OBSTACLE,   /* ObstacleCalc */
+    PROF_STAGE,      /* 上記以外の状態遷移処理 */
+    PROF_OUTPUT,     /* モーター出力 */
+    PROF_LOGGING,    /* datalogging */
+    PROF_CYCLE,      /* 周期全体 */
+    PROF_SECTIONS
+};
+
+#define PROF_HIST_BINS 16 // log2[us]ヒストグラム, bin k は 2^(k-1) <= t < 2^k [us], bin 0 は 0us
+#define PROF_SLOTS 5      // DrivingStage の種類数 0,101,102,103,999
+#define PROF_PERIOD 4000  // 周期ハンドラの周期[us]
+#define PROF_TEXT_MAX 4096 // format() の出力に必要な大きさ
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   区間ごとの統計
+ * 
+ * @struct  profstat_t
+ */
+typedef struct
+{
+    uint32_t count;                 /* 回数 */
+    uint32_t min, max;              /* 最小,最大[us] */
+    uint32_t sum;                   /* 合計[us],平均は sum/count */
+    uint16_t hist[PROF_HIST_BINS];  /* log2ヒストグラム */
+} profstat_t;
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   tracer_task 周期時間プロファイラ クラス
+ * 
+ * @class   CycleProfiler
+ * @note    fch_hrt()[us]で区間ごとに時刻を取る。DrivingStage ごとに統計を分ける。
+ *          周期ハンドラの起動間隔の揺らぎ(PROF_PERIOD との差の絶対値)も記録する。
+ *          MAKE_PROFILE を定義しないと PROF_* マクロは空になり,何も残らない。
+ */
+class CycleProfiler
+{
+private:
+    profstat_t stat[PROF_SLOTS][PROF_SECTIONS]; // 区間統計
+    profstat_t jitter;                          // 起動間隔の揺らぎ
+    int32_t jitter_min, jitter_max;             // 揺らぎの符号付き最小,最大[us]
+    HRTCNT t_start, t_lap, t_prev_start;        // 周期開始,直前の区間,前回の周期開始
+    int slot;                                   // 今回の DrivingStage スロット
+
+    static void clear(profstat_t *s);
+    static void add(profstat_t *s, uint32_t us);
+
+public:
+    CycleProfiler(); // Constructor
+
+    void begin(int stage);    // 周期開始
+    void lap(int section);    // 区間の終わり
+    void end();               // 周期終了
+    int format(char *buf, int size); // 統計をテキストにする
+    const profstat_t *get(int stage, int section);
+    static int stageSlot(int stage); // DrivingStage -> スロット
+};
+
+#if defined(MAKE_PROFILE)
+#define PROF_BEGIN(prof, stage) ((prof)->begin(stage))
+#define PROF_LAP(prof, section) ((prof)->lap(section))
+#define PROF_END(prof) ((prof)->end())
+#else
+#define PROF_BEGIN(prof, stage)
+#define PROF_LAP(prof, section)
+#define PROF_END(prof)
+#endif
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+static const char *const PROF_SECTION_NAME[PROF_SECTIONS] = {
+    "input", "color", "turnangle", "linetracer", "obstacle", "stage", "output", "logging", "cycle"};
+static const int PROF_SLOT_STAGE[PROF_SLOTS] = {0, 101, 102, 103, 999};
+
+// Constructor
+CycleProfiler::CycleProfiler()
+    : jitter_min(0), jitter_max(0),
+      t_start(0), t_lap(0), t_prev_start(0), slot(0)
+{
+    int i, j;
+    for (i = 0; i < PROF_SLOTS; i++)
+        for (j = 0; j < PROF_SECTIONS; j++)
+            clear(&stat[i][j]);
+    clear(&jitter);
+}
+
+/**
+ * @brief   統計の初期化
+ * 
+ * @fn      void CycleProfiler::clear(profstat_t *s)
+ */
+inline void CycleProfiler::clear(profstat_t *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->min = UINT32_MAX;
+}
+
+/**
+ * @brief   DrivingStage -> スロット
+ * 
+ * @fn      int CycleProfiler::stageSlot(int stage)
+ * @param   stage (int)DrivingStage
+ * @return  スロット番号, 未知の値は最後のスロット
+ */
+inline int CycleProfiler::stageSlot(int stage)
+{
+    int i;
+    for (i = 0; i < PROF_SLOTS - 1; i++)
+        if (PROF_SLOT_STAGE[i] == stage)
+            return i;
+    return PROF_SLOTS - 1;
+}
+
+/**
+ * @brief   統計に1サンプル足す
+ * 
+ * @fn      void CycleProfiler::add(profstat_t *s, uint32_t us)
+ */
+inline void CycleProfiler::add(profstat_t *s, uint32_t us)
+{
+    int bin = (us == 0) ? 0 : 32 - __builtin_clz(us);
+    if (bin >= PROF_HIST_BINS)
+        bin = PROF_HIST_BINS - 1;
+    s->count++;
+    s->sum += us;
+    if (us < s->min)
+        s->min = us;
+    if (us > s->max)
+        s->max = us;
+    if (s->hist[bin] != UINT16_MAX)
+        s->hist[bin]++;
+}
+
+/**
+ * @brief   周期開始
+ * 
+ * @fn      void CycleProfiler::begin(int stage)
+ * @param   stage (int)現在の DrivingStage
+ * @return  無し
+ */
+inline void CycleProfiler::begin(int stage)
+{
+    t_start = fch_hrt();
+    t_lap = t_start;
+    slot = stageSlot(stage);
+    if (t_prev_start != 0)
+    {
+        int32_t d = (int32_t)(t_start - t_prev_start) - PROF_PERIOD;
+        if (jitter.count == 0 || d < jitter_min)
+            jitter_min = d;
+        if (jitter.count == 0 || d > jitter_max)
+            jitter_max = d;
+        add(&jitter, (d < 0) ? -d : d);
+    }
+    t_prev_start = t_start;
+}
+
+/**
+ * @brief   区間の終わり
+ * 
+ * @fn      void CycleProfiler::lap(int section)
+ * @param   section (int)区間 PROF_INPUT...PROF_LOGGING
+ * @return  無し
+ */
+inline void CycleProfiler::lap(int section)
+{
+    HRTCNT now = fch_hrt();
+    add(&stat[slot][section], now - t_lap);
+    t_lap = now;
+}
+
+/**
+ * @brief   周期終了
+ * 
+ * @fn      void CycleProfiler::end()
+ * @return  無し
+ */
+inline void CycleProfiler::end()
+{
+    add(&stat[slot][PROF_CYCLE], fch_hrt() - t_start);
+}
+
+/**
+ * @brief   統計の取得
+ * 
+ * @fn      const profstat_t *CycleProfiler::get(int stage, int section)
+ * @param   stage   (int)DrivingStage, -1 なら起動間隔の揺らぎ
+ * @param   section (int)区間
+ */
+inline const profstat_t *CycleProfiler::get(int stage, int section)
+{
+    return (stage < 0) ? &jitter : &stat[stageSlot(stage)][section];
+}
+
+/**
+ * @brief   統計をテキストにする
+ * 
+ * @fn      int CycleProfiler::format(char *buf, int size)
+ * @param   buf     (char*)出力先
+ * @param   size    (int)出力先の大きさ
+ * @return  書いた文字数(終端を除く)
+ * @note    1行1区間: "stage section count min max mean | hist..." 回数0の区間は省く
+ */
+int CycleProfiler::format(char *buf, int size)
+{
+    int n = 0;
+    int i, j, k;
+
+    for (i = -1; i < PROF_SLOTS; i++)
+    {
+        for (j = 0; j < PROF_SECTIONS; j++)
+        {
+            const profstat_t *s = (i < 0) ? &jitter : &stat[i][j];
+            if (s->count == 0 || n >= size)
+                continue;
+            if (i < 0)
+                n += snprintf(buf + n, size - n, "jitter %ld..%ld", (long)jitter_min, (long)jitter_max);
+            else
+                n += snprintf(buf + n, size - n, "%d %s", PROF_SLOT_STAGE[i], PROF_SECTION_NAME[j]);
+            if (n >= size)
+                break;
+            n += snprintf(buf + n, size - n, " %lu %lu %lu %lu |", (unsigned long)s->count,
+                          (unsigned long)s->min, (unsigned long)s->max, (unsigned long)(s->sum / s->count));
+            for (k = 0; k < PROF_HIST_BINS && n < size; k++)
+                n += snprintf(buf + n, size - n, " %u", s->hist[k]);
+            if (n < size)
+                n += snprintf(buf + n, size - n, "\n");
+            if (i < 0)
+                break; // 揺らぎは1行だけ
+        }
+    }
+    return (n < size) ? n : size - 1;
+}
+
+#endif // EV3_APP_CYCLEPROFILER_H
@@ -0,0 +1,258 @@
+/**
+ * @file DataLogger.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief 
+ * @version 0.1
+ * @date 2021-06-20
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+#ifndef EV3_APP_DATALOGGER_H
+#define EV3_APP_DATALOGGER_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "logging/SpscRingBuffer.h"
+#include "logging/LogEncoder.h"
+
+#define LOG_RING_SIZE 128 // リングバッファのフレーム数,4ms周期で約0.5秒分
+#define LOG_BATCH_MAX 32  // 1回のfwriteで書き出す最大フレーム数
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   ログ1フレーム
+ * 
+ * @struct  logframe_t
+ * @note    先頭28byte= int(4byte) x7 は logdata_plot.py の 'Iiiiiii' と同じ並び。
+ *          後ろはその周期の走行状態と生の入力値で,ログ再生(host/replay)に使う。
+ *          最後は開始位置を原点とする姿勢(PoseOdometry)と,ジャイロで補正した方位(HeadingFilter, この2つは間引き)と,
+ *          走行モーターの前進速度(コースマップの速度計画 LookaheadPlanner を含む)と,
+ *          走行前に決めたラインのPID目標(LineCalibrator)と,tracer_task の締め切り超過の累計(DeadlineMonitor)と,
+ *          走行中に Bluetooth で変えた調整値の組の番号(CommandChannel)。
+ */
+typedef struct __attribute__((packed))
+{
+    unsigned int count_time; /* 開始からの経過時間[ms], 'I' */
+    int drivin;              /* 直進コーナー判定 x100, 'i' */
+    int turn;                /* 舵角, 'i' */
+    int omega;               /* 車両回転角, 'i' */
+    int hsv_val;             /* HSV明度, 'i' */
+    int distance;            /* 障害物との距離[cm], 'i' */
+    int gyro_deg;            /* ジャイロ角, 'i' (入力値を兼ねる) */
+    int stage;               /* DrivingStage */
+    int rgb_r;               /* 入力 カラーセンサ RGB Raw値 */
+    int rgb_g;
+    int rgb_b;
+    int left_count;          /* 入力 左ホイール回転角 */
+    int right_count;         /* 入力 右ホイール回転角 */
+    int arm_count;           /* 入力 アーム回転角 */
+    int sonar;               /* 入力 超音波センサ距離[cm] */
+    int button;              /* 入力 バックボタン */
+    int pose_x;              /* 位置 x[mm] */
+    int pose_y;              /* 位置 y[mm] */
+    int pose_heading;        /* 方位[deg] -180 to 179, 左回りが正 */
+    int fuse_heading;        /* ジャイロで補正した方位[deg] -180 to 179, 左回りが正 */
+    int fuse_rate;           /* ジャイロで補正した角速度[deg/s], 左回りが正 */
+    int fuse_bias;           /* ジャイロのバイアス[mdeg/s] (走行前に設定,ログ再生で使う) */
+    int fuse_zero;           /* 開始時のジャイロ角[mdeg] (同上) */
+    int power;               /* 走行モーター 前進速度, 走行モーターを止めている周期は 0 */
+    int cal_reflect;         /* PID目標 HSV明度 (走行前に設定,ログ再生で使う) */
+    int cal_hsv;             /* PID目標 HSV彩度 (同上) */
+    int dl_miss;             /* tracer_task の締め切り超過の累計 */
+    int dl_late;             /* 最大の超過時間[us] */
+    int dl_shed;             /* 縮退した周期の累計(そのフレームはログに残らない) */
+    int prm_seq;             /* 走行中に反映した調整値の組の番号, 0 なら変えていない */
+} logframe_t;
+
+#define LOG_LEGACY_BYTES 28 // MAKE_LOG_RAW で書き出す 'Iiiiiii' の部分
+static_assert(offsetof(logframe_t, stage) == LOG_LEGACY_BYTES, "logframe_t must start with the 'Iiiiiii' record");
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   ログチャンネル定義, logframe_t と同じ並び
+ * @note    経過時間,ホイール回転角は一定の割合で増えるので直線予測にする。
+ *          姿勢と補正した方位(pose.*, fuse.heading, fuse.rate)は診断用で,TracerCore が間引いて
+ *          (RATE_LOG_POSE, 100ms ごと)更新し,間のフレームは同じ値なので前回値で予測する
+ */
+#define LOG_CHANNELS 30
+static const logchannel_t LOG_SCHEMA[LOG_CHANNELS] = {
+    {"COUNT_time", 1},
+    {"drivinstage", 0},
+    {"turn", 0},
+    {"omega", 0},
+    {"hsv.val", 0},
+    {"distance", 0},
+    {"gyro_deg", 0},
+    {"stage", 0},
+    {"in.rgb_r", 0},
+    {"in.rgb_g", 0},
+    {"in.rgb_b", 0},
+    {"in.left", 1},
+    {"in.right", 1},
+    {"in.arm", 0},
+    {"in.sonar", 0},
+    {"in.button", 0},
+    {"pose.x", 0},
+    {"pose.y", 0},
+    {"pose.heading", 0},
+    {"fuse.heading", 0},
+    {"fuse.rate", 0},
+    {"fuse.bias", 0},
+    {"fuse.zero", 0},
+    {"power", 0},
+    {"cal.reflect", 0},
+    {"cal.hsv", 0},
+    {"dl.miss", 0},
+    {"dl.late", 0},
+    {"dl.shed", 0},
+    {"prm.seq", 0},
+};
+static_assert(sizeof(logframe_t) == 4 * LOG_CHANNELS, "logframe_t must match LOG_SCHEMA");
+#define LOG_HEADER_MAX_BYTES (16 + 34 * LOG_CHANNELS)
+#define LOG_BUFFER_BYTES (LOG_HEADER_MAX_BYTES + (1 + 5 + 5 * LOG_CHANNELS) * LOG_BATCH_MAX)
+
+/**
+ * @brief   logger_task の drain が使うスタックの見積もり[byte]
+ * @note    取り出したフレームと符号化バッファはメンバに置き,スタックには1フレームの値(values),
+ *          LogEncoder::encode の残差,fwrite(newlib, 見積もり LOG_FWRITE_STACK_BYTES)だけを置く。
+ *          app.cpp で STACK_SIZE と比べる(チャンネルを増やしてもスタックを溢れさせないため)
+ */
+#define LOG_FWRITE_STACK_BYTES 1024
+#define LOG_DRAIN_STACK_BYTES (4 * LOG_CHANNELS + 4 * LOG_MAX_CHANNELS + 64 + LOG_FWRITE_STACK_BYTES)
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   データロガー クラス
+ * 
+ * @class   DataLogger
+ * @note    tracer_task は put でリングバッファにコピーするだけ。
+ *          低優先度の logger_task が drain で符号化(LogEncoder)してまとめて fwrite する。
+ *          MAKE_LOG_RAW を定義すると従来の28byte固定長フレーム(入力値なし)で書き出す。
+ */
+class DataLogger
+{
+private:
+    SpscRingBuffer<logframe_t, LOG_RING_SIZE> ring; // フレームのリングバッファ
+    LogEncoder encoder;                             // 差分+varint 符号化
+    bool header_written;                            // ストリームヘッダ出力済み
+    logframe_t batch[LOG_BATCH_MAX];                // drain で取り出したフレーム(スタックに置かない)
+    uint8_t outbuf[LOG_BUFFER_BYTES];               // 符号化バッファ
+
+public:
+    DataLogger(); // Constructor
+
+    bool put(const logframe_t &frame); // フレームを積む(tracer_taskから)
+    int drain(FILE *fp);               // 溜まったフレームを書き出す(logger_taskから)
+    void writeRecord(FILE *fp, uint8_t tag, const void *data, int len); // 長さ付きレコードを書き出す
+    unsigned int getDropped();         // 満杯で捨てたフレーム数の取得
+    unsigned int getHighWater();       // 最大滞留フレーム数の取得
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+// Constructor
+DataLogger::DataLogger()
+    : encoder(LOG_SCHEMA, LOG_CHANNELS),
+      header_written(false)
+{
+}
+
+/**
+ * @brief   フレームを積む
+ * 
+ * @fn      bool DataLogger::put(const logframe_t &frame)
+ * @param   frame (const logframe_t&)ログ1フレーム
+ * @return  true: 積んだ, false: 満杯で捨てた
+ */
+inline bool DataLogger::put(const logframe_t &frame)
+{
+    return ring.push(frame);
+}
+
+/**
+ * @brief   溜まったフレームを書き出す
+ * 
+ * @fn      int DataLogger::drain(FILE *fp)
+ * @param   fp (FILE*)書き出し先
+ * @return  書き出したフレーム数
+ * @note    LOG_BATCH_MAX フレームずつまとめて fwrite する
+ */
+int DataLogger::drain(FILE *fp)
+{
+    unsigned int n, i;
+    int total = 0;
+
+    while ((n = ring.pop(batch, LOG_BATCH_MAX)) > 0)
+    {
+#if defined(MAKE_LOG_RAW)
+        for (i = 0; i < n; i++)
+            memcpy(&outbuf[i * LOG_LEGACY_BYTES], &batch[i], LOG_LEGACY_BYTES);
+        fwrite(outbuf, LOG_LEGACY_BYTES, n, fp);
+#else
+        int32_t values[LOG_CHANNELS];
+        int len = 0;
+        if (!header_written)
+        {
+            len = encoder.header(outbuf);
+            header_written = true;
+        }
+        for (i = 0; i < n; i++)
+        {
+            memcpy(values, &batch[i], sizeof(values));
+            len += encoder.encode(values, &outbuf[len]);
+        }
+        fwrite(outbuf, 1, len, fp);
+#endif
+        total += n;
+    }
+    return total;
+}
+
+/**
+ * @brief   長さ付きレコードを書き出す
+ * 
+ * @fn      void DataLogger::writeRecord(FILE *fp, uint8_t tag, const void *data, int len)
+ * @param   fp      (FILE*)書き出し先
+ * @param   tag     (uint8_t)レコードのタグ LOG_TAG_PROFILE など
+ * @param   data    (const void*)本体
+ * @param   len     (int)本体の長さ
+ * @return  無し
+ * @attention drain と同じタスクから呼ぶこと。MAKE_LOG_RAW のときは何もしない
+ */
+void DataLogger::writeRecord(FILE *fp, uint8_t tag, const void *data, int len)
+{
+#if !defined(MAKE_LOG_RAW)
+    int n = 0;
+    if (!header_written)
+    {
+        n = encoder.header(outbuf);
+        header_written = true;
+    }
+    outbuf[n++] = tag;
+    n += LogEncoder::putVarint(&outbuf[n], len);
+    fwrite(outbuf, 1, n, fp);
+    fwrite(data, 1, len, fp);
+#endif
+}
+
+/**
+ * @brief   満杯で捨てたフレーム数の取得
+ * 
+ * @fn      unsigned int DataLogger::getDropped()
+ * @return  unsigned int: 捨てたフレーム数
+ */
+inline unsigned int DataLogger::getDropped()
+{
+    return ring.getDropped();
+}
+
+/**
+ * @brief   最大滞留フレーム数の取得
+ * 
+ * @fn      unsigned int DataLogger::getHighWater()
+ * @return  unsigned int: 最大滞留フレーム数
+ */
+inline unsigned int DataLogger::getHighWater()
+{
+    return ring.getHighWater();
+}
+
+#endif // EV3_APP_DATALOGGER_H
@@ -0,0 +1,234 @@
+/**
+ * @file LogDecoder.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief 
+ * @version 0.1
+ * @date 2021-06-27
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+#ifndef EV3_APP_LOGDECODER_H
+#define EV3_APP_LOGDECODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "logging/LogEncoder.h"
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   ログデコーダ クラス(ホスト側ツール用)
+ * 
+ * @class   LogDecoder
+ * @note    next() を繰り返し呼ぶ。フレームを復号したら true を返し,values() で値を読む。
+ *          スキーマのチャンネル名で列を引くので,後から足されたチャンネルは無視できる。
+ */
+class LogDecoder
+{
+public:
+    struct channel_t
+    {
+        std::string name;
+        int order;
+    };
+
+    LogDecoder(); // Constructor
+
+    static bool isEncoded(const uint8_t *p, size_t n); // 先頭が "KHLG" か
+    bool next(const uint8_t *&p, const uint8_t *end);  // 1フレーム復号する
+    int channelIndex(const char *name) const;          // チャンネル名 -> 列番号, 無ければ -1
+    const std::vector<channel_t> &channels() const { return schema; }
+    const int32_t *values() const { return &cur[0]; }
+    int version() const { return ver; }
+    bool error() const { return err; }
+    unsigned long skippedRecords() const { return skipped; }
+    const std::vector<std::pair<uint8_t, std::string> > &records() const { return extra; } // フレーム以外のレコード
+
+    static bool getVarint(const uint8_t *&p, const uint8_t *end, uint32_t *v);
+    static int32_t unzigzag(uint32_t v) { return (int32_t)((v >> 1) ^ (0u - (v & 1))); }
+
+private:
+    bool readSchema(const uint8_t *p, const uint8_t *end);
+
+    std::vector<channel_t> schema;
+    std::vector<int32_t> cur, step, nxt, nstep;
+    std::vector<uint8_t> order; // チャンネルごとの予測次数(schema と同じ並び)
+    std::vector<std::pair<uint8_t, std::string> > extra;
+    bool have_header, have_key, err;
+    int ver;
+    unsigned long skipped;
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+// Constructor
+inline LogDecoder::LogDecoder()
+    : have_header(false), have_key(false), err(false), ver(0), skipped(0)
+{
+}
+
+inline bool LogDecoder::isEncoded(const uint8_t *p, size_t n)
+{
+    return n >= 5 && memcmp(p, LOG_MAGIC, 4) == 0;
+}
+
+inline bool LogDecoder::getVarint(const uint8_t *&p, const uint8_t *end, uint32_t *v)
+{
+    uint32_t r = 0;
+    for (int shift = 0; shift < 35 && p < end; shift += 7)
+    {
+        uint8_t c = *p++;
+        r |= (uint32_t)(c & 0x7f) << shift;
+        if ((c & 0x80) == 0)
+        {
+            *v = r;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline int LogDecoder::channelIndex(const char *name) const
+{
+    for (size_t i = 0; i < schema.size(); i++)
+        if (schema[i].name == name)
+            return (int)i;
+    return -1;
+}
+
+inline bool LogDecoder::readSchema(const uint8_t *p, const uint8_t *end)
+{
+    uint32_t n, len;
+    if (!getVarint(p, end, &n) || n > LOG_MAX_CHANNELS)
+        return false;
+    schema.clear();
+    for (uint32_t i = 0; i < n; i++)
+    {
+        channel_t ch;
+        if (!getVarint(p, end, &len) || p + len + 1 > end)
+            return false;
+        ch.name.assign((const char *)p, len);
+        p += len;
+        ch.order = *p++;
+        schema.push_back(ch);
+    }
+    order.resize(n);
+    for (uint32_t i = 0; i < n; i++)
+        order[i] = (uint8_t)schema[i].order;
+    cur.assign(n, 0);
+    step.assign(n, 0);
+    nxt.assign(n, 0);
+    nstep.assign(n, 0);
+    have_key = false;
+    return true;
+}
+
+/**
+ * @brief   1フレーム復号する
+ * 
+ * @fn      bool LogDecoder::next(const uint8_t *&p, const uint8_t *end)
+ * @param   p   (const uint8_t*&)読み出し位置, 読んだ分だけ進む
+ * @param   end (const uint8_t*)データ終端
+ * @return  true: フレームを復号した, false: 終端または途中で切れている(pは切れたレコードの先頭)
+ */
+inline bool LogDecoder::next(const uint8_t *&p, const uint8_t *end)
+{
+    while (p < end && !err)
+    {
+        const uint8_t *rec = p;
+        if (!have_header)
+        {
+            if (end - p < 5)
+                return false;
+            if (!isEncoded(p, end - p))
+            {
+                err = true;
+                return false;
+            }
+            ver = p[4];
+            p += 5;
+            have_header = true;
+            continue;
+        }
+
+        uint8_t tag = *p++;
+        if (tag == LOG_TAG_KEY || tag == LOG_TAG_DELTA)
+        {
+            uint32_t mask = ~0u, v = 0;
+            bool ok = true;
+            if (tag == LOG_TAG_DELTA)
+            {
+                if (!have_key)
+                {
+                    err = true; // キーフレームより先に差分フレーム
+                    return false;
+                }
+                ok = getVarint(p, end, &mask);
+            }
+            // 途中で切れていたら状態を変えずに戻れるよう,作業用の配列に復号する
+            const size_t n = schema.size();
+            if (tag == LOG_TAG_KEY)
+            {
+                for (size_t i = 0; ok && i < n; i++)
+                {
+                    ok = getVarint(p, end, &v);
+                    nxt[i] = unzigzag(v);
+                    nstep[i] = 0;
+                }
+            }
+            else
+            {
+                for (size_t i = 0; i < n; i++) // 変化のないチャンネルは予測のまま
+                {
+                    const uint32_t d = order[i] ? (uint32_t)step[i] : 0;
+                    nstep[i] = (int32_t)d;
+                    nxt[i] = (int32_t)((uint32_t)cur[i] + d);
+                }
+                for (uint32_t m = mask & (n < 32 ? (1u << n) - 1 : ~0u); ok && m != 0; m &= m - 1)
+                {
+                    const int i = __builtin_ctz(m);
+                    if (p < end && *p < 0x80) // 1byte の varint(ほとんどの残差)
+                        v = *p++;
+                    else
+                        ok = getVarint(p, end, &v);
+                    nstep[i] = (int32_t)((uint32_t)nstep[i] + (uint32_t)unzigzag(v));
+                    nxt[i] = (int32_t)((uint32_t)cur[i] + (uint32_t)nstep[i]);
+                }
+            }
+            if (!ok)
+            {
+                p = rec; // 途中で切れている
+                return false;
+            }
+            cur.swap(nxt);
+            step.swap(nstep);
+            have_key = true;
+            return true;
+        }
+
+        // -------- 長さ付きレコード --------
+        uint32_t len;
+        if (!getVarint(p, end, &len) || (size_t)(end - p) < len)
+        {
+            p = rec;
+            return false;
+        }
+        if (tag == LOG_TAG_SCHEMA)
+        {
+            if (!readSchema(p, p + len))
+                err = true;
+        }
+        else if (tag == LOG_TAG_PROFILE || tag == LOG_TAG_STARTUP || tag == LOG_TAG_COMMAND || tag == LOG_TAG_TLM_MAP ||
+                 tag == LOG_TAG_TELEMETRY)
+            extra.push_back(std::make_pair(tag, std::string((const char *)p, len)));
+        else
+            skipped++;
+        p += len;
+    }
+    return false;
+}
+
+#endif // EV3_APP_LOGDECODER_H
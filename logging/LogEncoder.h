@@ -0,0 +1,228 @@
+/**
+ * @file LogEncoder.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief 
+ * @version 0.1
+ * @date 2021-06-27
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+#ifndef EV3_APP_LOGENCODER_H
+#define EV3_APP_LOGENCODER_H
+
+#include <stdint.h>
+#include <string.h>
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   ログ形式 version 1
+ * @note    ストリーム = "KHLG" + version(1byte) + レコード列
+ *          レコード = タグ(1byte) + 本体
+ *          - 'S' スキーマ : varint 長さ + { varint チャンネル数, { varint 名前長, 名前, 予測次数(1byte) } x N }
+ *          - 'K' キーフレーム : zigzag varint の絶対値 x N
+ *          - 'D' 差分フレーム : varint 変化マスク + zigzag varint の予測残差(マスクのビットが立ったチャンネルだけ)
+ *          - 'P' プロファイル : varint 長さ + テキスト(CycleProfiler::format)
+ *          - 'U' 起動時間 : varint 長さ + テキスト(StartupTimer::format), 走行の最後のレコード(host/btcapture が走行の区切りにする)
+ *          - 'C' コマンドの応答 : varint 長さ + 応答フレーム(CommandChannel::encode)
+ *          - 'M' テレメトリのチャンネル表 : varint 長さ + 周期,チャンネルの番号,名前,倍率,間引き(Telemetry)
+ *          - 'T' テレメトリのサンプル : varint 長さ + 周期数,マスク,チャンネルごとの差分(Telemetry)
+ *          - 上記以外 : varint 長さ + 本体. 知らないタグは読み飛ばすこと
+ *          予測次数 0 は前回値, 1 は前回値+前回の差分(直線予測)で予測する。
+ *          デコーダはチャンネルを名前で引くので,チャンネルを足しても古いデコーダで読める。
+ */
+#define LOG_MAGIC "KHLG"
+#define LOG_VERSION 1
+#define LOG_TAG_SCHEMA 'S'
+#define LOG_TAG_KEY 'K'
+#define LOG_TAG_DELTA 'D'
+#define LOG_TAG_PROFILE 'P'
+#define LOG_TAG_STARTUP 'U'
+#define LOG_TAG_COMMAND 'C'
+#define LOG_TAG_TLM_MAP 'M'
+#define LOG_TAG_TELEMETRY 'T'
+#define LOG_MAX_CHANNELS 32
+#define LOG_KEYFRAME_INTERVAL 250                        // キーフレーム間隔[フレーム], 4ms周期で1秒
+#define LOG_FRAME_MAX_BYTES (1 + 5 + 5 * LOG_MAX_CHANNELS) // 1フレームの最大符号長
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   ログチャンネル定義
+ * 
+ * @struct  logchannel_t
+ */
+typedef struct
+{
+    const char *name; /* チャンネル名 */
+    int order;        /* 予測次数 0:前回値, 1:直線予測 */
+} logchannel_t;
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   差分+zigzag varint ログエンコーダ クラス
+ * 
+ * @class   LogEncoder
+ */
+class LogEncoder
+{
+private:
+    const logchannel_t *schema;     // チャンネル定義
+    int nch;                        // チャンネル数
+    int32_t prev[LOG_MAX_CHANNELS]; // 前回値
+    int32_t step[LOG_MAX_CHANNELS]; // 前回の差分
+    unsigned int frames;            // キーフレームからのフレーム数
+
+public:
+    LogEncoder(const logchannel_t *schema, int nch); // Constructor
+
+    int header(uint8_t *out);                    // ストリームヘッダとスキーマの出力
+    int encode(const int32_t *values, uint8_t *out); // 1フレームの符号化
+    void restart();                              // 次のフレームをキーフレームにする
+
+    static int putVarint(uint8_t *out, uint32_t v); // varint 出力
+    static uint32_t zigzag(int32_t v);              // zigzag 変換
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+// Constructor
+LogEncoder::LogEncoder(const logchannel_t *schema, int nch)
+    : schema(schema),
+      nch(nch > LOG_MAX_CHANNELS ? LOG_MAX_CHANNELS : nch),
+      frames(0)
+{
+    restart();
+}
+
+/**
+ * @brief   次のフレームをキーフレームにする
+ * 
+ * @fn      void LogEncoder::restart()
+ * @return  無し
+ */
+inline void LogEncoder::restart()
+{
+    memset(prev, 0, sizeof(prev));
+    memset(step, 0, sizeof(step));
+    frames = 0;
+}
+
+/**
+ * @brief   varint 出力
+ * 
+ * @fn      int LogEncoder::putVarint(uint8_t *out, uint32_t v)
+ * @param   out (uint8_t*)出力先, 最大5byte
+ * @param   v   (uint32_t)値
+ * @return  出力したbyte数
+ */
+inline int LogEncoder::putVarint(uint8_t *out, uint32_t v)
+{
+    int n = 0;
+    while (v >= 0x80)
+    {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+/**
+ * @brief   zigzag 変換, 0,-1,1,-2,... を 0,1,2,3,... にする
+ * 
+ * @fn      uint32_t LogEncoder::zigzag(int32_t v)
+ */
+inline uint32_t LogEncoder::zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+/**
+ * @brief   ストリームヘッダとスキーマの出力
+ * 
+ * @fn      int LogEncoder::header(uint8_t *out)
+ * @param   out (uint8_t*)出力先, 6 + 5 + 5 + 34 x チャンネル数 byte
+ * @return  出力したbyte数
+ * @note    本体の長さを先に数えて out に直接書く(logger_task のスタックに本体を置かない)
+ */
+int LogEncoder::header(uint8_t *out)
+{
+    uint8_t len_buf[5];
+    int n = 0, len = 0;
+    int i;
+
+    memcpy(out, LOG_MAGIC, 4);
+    out[4] = LOG_VERSION;
+    out[5] = LOG_TAG_SCHEMA;
+    n = 6;
+
+    len = putVarint(len_buf, nch);
+    for (i = 0; i < nch; i++)
+    {
+        int namelen = strlen(schema[i].name);
+        if (namelen > 32)
+            namelen = 32;
+        len += putVarint(len_buf, namelen) + namelen + 1;
+    }
+    n += putVarint(&out[n], len);
+
+    n += putVarint(&out[n], nch);
+    for (i = 0; i < nch; i++)
+    {
+        int namelen = strlen(schema[i].name);
+        if (namelen > 32)
+            namelen = 32;
+        n += putVarint(&out[n], namelen);
+        memcpy(&out[n], schema[i].name, namelen);
+        n += namelen;
+        out[n++] = (uint8_t)schema[i].order;
+    }
+    return n;
+}
+
+/**
+ * @brief   1フレームの符号化
+ * 
+ * @fn      int LogEncoder::encode(const int32_t *values, uint8_t *out)
+ * @param   values  (const int32_t*)チャンネル値, チャンネル数分
+ * @param   out     (uint8_t*)出力先, LOG_FRAME_MAX_BYTES byte
+ * @return  出力したbyte数
+ * @note    LOG_KEYFRAME_INTERVAL フレームごとにキーフレームを出す
+ */
+int LogEncoder::encode(const int32_t *values, uint8_t *out)
+{
+    uint32_t residual[LOG_MAX_CHANNELS];
+    uint32_t mask = 0;
+    int n = 0;
+    int i;
+
+    if (frames % LOG_KEYFRAME_INTERVAL == 0) // -------- キーフレーム --------
+    {
+        out[n++] = LOG_TAG_KEY;
+        for (i = 0; i < nch; i++)
+        {
+            n += putVarint(&out[n], zigzag(values[i]));
+            step[i] = 0;
+            prev[i] = values[i];
+        }
+        frames = 1;
+        return n;
+    }
+
+    // -------- 差分フレーム --------
+    for (i = 0; i < nch; i++)
+    {
+        uint32_t pred = (uint32_t)prev[i] + (schema[i].order ? (uint32_t)step[i] : 0);
+        residual[i] = zigzag((int32_t)((uint32_t)values[i] - pred));
+        if (residual[i] != 0)
+            mask |= 1u << i;
+        step[i] = (int32_t)((uint32_t)values[i] - (uint32_t)prev[i]);
+        prev[i] = values[i];
+    }
+    out[n++] = LOG_TAG_DELTA;
+    n += putVarint(&out[n], mask);
+    for (i = 0; i < nch; i++)
+        if (mask & (1u << i))
+            n += putVarint(&out[n], residual[i]);
+    frames++;
+    return n;
+}
+
+#endif // EV3_APP_LOGENCODER_H
@@ -0,0 +1,163 @@
+/**
+ * @file SpscRingBuffer.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief 
+ * @version 0.1
+ * @date 2021-06-20
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+#ifndef EV3_APP_SPSCRINGBUFFER_H
+#define EV3_APP_SPSCRINGBUFFER_H
+
+#include <atomic>
+#include <cstring>
+
+/**
+ * @brief 書き込み側/読み出し側の順序保証
+ * @note  EV3(ARM926)は単一コアでLDREX/DMBを持たないので,コンパイラの並べ替えだけ止めれば十分。
+ *        ホストビルドは別スレッドから読むので acquire/release のフェンスを入れる。
+ */
+#if defined(MAKE_HOST)
+#define SPSC_ACQUIRE() std::atomic_thread_fence(std::memory_order_acquire)
+#define SPSC_RELEASE() std::atomic_thread_fence(std::memory_order_release)
+#else
+#define SPSC_ACQUIRE() std::atomic_signal_fence(std::memory_order_seq_cst)
+#define SPSC_RELEASE() std::atomic_signal_fence(std::memory_order_seq_cst)
+#endif
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   ロックフリー 単一書き込み/単一読み出し リングバッファ
+ * 
+ * @class   SpscRingBuffer
+ * @tparam  T 要素の型(memcpyでコピーできること)
+ * @tparam  N 要素数(2のべき乗), 実際に格納できるのは N 個
+ * @note    push は書き込み側タスク(tracer_task)だけ,pop は読み出し側タスク(logger_task)だけが呼ぶこと。
+ *          インデックスはフリーランで,差分が格納数になる。
+ *          満杯のときは新しい要素を捨てて dropped を数える(書き込み側は待たない)。
+ */
+template <typename T, unsigned int N>
+class SpscRingBuffer
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "N must be a power of 2");
+
+private:
+    T buf[N];
+    std::atomic<unsigned int> head;      // 次の書き込み位置(書き込み側だけが更新)
+    std::atomic<unsigned int> tail;      // 次の読み出し位置(読み出し側だけが更新)
+    std::atomic<unsigned int> dropped;   // 満杯で捨てた要素数(書き込み側だけが更新)
+    std::atomic<unsigned int> highwater; // 最大格納数(書き込み側だけが更新)
+
+public:
+    SpscRingBuffer();
+
+    bool push(const T &item);                 // 1要素を書き込む
+    unsigned int pop(T *out, unsigned int max); // 最大max要素をまとめて読み出す
+    unsigned int size() const;                // 現在の格納数
+    unsigned int getDropped() const;          // 捨てた要素数の取得
+    unsigned int getHighWater() const;        // 最大格納数の取得
+    static unsigned int capacity() { return N; }
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+// Constructor
+template <typename T, unsigned int N>
+SpscRingBuffer<T, N>::SpscRingBuffer()
+    : head(0), tail(0), dropped(0), highwater(0)
+{
+}
+
+/**
+ * @brief 1要素を書き込む
+ * 
+ * @fn      bool SpscRingBuffer::push(const T &item)
+ * @param   item (const T&)書き込む要素
+ * @return  true: 書き込んだ, false: 満杯で捨てた
+ */
+template <typename T, unsigned int N>
+inline bool SpscRingBuffer<T, N>::push(const T &item)
+{
+    unsigned int h = head.load(std::memory_order_relaxed);
+    unsigned int t = tail.load(std::memory_order_relaxed);
+    SPSC_ACQUIRE(); // tail を読んでから buf を上書きする
+    unsigned int used = h - t;
+    if (used >= N)
+    {
+        dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return false;
+    }
+    buf[h & (N - 1)] = item;
+    SPSC_RELEASE(); // buf を書いてから head を進める
+    head.store(h + 1, std::memory_order_relaxed);
+    if (used + 1 > highwater.load(std::memory_order_relaxed))
+        highwater.store(used + 1, std::memory_order_relaxed);
+    return true;
+}
+
+/**
+ * @brief 最大max要素をまとめて読み出す
+ * 
+ * @fn      unsigned int SpscRingBuffer::pop(T *out, unsigned int max)
+ * @param   out (T*)読み出し先, max要素分の領域
+ * @param   max (unsigned int)読み出す最大要素数
+ * @return  読み出した要素数
+ */
+template <typename T, unsigned int N>
+unsigned int SpscRingBuffer<T, N>::pop(T *out, unsigned int max)
+{
+    unsigned int t = tail.load(std::memory_order_relaxed);
+    unsigned int h = head.load(std::memory_order_relaxed);
+    SPSC_ACQUIRE(); // head を読んでから buf を読む
+    unsigned int n = h - t;
+    if (n > max)
+        n = max;
+    // 折り返しで最大2回のmemcpy
+    unsigned int first = N - (t & (N - 1));
+    if (first > n)
+        first = n;
+    memcpy(out, &buf[t & (N - 1)], first * sizeof(T));
+    memcpy(out + first, &buf[0], (n - first) * sizeof(T));
+    SPSC_RELEASE(); // buf を読み終えてから tail を進める
+    tail.store(t + n, std::memory_order_relaxed);
+    return n;
+}
+
+/**
+ * @brief 現在の格納数
+ * 
+ * @fn      unsigned int SpscRingBuffer::size()
+ * @return  格納数
+ */
+template <typename T, unsigned int N>
+inline unsigned int SpscRingBuffer<T, N>::size() const
+{
+    return head.load(std::memory_order_relaxed) - tail.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief 満杯で捨てた要素数の取得
+ * 
+ * @fn      unsigned int SpscRingBuffer::getDropped()
+ * @return  捨てた要素数
+ */
+template <typename T, unsigned int N>
+inline unsigned int SpscRingBuffer<T, N>::getDropped() const
+{
+    return dropped.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief 最大格納数の取得
+ * 
+ * @fn      unsigned int SpscRingBuffer::getHighWater()
+ * @return  起動してからの最大格納数
+ */
+template <typename T, unsigned int N>
+inline unsigned int SpscRingBuffer<T, N>::getHighWater() const
+{
+    return highwater.load(std::memory_order_relaxed);
+}
+
+#endif // EV3_APP_SPSCRINGBUFFER_H
@@ -0,0 +1,145 @@
+/**
+ * @file StartupTimer.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief
+ * @version 0.1
+ * @date 2021-09-26
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef EV3_APP_STARTUPTIMER_H
+#define EV3_APP_STARTUPTIMER_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   起動の段階
+ * @note    lap(段階) は直前の lap/begin からの経過時間をその段階に積む。
+ *          STARTUP_WAIT より前の合計がスタート待機に入るまでの時間(time-to-ready)
+ */
+enum
+{
+    STARTUP_SENSOR = 0, /* センサー入力ポートの設定 ev3_sensor_config */
+    STARTUP_MOTOR,      /* モーター出力ポートの設定 ev3_motor_config */
+    STARTUP_OBJECTS,    /* オブジェクトの初期化とコースマップの読み込み */
+    STARTUP_GYRO,       /* アームのエンコーダーとジャイロのリセット */
+    STARTUP_BT,         /* Bluetooth のオープンとタスクの起動 */
+    STARTUP_CALIB,      /* ラインのしきい値の自動調整 */
+    STARTUP_WAIT,       /* スタート待機(タッチセンサかリモートスタートまで) */
+    STARTUP_LAUNCH,     /* スタートから周期ハンドラ開始まで */
+    STARTUP_PHASES
+};
+
+#define STARTUP_TEXT_MAX 256 // format() の出力に必要な大きさ
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   起動時間の計測 クラス
+ *
+ * @class   StartupTimer
+ * @note    時刻は呼び出し側が渡す(fch_hrt)。ev3api は呼ばない。
+ */
+class StartupTimer
+{
+private:
+    uint32_t t_lap;                     // 直前の段階の終わり[us]
+    uint32_t phase_us[STARTUP_PHASES];  // 段階ごとの時間[us]
+
+public:
+    StartupTimer(); // Constructor
+
+    void begin(uint32_t now_us);            // 計測開始
+    void lap(int phase, uint32_t now_us);   // 段階の終わり
+    uint32_t getPhaseUs(int phase);         // 段階の時間[us]
+    uint32_t getReadyUs();                  // スタート待機に入るまでの時間[us]
+    int format(char *buf, int size);        // 段階ごとの時間をテキストにする
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+static const char *const STARTUP_PHASE_NAME[STARTUP_PHASES] = {
+    "sensor", "motor", "objects", "gyro", "bt", "calib", "wait", "launch"};
+
+// Constructor
+StartupTimer::StartupTimer()
+    : t_lap(0)
+{
+    for (int i = 0; i < STARTUP_PHASES; i++)
+        phase_us[i] = 0;
+}
+
+/**
+ * @brief   計測開始
+ *
+ * @fn      void StartupTimer::begin(uint32_t now_us)
+ * @param   now_us  (uint32_t)現在時刻[us]
+ * @return  無し
+ */
+inline void StartupTimer::begin(uint32_t now_us)
+{
+    t_lap = now_us;
+    for (int i = 0; i < STARTUP_PHASES; i++)
+        phase_us[i] = 0;
+}
+
+/**
+ * @brief   段階の終わり
+ *
+ * @fn      void StartupTimer::lap(int phase, uint32_t now_us)
+ * @param   phase   (int)STARTUP_*
+ * @param   now_us  (uint32_t)現在時刻[us]
+ * @return  無し
+ */
+inline void StartupTimer::lap(int phase, uint32_t now_us)
+{
+    phase_us[phase] += now_us - t_lap;
+    t_lap = now_us;
+}
+
+/**
+ * @brief   段階の時間
+ *
+ * @fn      uint32_t StartupTimer::getPhaseUs(int phase)
+ * @param   phase   (int)STARTUP_*
+ * @return  uint32_t 段階の時間[us]
+ */
+inline uint32_t StartupTimer::getPhaseUs(int phase)
+{
+    return phase_us[phase];
+}
+
+/**
+ * @brief   スタート待機に入るまでの時間
+ *
+ * @fn      uint32_t StartupTimer::getReadyUs()
+ * @return  uint32_t STARTUP_WAIT より前の段階の合計[us]
+ */
+inline uint32_t StartupTimer::getReadyUs()
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < STARTUP_WAIT; i++)
+        sum += phase_us[i];
+    return sum;
+}
+
+/**
+ * @brief   段階ごとの時間をテキストにする
+ *
+ * @fn      int StartupTimer::format(char *buf, int size)
+ * @param   buf     (char*)出力先
+ * @param   size    (int)出力先の大きさ
+ * @return  書いた文字数(終端を除く)
+ * @note    1行1段階: "startup phase us", 最後に "startup ready us"
+ */
+int StartupTimer::format(char *buf, int size)
+{
+    int n = 0;
+    for (int i = 0; i < STARTUP_PHASES && n < size; i++)
+        n += snprintf(buf + n, size - n, "startup %s %lu\n", STARTUP_PHASE_NAME[i], (unsigned long)phase_us[i]);
+    if (n < size)
+        n += snprintf(buf + n, size - n, "startup ready %lu\n", (unsigned long)getReadyUs());
+    return (n < size) ? n : size - 1;
+}
+
+#endif // EV3_APP_STARTUPTIMER_H
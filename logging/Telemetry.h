@@ -0,0 +1,474 @@
+/**
+ * @file Telemetry.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief
+ * @version 0.1
+ * @date 2021-10-10
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef EV3_APP_TELEMETRY_H
+#define EV3_APP_TELEMETRY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "logging/SpscRingBuffer.h"
+#include "logging/DataLogger.h"
+#include "control/DoubleBuffer.h"
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   テレメトリのチャンネル番号
+ * @note    各モジュールが変数を番号で1回だけ登録する(Telemetry::add)。
+ *          Bluetooth のコマンド(CMD_TELEMETRY)の番号を兼ねる。並びを変えないこと(足すのは最後に)
+ */
+enum
+{
+    TLM_PID_REFLECT_P = 0, /* HSV明度PIDの各項 x TLM_FLOAT_SCALE */
+    TLM_PID_REFLECT_I,
+    TLM_PID_REFLECT_D,
+    TLM_PID_HSV_P,         /* HSV彩度PIDの各項 x TLM_FLOAT_SCALE */
+    TLM_PID_HSV_I,
+    TLM_PID_HSV_D,
+    TLM_HSV_HUE,           /* 色相[deg] */
+    TLM_HSV_SAT,           /* 彩度[%] */
+    TLM_HSV_VAL,           /* 明度[%] */
+    TLM_WHEEL_LEFT,        /* 区間の始めからの左ホイール回転角[deg] */
+    TLM_WHEEL_RIGHT,       /* 区間の始めからの右ホイール回転角[deg] */
+    TLM_RADIUS,            /* 車両の回転半径[mm] */
+    TLM_OMEGA,             /* 車両の回転角[deg] */
+    TLM_ARM_DEG,           /* アーム角[deg] */
+    TLM_STAGE,             /* DrivingStage */
+    TLM_CHANNELS
+};
+
+#define TLM_BIT(id) (1UL << (id))
+#define TLM_PERIOD_MS 4      // サンプルの周期[ms], tracer_task の周期(TracerCore の MAIN_CYCLE)
+#define TLM_FLOAT_SCALE 1000 // float の変数は x1000 の整数で送る
+#define TLM_RING_SIZE 64     // サンプルのリングバッファ(2のべき乗), 4ms周期で約0.25秒分
+#define TLM_MAP_MAX (5 + 5 + TLM_CHANNELS * (5 + 1 + 24 + 5 + 5)) // 'M' レコード本体の最大バイト数('T' より大きい)
+
+static const char *const TLM_NAME[TLM_CHANNELS] = {
+    "pid.reflect.p", "pid.reflect.i", "pid.reflect.d", "pid.hsv.p", "pid.hsv.i", "pid.hsv.d",
+    "hsv.hue", "hsv.sat", "hsv.val", "wheel.left", "wheel.right", "radius", "omega", "arm_deg", "stage"};
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   チャンネルごとの間引き
+ *
+ * @struct  tlmconfig_t
+ * @note    decim[id] 周期に1回サンプルする。0 は無効(サンプルしない,コストもかからない)
+ */
+typedef struct
+{
+    uint8_t decim[TLM_CHANNELS];
+} tlmconfig_t;
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   テレメトリの1サンプル(1周期分)
+ *
+ * @struct  tlmsample_t
+ * @note    value は mask の立ったチャンネルの値を番号順に詰めたもの。
+ *          restart は間引きを変えた後の最初のサンプルで,config がその間引き(logger_task が 'M' レコードを書く)。
+ *          mask が 0 なのは全部のチャンネルを無効にしたときだけ
+ */
+typedef struct
+{
+    uint32_t cycle;               /* 開始からの周期数 */
+    uint32_t mask;                /* TLM_BIT: 値のあるチャンネル */
+    bool restart;                 /* 間引きを変えた */
+    tlmconfig_t config;           /* restart のときの間引き */
+    int32_t value[TLM_CHANNELS];  /* 値 */
+} tlmsample_t;
+
+#define TLM_DRAIN_STACK_BYTES (sizeof(tlmsample_t) + 64 + LOG_FWRITE_STACK_BYTES) // drain が使うスタックの見積もり[byte]
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   テレメトリの登録簿 クラス
+ *
+ * @class   Telemetry
+ * @note    変数は走行前に add で番号ごとに1回登録する(ポインタを覚え,サンプルのときに読む)。
+ *          tracer_task は sample で有効なチャンネルのうち間引きの周期が来たものだけ読んでリングバッファに積み,
+ *          logger_task が drain で 'T' レコードに符号化する(値はチャンネルごとの前回からの差分)。
+ *          間引きは configure(bt_task のコマンドか走行前)で DoubleBuffer に公開し,sample の始めに反映する。
+ *          有効なチャンネルだけの表を持つので,無効なチャンネルは読まず,有効なチャンネルがなければ積まない。
+ *          'M' レコード: varint 周期[ms], varint チャンネル数, { varint 番号, varint 名前長, 名前, varint 倍率, varint 間引き } x N
+ *          'T' レコード: varint 周期数, varint マスク, zigzag varint の差分(マスクのビットが立ったチャンネルだけ)
+ */
+class Telemetry
+{
+private:
+    /** 登録した変数 */
+    typedef struct
+    {
+        const void *src;                /* 変数 (TLM_TYPE_FUNC は fn に渡す値) */
+        int32_t (*fn)(const void *src); /* TLM_TYPE_FUNC: 送る値を求める関数 */
+        uint8_t type;                   /* TLM_TYPE_* */
+        uint8_t q;                      /* 固定小数点の小数部のビット数 */
+    } source_t;
+
+    source_t source[TLM_CHANNELS];   // 番号 -> 変数
+    DoubleBuffer<tlmconfig_t> cfgbuf; // 間引き(bt_task -> tracer_task)
+    tlmconfig_t requested;           // 最後に公開した間引き(書き込み側だけが使う)
+    tlmconfig_t applied;             // 反映した間引き(tracer_task だけが使う)
+    uint8_t active[TLM_CHANNELS];    // 有効なチャンネル(tracer_task だけが使う)
+    uint8_t decim[TLM_CHANNELS];     // 有効なチャンネルの間引き
+    uint8_t count[TLM_CHANNELS];     // 有効なチャンネルの次のサンプルまでの周期数
+    int nactive;                     // 有効なチャンネルの数
+    bool restart;                    // 次のサンプルで 'M' レコードを書かせる
+    SpscRingBuffer<tlmsample_t, TLM_RING_SIZE> ring; // サンプル(tracer_task -> logger_task)
+    int32_t last[TLM_CHANNELS];      // 前回送った値(logger_task だけが使う)
+    uint8_t body[TLM_MAP_MAX];       // 'M', 'T' レコード本体(logger_task だけが使う, スタックに置かない)
+
+    int32_t read(int id);            // 登録した変数を読む
+    int writeMap(const tlmconfig_t &c, uint8_t *out); // 'M' レコード本体
+
+public:
+    enum
+    {
+        TLM_TYPE_NONE = 0,
+        TLM_TYPE_INT,   /* int */
+        TLM_TYPE_FLOAT, /* float x TLM_FLOAT_SCALE */
+        TLM_TYPE_FIXED, /* int32_t Q形式 x TLM_FLOAT_SCALE */
+        TLM_TYPE_FUNC   /* 関数の戻り値 */
+    };
+
+    Telemetry(); // Constructor
+
+    void add(int id, const int *src);               // 整数の変数の登録
+    void add(int id, const float *src);             // float の変数の登録
+    void addFixed(int id, const int32_t *src, int q); // 固定小数点の変数の登録
+    void add(int id, int32_t (*fn)(const void *), const void *ctx); // サンプルのときに求める値の登録
+    bool configure(const tlmconfig_t &c);           // 間引きの設定(bt_task, 走行前)
+    const tlmconfig_t &getRequested();              // 最後に設定した間引き(configure と同じタスクから)
+    void sample(uint32_t cycle);                    // 1周期分のサンプル(tracer_task)
+    int drain(FILE *fp, DataLogger *logger);        // 溜まったサンプルを書き出す(logger_task)
+    unsigned int getDropped();                      // 満杯で捨てたサンプル数
+
+    static bool parse(const char *spec, tlmconfig_t *c); // "名前:間引き,..." を間引きにする
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+// Constructor
+Telemetry::Telemetry()
+    : requested(),
+      applied(),
+      nactive(0),
+      restart(false)
+{
+    memset(source, 0, sizeof(source));
+    memset(last, 0, sizeof(last));
+}
+
+/**
+ * @brief   整数の変数の登録
+ *
+ * @fn      void Telemetry::add(int id, const int *src)
+ * @param   id  (int)TLM_*
+ * @param   src (const int*)変数, 走行中ずっと有効なこと
+ * @return  無し
+ * @attention 走行前(タスクの起動前)に呼ぶこと
+ */
+void Telemetry::add(int id, const int *src)
+{
+    if (id < 0 || id >= TLM_CHANNELS)
+        return;
+    source[id].src = src;
+    source[id].type = TLM_TYPE_INT;
+    source[id].q = 0;
+}
+
+/**
+ * @brief   float の変数の登録
+ *
+ * @fn      void Telemetry::add(int id, const float *src)
+ * @param   id  (int)TLM_*
+ * @param   src (const float*)変数, 値は TLM_FLOAT_SCALE 倍して丸めて送る
+ * @return  無し
+ */
+void Telemetry::add(int id, const float *src)
+{
+    if (id < 0 || id >= TLM_CHANNELS)
+        return;
+    source[id].src = src;
+    source[id].type = TLM_TYPE_FLOAT;
+    source[id].q = 0;
+}
+
+/**
+ * @brief   固定小数点の変数の登録
+ *
+ * @fn      void Telemetry::addFixed(int id, const int32_t *src, int q)
+ * @param   id  (int)TLM_*
+ * @param   src (const int32_t*)変数(Q形式)
+ * @param   q   (int)小数部のビット数, 値は TLM_FLOAT_SCALE 倍して送る
+ * @return  無し
+ */
+void Telemetry::addFixed(int id, const int32_t *src, int q)
+{
+    if (id < 0 || id >= TLM_CHANNELS)
+        return;
+    source[id].src = src;
+    source[id].type = TLM_TYPE_FIXED;
+    source[id].q = (uint8_t)q;
+}
+
+/**
+ * @brief   サンプルのときに求める値の登録
+ *
+ * @fn      void Telemetry::add(int id, int32_t (*fn)(const void *), const void *ctx)
+ * @param   id  (int)TLM_*
+ * @param   fn  (int32_t (*)(const void*))送る値を求める関数, tracer_task から呼ぶ
+ * @param   ctx (const void*)fn に渡す値, 走行中ずっと有効なこと
+ * @return  無し
+ * @note    fn はチャンネルが有効で間引きの周期が来たときだけ呼ぶ。毎周期は求めたくない値(除算が要るなど)に使う
+ */
+void Telemetry::add(int id, int32_t (*fn)(const void *), const void *ctx)
+{
+    if (id < 0 || id >= TLM_CHANNELS)
+        return;
+    source[id].src = ctx;
+    source[id].fn = fn;
+    source[id].type = TLM_TYPE_FUNC;
+    source[id].q = 0;
+}
+
+/**
+ * @brief   登録した変数を読む
+ *
+ * @fn      int32_t Telemetry::read(int id)
+ * @param   id  (int)TLM_*, 登録済みであること
+ * @return  int32_t 送る値
+ */
+inline int32_t Telemetry::read(int id)
+{
+    const source_t &s = source[id];
+    switch (s.type)
+    {
+    case TLM_TYPE_FLOAT:
+    {
+        const float f = *(const float *)s.src * TLM_FLOAT_SCALE;
+        return (int32_t)(f + (f >= 0 ? 0.5f : -0.5f));
+    }
+    case TLM_TYPE_FIXED:
+        return (int32_t)(((int64_t)*(const int32_t *)s.src * TLM_FLOAT_SCALE) >> s.q);
+    case TLM_TYPE_FUNC:
+        return s.fn(s.src);
+    default:
+        return *(const int *)s.src;
+    }
+}
+
+/**
+ * @brief   間引きの設定
+ *
+ * @fn      bool Telemetry::configure(const tlmconfig_t &c)
+ * @param   c   (const tlmconfig_t&)チャンネルごとの間引き, 登録していないチャンネルは無効になる
+ * @return  true: 公開した(次の sample で反映する), false: 反映中と重なった(やり直す)
+ * @note    書き込み側(bt_task か走行前の main)だけが呼ぶこと
+ */
+bool Telemetry::configure(const tlmconfig_t &c)
+{
+    if (!cfgbuf.publish(c))
+        return false;
+    requested = c;
+    return true;
+}
+
+/**
+ * @brief   最後に設定した間引き
+ *
+ * @fn      const tlmconfig_t &Telemetry::getRequested()
+ * @return  const tlmconfig_t& configure で最後に公開した間引き
+ */
+inline const tlmconfig_t &Telemetry::getRequested()
+{
+    return requested;
+}
+
+/**
+ * @brief   1周期分のサンプル
+ *
+ * @fn      void Telemetry::sample(uint32_t cycle)
+ * @param   cycle   (uint32_t)開始からの周期数(ホストはこれで時刻を戻す)
+ * @return  無し
+ * @note    新しい間引きがなく有効なチャンネルもなければ seq を1回読むだけ。
+ *          間引きは周期数の剰余でなくチャンネルごとの数え下げで行う(EV3 は除算命令がない)
+ */
+void Telemetry::sample(uint32_t cycle)
+{
+    tlmsample_t s;
+    if (cfgbuf.fetch(&applied))
+    {
+        nactive = 0;
+        for (int id = 0; id < TLM_CHANNELS; id++)
+        {
+            if (source[id].type == TLM_TYPE_NONE)
+                applied.decim[id] = 0; // 登録していない
+            if (applied.decim[id] == 0)
+                continue;
+            active[nactive] = (uint8_t)id;
+            decim[nactive] = applied.decim[id];
+            count[nactive] = 1; // 最初の周期でサンプルする
+            nactive++;
+        }
+        restart = true;
+    }
+    if (nactive == 0)
+    {
+        if (restart) // 全部無効にしたことも伝える
+        {
+            s.cycle = cycle;
+            s.mask = 0;
+            s.restart = true;
+            s.config = applied;
+            if (ring.push(s))
+                restart = false;
+        }
+        return;
+    }
+
+    s.mask = 0;
+    int n = 0;
+    for (int k = 0; k < nactive; k++)
+    {
+        if (--count[k] != 0)
+            continue;
+        count[k] = decim[k];
+        const int id = active[k];
+        s.mask |= TLM_BIT(id);
+        s.value[n++] = read(id);
+    }
+    if (s.mask == 0)
+        return;
+    s.cycle = cycle;
+    s.restart = restart;
+    if (restart)
+        s.config = applied;
+    if (ring.push(s)) // 満杯なら捨てる(制御周期を止めない), 'M' は次に積めたサンプルで書く
+        restart = false;
+}
+
+/**
+ * @brief   溜まったサンプルを書き出す
+ *
+ * @fn      int Telemetry::drain(FILE *fp, DataLogger *logger)
+ * @param   fp      (FILE*)書き出し先
+ * @param   logger  (DataLogger*)ログのストリーム(ヘッダを共有する)
+ * @return  書き出したサンプル数
+ * @note    間引きを変えた後のサンプルの前に 'M' レコードを書き,差分の基準を 0 に戻す
+ * @attention DataLogger::drain と同じタスクから呼ぶこと
+ */
+int Telemetry::drain(FILE *fp, DataLogger *logger)
+{
+    tlmsample_t s;
+    int total = 0;
+
+    while (ring.pop(&s, 1) == 1)
+    {
+        if (s.restart)
+        {
+            logger->writeRecord(fp, LOG_TAG_TLM_MAP, body, writeMap(s.config, body));
+            memset(last, 0, sizeof(last));
+        }
+        if (s.mask == 0)
+            continue;
+        int n = LogEncoder::putVarint(body, s.cycle);
+        n += LogEncoder::putVarint(&body[n], s.mask);
+        int k = 0;
+        for (int id = 0; id < TLM_CHANNELS; id++)
+        {
+            if ((s.mask & TLM_BIT(id)) == 0)
+                continue;
+            n += LogEncoder::putVarint(&body[n], LogEncoder::zigzag((int32_t)((uint32_t)s.value[k] - (uint32_t)last[id])));
+            last[id] = s.value[k++];
+        }
+        logger->writeRecord(fp, LOG_TAG_TELEMETRY, body, n);
+        total++;
+    }
+    return total;
+}
+
+/**
+ * @brief   'M' レコード本体
+ *
+ * @fn      int Telemetry::writeMap(const tlmconfig_t &c, uint8_t *out)
+ * @param   c   (const tlmconfig_t&)間引き
+ * @param   out (uint8_t*)出力先, TLM_MAP_MAX byte
+ * @return  int 書いたバイト数
+ * @note    登録した全部のチャンネルの名前と倍率を書く(無効なチャンネルは間引き 0)
+ */
+int Telemetry::writeMap(const tlmconfig_t &c, uint8_t *out)
+{
+    int n = LogEncoder::putVarint(out, TLM_PERIOD_MS);
+    int nch = 0;
+    for (int id = 0; id < TLM_CHANNELS; id++)
+        if (source[id].type != TLM_TYPE_NONE)
+            nch++;
+    n += LogEncoder::putVarint(&out[n], (uint32_t)nch);
+    for (int id = 0; id < TLM_CHANNELS; id++)
+    {
+        if (source[id].type == TLM_TYPE_NONE)
+            continue;
+        const int len = (int)strlen(TLM_NAME[id]);
+        n += LogEncoder::putVarint(&out[n], (uint32_t)id);
+        n += LogEncoder::putVarint(&out[n], (uint32_t)len);
+        memcpy(&out[n], TLM_NAME[id], len);
+        n += len;
+        n += LogEncoder::putVarint(&out[n], (source[id].type == TLM_TYPE_INT || source[id].type == TLM_TYPE_FUNC) ? 1 : TLM_FLOAT_SCALE);
+        n += LogEncoder::putVarint(&out[n], c.decim[id]);
+    }
+    return n;
+}
+
+/**
+ * @brief   満杯で捨てたサンプル数
+ *
+ * @fn      unsigned int Telemetry::getDropped()
+ * @return  unsigned int 捨てたサンプル数
+ */
+inline unsigned int Telemetry::getDropped()
+{
+    return ring.getDropped();
+}
+
+/**
+ * @brief   "名前:間引き,..." を間引きにする
+ *
+ * @fn      bool Telemetry::parse(const char *spec, tlmconfig_t *c)
+ * @param   spec    (const char*)例 "pid.reflect:1,hsv.val:2,stage:25", 空なら全部無効
+ * @param   c       (tlmconfig_t*)出力先, 書いていないチャンネルは 0(無効)
+ * @return  true: 読めた, false: 知らない名前か間引きが 1..255 でない(c は読めたところまで)
+ * @note    名前はチャンネル名か,その "." までの先頭("pid" で PID の6項)。ヒープを使わない
+ */
+bool Telemetry::parse(const char *spec, tlmconfig_t *c)
+{
+    memset(c, 0, sizeof(*c));
+    const char *p = spec;
+    while (*p != '\0')
+    {
+        const char *colon = strchr(p, ':');
+        if (colon == NULL)
+            return false;
+        const int len = (int)(colon - p);
+        char *end;
+        const long d = strtol(colon + 1, &end, 10);
+        if (d < 1 || d > 255 || (*end != ',' && *end != '\0'))
+            return false;
+        bool found = false;
+        for (int id = 0; id < TLM_CHANNELS; id++)
+            if (strncmp(TLM_NAME[id], p, len) == 0 && (TLM_NAME[id][len] == '\0' || TLM_NAME[id][len] == '.'))
+            {
+                c->decim[id] = (uint8_t)d;
+                found = true;
+            }
+        if (!found)
+            return false;
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return true;
+}
+
+#endif // EV3_APP_TELEMETRY_H
@@ -0,0 +1,177 @@
+/**
+ * @file TelemetryDecoder.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief
+ * @version 0.1
+ * @date 2021-10-10
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef EV3_APP_TELEMETRYDECODER_H
+#define EV3_APP_TELEMETRYDECODER_H
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "logging/LogDecoder.h"
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   テレメトリデコーダ クラス(ホスト側ツール用)
+ *
+ * @class   TelemetryDecoder
+ * @note    LogDecoder::records() の 'M' と 'T' レコードを順に add し,チャンネルごとの時系列に戻す。
+ *          時刻は 'T' の周期数 x 'M' の周期[ms],値は 'M' の倍率で割った実数。
+ *          間引きを変えると 'M' が入り,差分の基準は 0 に戻る。
+ */
+class TelemetryDecoder
+{
+public:
+    struct series_t
+    {
+        std::string name;         // チャンネル名
+        int id;                   // チャンネル番号(TLM_*)
+        uint32_t scale;           // 倍率
+        uint32_t decim;           // 最後の 'M' の間引き, 0 なら無効
+        std::vector<uint32_t> t_ms; // 時刻[ms]
+        std::vector<double> value;  // 値
+    };
+
+    TelemetryDecoder(); // Constructor
+
+    bool add(uint8_t tag, const std::string &body); // 'M' / 'T' レコードを1つ読む(他のタグは無視)
+    void addAll(const std::vector<std::pair<uint8_t, std::string> > &records); // records() を全部読む
+    const std::vector<series_t> &series() const { return ch; }
+    const series_t *find(const char *name) const;   // 名前 -> 時系列, 無ければ NULL
+    uint32_t periodMs() const { return period; }
+    unsigned long samples() const { return nsamples; } // 読んだ 'T' レコードの数
+    unsigned long maps() const { return nmaps; }       // 読んだ 'M' レコードの数
+    bool error() const { return err; }
+
+private:
+    bool readMap(const uint8_t *p, const uint8_t *end);
+    bool readSample(const uint8_t *p, const uint8_t *end);
+
+    std::vector<series_t> ch;
+    int index[32];             // チャンネル番号 -> ch の添字, -1 は未登録
+    int32_t last[32];          // 前回の値(差分の基準)
+    uint32_t period;
+    unsigned long nsamples, nmaps;
+    bool err;
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+// Constructor
+inline TelemetryDecoder::TelemetryDecoder()
+    : period(0), nsamples(0), nmaps(0), err(false)
+{
+    for (int i = 0; i < 32; i++)
+    {
+        index[i] = -1;
+        last[i] = 0;
+    }
+}
+
+/**
+ * @brief   'M' / 'T' レコードを1つ読む
+ *
+ * @fn      bool TelemetryDecoder::add(uint8_t tag, const std::string &body)
+ * @param   tag     (uint8_t)レコードのタグ
+ * @param   body    (const std::string&)レコード本体
+ * @return  true: 読めたか関係ないタグ, false: 壊れている('M' より先の 'T' を含む)
+ */
+inline bool TelemetryDecoder::add(uint8_t tag, const std::string &body)
+{
+    const uint8_t *p = (const uint8_t *)body.data();
+    bool ok = true;
+    if (tag == LOG_TAG_TLM_MAP)
+        ok = readMap(p, p + body.size());
+    else if (tag == LOG_TAG_TELEMETRY)
+        ok = readSample(p, p + body.size());
+    if (!ok)
+        err = true;
+    return ok;
+}
+
+inline void TelemetryDecoder::addAll(const std::vector<std::pair<uint8_t, std::string> > &records)
+{
+    for (size_t i = 0; i < records.size(); i++)
+        add(records[i].first, records[i].second);
+}
+
+inline const TelemetryDecoder::series_t *TelemetryDecoder::find(const char *name) const
+{
+    for (size_t i = 0; i < ch.size(); i++)
+        if (ch[i].name == name)
+            return &ch[i];
+    return NULL;
+}
+
+/**
+ * @brief   'M' レコードを読む
+ * @note    チャンネルは名前で引き継ぐ(間引きを変えても同じ時系列に足す)
+ */
+inline bool TelemetryDecoder::readMap(const uint8_t *p, const uint8_t *end)
+{
+    uint32_t n, id, len, scale, decim;
+    if (!LogDecoder::getVarint(p, end, &period) || !LogDecoder::getVarint(p, end, &n) || n > 32)
+        return false;
+    for (int i = 0; i < 32; i++)
+    {
+        index[i] = -1;
+        last[i] = 0;
+    }
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (!LogDecoder::getVarint(p, end, &id) || id >= 32 || !LogDecoder::getVarint(p, end, &len) ||
+            (size_t)(end - p) < len)
+            return false;
+        const std::string name((const char *)p, len);
+        p += len;
+        if (!LogDecoder::getVarint(p, end, &scale) || !LogDecoder::getVarint(p, end, &decim) || scale == 0)
+            return false;
+        size_t k = 0;
+        while (k < ch.size() && ch[k].name != name)
+            k++;
+        if (k == ch.size())
+        {
+            series_t s;
+            s.name = name;
+            ch.push_back(s);
+        }
+        ch[k].id = (int)id;
+        ch[k].scale = scale;
+        ch[k].decim = decim;
+        index[id] = (int)k;
+    }
+    nmaps++;
+    return true;
+}
+
+/**
+ * @brief   'T' レコードを読む
+ */
+inline bool TelemetryDecoder::readSample(const uint8_t *p, const uint8_t *end)
+{
+    uint32_t cycle, mask, v;
+    if (nmaps == 0 || !LogDecoder::getVarint(p, end, &cycle) || !LogDecoder::getVarint(p, end, &mask))
+        return false;
+    for (int id = 0; id < 32; id++)
+    {
+        if ((mask & (1u << id)) == 0)
+            continue;
+        if (index[id] < 0 || !LogDecoder::getVarint(p, end, &v))
+            return false;
+        last[id] = (int32_t)((uint32_t)last[id] + (uint32_t)LogDecoder::unzigzag(v));
+        series_t &s = ch[index[id]];
+        s.t_ms.push_back(cycle * period);
+        s.value.push_back((double)last[id] / s.scale);
+    }
+    nsamples++;
+    return true;
+}
+
+#endif // EV3_APP_TELEMETRYDECODER_H
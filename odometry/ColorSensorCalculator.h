@@ -13,19 +13,8 @@
 
 #include "ev3api.h"
 #include "etrobo_env.h"
-
-/** ******** ******** ******** ******** ******** ******** ******** ********
- * @brief   HSV値(色相,彩度,明度)
- * 
- * @struct  hsv_t
- * @note    サイズは12byte= int(4byte) x3 
- */
-typedef struct
-{
-    int hue; // hue
-    int sat; // saturation
-    int val; // value aka brightness
-} hsv_t;
+#include "odometry/HsvKernel.h"
+#include "odometry/StreamFilter.h"
 
 /** ******** ******** ******** ******** ******** ******** ******** ********
  * @brief   RGB値の測定とHSVの計算クラス
@@ -37,12 +26,19 @@ class ColorSensorCalculator
 private:
     rgb_raw_t rgb; // RGBの構造体
     hsv_t hsv;     // HSVの構造体
+    EmaFilter valFilter; // 明度の平滑化
+    EmaFilter satFilter; // 彩度の平滑化
+    int filter_shift;    // 平滑化の強さ, 0 でなし
+
+    void smooth();       // 明度と彩度の平滑化
 
 public:
     ColorSensorCalculator(); // Constructor
-    void calc();             // RGBからHSVに変換
+    void calc(const rgb_raw_t *raw); // 取得済みのRGBからHSVに変換
+    void setFilter(int shift);       // 明度と彩度の平滑化の設定
     int getHSVsat();         // saturation値を取得
     int getHSVval();         // value値を取得
+    const hsv_t &getHSV();   // HSVの構造体を取得(テレメトリの登録用)
 };
 
 // ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
@@ -50,60 +46,53 @@ public:
 // Constructor
 ColorSensorCalculator::ColorSensorCalculator()
     : rgb({0}),
-      hsv({0})
+      hsv({0}),
+      filter_shift(0)
 {
 }
 
 /**
- * @brief   RGBからHSVに変換
+ * @brief   取得済みのRGBからHSVに変換
  * 
- * @fn      void ColorSensorCalculator::calc()
+ * @fn      void ColorSensorCalculator::calc(const rgb_raw_t *raw)
+ * @param   raw (const rgb_raw_t*)RGB Raw値
  * @return  なし
+ * @note    ev3apiを呼ばない。RGBは RobotT の Io が読む(ログ再生はログの値)
  */
-void ColorSensorCalculator::calc()
+inline void ColorSensorCalculator::calc(const rgb_raw_t *raw)
 {
-    int rgb_max, rgb_min; // RGB最大値,最小値
-    int r, g, b;          // RGB,int型に変換
-    //int color_id;         // 識別カラーid
-    //unsigned int ambient; // 環境光
-
-    //color_id = ev3_color_sensor_get_color(color_sensor);    // 黄色しか識別しない,役に立たん
-    //ambient = ev3_color_sensor_get_ambient(color_sensor);   // 環境光はふらつきまくりで役に立たん
-
-    // RGB値取得
-    ev3_color_sensor_get_rgb_raw(color_sensor, &rgb);
-    r = rgb.r;
-    g = rgb.g;
-    b = rgb.b;
+    rgb = *raw;
+    HsvKernel::convert(&rgb, &hsv);
+    smooth();
+}
 
-    // -------- HSVの計算 --------
-    // 最大・最小値
-    rgb_max = r;
-    rgb_max = (g > rgb_max) ? g : rgb_max;
-    rgb_max = (b > rgb_max) ? b : rgb_max;
-    rgb_min = r;
-    rgb_min = (g < rgb_min) ? g : rgb_min;
-    rgb_min = (b < rgb_min) ? b : rgb_min;
+/**
+ * @brief   明度と彩度の平滑化の設定
+ *
+ * @fn      void ColorSensorCalculator::setFilter(int shift)
+ * @param   shift   (int)指数移動平均の新しい値の重み 1/2^shift, 0 でなし(変換したまま)
+ * @return  なし
+ * @note    走行前に設定すること。色相は平滑化しない
+ */
+inline void ColorSensorCalculator::setFilter(int shift)
+{
+    filter_shift = shift;
+    valFilter.setShift(shift);
+    satFilter.setShift(shift);
+}
 
-    // value:明度,正規化する,但し100倍して単位は%
-    hsv.val = 100 * rgb_max / 256;
-    // saturation:彩度,正規化する,但し100倍して単位は%
-    hsv.sat = 100 * (rgb_max - rgb_min) / rgb_max;
-    // hue:色相
-    if ((rgb_max - rgb_min) == 0) // 0除算回避
-    {
-        hsv.hue = 0;
-    }
-    else // RGBから変換,数式上正規化不要,単位はdeg
-    {
-        hsv.hue = (60 * (r - g)) / (rgb_max - rgb_min) + 240;
-        if (rgb_max == r)
-            hsv.hue = (60 * (g - b)) / (rgb_max - rgb_min);
-        if (rgb_max == g)
-            hsv.hue = (60 * (b - r)) / (rgb_max - rgb_min) + 120;
-        if (hsv.hue < 0)
-            hsv.hue += 360;
-    }
+/**
+ * @brief   明度と彩度の平滑化
+ *
+ * @fn      void ColorSensorCalculator::smooth()
+ * @return  なし
+ */
+inline void ColorSensorCalculator::smooth()
+{
+    if (filter_shift == 0)
+        return;
+    hsv.val = valFilter.update(hsv.val);
+    hsv.sat = satFilter.update(hsv.sat);
 }
 
 /**
@@ -128,4 +117,15 @@ inline int ColorSensorCalculator::getHSVval()
     return this->hsv.val;
 }
 
+/**
+ * @brief   HSVの構造体を取得
+ * 
+ * @fn      const hsv_t &ColorSensorCalculator::getHSV()
+ * @return  const hsv_t& hsv: 色相,彩度,明度
+ */
+inline const hsv_t &ColorSensorCalculator::getHSV()
+{
+    return this->hsv;
+}
+
 #endif // EV3_APP_COLORSENSORCALCULATOR_H
\ No newline at end of file
@@ -0,0 +1,222 @@
+/**
+ * @file CourseMap.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief
+ * @version 0.1
+ * @date 2021-08-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef EV3_APP_COURSEMAP_H
+#define EV3_APP_COURSEMAP_H
+
+#include <stdint.h>
+
+#include "odometry/PoseOdometry.h" // ODO_POS_Q
+
+#define CMAP_BIN_SHIFT 6                    // 区間の長さ 2^6 = 64[mm]
+#define CMAP_BIN_MM (1 << CMAP_BIN_SHIFT)
+#define CMAP_BINS 512                       // 記録できる区間の数(約32m)
+#define CMAP_CURV_SHIFT 16                  // 方位の変化の記録単位 2^16/周 (0.0055deg)
+#define CMAP_COLOR_BLACK 0                  // 黒のライン
+#define CMAP_COLOR_BLUE 1                   // 青のライン
+#define CMAP_MAGIC 0x4D43484B               // "KHCM"
+#define CMAP_VERSION 1
+#define CMAP_HEADER_BYTES 12
+#define CMAP_FILE_MAX (CMAP_HEADER_BYTES + 3 * CMAP_BINS) // 保存したマップの最大バイト数
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   走行距離ごとのコースの曲がり具合とラインの色 クラス
+ *
+ * @class   CourseMap
+ * @note    開始からの走行距離(PoseOdometry の s)を CMAP_BIN_MM ごとの区間に分け,
+ *          区間での方位の変化(曲率 x 区間の長さ)と,区間で多かったラインの色を記録する。
+ *          方位はジャイロで補正した方位(HeadingFilter)を使う(速いカーブの横滑りで車輪の差ほど曲がらないため)。
+ *          毎周期の記録はシフトと比較だけ。保存形式はリトルエンディアンの
+ *          ヘッダ(magic, version, 区間の長さ, 区間の数) + 方位の変化 int16 x 区間の数 + 色 uint8 x 区間の数。
+ */
+class CourseMap
+{
+private:
+    int16_t curv[CMAP_BINS];  // 区間での方位の変化 [2^16/周] 左回りが正
+    uint8_t color[CMAP_BINS]; // 区間のラインの色 CMAP_COLOR_*
+    int length;               // 記録した区間の数
+    int bin;                  // 記録中の区間, -1 で未開始
+    uint32_t bin_heading;     // 記録中の区間の始めの方位
+    int blue, samples;        // 記録中の区間の青のサンプル数,全サンプル数
+
+public:
+    CourseMap(); // Constructor
+
+    void clear();                                  // 記録を消す
+    void record(int32_t s, uint32_t heading, bool blue); // 1周期分を記録する
+    int getLength();                               // 記録した区間の数
+    int getCurv(int index);                        // 区間での方位の変化 [2^16/周]
+    int getColor(int index);                       // 区間のラインの色
+    int save(uint8_t *buf, int size);              // バイト列に書き出す
+    bool load(const uint8_t *buf, int size);       // バイト列から読み込む
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+// Constructor
+CourseMap::CourseMap()
+{
+    clear();
+}
+
+/**
+ * @brief   記録を消す
+ *
+ * @fn      void CourseMap::clear()
+ * @return  無し
+ */
+void CourseMap::clear()
+{
+    for (int i = 0; i < CMAP_BINS; i++)
+    {
+        curv[i] = 0;
+        color[i] = CMAP_COLOR_BLACK;
+    }
+    length = 0;
+    bin = -1;
+    bin_heading = 0;
+    blue = 0;
+    samples = 0;
+}
+
+/**
+ * @brief   1周期分を記録する
+ *
+ * @fn      void CourseMap::record(int32_t s, uint32_t heading, bool blue)
+ * @param   s       (int32_t)開始からの走行距離 [mm] Q(ODO_POS_Q)
+ * @param   heading (uint32_t)方位 [2^32/周] 左回りが正
+ * @param   blue    (bool)青のラインを見ている
+ * @return  無し
+ * @note    走行距離が次の区間に入ったら前の区間を確定する。後退中と CMAP_BINS を超えた分は記録しない
+ */
+void CourseMap::record(int32_t s, uint32_t heading, bool blue)
+{
+    if (s < 0)
+        return;
+    int now = s >> (ODO_POS_Q + CMAP_BIN_SHIFT);
+    if (now != bin)
+    {
+        if (bin >= 0 && now > bin && bin < CMAP_BINS) // 区間の確定
+        {
+            curv[bin] = (int16_t)((int32_t)(heading - bin_heading) >> CMAP_CURV_SHIFT);
+            color[bin] = (this->blue * 2 > samples) ? CMAP_COLOR_BLUE : CMAP_COLOR_BLACK;
+            for (int i = bin + 1; i < now && i < CMAP_BINS; i++) // 1周期で区間を飛ばしたとき(通常はない)
+            {
+                curv[i] = 0;
+                color[i] = color[bin];
+            }
+            length = (now < CMAP_BINS) ? now : CMAP_BINS;
+        }
+        bin = now;
+        bin_heading = heading;
+        this->blue = 0;
+        samples = 0;
+    }
+    this->blue += blue ? 1 : 0;
+    samples++;
+}
+
+/**
+ * @brief   記録した区間の数
+ *
+ * @fn      int CourseMap::getLength()
+ * @return  int 区間の数
+ */
+inline int CourseMap::getLength()
+{
+    return length;
+}
+
+/**
+ * @brief   区間での方位の変化
+ *
+ * @fn      int CourseMap::getCurv(int index)
+ * @param   index   (int)区間の番号
+ * @return  int 方位の変化 [2^16/周] 左回りが正
+ */
+inline int CourseMap::getCurv(int index)
+{
+    return curv[index];
+}
+
+/**
+ * @brief   区間のラインの色
+ *
+ * @fn      int CourseMap::getColor(int index)
+ * @param   index   (int)区間の番号
+ * @return  int CMAP_COLOR_*
+ */
+inline int CourseMap::getColor(int index)
+{
+    return color[index];
+}
+
+/**
+ * @brief   バイト列に書き出す
+ *
+ * @fn      int CourseMap::save(uint8_t *buf, int size)
+ * @param   buf     (uint8_t*)書き出し先
+ * @param   size    (int)書き出し先の大きさ, CMAP_FILE_MAX あれば足りる
+ * @return  int 書き出したバイト数, 足りなければ 0
+ */
+int CourseMap::save(uint8_t *buf, int size)
+{
+    int bytes = CMAP_HEADER_BYTES + 3 * length;
+    if (size < bytes)
+        return 0;
+    uint32_t magic = CMAP_MAGIC;
+    for (int k = 0; k < 4; k++)
+        buf[k] = (uint8_t)(magic >> (8 * k));
+    buf[4] = CMAP_VERSION;
+    buf[5] = CMAP_BIN_SHIFT;
+    buf[6] = (uint8_t)length;
+    buf[7] = (uint8_t)(length >> 8);
+    buf[8] = buf[9] = buf[10] = buf[11] = 0; // 予約
+    uint8_t *p = buf + CMAP_HEADER_BYTES;
+    for (int i = 0; i < length; i++)
+    {
+        *p++ = (uint8_t)curv[i];
+        *p++ = (uint8_t)((uint16_t)curv[i] >> 8);
+    }
+    for (int i = 0; i < length; i++)
+        *p++ = color[i];
+    return bytes;
+}
+
+/**
+ * @brief   バイト列から読み込む
+ *
+ * @fn      bool CourseMap::load(const uint8_t *buf, int size)
+ * @param   buf     (const uint8_t*)save で書き出したバイト列
+ * @param   size    (int)バイト数
+ * @return  true: 読み込んだ, false: 形式が違う(記録は空のまま)
+ */
+bool CourseMap::load(const uint8_t *buf, int size)
+{
+    clear();
+    if (size < CMAP_HEADER_BYTES)
+        return false;
+    uint32_t magic = 0;
+    for (int k = 0; k < 4; k++)
+        magic |= (uint32_t)buf[k] << (8 * k);
+    int n = buf[6] | (buf[7] << 8);
+    if (magic != CMAP_MAGIC || buf[4] != CMAP_VERSION || buf[5] != CMAP_BIN_SHIFT ||
+        n > CMAP_BINS || size < CMAP_HEADER_BYTES + 3 * n)
+        return false;
+    const uint8_t *p = buf + CMAP_HEADER_BYTES;
+    for (int i = 0; i < n; i++, p += 2)
+        curv[i] = (int16_t)(p[0] | (p[1] << 8));
+    for (int i = 0; i < n; i++)
+        color[i] = (*p++ == CMAP_COLOR_BLUE) ? CMAP_COLOR_BLUE : CMAP_COLOR_BLACK;
+    length = n;
+    return true;
+}
+
+#endif // EV3_APP_COURSEMAP_H
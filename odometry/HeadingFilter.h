@@ -0,0 +1,314 @@
+/**
+ * @file HeadingFilter.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief
+ * @version 0.1
+ * @date 2021-08-08
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef EV3_APP_HEADINGFILTER_H
+#define EV3_APP_HEADINGFILTER_H
+
+#include <stdint.h>
+
+#define HF_CYCLE_MS 4            // 更新周期[ms] (MAIN_CYCLE)
+#define HF_BAM_PER_DEG 11930465  // 1deg あたりの方位 [2^32/周]
+#define HF_GYRO_SHIFT 3          // ジャイロ取得ごとに方位の差の 1/2^3 だけジャイロに寄せる(ジャイロ20msで時定数約0.16s)
+#define HF_RATE_SHIFT 3          // 角速度の指数移動平均 1/2^3
+#define HF_RATE_Q 4              // 角速度の小数部ビット数
+#define HF_BIAS_Q 8              // ジャイロのバイアスの小数部ビット数
+#define GYRO_CAL_WINDOW_MS 5000  // バイアス推定の窓[ms],長く待つときは直近の窓を使う
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   ジャイロとホイールオドメトリの方位の相補フィルタ クラス
+ *
+ * @class   HeadingFilter
+ * @note    毎周期オドメトリの方位の変化で進め,ジャイロを取得した周期にバイアスを引いたジャイロ角へ寄せる。
+ *          短い時間はなめらかなオドメトリ,長い時間はスリップの影響を受けないジャイロを信じる。
+ *          方位は左回り(反時計回り)が正の 2進角度 [2^32/周] で,PoseOdometry と同じ向き。
+ *          毎周期の計算に除算と浮動小数点は使わない。
+ */
+class HeadingFilter
+{
+private:
+    uint32_t heading;   // 推定方位 [2^32/周]
+    uint32_t odo_prev;  // 前回のオドメトリ方位
+    uint32_t gyro_ref;  // 方位の原点でのジャイロ角 [2^32/周] 時計回り
+    int64_t drift;      // 開始からのバイアスの積算 [2^32/周] Q(HF_BIAS_Q) 時計回り
+    int32_t bias;       // ジャイロのバイアス [2^32/周/周期] Q(HF_BIAS_Q) 時計回り
+    int32_t rate;       // 角速度 [2^32/周/周期] Q(HF_RATE_Q)
+    int bias_mdps;      // ジャイロのバイアス [mdeg/s] 時計回り(設定値)
+    int zero_mdeg;      // 開始時のジャイロ角 [mdeg] 時計回り(設定値)
+    bool gyro_valid;    // ジャイロの原点が決まった
+
+public:
+    HeadingFilter(); // Constructor
+
+    void calibrate(int bias_mdps, int zero_mdeg);                   // ジャイロのバイアスと開始時の角度の設定
+    void update(uint32_t odo_heading, int gyro_deg, bool gyro_new); // 1周期進める
+    uint32_t getHeading();                                          // 推定方位の取得
+    int getHeadingDeg();                                            // 推定方位[deg] -180 to 179
+    int getRateDps();                                               // 角速度[deg/s]
+    int getBiasMdps();                                              // ジャイロのバイアス[mdeg/s]
+    int getZeroMdeg();                                              // 開始時のジャイロ角[mdeg]
+};
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   停止中のジャイロ角の傾きによるバイアス推定 クラス
+ *
+ * @class   GyroBiasEstimator
+ * @note    スタート待ちの間(車体が止まっている間)にジャイロ角を渡し,最小二乗で傾きを求める。
+ *          ジャイロ角は 1deg 単位なので,窓を長くとるほど(角度が変わる時刻を多く見るほど)細かく求まる。
+ *          傾きの計算(除算)は getBiasMdps と窓の切り替えのときだけ。
+ */
+class GyroBiasEstimator
+{
+private:
+    int t0;                       // 窓の開始時刻[ms]
+    int n;                        // 窓内のサンプル数
+    int64_t st, sg, stt, stg;     // 窓内の Σt, Σg, Σt^2, Σtg
+    int last_mdps;                // 直前の窓の推定値
+    int last_zero;                // 直前の窓の終わりの推定角度[mdeg]
+    bool has_last;                // 直前の窓がある
+    int span;                     // 窓内の経過時間[ms]
+
+    int fit(); // 窓内の傾き[mdeg/s]
+
+public:
+    GyroBiasEstimator(); // Constructor
+
+    void add(int t_ms, int gyro_deg); // サンプルの追加
+    int getBiasMdps();                // 推定バイアス[mdeg/s] 時計回り
+    int getZeroMdeg();                // 最後のサンプルの時刻の推定角度[mdeg]
+    int getSpanMs();                  // 推定に使った時間[ms]
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+// Constructor
+HeadingFilter::HeadingFilter()
+    : heading(0),
+      odo_prev(0),
+      gyro_ref(0),
+      drift(0),
+      bias(0),
+      rate(0),
+      bias_mdps(0),
+      zero_mdeg(0),
+      gyro_valid(false)
+{
+}
+
+/**
+ * @brief   ジャイロのバイアスと開始時の角度の設定
+ *
+ * @fn      void HeadingFilter::calibrate(int bias_mdps, int zero_mdeg)
+ * @param   bias_mdps   (int)バイアス [mdeg/s] 時計回りが正(ジャイロ角の増える向き)
+ * @param   zero_mdeg   (int)開始時のジャイロ角 [mdeg] 時計回りが正
+ * @return  無し
+ * @note    走行前に1回呼ぶ(GyroBiasEstimator の結果)。ここだけ除算を使う。
+ *          ジャイロ角は 1deg 単位なので,呼ばないと最初に取得した値の丸め(最大0.5deg)が方位にずっと残る
+ */
+void HeadingFilter::calibrate(int bias_mdps, int zero_mdeg)
+{
+    this->bias_mdps = bias_mdps;
+    this->zero_mdeg = zero_mdeg;
+    bias = (int32_t)((int64_t)bias_mdps * HF_BAM_PER_DEG * HF_CYCLE_MS * (1 << HF_BIAS_Q) / 1000000);
+    gyro_ref = (uint32_t)((int64_t)zero_mdeg * HF_BAM_PER_DEG / 1000) + heading;
+    drift = 0;
+    gyro_valid = true;
+}
+
+/**
+ * @brief   1周期進める
+ *
+ * @fn      void HeadingFilter::update(uint32_t odo_heading, int gyro_deg, bool gyro_new)
+ * @param   odo_heading (uint32_t)オドメトリ方位 [2^32/周] (PoseOdometry)
+ * @param   gyro_deg    (int)ジャイロ角[deg] 時計回りが正
+ * @param   gyro_new    (bool)今回の周期でジャイロ角を取得した
+ * @return  無し
+ */
+void HeadingFilter::update(uint32_t odo_heading, int gyro_deg, bool gyro_new)
+{
+    uint32_t prev = heading;
+
+    // -------- 予測: オドメトリの方位の変化 --------
+    heading += odo_heading - odo_prev;
+    odo_prev = odo_heading;
+    drift += bias;
+
+    // -------- 補正: バイアスを引いたジャイロ角に寄せる --------
+    if (gyro_new)
+    {
+        uint32_t g = (uint32_t)gyro_deg * HF_BAM_PER_DEG; // 時計回り, 2^32 で折り返す
+        if (!gyro_valid) // calibrate していなければ,今の推定方位をジャイロの原点に合わせる
+        {
+            gyro_ref = g + heading;
+            drift = 0;
+            gyro_valid = true;
+        }
+        uint32_t gyro_heading = (uint32_t)0 - (g - gyro_ref - (uint32_t)(drift >> HF_BIAS_Q));
+        int32_t err = (int32_t)(gyro_heading - heading);
+        heading += (uint32_t)(err >> HF_GYRO_SHIFT);
+    }
+
+    // -------- 角速度: 推定方位の変化の移動平均 --------
+    int32_t d = (int32_t)(heading - prev);
+    rate += ((d << HF_RATE_Q) - rate) >> HF_RATE_SHIFT;
+}
+
+/**
+ * @brief   推定方位の取得
+ *
+ * @fn      uint32_t HeadingFilter::getHeading()
+ * @return  uint32_t 推定方位 [2^32/周] 左回りが正
+ */
+inline uint32_t HeadingFilter::getHeading()
+{
+    return heading;
+}
+
+/**
+ * @brief   推定方位[deg]
+ *
+ * @fn      int HeadingFilter::getHeadingDeg()
+ * @return  int 推定方位[deg] -180 to 179, 左回りが正
+ */
+inline int HeadingFilter::getHeadingDeg()
+{
+    return (int)(((int64_t)(int32_t)heading * 360 + (1LL << 31)) >> 32);
+}
+
+/**
+ * @brief   角速度[deg/s]
+ *
+ * @fn      int HeadingFilter::getRateDps()
+ * @return  int 角速度[deg/s] 左回りが正
+ */
+inline int HeadingFilter::getRateDps()
+{
+    const int64_t scale = (int64_t)360 * (1000 / HF_CYCLE_MS);
+    return (int)(((int64_t)rate * scale + (1LL << (31 + HF_RATE_Q))) >> (32 + HF_RATE_Q));
+}
+
+/**
+ * @brief   ジャイロのバイアス[mdeg/s]
+ *
+ * @fn      int HeadingFilter::getBiasMdps()
+ * @return  int calibrate で設定した値
+ */
+inline int HeadingFilter::getBiasMdps()
+{
+    return bias_mdps;
+}
+
+/**
+ * @brief   開始時のジャイロ角[mdeg]
+ *
+ * @fn      int HeadingFilter::getZeroMdeg()
+ * @return  int calibrate で設定した値
+ */
+inline int HeadingFilter::getZeroMdeg()
+{
+    return zero_mdeg;
+}
+
+// Constructor
+GyroBiasEstimator::GyroBiasEstimator()
+    : t0(0), n(0), st(0), sg(0), stt(0), stg(0), last_mdps(0), last_zero(0), has_last(false), span(0)
+{
+}
+
+/**
+ * @brief   窓内の傾き
+ *
+ * @fn      int GyroBiasEstimator::fit()
+ * @return  int 傾き[mdeg/s], サンプルが足りなければ 0
+ */
+int GyroBiasEstimator::fit()
+{
+    int64_t den = (int64_t)n * stt - st * st;
+    if (n < 2 || den == 0)
+        return 0;
+    double slope = (double)((int64_t)n * stg - st * sg) / (double)den; // [deg/ms]
+    return (int)(slope * 1000000.0 + (slope >= 0 ? 0.5 : -0.5));
+}
+
+/**
+ * @brief   サンプルの追加
+ *
+ * @fn      void GyroBiasEstimator::add(int t_ms, int gyro_deg)
+ * @param   t_ms        (int)時刻[ms]
+ * @param   gyro_deg    (int)ジャイロ角[deg]
+ * @return  無し
+ * @note    窓が GYRO_CAL_WINDOW_MS に達したら推定値を残して次の窓を始める
+ */
+void GyroBiasEstimator::add(int t_ms, int gyro_deg)
+{
+    if (n == 0)
+        t0 = t_ms;
+    int64_t t = t_ms - t0;
+    n++;
+    st += t;
+    sg += gyro_deg;
+    stt += t * t;
+    stg += t * gyro_deg;
+    span = (int)t;
+    if (span >= GYRO_CAL_WINDOW_MS)
+    {
+        last_mdps = fit();
+        has_last = true;
+        last_zero = getZeroMdeg();
+        n = 0;
+        st = sg = stt = stg = 0;
+        span = 0;
+    }
+}
+
+/**
+ * @brief   推定バイアス
+ *
+ * @fn      int GyroBiasEstimator::getBiasMdps()
+ * @return  int バイアス[mdeg/s] 時計回りが正
+ * @note    今の窓が半分に満たないときは直前の窓の値を使う
+ */
+int GyroBiasEstimator::getBiasMdps()
+{
+    if (has_last && span < GYRO_CAL_WINDOW_MS / 2)
+        return last_mdps;
+    return fit();
+}
+
+/**
+ * @brief   最後のサンプルの時刻の推定角度
+ *
+ * @fn      int GyroBiasEstimator::getZeroMdeg()
+ * @return  int 推定角度[mdeg] (直線のあてはめなので 1deg より細かい)
+ * @note    窓の平均の時刻と角度から getBiasMdps の傾きで最後のサンプルの時刻まで延ばす
+ */
+int GyroBiasEstimator::getZeroMdeg()
+{
+    if (n == 0)
+        return last_zero;
+    double mean_t = (double)st / n;
+    double mean_g = (double)sg / n;
+    double g = mean_g * 1000.0 + getBiasMdps() * 1e-3 * (span - mean_t);
+    return (int)(g + (g >= 0 ? 0.5 : -0.5));
+}
+
+/**
+ * @brief   推定に使った時間
+ *
+ * @fn      int GyroBiasEstimator::getSpanMs()
+ * @return  int 推定に使った窓の長さ[ms]
+ */
+int GyroBiasEstimator::getSpanMs()
+{
+    if (has_last && span < GYRO_CAL_WINDOW_MS / 2)
+        return GYRO_CAL_WINDOW_MS;
+    return span;
+}
+
+#endif // EV3_APP_HEADINGFILTER_H
@@ -0,0 +1,220 @@
+/**
+ * @file HsvKernel.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief 除算なしのRGB->HSV変換カーネル
+ * @version 0.1
+ * @date 2020-10-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note ARM926にはハードウェア除算がないので,除数(rgb_max, rgb_max - rgb_min)の
+ *       逆数表をコンパイル時に作り,乗算とシフトで商を求める。
+ *       ceil(2^32/d) の上位32bit乗算は n < 2^22, d <= HSV_RGB_MAX の範囲で
+ *       整数除算(0方向への切り捨て)と完全に一致する(d = 1 は商 = n)。
+ *       逆数表の0番は0なので,全チャネル0(rgb_max = 0)でも値は0になる。
+ */
+#ifndef EV3_APP_HSVKERNEL_H
+#define EV3_APP_HSVKERNEL_H
+
+#include <stdint.h>
+#include "ev3api.h"
+
+#define HSV_RGB_MAX 1023   // RGB Raw値の上限,これを超える値は飽和させる
+#define HSV_RECIP_SHIFT 32 // 逆数表の固定小数点ビット数
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   HSV値(色相,彩度,明度)
+ *
+ * @struct  hsv_t
+ * @note    サイズは12byte= int(4byte) x3
+ */
+typedef struct
+{
+    int hue; // hue
+    int sat; // saturation
+    int val; // value aka brightness
+} hsv_t;
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   除数の逆数表 recip[d] = ceil(2^32/d), recip[0] = recip[1] = 0
+ *
+ * @struct  hsv_reciptable_t
+ * @note    コンパイル時に作る(.rodata に置かれ,起動時の計算も初期化の順序もない)。
+ *          1 は 2^32 が入らないので0にして divRecip で商 = n とする
+ */
+struct hsv_reciptable_t
+{
+    uint32_t v[HSV_RGB_MAX + 1];
+
+    constexpr hsv_reciptable_t() : v()
+    {
+        for (uint32_t d = 2; d <= HSV_RGB_MAX; d++)
+            v[d] = (uint32_t)((((uint64_t)1 << HSV_RECIP_SHIFT) + d - 1) / d);
+    }
+};
+
+static constexpr hsv_reciptable_t HSV_RECIP = hsv_reciptable_t();
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   HSVのバッチ変換用配列(SoA)
+ *
+ * @struct  hsv_soa_t
+ * @note    各配列は n 要素。入力と出力は別の配列であること
+ */
+typedef struct
+{
+    const uint16_t *r; // 入力 R
+    const uint16_t *g; // 入力 G
+    const uint16_t *b; // 入力 B
+    int16_t *hue;      // 出力 色相[deg]
+    int16_t *sat;      // 出力 彩度[%]
+    int16_t *val;      // 出力 明度[%]
+} hsv_soa_t;
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   除算なしのRGB->HSV変換
+ *
+ * @class   HsvKernel
+ * @note    static 関数のみ。逆数表はコンパイル時の定数(HSV_RECIP)なので,初期化は要らない
+ */
+class HsvKernel
+{
+private:
+    static int clampRaw(int x);                      // HSV_RGB_MAX で飽和
+    static int divRecip(int num, int den);            // num/den (0方向への切り捨て)
+    static void convertOne(int r, int g, int b,
+                           int *hue, int *sat, int *val); // 1サンプル変換
+    static void convertArrays(const uint16_t *__restrict r,
+                              const uint16_t *__restrict g,
+                              const uint16_t *__restrict b,
+                              int16_t *__restrict hue,
+                              int16_t *__restrict sat,
+                              int16_t *__restrict val, int n); // 配列変換の本体
+
+public:
+    static void convert(const rgb_raw_t *rgb, hsv_t *hsv); // 1サンプル変換
+    static void convertBatch(const hsv_soa_t *soa, int n);  // 配列変換
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+/**
+ * @brief   HSV_RGB_MAX で飽和
+ *
+ * @fn      int HsvKernel::clampRaw(int)
+ * @param   x (int)RGB Raw値
+ * @return  int 0..HSV_RGB_MAX
+ */
+inline int HsvKernel::clampRaw(int x)
+{
+    return (x > HSV_RGB_MAX) ? HSV_RGB_MAX : x;
+}
+
+/**
+ * @brief   逆数表による除算
+ *
+ * @fn      int HsvKernel::divRecip(int,int)
+ * @param   num (int)被除数, |num| < 2^22
+ * @param   den (int)除数, 0..HSV_RGB_MAX (0のときは0を返す)
+ * @return  int num/den と同じ値
+ */
+inline int HsvKernel::divRecip(int num, int den)
+{
+    int sign = num >> 31; // 負なら全ビット1
+    uint32_t mag = (uint32_t)((num ^ sign) - sign);
+    uint32_t q = (uint32_t)(((uint64_t)mag * HSV_RECIP.v[den]) >> HSV_RECIP_SHIFT);
+    q = (den == 1) ? mag : q;
+    return ((int)q ^ sign) - sign;
+}
+
+/**
+ * @brief   1サンプル変換
+ *
+ * @fn      void HsvKernel::convertOne(int,int,int,int*,int*,int*)
+ * @note    ColorSensorCalculator::calc の旧実装と同じ値を返す。
+ *          条件分岐はビットマスクの選択に置換え(バッチ変換を自動ベクトル化させるため)
+ */
+inline void HsvKernel::convertOne(int r, int g, int b, int *hue, int *sat, int *val)
+{
+    int rgb_max, rgb_min, diff, h;
+    int sel_g, sel_r, sel_b; // 最大のチャネル,選択なら全ビット1
+
+    r = clampRaw(r);
+    g = clampRaw(g);
+    b = clampRaw(b);
+
+    // 最大・最小値
+    rgb_max = r;
+    rgb_max = (g > rgb_max) ? g : rgb_max;
+    rgb_max = (b > rgb_max) ? b : rgb_max;
+    rgb_min = r;
+    rgb_min = (g < rgb_min) ? g : rgb_min;
+    rgb_min = (b < rgb_min) ? b : rgb_min;
+    diff = rgb_max - rgb_min;
+
+    // value:明度,100倍して単位は%
+    *val = (100 * rgb_max) >> 8;
+    // saturation:彩度,rgb_max = 0 なら逆数表により0
+    *sat = divRecip(100 * diff, rgb_max);
+    // hue:色相,g最大 > r最大 > b最大 の優先順
+    sel_g = -(rgb_max == g);
+    sel_r = -(rgb_max == r) & ~sel_g;
+    sel_b = ~(sel_g | sel_r);
+    h = ((b - r) & sel_g) | ((g - b) & sel_r) | ((r - g) & sel_b);
+    h = divRecip(60 * h, diff) + ((120 & sel_g) | (240 & sel_b));
+    h += 360 & (h >> 31);    // 負なら+360
+    *hue = h & -(diff != 0); // 無彩色は0
+}
+
+/**
+ * @brief   1サンプル変換
+ *
+ * @fn      void HsvKernel::convert(const rgb_raw_t*,hsv_t*)
+ * @param   rgb (const rgb_raw_t*)RGB Raw値
+ * @param   hsv (hsv_t*)変換結果
+ * @return  なし
+ */
+inline void HsvKernel::convert(const rgb_raw_t *rgb, hsv_t *hsv)
+{
+    convertOne(rgb->r, rgb->g, rgb->b, &hsv->hue, &hsv->sat, &hsv->val);
+}
+
+/**
+ * @brief   配列変換
+ *
+ * @fn      void HsvKernel::convertBatch(const hsv_soa_t*,int)
+ * @param   soa (const hsv_soa_t*)入出力の配列
+ * @param   n   (int)要素数
+ * @return  なし
+ * @note    ループ内に分岐がないので,ホストでは -O2 でもSIMDに自動ベクトル化される
+ *          (逆数表の参照は -mavx2 なら gather)。記録済み走行データの再計算用
+ */
+void HsvKernel::convertBatch(const hsv_soa_t *soa, int n)
+{
+    convertArrays(soa->r, soa->g, soa->b, soa->hue, soa->sat, soa->val, n);
+}
+
+/**
+ * @brief   配列変換の本体
+ *
+ * @fn      void HsvKernel::convertArrays(const uint16_t*,const uint16_t*,const uint16_t*,int16_t*,int16_t*,int16_t*,int)
+ * @note    restrict は引数に付けないとgccが別名の実行時検査を諦めてベクトル化しない
+ */
+void HsvKernel::convertArrays(const uint16_t *__restrict r,
+                              const uint16_t *__restrict g,
+                              const uint16_t *__restrict b,
+                              int16_t *__restrict hue,
+                              int16_t *__restrict sat,
+                              int16_t *__restrict val, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        int h, s, v;
+        convertOne(r[i], g[i], b[i], &h, &s, &v);
+        hue[i] = (int16_t)h;
+        sat[i] = (int16_t)s;
+        val[i] = (int16_t)v;
+    }
+}
+
+#endif // EV3_APP_HSVKERNEL_H
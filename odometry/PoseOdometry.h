@@ -0,0 +1,254 @@
+/**
+ * @file PoseOdometry.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief
+ * @version 0.1
+ * @date 2021-08-01
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef EV3_APP_POSEODOMETRY_H
+#define EV3_APP_POSEODOMETRY_H
+
+#include <stdint.h>
+
+#define ODO_WHEEL_RADIUS 50 // 車輪半径[mm]
+#define ODO_HALF_TRACK 77   // 1/2トレッド[mm]
+#define ODO_PI 3.14159265358979323846
+
+#define ODO_TABLE_BITS 10                      // sin表の分割数 2^10 (0.35deg)
+#define ODO_TABLE_SIZE (1 << ODO_TABLE_BITS)
+#define ODO_TRIG_Q 14                          // sin表の小数部ビット数
+#define ODO_POS_Q 8                            // 位置,走行距離の小数部ビット数
+#define ODO_WINDOW 16                          // 直進/カーブ判定の窓[周期] 64ms
+#define ODO_CURVE_ENTER_MM 1500                // 回転半径がこれより小さくなったらカーブ
+#define ODO_CURVE_EXIT_MM 3000                 // 回転半径がこれより大きくなったら直進
+#define ODO_MIN_TRAVEL_Q (2 << ODO_POS_Q)      // 窓内の走行距離がこれ未満なら判定しない(停止中)
+static_assert((ODO_WINDOW & (ODO_WINDOW - 1)) == 0, "ODO_WINDOW must be a power of 2");
+
+/** 走行距離: ホイール回転角の和(左+右)[deg]あたり [mm] Q(ODO_POS_Q+16), (l+r)/2 * πr/180 */
+#define ODO_MM_PER_SUMDEG ((int64_t)(ODO_PI * ODO_WHEEL_RADIUS / 360.0 * (1LL << (ODO_POS_Q + 16)) + 0.5))
+/** 方位: ホイール回転角の差(右-左)[deg]あたりの方位 [2^32/周] , r/2d * (r-l) */
+#define ODO_BAM_PER_DIFFDEG ((int64_t)(4294967296.0 * ODO_WHEEL_RADIUS / (2.0 * ODO_HALF_TRACK * 360.0) + 0.5))
+/** 回転半径の計算: 走行距離 Q(ODO_POS_Q) / 方位 [2^32/周] -> [mm] の係数 2^32/(2π 2^ODO_POS_Q) */
+#define ODO_RADIUS_SCALE ((int64_t)(4294967296.0 / (2.0 * ODO_PI * (1 << ODO_POS_Q)) + 0.5))
+
+/**
+ * @brief   コンパイル時の sin(x) (テイラー展開, |x| <= π/2 に折り返す)
+ */
+constexpr double odo_sin(double x)
+{
+    while (x > ODO_PI)
+        x -= 2.0 * ODO_PI;
+    while (x < -ODO_PI)
+        x += 2.0 * ODO_PI;
+    if (x > ODO_PI / 2)
+        x = ODO_PI - x;
+    if (x < -ODO_PI / 2)
+        x = -ODO_PI - x;
+    double term = x, sum = x;
+    for (int k = 1; k < 12; k++)
+    {
+        term *= -x * x / ((2 * k) * (2 * k + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   sin表 Q(ODO_TRIG_Q), cos は1/4周先を引く
+ *
+ * @struct  odo_sintable_t
+ * @note    コンパイル時に作る(.rodata に置かれ,起動時の計算はない)
+ */
+struct odo_sintable_t
+{
+    int16_t v[ODO_TABLE_SIZE + ODO_TABLE_SIZE / 4];
+
+    constexpr odo_sintable_t() : v()
+    {
+        for (int i = 0; i < ODO_TABLE_SIZE + ODO_TABLE_SIZE / 4; i++)
+        {
+            double s = odo_sin(2.0 * ODO_PI * i / ODO_TABLE_SIZE) * (1 << ODO_TRIG_Q);
+            v[i] = (int16_t)(s >= 0 ? s + 0.5 : s - 0.5);
+        }
+    }
+};
+
+static constexpr odo_sintable_t ODO_SIN = odo_sintable_t();
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   車両の姿勢
+ *
+ * @struct  pose_t
+ * @note    開始位置が原点,開始時の向きが x 軸。方位は左回り(反時計回り)が正
+ */
+typedef struct
+{
+    int32_t x, y;     /* 位置 [mm] Q(ODO_POS_Q) */
+    uint32_t heading; /* 方位 [2^32/周] (2進角度,一周で折り返す) */
+    int32_t s;        /* 走行距離 [mm] Q(ODO_POS_Q) 後退で減る */
+} pose_t;
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   ホイール回転角による差分オドメトリ クラス
+ *
+ * @class   PoseOdometry
+ * @note    走行距離と方位はエンコーダー値(リセットしない積算値)の和と差から毎回直接求めるので誤差が積もらない。
+ *          位置は1周期の移動を中点の方位で積分する(sin/cos はコンパイル時に作った表)。
+ *          直進/カーブは直近 ODO_WINDOW 周期の回転半径(走行距離/方位変化)をヒステリシスで判定する。
+ *          毎周期の計算に除算と浮動小数点は使わない。ev3api も呼ばない。
+ */
+class PoseOdometry
+{
+private:
+    int left0, right0;                 // 原点のエンコーダー値
+    pose_t pose;                       // 現在の姿勢
+    uint32_t hist_heading[ODO_WINDOW]; // 判定窓: 方位
+    int32_t hist_s[ODO_WINDOW];        // 判定窓: 走行距離
+    int hist_index;                    // 判定窓の一番古い位置
+    bool straight;                     // 直進中
+
+public:
+    PoseOdometry(); // Constructor
+
+    void reset(int left_deg, int right_deg);  // 今のエンコーダー値と姿勢を原点にする
+    void update(int left_deg, int right_deg); // エンコーダー値から姿勢を進める
+    const pose_t &getPose() const;            // 姿勢の取得
+    bool isStraight() const;                  // 直進中か
+
+    static int headingToDeg(int32_t bam);        // 方位差 -> [deg](四捨五入)
+    static int radiusMm(int32_t ds, int32_t dh); // 走行距離と方位差 -> 回転半径[mm]
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+// Constructor
+PoseOdometry::PoseOdometry()
+{
+    reset(0, 0);
+}
+
+/**
+ * @brief   今のエンコーダー値と姿勢を原点にする
+ *
+ * @fn      void PoseOdometry::reset(int left_deg, int right_deg)
+ * @param   left_deg    (int)左ホイール回転角
+ * @param   right_deg   (int)右ホイール回転角
+ * @return  無し
+ * @note    走行開始前に1回だけ呼ぶ(エンコーダー自体はリセットしない)
+ */
+void PoseOdometry::reset(int left_deg, int right_deg)
+{
+    left0 = left_deg;
+    right0 = right_deg;
+    pose.x = 0;
+    pose.y = 0;
+    pose.heading = 0;
+    pose.s = 0;
+    for (int i = 0; i < ODO_WINDOW; i++)
+    {
+        hist_heading[i] = 0;
+        hist_s[i] = 0;
+    }
+    hist_index = 0;
+    straight = true;
+}
+
+/**
+ * @brief   エンコーダー値から姿勢を進める
+ *
+ * @fn      void PoseOdometry::update(int left_deg, int right_deg)
+ * @param   left_deg    (int)左ホイール回転角
+ * @param   right_deg   (int)右ホイール回転角
+ * @return  無し
+ */
+void PoseOdometry::update(int left_deg, int right_deg)
+{
+    int sum = (left_deg - left0) + (right_deg - right0);
+    int diff = (right_deg - right0) - (left_deg - left0);
+    int32_t s = (int32_t)((sum * ODO_MM_PER_SUMDEG) >> 16);
+    uint32_t heading = (uint32_t)(diff * ODO_BAM_PER_DIFFDEG); // 2^32 で折り返す
+
+    // -------- 位置: 中点の方位で積分 --------
+    int32_t ds = s - pose.s;
+    uint32_t mid = pose.heading + (uint32_t)((int32_t)(heading - pose.heading) / 2);
+    uint32_t index = (mid + (1U << (31 - ODO_TABLE_BITS))) >> (32 - ODO_TABLE_BITS); // 四捨五入
+    index &= ODO_TABLE_SIZE - 1;
+    int32_t c = ODO_SIN.v[index + ODO_TABLE_SIZE / 4];
+    int32_t sn = ODO_SIN.v[index];
+    pose.x += (int32_t)(((int64_t)ds * c + (1 << (ODO_TRIG_Q - 1))) >> ODO_TRIG_Q);
+    pose.y += (int32_t)(((int64_t)ds * sn + (1 << (ODO_TRIG_Q - 1))) >> ODO_TRIG_Q);
+    pose.heading = heading;
+    pose.s = s;
+
+    // -------- 直進/カーブ: 窓内の回転半径 R = Δs / Δθ をヒステリシスで判定 --------
+    // R < ENTER  <=>  |Δθ[2^32/周]| * 2π 2^ODO_POS_Q * ENTER > |Δs| * 2^32 を除算なしで比べる
+    int32_t dh = (int32_t)(heading - hist_heading[hist_index]);
+    int32_t dsw = s - hist_s[hist_index];
+    int64_t turn = (dh < 0) ? -(int64_t)dh : (int64_t)dh;
+    int64_t travel = (dsw < 0) ? -(int64_t)dsw : (int64_t)dsw;
+    if (travel >= ODO_MIN_TRAVEL_Q || turn != 0)
+    {
+        if (straight && turn * ODO_CURVE_ENTER_MM > travel * ODO_RADIUS_SCALE)
+            straight = false;
+        else if (!straight && turn * ODO_CURVE_EXIT_MM < travel * ODO_RADIUS_SCALE)
+            straight = true;
+    }
+    hist_heading[hist_index] = heading;
+    hist_s[hist_index] = s;
+    hist_index = (hist_index + 1) & (ODO_WINDOW - 1);
+}
+
+/**
+ * @brief   姿勢の取得
+ *
+ * @fn      const pose_t &PoseOdometry::getPose()
+ * @return  const pose_t& 現在の姿勢
+ */
+inline const pose_t &PoseOdometry::getPose() const
+{
+    return pose;
+}
+
+/**
+ * @brief   直進中か
+ *
+ * @fn      bool PoseOdometry::isStraight()
+ * @return  true: 直進, false: カーブ(その場旋回を含む)
+ */
+inline bool PoseOdometry::isStraight() const
+{
+    return straight;
+}
+
+/**
+ * @brief   方位差 -> [deg]
+ *
+ * @fn      int PoseOdometry::headingToDeg(int32_t bam)
+ * @param   bam (int32_t)方位差 [2^32/周] (符号付き)
+ * @return  int 方位差 [deg] 四捨五入
+ */
+inline int PoseOdometry::headingToDeg(int32_t bam)
+{
+    return (int)(((int64_t)bam * 360 + (1LL << 31)) >> 32);
+}
+
+/**
+ * @brief   走行距離と方位差 -> 回転半径
+ *
+ * @fn      int PoseOdometry::radiusMm(int32_t ds, int32_t dh)
+ * @param   ds  (int32_t)走行距離 [mm] Q(ODO_POS_Q)
+ * @param   dh  (int32_t)方位差 [2^32/周] (符号付き)
+ * @return  int 回転半径 [mm], 左回りが正。dh が 0 なら 0
+ * @note    除算を使うのでカーブ中の表示用にだけ呼ぶ
+ */
+inline int PoseOdometry::radiusMm(int32_t ds, int32_t dh)
+{
+    if (dh == 0)
+        return 0;
+    return (int)((int64_t)ds * ODO_RADIUS_SCALE / dh);
+}
+
+#endif // EV3_APP_POSEODOMETRY_H
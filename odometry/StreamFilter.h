@@ -0,0 +1,421 @@
+/**
+ * @file StreamFilter.h
+ * @author kengo hara (kengo.hara@veriserve.co.jp)
+ * @brief
+ * @version 0.1
+ * @date 2021-09-05
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef EV3_APP_STREAMFILTER_H
+#define EV3_APP_STREAMFILTER_H
+
+#include <stdint.h>
+
+#define EMA_Q 8 // 指数移動平均の小数部ビット数
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   指数移動平均 クラス
+ *
+ * @class   EmaFilter
+ * @note    y += (x - y) / 2^shift。shift が 0 なら入力のまま。更新は加減算とシフトだけ O(1)
+ */
+class EmaFilter
+{
+private:
+    int32_t acc;  // 平均 Q(EMA_Q)
+    int shift;    // 平滑化の強さ
+    bool started; // 最初の入力を済ませた
+
+public:
+    EmaFilter(); // Constructor
+
+    void setShift(int shift); // 平滑化の強さの設定
+    int update(int x);        // 1サンプル進める
+    int get();                // 平均の取得
+};
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   移動中央値 クラス
+ *
+ * @class   MedianFilter
+ * @tparam  N   窓の最大長
+ * @note    直近 window 個を入力順のリングと昇順の配列の両方に持つ。
+ *          一番古い値を二分探索で見つけ,新しい値の位置まで詰めながら置き換える(比較 O(log w),移動は w 以下)。
+ *          ヒープは使わない。窓が埋まるまでは入力済みの値の中央値
+ */
+template <int N>
+class MedianFilter
+{
+private:
+    int16_t ring[N];   // 入力順
+    int16_t sorted[N]; // 昇順
+    int window;        // 窓の長さ 1 to N
+    int count;         // 入力済みの数(window まで)
+    int head;          // 次に置き換える ring の位置
+
+    int find(int x); // sorted の中で x 以上の最初の位置
+
+public:
+    MedianFilter(); // Constructor
+
+    void setWindow(int window); // 窓の長さの設定(内容は捨てる)
+    int update(int x);          // 1サンプル進める
+    int get();                  // 中央値の取得
+};
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   移動最小値/最大値 クラス
+ *
+ * @class   MinMaxFilter
+ * @tparam  N   窓の最大長
+ * @note    単調な両端キュー(固定長のリング)を最小用と最大用に持つ。
+ *          新しい値より大きい(小さい)末尾を捨ててから積み,窓から出た先頭を捨てる。
+ *          各値は1回積んで1回捨てるだけなので更新はならし O(1)
+ */
+template <int N>
+class MinMaxFilter
+{
+private:
+    struct entry_t
+    {
+        uint32_t t; // 入力番号
+        int16_t v;  // 値
+    };
+    entry_t lo[N], hi[N];          // 最小用,最大用のキュー
+    int lo_head, lo_size;          // 最小用の先頭位置と長さ
+    int hi_head, hi_size;          // 最大用の先頭位置と長さ
+    int window;                    // 窓の長さ 1 to N
+    uint32_t t;                    // 次の入力番号
+
+    static int wrap(int i) { return (i >= N) ? i - N : i; } // リングの位置(除算を使わない)
+
+public:
+    MinMaxFilter(); // Constructor
+
+    void setWindow(int window); // 窓の長さの設定(内容は捨てる)
+    void update(int x);         // 1サンプル進める
+    int getMin();               // 窓の最小値
+    int getMax();               // 窓の最大値
+};
+
+/** ******** ******** ******** ******** ******** ******** ******** ********
+ * @brief   チャタリング除去 クラス
+ *
+ * @class   Debounce
+ * @note    入力が on 回続けて真になったら真,off 回続けて偽になったら偽にする。1 なら入力のまま
+ */
+class Debounce
+{
+private:
+    int on_count, off_count; // 切り替えに要る回数
+    int run;                 // 今の状態と違う入力が続いた回数
+    bool state;              // 出力
+
+public:
+    Debounce(); // Constructor
+
+    void setCounts(int on, int off); // 切り替えに要る回数の設定
+    bool update(bool x);             // 1サンプル進める
+    bool get();                      // 出力の取得
+};
+
+// ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
+
+// Constructor
+EmaFilter::EmaFilter()
+    : acc(0),
+      shift(0),
+      started(false)
+{
+}
+
+/**
+ * @brief   平滑化の強さの設定
+ *
+ * @fn      void EmaFilter::setShift(int shift)
+ * @param   shift   (int)新しい入力の重み 1/2^shift, 0 で入力のまま
+ * @return  無し
+ */
+inline void EmaFilter::setShift(int shift)
+{
+    this->shift = shift;
+    started = false;
+}
+
+/**
+ * @brief   1サンプル進める
+ *
+ * @fn      int EmaFilter::update(int x)
+ * @param   x   (int)入力
+ * @return  int 平均(四捨五入)
+ * @note    最初の入力は平均の初期値にする
+ */
+inline int EmaFilter::update(int x)
+{
+    if (shift == 0)
+        return x;
+    const int32_t xq = (int32_t)x << EMA_Q;
+    if (!started)
+    {
+        acc = xq;
+        started = true;
+    }
+    acc += (xq - acc) >> shift;
+    return get();
+}
+
+/**
+ * @brief   平均の取得
+ *
+ * @fn      int EmaFilter::get()
+ * @return  int 平均(四捨五入)
+ */
+inline int EmaFilter::get()
+{
+    return (acc + (1 << (EMA_Q - 1))) >> EMA_Q;
+}
+
+// Constructor
+template <int N>
+MedianFilter<N>::MedianFilter()
+{
+    setWindow(1);
+}
+
+/**
+ * @brief   窓の長さの設定
+ *
+ * @fn      void MedianFilter::setWindow(int window)
+ * @param   window  (int)窓の長さ, 1 to N に丸める(1 で入力のまま)。奇数にすること
+ * @return  無し
+ */
+template <int N>
+void MedianFilter<N>::setWindow(int window)
+{
+    if (window < 1)
+        window = 1;
+    if (window > N)
+        window = N;
+    this->window = window;
+    count = 0;
+    head = 0;
+}
+
+/**
+ * @brief   sorted の中で x 以上の最初の位置
+ *
+ * @fn      int MedianFilter::find(int x)
+ * @param   x   (int)値
+ * @return  int 0 to count
+ */
+template <int N>
+inline int MedianFilter<N>::find(int x)
+{
+    int lo = 0, hi = count;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) >> 1;
+        if (sorted[mid] < x)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * @brief   1サンプル進める
+ *
+ * @fn      int MedianFilter::update(int x)
+ * @param   x   (int)入力 (int16_t の範囲)
+ * @return  int 窓の中央値
+ */
+template <int N>
+int MedianFilter<N>::update(int x)
+{
+    if (window == 1)
+        return x;
+    int i;
+    if (count < window) // -------- 窓が埋まるまで: 挿入 --------
+    {
+        ring[count] = (int16_t)x;
+        i = count++;
+    }
+    else // -------- 一番古い値を x に置き換える --------
+    {
+        const int old = ring[head];
+        ring[head] = (int16_t)x;
+        if (++head == window)
+            head = 0;
+        i = find(old); // old と等しい値のどれかを置き換えればよい
+    }
+    while (i > 0 && sorted[i - 1] > x) // 小さい方へ詰める
+    {
+        sorted[i] = sorted[i - 1];
+        i--;
+    }
+    while (i + 1 < count && sorted[i + 1] < x) // 大きい方へ詰める
+    {
+        sorted[i] = sorted[i + 1];
+        i++;
+    }
+    sorted[i] = (int16_t)x;
+    return get();
+}
+
+/**
+ * @brief   中央値の取得
+ *
+ * @fn      int MedianFilter::get()
+ * @return  int 窓の中央値(偶数個のときは小さい方), 入力がなければ 0
+ */
+template <int N>
+inline int MedianFilter<N>::get()
+{
+    return (count > 0) ? sorted[(count - 1) >> 1] : 0;
+}
+
+// Constructor
+template <int N>
+MinMaxFilter<N>::MinMaxFilter()
+{
+    setWindow(1);
+}
+
+/**
+ * @brief   窓の長さの設定
+ *
+ * @fn      void MinMaxFilter::setWindow(int window)
+ * @param   window  (int)窓の長さ, 1 to N に丸める
+ * @return  無し
+ */
+template <int N>
+void MinMaxFilter<N>::setWindow(int window)
+{
+    if (window < 1)
+        window = 1;
+    if (window > N)
+        window = N;
+    this->window = window;
+    lo_head = lo_size = 0;
+    hi_head = hi_size = 0;
+    t = 0;
+}
+
+/**
+ * @brief   1サンプル進める
+ *
+ * @fn      void MinMaxFilter::update(int x)
+ * @param   x   (int)入力 (int16_t の範囲)
+ * @return  無し
+ */
+template <int N>
+void MinMaxFilter<N>::update(int x)
+{
+    // -------- 窓から出た先頭を捨てる --------
+    if (lo_size > 0 && t - lo[lo_head].t >= (uint32_t)window)
+    {
+        lo_head = wrap(lo_head + 1);
+        lo_size--;
+    }
+    if (hi_size > 0 && t - hi[hi_head].t >= (uint32_t)window)
+    {
+        hi_head = wrap(hi_head + 1);
+        hi_size--;
+    }
+    // -------- 新しい値より大きい(小さい)末尾を捨てて積む --------
+    while (lo_size > 0 && lo[wrap(lo_head + lo_size - 1)].v >= x)
+        lo_size--;
+    while (hi_size > 0 && hi[wrap(hi_head + hi_size - 1)].v <= x)
+        hi_size--;
+    entry_t e = {t, (int16_t)x};
+    lo[wrap(lo_head + lo_size++)] = e;
+    hi[wrap(hi_head + hi_size++)] = e;
+    t++;
+}
+
+/**
+ * @brief   窓の最小値
+ *
+ * @fn      int MinMaxFilter::getMin()
+ * @return  int 最小値, 入力がなければ 0
+ */
+template <int N>
+inline int MinMaxFilter<N>::getMin()
+{
+    return (lo_size > 0) ? lo[lo_head].v : 0;
+}
+
+/**
+ * @brief   窓の最大値
+ *
+ * @fn      int MinMaxFilter::getMax()
+ * @return  int 最大値, 入力がなければ 0
+ */
+template <int N>
+inline int MinMaxFilter<N>::getMax()
+{
+    return (hi_size > 0) ? hi[hi_head].v : 0;
+}
+
+// Constructor
+Debounce::Debounce()
+    : on_count(1),
+      off_count(1),
+      run(0),
+      state(false)
+{
+}
+
+/**
+ * @brief   切り替えに要る回数の設定
+ *
+ * @fn      void Debounce::setCounts(int on, int off)
+ * @param   on  (int)真にするのに続けて要る真の入力の数, 1 で入力のまま
+ * @param   off (int)偽にするのに続けて要る偽の入力の数
+ * @return  無し
+ */
+inline void Debounce::setCounts(int on, int off)
+{
+    on_count = (on < 1) ? 1 : on;
+    off_count = (off < 1) ? 1 : off;
+    run = 0;
+    state = false;
+}
+
+/**
+ * @brief   1サンプル進める
+ *
+ * @fn      bool Debounce::update(bool x)
+ * @param   x   (bool)入力
+ * @return  bool 出力
+ */
+inline bool Debounce::update(bool x)
+{
+    if (x == state)
+    {
+        run = 0;
+        return state;
+    }
+    if (++run >= (x ? on_count : off_count))
+    {
+        state = x;
+        run = 0;
+    }
+    return state;
+}
+
+/**
+ * @brief   出力の取得
+ *
+ * @fn      bool Debounce::get()
+ * @return  bool 出力
+ */
+inline bool Debounce::get()
+{
+    return state;
+}
+
+#endif // EV3_APP_STREAMFILTER_H
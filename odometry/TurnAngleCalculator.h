@@ -13,23 +13,24 @@
 
 #include "ev3api.h"
 #include "etrobo_env.h"
-#include "cmath"
+#include "odometry/PoseOdometry.h"
 
-#define HALFTRACK 77   /* 1/2トレッド */
-#define WHEELRADIUS 50 /* 車輪半径 */
+#define HALFTRACK ODO_HALF_TRACK     /* 1/2トレッド */
+#define WHEELRADIUS ODO_WHEEL_RADIUS /* 車輪半径 */
 
 /** ******** ******** ******** ******** ******** ******** ******** ********
  * @brief   左右のホイール回転角,回転半径,回転角
  * 
  * @struct  turnangle_t
- * @note    サイズは20byte= int(4byte) x5
+ * @note    サイズは16byte= int(4byte) x4
+ *          ホイール回転角,回転角は直進/カーブが切り替わった位置(区間の始め)からの値。
+ *          回転半径は除算が要るので毎周期は求めない(表示するときに TurnAngleCalculator::getRadius で求める)
  */
 typedef struct
 {
     int leftWheel_deg;  /* 左ホイール回転角 */
     int rightWheel_deg; /* 右ホイール回転角 */
-    int radius;         /* 車両の回転半径 */
-    int omega;          /* 車両の回転角 */
+    int omega;          /* 車両の回転角[deg],右回りが正 */
     int MODE_straight;  /* 直進中判定モード,1(true)=直進,0(false)=直進以外 */
 } turnangle_t;
 
@@ -37,67 +38,110 @@ typedef struct
  * @brief 回転半径と回転角の測定クラス
  * 
  * @class TurnAngleCalculator
+ * @note  姿勢は PoseOdometry で連続して求め,エンコーダーはリセットしない。
+ *        直進/カーブの判定と回転半径は姿勢(走行距離と方位の変化)から求め,
+ *        区間の値は切り替わったときの姿勢とエンコーダー値からの差で出す。
  */
 class TurnAngleCalculator
 {
 private:
+    PoseOdometry odo;     // 姿勢
+    int left_ref;         // 区間の始めの左ホイール回転角
+    int right_ref;        // 区間の始めの右ホイール回転角
+    uint32_t heading_ref; // 区間の始めの方位
+    int32_t s_ref;        // 区間の始めの走行距離
+
 public:
-    TurnAngleCalculator();                   // Constructor
-    void calc(turnangle_t *angle, int turn); // 回転半径と回転角の計算
+    TurnAngleCalculator();                 // Constructor
+    void calc(turnangle_t *angle,
+              int left_deg, int right_deg); // 取得済みの回転角から計算
+    const pose_t &getPose();               // 姿勢の取得
+    int getRadius() const;                 // 区間の回転半径の取得(除算する)
+
+    static int32_t readRadius(const void *self); // テレメトリ用, getRadius を呼ぶ
 };
 
 // ******** 以降の実装部はリリース時にcppに分離 ******** ******** ********
 
 // Constructor
 TurnAngleCalculator::TurnAngleCalculator()
+    : left_ref(0),
+      right_ref(0),
+      heading_ref(0),
+      s_ref(0)
 {
-    ev3_motor_reset_counts(left_motor);
-    ev3_motor_reset_counts(right_motor);
+    // ev3api は呼ばない(静的に確保するので)。
+    // エンコーダーは走行前に1回だけ MotorRunner::reset() でリセットし,以降は積算値を使う
 }
 
 /**
- * @brief   回転半径と回転角の計算
+ * @brief   取得済みのホイール回転角から回転半径と回転角を計算
  * 
- * @fn      void TurnAngleCalculator::calc(turnangle_t *angle, int turn)
- * @param   angle   (turnangle_t*)回転半径と回転角の構造体
- * @param   turn    (int)ev3_motor_steerのturn_ratio
+ * @fn      void TurnAngleCalculator::calc(turnangle_t *angle, int left_deg, int right_deg)
+ * @param   angle       (turnangle_t*)回転半径と回転角の構造体
+ * @param   left_deg    (int)左ホイール回転角(リセットしない積算値)
+ * @param   right_deg   (int)右ホイール回転角(リセットしない積算値)
  * @return  無し
+ * @note    ev3apiを呼ばない。回転角は RobotT の Io が読む
  */
-void TurnAngleCalculator::calc(turnangle_t *angle, int turn)
+void TurnAngleCalculator::calc(turnangle_t *angle, int left_deg, int right_deg)
 {
-    /* -------- ホイール回転角取得 -------- */
-    angle->leftWheel_deg = ev3_motor_get_counts(left_motor);
-    angle->rightWheel_deg = ev3_motor_get_counts(right_motor);
-    /* 車両回転角:ω = r/2d*(θleft-θright), 車輪半径:r=50,トレッド:2d=154 */
-    angle->omega = (angle->leftWheel_deg - angle->rightWheel_deg) * WHEELRADIUS / (2 * HALFTRACK);
+    odo.update(left_deg, right_deg);
+    const pose_t &pose = odo.getPose();
 
-    if (!angle->MODE_straight) /* -------- 直進中でなければ -------- */
-    {
-        if (turn == 0) /* -------- 舵角が0なら回転角リセット -------- */
-        {
-            ev3_motor_reset_counts(left_motor);
-            ev3_motor_reset_counts(right_motor);
-            angle->radius = 0;
-            angle->MODE_straight = true;
-        }
-        else /* -------- 舵角が0以外なら計算 -------- */
-        {
-            /* 回転半径:ρ = d*(θleft+θright)/(θleft-θright), トレッド/2:d=77 */
-            if ((angle->leftWheel_deg - angle->rightWheel_deg) == 0) /* 0除算回避 */
-                angle->radius = 0;
-            else
-                angle->radius = 77 * (angle->leftWheel_deg + angle->rightWheel_deg) / (angle->leftWheel_deg - angle->rightWheel_deg);
-        }
-    }
-    else /* -------- 直進モード -------- */
+    if (odo.isStraight() != (angle->MODE_straight != 0)) /* -------- 直進/カーブが切り替わったら区間の始め -------- */
     {
-        if (std::abs(turn) > 10) /* -------- 舵角が10を超えるまで何もしない -------- */
-        {
-            ev3_motor_reset_counts(left_motor);
-            ev3_motor_reset_counts(right_motor);
-            angle->MODE_straight = false;
-        }
+        angle->MODE_straight = odo.isStraight();
+        left_ref = left_deg;
+        right_ref = right_deg;
+        heading_ref = pose.heading;
+        s_ref = pose.s;
     }
+
+    int32_t dh = (int32_t)(pose.heading - heading_ref);
+    angle->leftWheel_deg = left_deg - left_ref;
+    angle->rightWheel_deg = right_deg - right_ref;
+    /* 車両回転角: 方位は左回りが正,回転角は従来どおり右回りが正 */
+    angle->omega = -PoseOdometry::headingToDeg(dh);
+}
+
+/**
+ * @brief   姿勢の取得
+ * 
+ * @fn      const pose_t &TurnAngleCalculator::getPose()
+ * @return  const pose_t& 開始位置を原点とする姿勢
+ */
+inline const pose_t &TurnAngleCalculator::getPose()
+{
+    return odo.getPose();
+}
+
+/**
+ * @brief   区間の回転半径の取得
+ *
+ * @fn      int TurnAngleCalculator::getRadius()
+ * @return  int 区間の始めからの回転半径 ρ = Δs/Δθ [mm],右回りが正, 直進中は0
+ * @note    64bitの除算を使うので毎周期は呼ばない(テレメトリの radius を送る周期だけ)
+ */
+inline int TurnAngleCalculator::getRadius() const
+{
+    if (odo.isStraight())
+        return 0;
+    const pose_t &pose = odo.getPose();
+    return -PoseOdometry::radiusMm(pose.s - s_ref, (int32_t)(pose.heading - heading_ref));
+}
+
+/**
+ * @brief   テレメトリ用の回転半径の取得
+ *
+ * @fn      int32_t TurnAngleCalculator::readRadius(const void *self)
+ * @param   self    (const void*)TurnAngleCalculator
+ * @return  int32_t getRadius の値
+ * @note    Telemetry::add(id, fn, ctx) に登録する
+ */
+int32_t TurnAngleCalculator::readRadius(const void *self)
+{
+    return ((const TurnAngleCalculator *)self)->getRadius();
 }
 
-#endif // EV3_APP_TURNANGLECALCULATOR_H
\ No newline at end of file
+#endif // EV3_APP_TURNANGLECALCULATOR_H